@@ -0,0 +1,536 @@
+#ifdef WINDDK
+#include <windows.h>
+#include <strsafe.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <glob.h>
+#endif // _WIN32
+#include "globals.h"
+#include "platform.h"
+#include "serial.h"
+#include "sensors.h"
+#include "trouble_code_reader.h"
+#include "session.h"
+#include "output_buffer.h"
+#include "mapped_file.h"
+#include "capture.h"
+#include "topwork.h"
+#include "text_kernels.h"
+#include "batch.h"
+
+#ifdef _WIN32
+#define PATH_SEPARATOR  '\\'
+#define same_name       _stricmp
+#else // _WIN32
+#define PATH_SEPARATOR  '/'
+#define same_name       strcmp
+#endif // _WIN32
+
+typedef struct _BATCH_FILE
+{
+    char *name;
+    const char *base;           // the name without its directories
+    int numbered;               // -o: another file has the same base, so the report is <base>.<n>.txt
+    OUTPUT_BUFFER report;
+    int failed;
+    volatile unsigned long done;    // the report is ready for the output stream
+} BATCH_FILE;
+
+// the files a worker has left, [next, end) of the list
+typedef struct _BATCH_QUEUE
+{
+    PLATFORM_MUTEX lock;
+    unsigned long next;
+    unsigned long end;
+} BATCH_QUEUE;
+
+struct _BATCH;
+
+typedef struct _BATCH_WORKER
+{
+    struct _BATCH *batch;
+    int index;
+    PLATFORM_THREAD thread;
+    SCAN_SESSION session;       // one per worker, set up again for every file
+    unsigned long steals;
+} BATCH_WORKER;
+
+typedef struct _BATCH
+{
+    BATCH_FILE *files;
+    unsigned long numFiles;
+    unsigned long maxFiles;
+    BATCH_QUEUE queues[BATCH_MAX_THREADS];
+    BATCH_WORKER *workers;
+    int numWorkers;
+    const char *outDir;         // NULL: the reports go to stdout
+    PLATFORM_MUTEX outputLock;  // stdout and nextOut
+    unsigned long nextOut;      // the first file not yet written to stdout
+} BATCH;
+
+static char *copy_string(const char *text)
+{
+    unsigned long length = (unsigned long)strlen(text) + 1;
+    char *copy = (char *)malloc(length);
+
+    if (copy)
+    {
+        memcpy(copy, text, length);
+    }
+    return copy;
+}
+
+static int add_file(BATCH *batch, const char *name)
+{
+    if (batch->numFiles == batch->maxFiles)
+    {
+        unsigned long maxFiles = batch->maxFiles ? batch->maxFiles * 2 : 256;
+        BATCH_FILE *files = (BATCH_FILE *)realloc(batch->files, maxFiles * sizeof(BATCH_FILE));
+        if (NULL == files)
+        {
+            return FALSE;
+        }
+        batch->files = files;
+        batch->maxFiles = maxFiles;
+    }
+    memset(&batch->files[batch->numFiles], 0, sizeof(BATCH_FILE));
+    batch->files[batch->numFiles].name = copy_string(name);
+    if (NULL == batch->files[batch->numFiles].name)
+    {
+        return FALSE;
+    }
+    ++batch->numFiles;
+    return TRUE;
+}
+
+// a name, or every file a pattern matches; a pattern matching nothing is kept so it is reported
+static int add_pattern(BATCH *batch, const char *pattern)
+{
+    int added = 0;
+
+    if (NULL == strpbrk(pattern, "*?["))
+    {
+        return add_file(batch, pattern);
+    }
+#ifdef _WIN32
+    {
+        WIN32_FIND_DATAA found;
+        HANDLE find = FindFirstFileA(pattern, &found);
+        const char *base = pattern + strlen(pattern);
+        char path[MAX_PATH];
+
+        while (base > pattern && '\\' != base[-1] && '/' != base[-1] && ':' != base[-1])
+        {
+            --base;
+        }
+        if (INVALID_HANDLE_VALUE != find)
+        {
+            do
+            {
+                if (0 == (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+                    (unsigned long)(base - pattern) + strlen(found.cFileName) < sizeof(path))
+                {
+                    memcpy(path, pattern, base - pattern);
+                    StringCchCopy(path + (base - pattern), sizeof(path) - (base - pattern), found.cFileName);
+                    if (!add_file(batch, path))
+                    {
+                        FindClose(find);
+                        return FALSE;
+                    }
+                    ++added;
+                }
+            } while (FindNextFileA(find, &found));
+            FindClose(find);
+        }
+    }
+#else // _WIN32
+    {
+        glob_t found;
+        size_t k;
+
+        if (0 == glob(pattern, 0, NULL, &found))
+        {
+            for (k = 0; k < found.gl_pathc; ++k)
+            {
+                if (!add_file(batch, found.gl_pathv[k]))
+                {
+                    globfree(&found);
+                    return FALSE;
+                }
+                ++added;
+            }
+            globfree(&found);
+        }
+    }
+#endif // _WIN32
+    return added ? TRUE : add_file(batch, pattern);
+}
+
+// one path or pattern per line, blank lines skipped
+static int add_list(BATCH *batch, const char *listName)
+{
+    char line[1024];
+    char *end;
+    FILE *list = fopen(listName, "r");
+
+    if (NULL == list)
+    {
+        fprintf(stderr, "Error: unable to open the list %s\n", listName);
+        return FALSE;
+    }
+    while (fgets(line, sizeof(line), list))
+    {
+        end = line + strlen(line);
+        while (end > line && (LINE_DELIMITER == end[-1] || RECORD_DELIMITER == end[-1] || ' ' == end[-1]))
+        {
+            --end;
+        }
+        *end = '\0';
+        if (line[0] && !add_pattern(batch, line))
+        {
+            fclose(list);
+            return FALSE;
+        }
+    }
+    fclose(list);
+    return TRUE;
+}
+
+// the whole scan of one file into its report, the same as a -i run prints
+static void decode_file(BATCH_WORKER *worker, BATCH_FILE *file)
+{
+    SCAN_SESSION *session = &worker->session;
+    MAPPED_FILE simFile;
+    const DTC_RESULT *dtcs;
+    char vin[64];
+    char modelYear[8];
+
+    if (!outbuf_init_dynamic(&file->report, OUTPUT_BUFFER_SIZE, 0))
+    {
+        file->failed = TRUE;
+        return;
+    }
+    memset(&simFile, 0, sizeof(simFile));
+    memset(vin, 0, sizeof(vin));
+    memset(modelYear, 0, sizeof(modelYear));
+    if (!map_file(&simFile, file->name))
+    {
+        outbuf_printf(&file->report, "Error: unable to open %s\n", file->name);
+        file->failed = TRUE;
+        return;
+    }
+
+    initializeSession(session);
+    session->report = &file->report;
+    if (capture_is_capture(simFile.data, simFile.size))
+    {
+        dtcs = replay_capture(session, simFile.data, simFile.size);
+    }
+    else
+    {
+        workInit(session, simFile.data, simFile.size, 0, vin, sizeof(vin), modelYear, sizeof(modelYear));
+        if (READY == session->comport.status)
+        {
+            session_vehicle(session, vin, modelYear);
+        }
+        process_all_codes(session);
+        dtcs = acquire_trouble_codes(session);
+    }
+    if (!write_scan_report(session, dtcs, &file->report))
+    {
+        outbuf_append(&file->report, "Error: trouble code report truncated\n");
+    }
+    destroySession(session);
+    unmap_file(&simFile);
+}
+
+static int compare_bases(const void *a, const void *b)
+{
+    return same_name((*(const BATCH_FILE * const *)a)->base, (*(const BATCH_FILE * const *)b)->base);
+}
+
+// files from different directories may share a name; their reports are
+// told apart by the file's place in the list, from 1
+static void number_same_names(BATCH *batch)
+{
+    BATCH_FILE **sorted = (BATCH_FILE **)malloc(batch->numFiles * sizeof(BATCH_FILE *));
+    unsigned long k;
+
+    for (k = 0; k < batch->numFiles; ++k)
+    {
+        batch->files[k].base = batch->files[k].name + strlen(batch->files[k].name);
+        while (batch->files[k].base > batch->files[k].name &&
+               '/' != batch->files[k].base[-1] && '\\' != batch->files[k].base[-1])
+        {
+            --batch->files[k].base;
+        }
+        // without the memory to sort, every report is numbered
+        batch->files[k].numbered = sorted ? FALSE : TRUE;
+        if (sorted)
+        {
+            sorted[k] = &batch->files[k];
+        }
+    }
+    if (NULL == sorted)
+    {
+        return;
+    }
+    qsort(sorted, batch->numFiles, sizeof(BATCH_FILE *), compare_bases);
+    for (k = 1; k < batch->numFiles; ++k)
+    {
+        if (0 == same_name(sorted[k - 1]->base, sorted[k]->base))
+        {
+            sorted[k - 1]->numbered = TRUE;
+            sorted[k]->numbered = TRUE;
+        }
+    }
+    free(sorted);
+}
+
+static void write_report_file(BATCH *batch, BATCH_FILE *file)
+{
+    unsigned long number = (unsigned long)(file - batch->files) + 1;
+    char path[1024];
+    FILE *out;
+
+#ifdef WIN_VS6
+    if (file->numbered)
+    {
+        _snprintf(path, sizeof(path), "%s%c%s.%lu.txt", batch->outDir, PATH_SEPARATOR, file->base, number);
+    }
+    else
+    {
+        _snprintf(path, sizeof(path), "%s%c%s.txt", batch->outDir, PATH_SEPARATOR, file->base);
+    }
+    path[sizeof(path) - 1] = '\0';
+#else // WIN_VS6
+    if (file->numbered)
+    {
+        StringCchPrintf(path, sizeof(path), "%s%c%s.%lu.txt", batch->outDir, PATH_SEPARATOR, file->base, number);
+    }
+    else
+    {
+        StringCchPrintf(path, sizeof(path), "%s%c%s.txt", batch->outDir, PATH_SEPARATOR, file->base);
+    }
+#endif // WIN_VS6
+    out = fopen(path, "w");
+    if (NULL == out)
+    {
+        fprintf(stderr, "Error: unable to write %s\n", path);
+        file->failed = TRUE;
+        return;
+    }
+    fwrite(file->report.buf, 1, file->report.len, out);
+    fclose(out);
+}
+
+// the reports that are next in list order go out, whichever worker finished them
+static void write_ready_reports(BATCH *batch)
+{
+    BATCH_FILE *file;
+
+    mutex_lock(&batch->outputLock);
+    while (batch->nextOut < batch->numFiles &&
+           atomic_load_acquire(&batch->files[batch->nextOut].done))
+    {
+        file = &batch->files[batch->nextOut++];
+        printf("== %s ==\n", file->name);
+        fwrite(file->report.buf, 1, file->report.len, stdout);
+        outbuf_free(&file->report);
+    }
+    mutex_unlock(&batch->outputLock);
+}
+
+static int take_own(BATCH_QUEUE *queue, unsigned long *index)
+{
+    int taken = FALSE;
+
+    mutex_lock(&queue->lock);
+    if (queue->next < queue->end)
+    {
+        *index = queue->next++;
+        taken = TRUE;
+    }
+    mutex_unlock(&queue->lock);
+    return taken;
+}
+
+// half of what another worker has left, from the end of its share, becomes this worker's share
+static int steal(BATCH_WORKER *worker, unsigned long *index)
+{
+    BATCH *batch = worker->batch;
+    BATCH_QUEUE *victim;
+    BATCH_QUEUE *own = &batch->queues[worker->index];
+    unsigned long start = 0;
+    unsigned long end = 0;
+    int k;
+
+    for (k = 1; k < batch->numWorkers && start == end; ++k)
+    {
+        victim = &batch->queues[(worker->index + k) % batch->numWorkers];
+        mutex_lock(&victim->lock);
+        if (victim->next < victim->end)
+        {
+            end = victim->end;
+            start = end - (end - victim->next + 1) / 2;
+            victim->end = start;
+        }
+        mutex_unlock(&victim->lock);
+    }
+    if (start == end)
+    {
+        return FALSE;
+    }
+    ++worker->steals;
+    mutex_lock(&own->lock);
+    own->next = start + 1;
+    own->end = end;
+    mutex_unlock(&own->lock);
+    *index = start;
+    return TRUE;
+}
+
+static void batch_worker(void *arg)
+{
+    BATCH_WORKER *worker = (BATCH_WORKER *)arg;
+    BATCH *batch = worker->batch;
+    BATCH_FILE *file;
+    unsigned long index;
+
+    while (take_own(&batch->queues[worker->index], &index) || steal(worker, &index))
+    {
+        file = &batch->files[index];
+        decode_file(worker, file);
+        if (batch->outDir)
+        {
+            if (!file->failed || file->report.len)
+            {
+                write_report_file(batch, file);
+            }
+            outbuf_free(&file->report);
+        }
+        else
+        {
+            atomic_store_release(&file->done, TRUE);
+            write_ready_reports(batch);
+        }
+    }
+}
+
+int batch_main(int argc, char *argv[])
+{
+    BATCH batch;
+    int threads = 0;
+    int index;
+    int w;
+    unsigned long k;
+    unsigned long failed = 0;
+    unsigned long steals = 0;
+    TIME_US start = time_now_us();
+
+    memset(&batch, 0, sizeof(batch));
+    for (index = 0; index < argc; ++index)
+    {
+        if (0 == strcmp(argv[index], "-j") && index + 1 < argc)
+        {
+            threads = atoi(argv[++index]);
+        }
+        else if (0 == strcmp(argv[index], "-o") && index + 1 < argc)
+        {
+            batch.outDir = argv[++index];
+        }
+        else if ('@' == argv[index][0])
+        {
+            if (!add_list(&batch, argv[index] + 1))
+            {
+                return 1;
+            }
+        }
+        else if (!add_pattern(&batch, argv[index]))
+        {
+            fprintf(stderr, "Error: not enough memory for the file list\n");
+            return 1;
+        }
+    }
+    if (0 == batch.numFiles)
+    {
+        fprintf(stderr, "Usage: ScanTool --batch [-j threads] [-o dir] file|pattern|@list ...\n");
+        return 1;
+    }
+
+    if (threads <= 0)
+    {
+        threads = cpu_count();
+    }
+    if (threads > BATCH_MAX_THREADS)
+    {
+        threads = BATCH_MAX_THREADS;
+    }
+    if ((unsigned long)threads > batch.numFiles)
+    {
+        threads = (int)batch.numFiles;
+    }
+    batch.workers = (BATCH_WORKER *)calloc(threads, sizeof(BATCH_WORKER));
+    if (NULL == batch.workers)
+    {
+        fprintf(stderr, "Error: not enough memory for %d workers\n", threads);
+        return 1;
+    }
+    if (batch.outDir)
+    {
+        number_same_names(&batch);
+    }
+    // picked once here rather than raced for by the workers
+    (void)text_kernels_level();
+    mutex_init(&batch.outputLock);
+    batch.numWorkers = threads;
+    for (w = 0; w < threads; ++w)
+    {
+        mutex_init(&batch.queues[w].lock);
+        batch.queues[w].next = batch.numFiles * w / threads;
+        batch.queues[w].end = batch.numFiles * (w + 1) / threads;
+        batch.workers[w].batch = &batch;
+        batch.workers[w].index = w;
+    }
+    // the first worker is this thread; one that does not start leaves its share to be stolen
+    for (w = 1; w < threads; ++w)
+    {
+        if (!thread_start(&batch.workers[w].thread, batch_worker, &batch.workers[w]))
+        {
+            batch.workers[w].batch = NULL;
+        }
+    }
+    batch_worker(&batch.workers[0]);
+    for (w = 1; w < threads; ++w)
+    {
+        if (batch.workers[w].batch)
+        {
+            thread_join(&batch.workers[w].thread);
+        }
+    }
+    // a share left by a worker that never started
+    batch_worker(&batch.workers[0]);
+
+    for (k = 0; k < batch.numFiles; ++k)
+    {
+        failed += batch.files[k].failed ? 1 : 0;
+        free(batch.files[k].name);
+    }
+    for (w = 0; w < threads; ++w)
+    {
+        steals += batch.workers[w].steals;
+        mutex_destroy(&batch.queues[w].lock);
+    }
+    mutex_destroy(&batch.outputLock);
+    fprintf(stderr, "Batch: %lu files, %lu failed, %d threads, %lu steals, %lu ms\n",
+            batch.numFiles, failed, threads, steals, (unsigned long)((time_now_us() - start) / 1000));
+    free(batch.workers);
+    free(batch.files);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,34 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BATCH_MAX_THREADS   64
+
+/*
+ * Decode many simulation files and captures in one process:
+ *
+ *    ScanTool --batch [-j threads] [-o dir] file|pattern|@list ...
+ *
+ * Each file is scanned in its own session on a pool of worker threads,
+ * one per processor unless -j says otherwise.  Every worker starts with
+ * an even share of the list and steals half of what another has left
+ * once its own share is done, so a few slow files do not hold up the
+ * rest.  The reports go to stdout in list order, each under a
+ * "== file ==" line, or with -o to dir/<file name>.txt; files from
+ * different directories with the same name go to dir/<file name>.<n>.txt,
+ * n their place in the list from 1.  A pattern is
+ * expanded here for shells that do not; @list names a file holding one
+ * path per line.
+ *
+ * Returns the process exit code: 0, or 1 if a file could not be read.
+ */
+int batch_main(int argc, char *argv[]);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* BATCH_H */
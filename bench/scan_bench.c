@@ -0,0 +1,853 @@
+/*
+ * Time per call of the response decoding path, from single kernels up to
+ * a whole scan, written as JSON so two runs can be compared.
+ *
+ *   scan_bench [-m ms] [-f filter] [-i simfile] [-o results.json]
+ *   scan_bench -c old.json new.json [-t percent]
+ *
+ * Micro benchmarks take one response through one routine; the sim scan
+ * decodes a whole simulation file (built in, or -i) as ScanTool -i does,
+ * and the live sweep plays the same exchanges through the replay adapter
+ * so the serial code path runs too.  Compare mode prints the change in
+ * ns/op per benchmark and exits 1 if any got slower by more than the
+ * threshold.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef _WIN32
+#include <io.h>
+#else // _WIN32
+#include <unistd.h>
+#endif // _WIN32
+#include "../globals.h"
+#include "../platform.h"
+#include "../serial.h"
+#include "../sensors.h"
+#include "../trouble_code_reader.h"
+#include "../elm_response.h"
+#include "../session.h"
+#include "../topwork.h"
+#include "../capture.h"
+#include "../replay_adapter.h"
+#include "../output_buffer.h"
+
+#ifdef _WIN32
+#define NULL_DEVICE     "NUL"
+#else // _WIN32
+#define NULL_DEVICE     "/dev/null"
+#endif // _WIN32
+
+#define DEFAULT_MIN_MS      200
+#define MAX_RESULTS         256
+#define MAX_NAME            64
+#define DEFAULT_THRESHOLD   5.0     // percent slower that counts as a regression
+#define EXCHANGE_US         50000   // spacing of the exchanges in the live sweep capture
+#define ANSWER_US           30000   // command to response in the live sweep capture
+
+// a scan of one vehicle, headers off, as ScanTool -i reads it
+static const char defaultSim[] =
+    "0902\r014\r0:490201314433\r1:4856313354303953\r2:37313830353735\r\r>"
+    "0101\r41 01 82 07 65 04\r\r>"
+    "0100\r41 00 BE 3F A8 13\r\r>"
+    "0103\r41 03 02 00\r\r>"
+    "0104\r41 04 33\r\r>"
+    "0105\r41 05 7C\r\r>"
+    "0106\r41 06 80\r\r>"
+    "0107\r41 07 7E\r\r>"
+    "010C\r41 0C 1A F8\r\r>"
+    "010D\r41 0D 3C\r\r>"
+    "010E\r41 0E 8C\r\r>"
+    "010F\r41 0F 46\r\r>"
+    "0110\r41 10 01 F4\r\r>"
+    "0111\r41 11 26\r\r>"
+    "0113\r41 13 33\r\r>"
+    "0115\r41 15 5A 80\r\r>"
+    "011C\r41 1C 06\r\r>"
+    "011F\r41 1F 02 58\r\r>"
+    "03\r43 01 33 01 34 00 00\r\r>"
+    "07\r47 01 00 00 00 00 00\r\r>"
+    "0A\r4A 01 33 00 00 00 00\r\r>";
+
+// the same vehicle with headers on (ATH1): 11-bit CAN IDs, each frame led by its ISO-TP byte
+static const char headersSim[] =
+    "0902\r7E8 10 14 49 02 01 31 44 33 \r7E8 21 48 56 31 33 54 30 39 \r7E8 22 53 37 31 38 30 35 37 \r\r>"
+    "0101\r7E8 06 41 01 82 07 65 04 \r\r>"
+    "0100\r7E8 06 41 00 BE 3F A8 13 \r\r>"
+    "0103\r7E8 04 41 03 02 00 \r\r>"
+    "0104\r7E8 03 41 04 33 \r\r>"
+    "0105\r7E8 03 41 05 7C \r\r>"
+    "0106\r7E8 03 41 06 80 \r\r>"
+    "0107\r7E8 03 41 07 7E \r\r>"
+    "010C\r7E8 04 41 0C 1A F8 \r\r>"
+    "010D\r7E8 03 41 0D 3C \r\r>"
+    "010E\r7E8 03 41 0E 8C \r\r>"
+    "010F\r7E8 03 41 0F 46 \r\r>"
+    "0110\r7E8 04 41 10 01 F4 \r\r>"
+    "0111\r7E8 03 41 11 26 \r\r>"
+    "0113\r7E8 03 41 13 33 \r\r>"
+    "0115\r7E8 04 41 15 5A 80 \r\r>"
+    "011C\r7E8 03 41 1C 06 \r\r>"
+    "011F\r7E8 04 41 1F 02 58 \r\r>"
+    "03\r7E8 07 43 01 33 01 34 00 00 \r\r>"
+    "07\r7E8 07 47 01 00 00 00 00 00 \r\r>"
+    "0A\r7E8 07 4A 01 33 00 00 00 00 \r\r>";
+
+// two scans of a vehicle with two ECUs, headers off: each scan's answers number the ECUs from 1,
+// and the second ECU reports P0201 as stored and permanent
+static const char scansSim[] =
+    "0101\r41 01 81 07 65 04\r41 01 81 07 65 04\r\r>"
+    "03\r43 01 01 33\r43 01 02 01\r\r>"
+    "07\r47 00\r47 01 01 71\r\r>"
+    "0A\r4A 00\r4A 01 02 01\r\r>"
+    "0101\r41 01 81 07 65 04\r41 01 81 07 65 04\r\r>"
+    "03\r43 01 01 33\r43 01 02 01\r\r>"
+    "07\r47 00\r47 01 01 71\r\r>"
+    "0A\r4A 00\r4A 01 02 01\r\r>";
+
+// the VIN exchange alone
+static const char vinSim[] =
+    "0902\r014\r0:490201314433\r1:4856313354303953\r2:37313830353735\r\r>";
+
+// two CAN ECUs with headers on, then a multi-frame VIN
+static const char multiEcuResponse[] =
+    "7E8 06 41 00 BE 3F A8 13 \r7E9 06 41 00 98 18 80 11 \r"
+    "7E8 10 14 49 02 01 31 44 33 \r7E8 21 48 56 31 33 54 30 39 \r7E8 22 37 31 38 30 35 37 35 \r\r>";
+
+static const char spacedResponse[] = "41 00 BE 3F A8 13 \r41 0C 1A F8 \r43 01 33 01 34 00 00 \r";
+
+// Mode 01 responses as process_and_display_data gets them
+static const unsigned char mode01Responses[][6] =
+{
+    { 0x41, 0x0C, 0x1A, 0xF8 },
+    { 0x41, 0x0D, 0x3C },
+    { 0x41, 0x05, 0x7C },
+    { 0x41, 0x01, 0x82, 0x07, 0x65, 0x04 },
+};
+static const int mode01Lengths[] = { 4, 3, 3, 6 };
+
+static const unsigned char dtcResponse[] = { 0x01, 0x33, 0x01, 0x34, 0xC1, 0x00, 0x00, 0x00 };
+
+static const char *troubleCodes[] =
+{
+    "P0133", "P0134", "P0300", "P0420", "P0171", "P0700", "U0100", "P0455",
+};
+
+typedef void (*BENCH_FUNC)(void *context, unsigned long op);
+
+typedef struct _BENCH_RESULT
+{
+    char name[MAX_NAME];
+    double nsPerOp;
+    unsigned long ops;
+    double allocsPerOp;         // below 0 if allocations are not counted
+    double allocBytesPerOp;
+    double bytesPerSec;         // 0 if the benchmark has no input size
+} BENCH_RESULT;
+
+typedef struct _BENCH_RUN
+{
+    TIME_US minUs;
+    const char *filter;
+    FILE *json;
+    int numResults;
+} BENCH_RUN;
+
+typedef struct _MEMORY_SINK
+{
+    unsigned char *buf;
+    unsigned long len;
+    unsigned long max;
+} MEMORY_SINK;
+
+typedef struct _SIM_INPUT
+{
+    const char *buf;
+    unsigned long size;
+} SIM_INPUT;
+
+typedef struct _FORMULA_INPUT
+{
+    int index;
+    unsigned long mask;
+} FORMULA_INPUT;
+
+static SCAN_SESSION session;
+static char scratch[1024];
+static volatile unsigned long sink;    // keeps results live
+
+#ifdef __GLIBC__
+// every allocation goes through these while the benchmarks run
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+// the live sweep's decode stage allocates from its own thread
+static unsigned long allocCount;
+static unsigned long allocBytes;
+
+static void count_allocation(size_t size)
+{
+    __atomic_fetch_add(&allocCount, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&allocBytes, (unsigned long)size, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size)
+{
+    count_allocation(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    count_allocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    count_allocation(size);
+    return __libc_realloc(ptr, size);
+}
+#define COUNTS_ALLOCATIONS  TRUE
+#else // __GLIBC__
+static unsigned long allocCount;
+static unsigned long allocBytes;
+#define COUNTS_ALLOCATIONS  FALSE
+#endif // __GLIBC__
+
+// names go into the JSON unescaped, so keep them to a safe set
+static void bench_name(char *name, const char *prefix, const char *text)
+{
+    unsigned long len;
+    int lastSep = FALSE;
+
+    for (len = 0; *prefix && len < MAX_NAME - 1; ++prefix)
+    {
+        name[len++] = *prefix;
+    }
+    for (; text && *text && len < MAX_NAME - 1; ++text)
+    {
+        if (isalnum((unsigned char)*text))
+        {
+            name[len++] = *text;
+            lastSep = FALSE;
+        }
+        else if (!lastSep && len && '/' != name[len - 1])
+        {
+            name[len++] = '_';
+            lastSep = TRUE;
+        }
+    }
+    while (len && '_' == name[len - 1])
+    {
+        --len;
+    }
+    name[len] = '\0';
+}
+
+// run the op in doubling batches until the minimum time has passed
+static void run_bench(BENCH_RUN *run, const char *name, BENCH_FUNC func, void *context, unsigned long bytesPerOp)
+{
+    BENCH_RESULT result;
+    unsigned long batch = 1;
+    unsigned long op = 0;
+    unsigned long allocs, bytes;
+    TIME_US start, elapsed;
+
+    if (run->filter && NULL == strstr(name, run->filter))
+    {
+        return;
+    }
+    func(context, op++);       // warm the caches, and any one-time setup
+    atomic_store_release(&allocCount, 0);
+    atomic_store_release(&allocBytes, 0);
+    start = time_now_us();
+    for (;;)
+    {
+        unsigned long k;
+        for (k = 0; k < batch; ++k)
+        {
+            func(context, op++);
+        }
+        elapsed = time_now_us() - start;
+        if (elapsed >= run->minUs)
+        {
+            break;
+        }
+        batch *= 2;
+    }
+    allocs = atomic_load_acquire(&allocCount);
+    bytes = atomic_load_acquire(&allocBytes);
+
+    memset(&result, 0, sizeof(result));
+    bench_name(result.name, name, NULL);
+    result.ops = op - 1;
+    result.nsPerOp = (double)elapsed * 1000.0 / result.ops;
+    result.allocsPerOp = COUNTS_ALLOCATIONS ? (double)allocs / result.ops : -1.0;
+    result.allocBytesPerOp = COUNTS_ALLOCATIONS ? (double)bytes / result.ops : -1.0;
+    result.bytesPerSec = (bytesPerOp && elapsed) ? (double)bytesPerOp * result.ops * 1000000.0 / elapsed : 0.0;
+
+    fprintf(run->json, "%s\n    {\"name\": \"%s\", \"ns_per_op\": %.2f, \"ops\": %lu, ",
+            run->numResults ? "," : "", result.name, result.nsPerOp, result.ops);
+    if (COUNTS_ALLOCATIONS)
+    {
+        fprintf(run->json, "\"allocs_per_op\": %.3f, \"alloc_bytes_per_op\": %.1f, ", result.allocsPerOp, result.allocBytesPerOp);
+    }
+    else
+    {
+        fprintf(run->json, "\"allocs_per_op\": null, \"alloc_bytes_per_op\": null, ");
+    }
+    if (result.bytesPerSec > 0.0)
+    {
+        fprintf(run->json, "\"bytes_per_sec\": %.0f}", result.bytesPerSec);
+    }
+    else
+    {
+        fprintf(run->json, "\"bytes_per_sec\": null}");
+    }
+    fflush(run->json);
+    ++run->numResults;
+
+    fprintf(stderr, "%-48s %12.1f ns/op %10.3f allocs/op", result.name, result.nsPerOp, COUNTS_ALLOCATIONS ? result.allocsPerOp : 0.0);
+    if (result.bytesPerSec > 0.0)
+    {
+        fprintf(stderr, " %10.1f MB/s", result.bytesPerSec / (1024.0 * 1024.0));
+    }
+    fprintf(stderr, "\n");
+}
+
+static void bench_compress_response(void *context, unsigned long op)
+{
+    (void)context;
+    (void)op;
+    memcpy(scratch, spacedResponse, sizeof(spacedResponse));
+    sink += (unsigned long)compress_response(scratch, sizeof(scratch));
+}
+
+static void bench_elm_next_message(void *context, unsigned long op)
+{
+    ELM_MESSAGE_READER reader;
+    ELM_MESSAGE msg;
+
+    (void)context;
+    (void)op;
+    elm_reader_init(&reader, multiEcuResponse, sizeof(multiEcuResponse) - 1, 3);
+    while (elm_next_message(&reader, &msg))
+    {
+        sink += msg.length;
+    }
+}
+
+static void bench_parse_dtcs(void *context, unsigned long op)
+{
+    (void)context;
+    (void)op;
+    // the codes are new to the ECU every time, the session list already has them
+    session.dtcs.ecus[0].count[DTC_STORED] = 0;
+    sink += parse_dtcs(&session, dtcResponse, sizeof(dtcResponse), DTC_STORED, 0);
+}
+
+static void bench_add_trouble_code_new(void *context, unsigned long op)
+{
+    (void)context;
+    // a code not yet in the session list, which looks up its description
+    session.numFoundCodes = 0;
+    add_trouble_code(&session, (char *)troubleCodes[op % (sizeof(troubleCodes) / sizeof(troubleCodes[0]))], DTC_STORED, 0);
+}
+
+static void bench_add_trouble_code_repeat(void *context, unsigned long op)
+{
+    (void)context;
+    add_trouble_code(&session, (char *)troubleCodes[op % (sizeof(troubleCodes) / sizeof(troubleCodes[0]))], DTC_STORED, 0);
+}
+
+static void bench_process_and_display_data(void *context, unsigned long op)
+{
+    int k = (int)(op % (sizeof(mode01Lengths) / sizeof(mode01Lengths[0])));
+
+    (void)context;
+    process_and_display_data(&session, mode01Responses[k], mode01Lengths[k]);
+}
+
+static void bench_formula(void *context, unsigned long op)
+{
+    static const unsigned long raw[8] =
+    {
+        0x00000000UL, 0x1A2B3C4DUL, 0x7F7F7F7FUL, 0x80808080UL,
+        0xFFFFFFFFUL, 0x00C80064UL, 0x0123ABCDUL, 0x55AA55AAUL,
+    };
+    const FORMULA_INPUT *input = (const FORMULA_INPUT *)context;
+
+    sensor_format(input->index, (int)(raw[op & 7] & input->mask), scratch, sizeof(scratch));
+    sink += (unsigned char)scratch[0];
+}
+
+// a whole scan of the simulation input, VIN to trouble codes
+static void bench_sim_scan(void *context, unsigned long op)
+{
+    const SIM_INPUT *input = (const SIM_INPUT *)context;
+    char vin[64];
+    char year[8];
+
+    (void)op;
+    initializeSession(&session);
+    workInit(&session, input->buf, input->size, 0, vin, sizeof(vin), year, sizeof(year));
+    process_all_codes(&session);
+    sink += acquire_trouble_codes(&session)->numEcus;
+    destroySession(&session);
+}
+
+// a scan of the simulation input, its output as ScanTool -i prints it
+static void decode_sim(const char *buf, unsigned long size, OUTPUT_BUFFER *out)
+{
+    char vin[64];
+    char year[8];
+
+    initializeSession(&session);
+    session.report = out;
+    workInit(&session, buf, size, 0, vin, sizeof(vin), year, sizeof(year));
+    session_vehicle(&session, vin, year);
+    process_all_codes(&session);
+    (void)write_scan_report(&session, acquire_trouble_codes(&session), out);
+    destroySession(&session);
+}
+
+// headers on or off, the built in vehicle must decode to the same text, and to something
+static int check_headers(void)
+{
+    OUTPUT_BUFFER off;
+    OUTPUT_BUFFER on;
+    int same = FALSE;
+
+    if (outbuf_init_dynamic(&off, OUTPUT_GROW_DEFAULT, 0) &&
+        outbuf_init_dynamic(&on, OUTPUT_GROW_DEFAULT, 0))
+    {
+        decode_sim(defaultSim, sizeof(defaultSim) - 1, &off);
+        decode_sim(headersSim, sizeof(headersSim) - 1, &on);
+        same = (NULL != strstr(off.buf, "1D3HV13T09S718057") &&
+                NULL != strstr(off.buf, "P0133") &&
+                off.len == on.len &&
+                0 == memcmp(off.buf, on.buf, off.len)) ? TRUE : FALSE;
+        if (!same)
+        {
+            fprintf(stderr, "Headers off:\n%s\nHeaders on:\n%s\n", off.buf, on.buf);
+        }
+        outbuf_free(&on);
+    }
+    outbuf_free(&off);
+    return same;
+}
+
+// a log of several scans holds the same two ECUs and the stored codes Mode 01 PID 01 reports,
+// and a code is counted once per ECU whatever the kinds it is reported as
+static int check_scans(void)
+{
+    OUTPUT_BUFFER out;
+    int right;
+
+    if (!outbuf_init_dynamic(&out, OUTPUT_GROW_DEFAULT, 0))
+    {
+        return FALSE;
+    }
+    decode_sim(scansSim, sizeof(scansSim) - 1, &out);
+    right = (NULL != strstr(out.buf, "ECU 2: 1 stored, 1 pending, 1 permanent") &&
+             NULL != strstr(out.buf, "P0201(1) ") &&
+             NULL == strstr(out.buf, "ECU 3:") &&
+             NULL == strstr(out.buf, "different number")) ? TRUE : FALSE;
+    if (!right)
+    {
+        fprintf(stderr, "Two scans:\n%s\n", out.buf);
+    }
+    outbuf_free(&out);
+    return right;
+}
+
+static void bench_vin_decode(void *context, unsigned long op)
+{
+    char vin[64];
+    char year[8];
+
+    (void)context;
+    (void)op;
+    initializeSession(&session);
+    workInit(&session, vinSim, sizeof(vinSim) - 1, 0, vin, sizeof(vin), year, sizeof(year));
+    sink += (unsigned char)vin[0];
+    destroySession(&session);
+}
+
+// the scan as the live code path runs it, against the replay adapter
+static void bench_live_sweep(void *context, unsigned long op)
+{
+    const MEMORY_SINK *capture = (const MEMORY_SINK *)context;
+    REPLAY_ADAPTER adapter;
+    char vin[64];
+    char year[8];
+
+    (void)op;
+    if (!replay_adapter_init(&adapter, (const char *)capture->buf, capture->len, REPLAY_FAST))
+    {
+        return;
+    }
+    initializeSession(&session);
+    replay_adapter_attach(&adapter, &session.comport);
+    workInit(&session, NULL, 0, 0, vin, sizeof(vin), year, sizeof(year));
+    process_all_codes(&session);
+    sink += acquire_trouble_codes(&session)->numEcus;
+    close_comport(&session.comport);
+    replay_adapter_free(&adapter);
+    destroySession(&session);
+}
+
+static void memory_sink(void *context, const unsigned char *data, unsigned long length)
+{
+    MEMORY_SINK *mem = (MEMORY_SINK *)context;
+
+    if (mem->len + length > mem->max)
+    {
+        unsigned long newMax = (mem->max ? mem->max * 2 : 64 * 1024) + length;
+        unsigned char *newBuf = (unsigned char *)realloc(mem->buf, newMax);
+        if (NULL == newBuf)
+        {
+            return;
+        }
+        mem->buf = newBuf;
+        mem->max = newMax;
+    }
+    memcpy(mem->buf + mem->len, data, length);
+    mem->len += length;
+}
+
+// each "command\r...>" exchange of the simulation text, as the port would log it
+static int sim_to_capture(const char *buf, unsigned long size, MEMORY_SINK *capture)
+{
+    CAPTURE_WRITER writer;
+    TIME_US now = 0;
+    unsigned long start = 0;
+
+    memset(capture, 0, sizeof(*capture));
+    if (!capture_writer_init(&writer, memory_sink, capture, 0, 0))
+    {
+        return FALSE;
+    }
+    while (start < size)
+    {
+        const char *prompt = (const char *)memchr(buf + start, '>', size - start);
+        unsigned long end = prompt ? (unsigned long)(prompt - buf) + 1 : size;
+        unsigned long cmdLen = 0;
+
+        while (start + cmdLen < end && '\r' != buf[start + cmdLen] && '\n' != buf[start + cmdLen])
+        {
+            ++cmdLen;
+        }
+        if (cmdLen)
+        {
+            capture_write(&writer, CAPTURE_TX, 0, now, buf + start, cmdLen);
+            capture_write(&writer, CAPTURE_RX, 0, now + ANSWER_US, buf + start, end - start);
+            capture_write(&writer, CAPTURE_PROMPT, 0, now + ANSWER_US, NULL, 0);
+        }
+        now += EXCHANGE_US;
+        start = end;
+        while (start < size && ('\r' == buf[start] || '\n' == buf[start]))
+        {
+            ++start;
+        }
+    }
+    capture_writer_finish(&writer);
+    return NULL != capture->buf;
+}
+
+static void run_all(BENCH_RUN *run, const SIM_INPUT *sim)
+{
+    FORMULA_INPUT formula;
+    MEMORY_SINK capture;
+    SIM_INPUT headers;
+    char name[MAX_NAME];
+    int numSensors = sensor_count();
+    int k, j;
+
+    initializeSession(&session);
+    run_bench(run, "compress_response", bench_compress_response, NULL, sizeof(spacedResponse) - 1);
+    run_bench(run, "elm_next_message", bench_elm_next_message, NULL, sizeof(multiEcuResponse) - 1);
+    run_bench(run, "parse_dtcs", bench_parse_dtcs, NULL, sizeof(dtcResponse));
+    run_bench(run, "add_trouble_code/new", bench_add_trouble_code_new, NULL, 0);
+    run_bench(run, "add_trouble_code/repeat", bench_add_trouble_code_repeat, NULL, 0);
+    run_bench(run, "process_and_display_data", bench_process_and_display_data, NULL, 0);
+    for (k = 0; k < numSensors; ++k)
+    {
+        char prefix[16];
+        int bytes = sensor_data_bytes(k);
+        int repeats = 0;
+
+        formula.index = k;
+        formula.mask = (bytes >= 4) ? 0xFFFFFFFFUL : ((1UL << (8 * bytes)) - 1);
+#ifdef WIN_VS6
+        sprintf(prefix, "formula/%s/", sensor_pid(k));
+#else // WIN_VS6
+        StringCchPrintf(prefix, sizeof(prefix), "formula/%s/", sensor_pid(k));
+#endif // WIN_VS6
+        bench_name(name, prefix, sensor_label(k));
+        // a few sensors are listed again for their progress bars
+        for (j = 0; j < k; ++j)
+        {
+            if (0 == strcmp(sensor_pid(j), sensor_pid(k)) &&
+                0 == strcmp(sensor_label(j), sensor_label(k)))
+            {
+                ++repeats;
+            }
+        }
+        if (repeats && strlen(name) + 4 < sizeof(name))
+        {
+#ifdef WIN_VS6
+            sprintf(name + strlen(name), "_%d", repeats + 1);
+#else // WIN_VS6
+            StringCchPrintf(name + strlen(name), sizeof(name) - strlen(name), "_%d", repeats + 1);
+#endif // WIN_VS6
+        }
+        run_bench(run, name, bench_formula, &formula, 0);
+    }
+    destroySession(&session);
+
+    run_bench(run, "vin_decode", bench_vin_decode, NULL, sizeof(vinSim) - 1);
+    run_bench(run, "sim_scan", bench_sim_scan, (void *)sim, sim->size);
+    headers.buf = headersSim;
+    headers.size = sizeof(headersSim) - 1;
+    run_bench(run, "sim_scan/headers", bench_sim_scan, &headers, headers.size);
+    if (sim_to_capture(sim->buf, sim->size, &capture))
+    {
+        run_bench(run, "live_sweep", bench_live_sweep, &capture, capture.len);
+        free(capture.buf);
+    }
+}
+
+typedef struct _SAVED_RESULT
+{
+    char name[MAX_NAME];
+    double nsPerOp;
+} SAVED_RESULT;
+
+// the name and ns/op of each benchmark line of a results file
+static int load_results(const char *fname, SAVED_RESULT *results, int maxResults)
+{
+    char line[512];
+    int count = 0;
+    FILE *in = fopen(fname, "r");
+
+    if (NULL == in)
+    {
+        fprintf(stderr, "Error: unable to open %s\n", fname);
+        return -1;
+    }
+    while (count < maxResults && fgets(line, sizeof(line), in))
+    {
+        const char *name = strstr(line, "\"name\": \"");
+        const char *ns = strstr(line, "\"ns_per_op\": ");
+        const char *end;
+        unsigned long len;
+
+        if (NULL == name || NULL == ns)
+        {
+            continue;
+        }
+        name += 9;
+        end = strchr(name, '"');
+        len = end ? (unsigned long)(end - name) : 0;
+        if (0 == len || len >= MAX_NAME ||
+            1 != sscanf(ns + 13, "%lf", &results[count].nsPerOp))
+        {
+            continue;
+        }
+        memcpy(results[count].name, name, len);
+        results[count].name[len] = '\0';
+        ++count;
+    }
+    fclose(in);
+    return count;
+}
+
+static int compare_runs(const char *oldName, const char *newName, double threshold)
+{
+    static SAVED_RESULT oldResults[MAX_RESULTS];
+    static SAVED_RESULT newResults[MAX_RESULTS];
+    int numOld = load_results(oldName, oldResults, MAX_RESULTS);
+    int numNew = load_results(newName, newResults, MAX_RESULTS);
+    int regressions = 0;
+    int k, j;
+
+    if (numOld < 0 || numNew < 0)
+    {
+        return 2;
+    }
+    printf("%-48s %12s %12s %9s\n", "benchmark", "old ns/op", "new ns/op", "change");
+    for (k = 0; k < numNew; ++k)
+    {
+        for (j = 0; j < numOld && strcmp(oldResults[j].name, newResults[k].name); ++j)
+        {
+        }
+        if (j == numOld)
+        {
+            printf("%-48s %12s %12.1f %9s\n", newResults[k].name, "-", newResults[k].nsPerOp, "new");
+        }
+        else
+        {
+            double change = oldResults[j].nsPerOp > 0.0 ?
+                            (newResults[k].nsPerOp - oldResults[j].nsPerOp) * 100.0 / oldResults[j].nsPerOp : 0.0;
+            int slower = change > threshold;
+            printf("%-48s %12.1f %12.1f %+8.1f%%%s\n", newResults[k].name, oldResults[j].nsPerOp,
+                   newResults[k].nsPerOp, change, slower ? "  REGRESSION" : "");
+            regressions += slower;
+        }
+    }
+    for (j = 0; j < numOld; ++j)
+    {
+        for (k = 0; k < numNew && strcmp(oldResults[j].name, newResults[k].name); ++k)
+        {
+        }
+        if (k == numNew)
+        {
+            printf("%-48s %12.1f %12s %9s\n", oldResults[j].name, oldResults[j].nsPerOp, "-", "gone");
+        }
+    }
+    printf("%d of %d benchmarks slower by more than %.1f%%\n", regressions, numNew, threshold);
+    return regressions ? 1 : 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: scan_bench [-m ms] [-f filter] [-i simfile] [-o results.json]\n"
+                    "       scan_bench -c old.json new.json [-t percent]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    BENCH_RUN run;
+    SIM_INPUT sim;
+    const char *outName = NULL;
+    const char *simName = NULL;
+    const char *compare[2] = { NULL, NULL };
+    double threshold = DEFAULT_THRESHOLD;
+    char *simText = NULL;
+    int index;
+
+    memset(&run, 0, sizeof(run));
+    run.minUs = (TIME_US)DEFAULT_MIN_MS * 1000;
+    for (index = 1; index < argc; ++index)
+    {
+        const char *parm = argv[index];
+        if ('-' != parm[0] || 0 == parm[1] || 0 != parm[2])
+        {
+            usage();
+            return 2;
+        }
+        if ('c' == parm[1] && index + 2 < argc)
+        {
+            compare[0] = argv[++index];
+            compare[1] = argv[++index];
+        }
+        else if (index + 1 >= argc)
+        {
+            usage();
+            return 2;
+        }
+        else if ('m' == parm[1])
+        {
+            run.minUs = (TIME_US)strtoul(argv[++index], NULL, 10) * 1000;
+        }
+        else if ('f' == parm[1])
+        {
+            run.filter = argv[++index];
+        }
+        else if ('i' == parm[1])
+        {
+            simName = argv[++index];
+        }
+        else if ('o' == parm[1])
+        {
+            outName = argv[++index];
+        }
+        else if ('t' == parm[1])
+        {
+            threshold = atof(argv[++index]);
+        }
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (compare[0])
+    {
+        return compare_runs(compare[0], compare[1], threshold);
+    }
+
+    sim.buf = defaultSim;
+    sim.size = sizeof(defaultSim) - 1;
+    if (simName)
+    {
+        FILE *in = fopen(simName, "rb");
+        long size = -1;
+        if (in && 0 == fseek(in, 0, SEEK_END) && (size = ftell(in)) > 0)
+        {
+            rewind(in);
+            simText = (char *)malloc((size_t)size);
+            if (simText && (size_t)size == fread(simText, 1, (size_t)size, in))
+            {
+                sim.buf = simText;
+                sim.size = (unsigned long)size;
+            }
+        }
+        if (in)
+        {
+            fclose(in);
+        }
+        if (sim.buf != simText)
+        {
+            fprintf(stderr, "Error: unable to read %s\n", simName);
+            return 2;
+        }
+    }
+
+    // the scan code prints as it goes, keep it out of the results
+    if (outName)
+    {
+        run.json = fopen(outName, "w");
+    }
+    else
+    {
+        run.json = fdopen(dup(fileno(stdout)), "w");
+    }
+    if (NULL == run.json)
+    {
+        fprintf(stderr, "Error: unable to write %s\n", outName ? outName : "the results");
+        return 2;
+    }
+    if (NULL == freopen(NULL_DEVICE, "w", stdout))
+    {
+        fprintf(stderr, "Error: unable to open %s\n", NULL_DEVICE);
+        return 2;
+    }
+
+    // timing a decoder that reads nothing would prove nothing
+    if (!check_headers())
+    {
+        fprintf(stderr, "Error: the scan decodes the headers on vehicle differently\n");
+        fclose(run.json);
+        return 1;
+    }
+    if (!check_scans())
+    {
+        fprintf(stderr, "Error: the scan counts the ECUs of a log of two scans wrongly\n");
+        fclose(run.json);
+        return 1;
+    }
+
+    fprintf(run.json, "{\n  \"min_ms\": %lu,\n  \"allocations_counted\": %s,\n  \"benchmarks\": [",
+            (unsigned long)(run.minUs / 1000), COUNTS_ALLOCATIONS ? "true" : "false");
+    run_all(&run, &sim);
+    fprintf(run.json, "\n  ]\n}\n");
+    fclose(run.json);
+    free(simText);
+    return 0;
+}
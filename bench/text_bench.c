@@ -0,0 +1,156 @@
+/*
+ * Throughput of the text kernels on capture-like input, per kernel set
+ * this CPU supports.  Every set is checked against the scalar output.
+ *
+ *   text_bench [megabytes]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../globals.h"
+#include "../text_kernels.h"
+
+#define DEFAULT_MEGABYTES   64
+#define MIN_SECONDS         1.0
+
+// a Mode 01 answer and a multi-frame VIN, as they come off the wire
+static const char *sampleLines[] =
+{
+    "41 0C 1A F8 \r",
+    "41 00 BE 3F A8 13 \r",
+    "7E8 06 41 00 BE 3F A8 13 \r",
+    "0: 49 02 01 31 44 33 \r",
+    "1: 48 56 31 33 54 30 39 \r",
+    "43 01 33 01 34 00 00 \r",
+};
+
+static void fill_text(char *buf, unsigned long size)
+{
+    unsigned long pos = 0;
+    int line = 0;
+
+    while (pos < size)
+    {
+        const char *text = sampleLines[line++ % (sizeof(sampleLines) / sizeof(sampleLines[0]))];
+        unsigned long len = (unsigned long)strlen(text);
+        if (len > size - pos)
+        {
+            len = size - pos;
+        }
+        memcpy(buf + pos, text, len);
+        pos += len;
+    }
+}
+
+static void fill_hex(char *buf, unsigned long size)
+{
+    static const char digits[] = "0123456789ABCDEFabcdef";
+    unsigned long k;
+
+    srand(1);
+    for (k = 0; k < size; ++k)
+    {
+        buf[k] = digits[rand() % (sizeof(digits) - 1)];
+    }
+}
+
+static double seconds_since(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long size = DEFAULT_MEGABYTES;
+    char *text, *work, *hex, *strippedText;
+    unsigned char *bytes, *reference;
+    unsigned long stripped = 0;
+    unsigned long referenceLength = 0;
+    int level;
+    int failed = FALSE;
+
+    if (argc > 1)
+    {
+        size = strtoul(argv[1], NULL, 10);
+    }
+    size = (size ? size : DEFAULT_MEGABYTES) * 1024 * 1024;
+
+    text = (char *)malloc(size);
+    work = (char *)malloc(size);
+    hex = (char *)malloc(size);
+    strippedText = (char *)malloc(size);
+    bytes = (unsigned char *)malloc(size / 2);
+    reference = (unsigned char *)malloc(size / 2);
+    if (!text || !work || !hex || !strippedText || !bytes || !reference)
+    {
+        fprintf(stderr, "Error: unable to allocate %lu bytes\n", size);
+        return 1;
+    }
+    fill_text(text, size);
+    fill_hex(hex, size);
+
+    printf("%-8s %14s %14s\n", "kernels", "strip MB/s", "decode MB/s");
+    for (level = TEXT_KERNEL_SCALAR; level <= TEXT_KERNEL_AVX2; ++level)
+    {
+        double stripTime, decodeTime;
+        clock_t start;
+        int runs;
+
+        if (text_kernels_select(level) != level)
+        {
+            break;
+        }
+
+        runs = 0;
+        stripTime = 0;
+        do
+        {
+            memcpy(work, text, size);
+            start = clock();
+            stripped = strip_spaces(work, size);
+            stripTime += seconds_since(start);
+            ++runs;
+        } while (stripTime < MIN_SECONDS);
+        stripTime /= runs;
+
+        runs = 0;
+        start = clock();
+        do
+        {
+            if (!hex_to_bytes(hex, size, bytes))
+            {
+                failed = TRUE;
+            }
+            ++runs;
+        } while (seconds_since(start) < MIN_SECONDS);
+        decodeTime = seconds_since(start) / runs;
+
+        if (TEXT_KERNEL_SCALAR == level)
+        {
+            memcpy(reference, bytes, size / 2);
+            memcpy(strippedText, work, stripped);
+            referenceLength = stripped;
+        }
+        else if (stripped != referenceLength ||
+                 memcmp(strippedText, work, stripped) ||
+                 memcmp(reference, bytes, size / 2))
+        {
+            failed = TRUE;
+        }
+        printf("%-8s %14.1f %14.1f\n", text_kernels_name(level),
+               size / stripTime / (1024 * 1024), size / decodeTime / (1024 * 1024));
+    }
+    if (failed)
+    {
+        fprintf(stderr, "Error: kernel output differs from scalar\n");
+    }
+
+    free(reference);
+    free(bytes);
+    free(strippedText);
+    free(hex);
+    free(work);
+    free(text);
+    return failed ? 1 : 0;
+}
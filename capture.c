@@ -0,0 +1,393 @@
+#ifdef WINDDK
+#include <windows.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <string.h>
+#include <stdlib.h>
+#include "globals.h"
+#include "platform.h"
+#include "capture.h"
+
+static const char captureMagic[8] = { 'S', 'C', 'A', 'N', 'C', 'A', 'P', 0x1A };
+static const char trailerMagic[8] = { 'C', 'A', 'P', 'I', 'N', 'D', 'E', 'X' };
+
+#define MAX_VARINT  10      // bytes of a 64 bit varint
+
+static void put_u16(unsigned char *p, unsigned int value)
+{
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+}
+
+static void put_u32(unsigned char *p, unsigned long value)
+{
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+    p[2] = (unsigned char)(value >> 16);
+    p[3] = (unsigned char)(value >> 24);
+}
+
+static void put_u64(unsigned char *p, PLATFORM_U64 value)
+{
+    put_u32(p, (unsigned long)(value & 0xFFFFFFFFUL));
+    put_u32(p + 4, (unsigned long)(value >> 32));
+}
+
+static unsigned long get_u32(const unsigned char *p)
+{
+    return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+           ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static PLATFORM_U64 get_u64(const unsigned char *p)
+{
+    return (PLATFORM_U64)get_u32(p) | ((PLATFORM_U64)get_u32(p + 4) << 32);
+}
+
+// returns the bytes written
+static int put_varint(unsigned char *p, PLATFORM_U64 value)
+{
+    int n = 0;
+    while (value >= 0x80)
+    {
+        p[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    p[n++] = (unsigned char)value;
+    return n;
+}
+
+// returns FALSE if the varint runs past end
+static int get_varint(const unsigned char *buf, unsigned long end, unsigned long *pos, PLATFORM_U64 *value)
+{
+    int shift = 0;
+
+    *value = 0;
+    while (*pos < end && shift < 7 * MAX_VARINT)
+    {
+        unsigned char b = buf[(*pos)++];
+        *value |= (PLATFORM_U64)(b & 0x7F) << shift;
+        if (0 == (b & 0x80))
+        {
+            return TRUE;
+        }
+        shift += 7;
+    }
+    return FALSE;
+}
+
+static void emit(CAPTURE_WRITER *writer, const unsigned char *data, unsigned long length)
+{
+    writer->sink(writer->context, data, length);
+    writer->offset += length;
+}
+
+// returns FALSE if the block buffer could not be allocated
+int capture_writer_init(CAPTURE_WRITER *writer, CAPTURE_SINK sink, void *context, TIME_US wallClock, int flags)
+{
+    unsigned char header[CAPTURE_HEADER_SIZE];
+
+    memset(writer, 0, sizeof(*writer));
+    writer->blockSize = CAPTURE_BLOCK_HEADER + CAPTURE_BLOCK_SIZE + 3 * MAX_VARINT + 1;
+    writer->block = (unsigned char *)malloc(writer->blockSize);
+    if (NULL == writer->block)
+    {
+        return FALSE;
+    }
+    writer->sink = sink;
+    writer->context = context;
+    writer->blockLen = CAPTURE_BLOCK_HEADER;
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, captureMagic, sizeof(captureMagic));
+    put_u16(header + 8, CAPTURE_VERSION);
+    put_u16(header + 10, (unsigned int)flags);
+    put_u64(header + 16, wallClock);
+    emit(writer, header, sizeof(header));
+    return TRUE;
+}
+
+// hand the records written so far to the sink as one block
+void capture_flush_block(CAPTURE_WRITER *writer)
+{
+    if (0 == writer->blockRecords)
+    {
+        return;
+    }
+    if (writer->numBlocks >= writer->maxBlocks)
+    {
+        unsigned long newMax = writer->maxBlocks ? writer->maxBlocks * 2 : 64;
+        CAPTURE_INDEX_ENTRY *newIndex = (CAPTURE_INDEX_ENTRY *)realloc(writer->index, newMax * sizeof(CAPTURE_INDEX_ENTRY));
+        if (newIndex)
+        {
+            writer->index = newIndex;
+            writer->maxBlocks = newMax;
+        }
+    }
+    // without room in the index the block is still written, it just cannot be seeked to
+    if (writer->numBlocks < writer->maxBlocks)
+    {
+        writer->index[writer->numBlocks].offset = writer->offset;
+        writer->index[writer->numBlocks].time = writer->blockTime;
+        writer->index[writer->numBlocks].records = writer->blockRecords;
+        ++writer->numBlocks;
+    }
+
+    put_u32(writer->block, CAPTURE_BLOCK_MAGIC);
+    put_u32(writer->block + 4, writer->blockLen - CAPTURE_BLOCK_HEADER);
+    put_u32(writer->block + 8, writer->blockRecords);
+    put_u32(writer->block + 12, 0);
+    put_u64(writer->block + 16, writer->blockTime);
+    emit(writer, writer->block, writer->blockLen);
+
+    writer->blockLen = CAPTURE_BLOCK_HEADER;
+    writer->blockRecords = 0;
+}
+
+// returns FALSE if a record too large for the block could not be made room for
+int capture_write(CAPTURE_WRITER *writer, int type, unsigned long port, TIME_US time, const void *data, unsigned long length)
+{
+    unsigned long need = 3 * MAX_VARINT + 1 + length;
+
+    if (writer->blockRecords &&
+        writer->blockLen + need > writer->blockSize)
+    {
+        capture_flush_block(writer);
+    }
+    if (CAPTURE_BLOCK_HEADER + need > writer->blockSize)
+    {
+        unsigned char *newBlock = (unsigned char *)realloc(writer->block, CAPTURE_BLOCK_HEADER + need);
+        if (NULL == newBlock)
+        {
+            return FALSE;
+        }
+        writer->block = newBlock;
+        writer->blockSize = CAPTURE_BLOCK_HEADER + need;
+    }
+    if (0 == writer->blockRecords)
+    {
+        writer->blockTime = time;
+        writer->lastTime = time;
+    }
+    // times only go forward, a clock step back is recorded as no time passing
+    if (time < writer->lastTime)
+    {
+        time = writer->lastTime;
+    }
+
+    writer->blockLen += put_varint(writer->block + writer->blockLen, time - writer->lastTime);
+    writer->block[writer->blockLen++] = (unsigned char)type;
+    writer->blockLen += put_varint(writer->block + writer->blockLen, port);
+    writer->blockLen += put_varint(writer->block + writer->blockLen, length);
+    if (length)
+    {
+        memcpy(writer->block + writer->blockLen, data, length);
+        writer->blockLen += length;
+    }
+    writer->lastTime = time;
+    ++writer->blockRecords;
+
+    if (writer->blockLen >= CAPTURE_BLOCK_HEADER + CAPTURE_BLOCK_SIZE)
+    {
+        capture_flush_block(writer);
+    }
+    return TRUE;
+}
+
+// write the last block, the index and the trailer
+void capture_writer_finish(CAPTURE_WRITER *writer)
+{
+    unsigned char entry[CAPTURE_INDEX_ENTRY_SIZE];
+    unsigned char trailer[CAPTURE_TRAILER_SIZE];
+    PLATFORM_U64 indexOffset;
+    unsigned long k;
+
+    if (NULL == writer->block)
+    {
+        return;
+    }
+    capture_flush_block(writer);
+
+    indexOffset = writer->offset;
+    put_u32(entry, CAPTURE_INDEX_MAGIC);
+    put_u32(entry + 4, writer->numBlocks);
+    emit(writer, entry, 8);
+    for (k = 0; k < writer->numBlocks; ++k)
+    {
+        put_u64(entry, writer->index[k].offset);
+        put_u64(entry + 8, writer->index[k].time);
+        put_u32(entry + 16, writer->index[k].records);
+        put_u32(entry + 20, 0);
+        emit(writer, entry, CAPTURE_INDEX_ENTRY_SIZE);
+    }
+    put_u64(trailer, indexOffset);
+    memcpy(trailer + 8, trailerMagic, sizeof(trailerMagic));
+    emit(writer, trailer, sizeof(trailer));
+
+    free(writer->block);
+    free(writer->index);
+    memset(writer, 0, sizeof(*writer));
+}
+
+int capture_is_capture(const char *buf, unsigned long size)
+{
+    return (size >= CAPTURE_HEADER_SIZE &&
+            0 == memcmp(buf, captureMagic, sizeof(captureMagic))) ? TRUE : FALSE;
+}
+
+// TRUE if every block the index names starts in the blocks before it,
+// so capture_seek never steps outside them
+static int index_in_range(const unsigned char *index, unsigned long numBlocks, unsigned long indexOffset)
+{
+    unsigned long k;
+
+    if (indexOffset < CAPTURE_HEADER_SIZE + CAPTURE_BLOCK_HEADER)
+    {
+        return (0 == numBlocks) ? TRUE : FALSE;
+    }
+    for (k = 0; k < numBlocks; ++k)
+    {
+        PLATFORM_U64 offset = get_u64(index + k * CAPTURE_INDEX_ENTRY_SIZE);
+        if (offset < CAPTURE_HEADER_SIZE || offset > indexOffset - CAPTURE_BLOCK_HEADER)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// returns FALSE if buf does not hold a capture this version can read
+int capture_reader_init(CAPTURE_READER *reader, const char *buf, unsigned long size)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+
+    memset(reader, 0, sizeof(*reader));
+    if (!capture_is_capture(buf, size) ||
+        CAPTURE_VERSION != (p[8] | (p[9] << 8)))
+    {
+        return FALSE;
+    }
+    reader->buf = p;
+    reader->size = size;
+    reader->flags = p[10] | (p[11] << 8);
+    reader->wallClock = get_u64(p + 16);
+    reader->pos = CAPTURE_HEADER_SIZE;
+
+    // the index is only used if the trailer and the index agree,
+    // compared so that an offset near the top of the range cannot wrap
+    if (size >= CAPTURE_HEADER_SIZE + 8 + CAPTURE_TRAILER_SIZE &&
+        0 == memcmp(p + size - 8, trailerMagic, sizeof(trailerMagic)))
+    {
+        PLATFORM_U64 indexOffset = get_u64(p + size - CAPTURE_TRAILER_SIZE);
+        if (indexOffset >= CAPTURE_HEADER_SIZE &&
+            indexOffset <= size - CAPTURE_TRAILER_SIZE - 8 &&
+            CAPTURE_INDEX_MAGIC == get_u32(p + (unsigned long)indexOffset))
+        {
+            unsigned long numBlocks = get_u32(p + (unsigned long)indexOffset + 4);
+            if ((size - CAPTURE_TRAILER_SIZE - (unsigned long)indexOffset - 8) / CAPTURE_INDEX_ENTRY_SIZE >= numBlocks &&
+                index_in_range(p + (unsigned long)indexOffset + 8, numBlocks, (unsigned long)indexOffset))
+            {
+                reader->index = p + (unsigned long)indexOffset + 8;
+                reader->numBlocks = numBlocks;
+            }
+        }
+    }
+    return TRUE;
+}
+
+// step into the block at pos, FALSE at the index or where the capture was cut off
+static int enter_block(CAPTURE_READER *reader)
+{
+    unsigned long payload;
+
+    if (reader->pos + CAPTURE_BLOCK_HEADER > reader->size ||
+        CAPTURE_BLOCK_MAGIC != get_u32(reader->buf + reader->pos))
+    {
+        return FALSE;
+    }
+    payload = get_u32(reader->buf + reader->pos + 4);
+    if (payload > reader->size - reader->pos - CAPTURE_BLOCK_HEADER)
+    {
+        return FALSE;
+    }
+    reader->blockRecords = get_u32(reader->buf + reader->pos + 8);
+    reader->time = get_u64(reader->buf + reader->pos + 16);
+    reader->pos += CAPTURE_BLOCK_HEADER;
+    reader->blockEnd = reader->pos + payload;
+    return TRUE;
+}
+
+// returns FALSE after the last record
+int capture_next(CAPTURE_READER *reader, CAPTURE_RECORD *rec)
+{
+    PLATFORM_U64 delta, port, length;
+
+    for (;;)
+    {
+        while (0 == reader->blockRecords || reader->pos >= reader->blockEnd)
+        {
+            if (reader->blockEnd)
+            {
+                reader->pos = reader->blockEnd;
+                reader->blockEnd = 0;
+            }
+            if (!enter_block(reader))
+            {
+                return FALSE;
+            }
+        }
+
+        if (get_varint(reader->buf, reader->blockEnd, &reader->pos, &delta) &&
+            reader->pos < reader->blockEnd)
+        {
+            rec->type = reader->buf[reader->pos++];
+            if (get_varint(reader->buf, reader->blockEnd, &reader->pos, &port) &&
+                get_varint(reader->buf, reader->blockEnd, &reader->pos, &length) &&
+                length <= reader->blockEnd - reader->pos)
+            {
+                reader->time += delta;
+                rec->time = reader->time;
+                rec->port = (unsigned long)port;
+                rec->data = reader->buf + reader->pos;
+                rec->length = (unsigned long)length;
+                reader->pos += (unsigned long)length;
+                --reader->blockRecords;
+                return TRUE;
+            }
+        }
+        // a damaged record spoils the rest of its block only
+        reader->blockRecords = 0;
+    }
+}
+
+// position at the last block starting at or before time
+// returns FALSE if the capture has no index
+int capture_seek(CAPTURE_READER *reader, TIME_US time)
+{
+    unsigned long lo = 0;
+    unsigned long hi;
+
+    if (NULL == reader->index || 0 == reader->numBlocks)
+    {
+        return FALSE;
+    }
+    hi = reader->numBlocks;
+    while (hi - lo > 1)
+    {
+        unsigned long mid = lo + (hi - lo) / 2;
+        if (get_u64(reader->index + mid * CAPTURE_INDEX_ENTRY_SIZE + 8) <= time)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    reader->pos = (unsigned long)get_u64(reader->index + lo * CAPTURE_INDEX_ENTRY_SIZE);
+    reader->blockEnd = 0;
+    reader->blockRecords = 0;
+    return TRUE;
+}
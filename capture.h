@@ -0,0 +1,108 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Binary capture of interface traffic.  All integers are little endian.
+ *
+ *   header   "SCANCAP" 0x1A, u16 version, u16 flags, u32 0,
+ *            u64 wall clock at the start (us since 1970, 0 if unknown), u64 0
+ *   block    u32 CAPTURE_BLOCK_MAGIC, u32 payload bytes, u32 records, u32 0,
+ *            u64 time of the block (us since the start), then the records
+ *   record   varint us since the previous record (or the block time),
+ *            u8 type, varint port, varint length, the raw bytes
+ *   index    u32 CAPTURE_INDEX_MAGIC, u32 blocks,
+ *            per block u64 file offset, u64 block time, u32 records, u32 0
+ *   trailer  u64 file offset of the index, "CAPINDEX"
+ *
+ * A capture cut short (no index) is still read block by block up to the
+ * last complete block.
+ */
+#define CAPTURE_VERSION          1
+#define CAPTURE_HEADER_SIZE      32
+#define CAPTURE_BLOCK_HEADER     24
+#define CAPTURE_INDEX_ENTRY_SIZE 24
+#define CAPTURE_TRAILER_SIZE     16
+#define CAPTURE_BLOCK_MAGIC      0x314B4C42UL    // "BLK1"
+#define CAPTURE_INDEX_MAGIC      0x31584449UL    // "IDX1"
+#define CAPTURE_BLOCK_SIZE       (16 * 1024)     // payload bytes a block is closed at
+
+#define CAPTURE_FLAG_NO_TIMING   0x0001          // converted from a log without times
+
+typedef enum
+{
+    CAPTURE_TX = 1,         // time the command started out
+    CAPTURE_RX = 2,         // time the first byte of the response came in
+    CAPTURE_PROMPT = 3,     // time the '>' prompt came in, no data
+    CAPTURE_MARK = 4        // a note, such as the start time of the text log
+} CAPTURE_RECORD_TYPE;
+
+typedef struct _CAPTURE_RECORD
+{
+    int type;
+    unsigned long port;     // COM port number or session ID
+    TIME_US time;           // us since the start of the capture
+    const unsigned char *data;
+    unsigned long length;
+} CAPTURE_RECORD;
+
+// the writer hands finished blocks, and the header and index, to a sink
+typedef void (*CAPTURE_SINK)(void *context, const unsigned char *data, unsigned long length);
+
+typedef struct _CAPTURE_INDEX_ENTRY
+{
+    PLATFORM_U64 offset;
+    TIME_US time;
+    unsigned long records;
+} CAPTURE_INDEX_ENTRY;
+
+typedef struct _CAPTURE_WRITER
+{
+    CAPTURE_SINK sink;
+    void *context;
+    unsigned char *block;           // header space, then the records
+    unsigned long blockLen;
+    unsigned long blockSize;
+    unsigned long blockRecords;
+    TIME_US blockTime;
+    TIME_US lastTime;
+    PLATFORM_U64 offset;            // bytes handed to the sink so far
+    CAPTURE_INDEX_ENTRY *index;
+    unsigned long numBlocks;
+    unsigned long maxBlocks;
+} CAPTURE_WRITER;
+
+typedef struct _CAPTURE_READER
+{
+    const unsigned char *buf;
+    unsigned long size;
+    int flags;
+    TIME_US wallClock;
+    unsigned long pos;              // next record
+    unsigned long blockEnd;         // end of the current block, 0 if between blocks
+    unsigned long blockRecords;     // records left in the current block
+    TIME_US time;
+    const unsigned char *index;     // NULL if the capture has none
+    unsigned long numBlocks;
+} CAPTURE_READER;
+
+int capture_writer_init(CAPTURE_WRITER *writer, CAPTURE_SINK sink, void *context, TIME_US wallClock, int flags);
+int capture_write(CAPTURE_WRITER *writer, int type, unsigned long port, TIME_US time, const void *data, unsigned long length);
+void capture_flush_block(CAPTURE_WRITER *writer);
+void capture_writer_finish(CAPTURE_WRITER *writer);
+
+int capture_is_capture(const char *buf, unsigned long size);
+int capture_reader_init(CAPTURE_READER *reader, const char *buf, unsigned long size);
+int capture_next(CAPTURE_READER *reader, CAPTURE_RECORD *rec);
+int capture_seek(CAPTURE_READER *reader, TIME_US time);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* CAPTURE_H */
@@ -0,0 +1,483 @@
+#ifdef WINDDK
+#include <windows.h>
+#include <strsafe.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <io.h>
+#else // _WIN32
+#include <errno.h>
+#include <unistd.h>
+#endif // _WIN32
+#include "globals.h"
+#include "platform.h"
+#include "capture.h"
+#include "comm_log.h"
+#include "scan_trace.h"
+
+/*
+ * head and tail count every byte ever written and flushed, so head - tail
+ * is what the ring holds even after the counters wrap.
+ *
+ * A capture goes through the same ring: records are packed into blocks
+ * under captureLock and each finished block is put in the ring whole.
+ *
+ * The ring goes to the file with write(2) on its descriptor, which a
+ * signal handler may call too; ringWriter says who is writing it.
+ */
+typedef struct _COMM_LOG
+{
+    FILE *file;
+    int fd;                     // of file
+    COMM_LOG_FORMAT format;
+    char *ring;
+    unsigned long size;
+    volatile unsigned long head;
+    volatile unsigned long tail;
+    unsigned long flushIntervalMs;
+    volatile int stop;
+    int isOpen;
+    PLATFORM_MUTEX lock;        // writers, and head
+    PLATFORM_MUTEX flushLock;   // one flush at a time, and tail
+    PLATFORM_EVENT wake;        // to the flusher: the ring is filling up or closing
+    PLATFORM_EVENT space;       // to writers: the flusher made room
+    PLATFORM_THREAD flusher;
+    PLATFORM_MUTEX captureLock; // the capture writer
+    CAPTURE_WRITER capture;
+    TIME_US startTime;
+    volatile unsigned long ringWriter;  // RING_IDLE, RING_FLUSHER or RING_SIGNAL
+} COMM_LOG;
+
+#define RING_IDLE       0
+#define RING_FLUSHER    1       // flush_ring is writing the ring out
+#define RING_SIGNAL     2       // flush_on_signal has it, for good
+#define SIGNAL_WAIT_MS  1000    // for the flusher to finish its write before the process dies
+
+static COMM_LOG commLog;
+
+static const int flushSignals[] = { SIGINT, SIGTERM, SIGABRT, SIGSEGV };
+
+// all of it, unless the file cannot take it; safe in a signal handler
+static void write_all(const char *data, unsigned long count)
+{
+    long written;
+
+    while (count > 0)
+    {
+#ifdef _WIN32
+        written = _write(commLog.fd, data, (unsigned int)count);
+#else // _WIN32
+        written = (long)write(commLog.fd, data, count);
+        if (written < 0 && EINTR == errno)
+        {
+            continue;
+        }
+#endif // _WIN32
+        if (written <= 0)
+        {
+            return;
+        }
+        data += written;
+        count -= (unsigned long)written;
+    }
+}
+
+// write out what the ring holds in one or two blocks
+static void write_ring(unsigned long from, unsigned long to)
+{
+    unsigned long start = from % commLog.size;
+    unsigned long count = to - from;
+
+    if (start + count > commLog.size)
+    {
+        write_all(commLog.ring + start, commLog.size - start);
+        count -= commLog.size - start;
+        start = 0;
+    }
+    write_all(commLog.ring + start, count);
+}
+
+static void flush_ring(void)
+{
+    unsigned long head;
+
+    mutex_lock(&commLog.flushLock);
+    mutex_lock(&commLog.lock);
+    head = commLog.head;
+    mutex_unlock(&commLog.lock);
+    // writers only add past head, so the file write needs no lock; once a
+    // signal handler has the ring the process is going, and it writes it
+    if (head != commLog.tail && atomic_compare_swap(&commLog.ringWriter, RING_IDLE, RING_FLUSHER))
+    {
+        TRACE_BEGIN();
+        write_ring(commLog.tail, head);
+        TRACE_END("sink", "comm log write", NULL);
+        mutex_lock(&commLog.lock);
+        commLog.tail = head;
+        mutex_unlock(&commLog.lock);
+        atomic_store_release(&commLog.ringWriter, RING_IDLE);
+        event_signal(&commLog.space);
+    }
+    mutex_unlock(&commLog.flushLock);
+}
+
+static void ring_put(const char *text, unsigned long count)
+{
+    unsigned long start = commLog.head % commLog.size;
+
+    if (start + count > commLog.size)
+    {
+        memcpy(commLog.ring + start, text, commLog.size - start);
+        text += commLog.size - start;
+        count -= commLog.size - start;
+        commLog.head += commLog.size - start;
+        start = 0;
+    }
+    memcpy(commLog.ring + start, text, count);
+    commLog.head += count;
+}
+
+// called with lock held, returns FALSE if the log closed before there was room
+static int ring_wait_for_room(unsigned long count)
+{
+    // full: only a flusher falling behind makes the traffic wait
+    while (commLog.size - (commLog.head - commLog.tail) < count && !commLog.stop)
+    {
+        mutex_unlock(&commLog.lock);
+        event_signal(&commLog.wake);
+        (void)event_wait(&commLog.space, commLog.flushIntervalMs);
+        mutex_lock(&commLog.lock);
+    }
+    return (commLog.size - (commLog.head - commLog.tail) >= count) ? TRUE : FALSE;
+}
+
+// the capture writer's sink, blocks larger than half the ring go in pieces
+static void capture_sink(void *context, const unsigned char *data, unsigned long length)
+{
+    unsigned long count;
+    unsigned long used;
+
+    (void)context;
+    while (length > 0)
+    {
+        count = (length > commLog.size / 2) ? commLog.size / 2 : length;
+        mutex_lock(&commLog.lock);
+        if (ring_wait_for_room(count))
+        {
+            ring_put((const char *)data, count);
+        }
+        used = commLog.head - commLog.tail;
+        mutex_unlock(&commLog.lock);
+        if (used >= commLog.size / 2)
+        {
+            event_signal(&commLog.wake);
+        }
+        data += count;
+        length -= count;
+    }
+}
+
+// a capture block is only written when full, unless the flusher pushes it out
+static void push_capture_block(void)
+{
+    int room;
+
+    // a writer holding the lock may be waiting on the flusher for room,
+    // and its records go out with the next push anyway
+    if (!mutex_trylock(&commLog.captureLock))
+    {
+        return;
+    }
+    mutex_lock(&commLog.lock);
+    // the flusher must never wait on itself for room
+    room = (commLog.size - (commLog.head - commLog.tail) >= commLog.capture.blockLen) ? TRUE : FALSE;
+    mutex_unlock(&commLog.lock);
+    if (room)
+    {
+        capture_flush_block(&commLog.capture);
+    }
+    mutex_unlock(&commLog.captureLock);
+}
+
+static void flusher_thread(void *arg)
+{
+    (void)arg;
+    TRACE_THREAD_NAME("comm log flusher");
+    while (!commLog.stop)
+    {
+        (void)event_wait(&commLog.wake, commLog.flushIntervalMs);
+        flush_ring();
+        if (COMM_LOG_CAPTURE == commLog.format)
+        {
+            push_capture_block();
+            flush_ring();
+        }
+    }
+    flush_ring();
+}
+
+/*
+ * Killed by a signal: the locks may be held by the thread that was
+ * interrupted, so only what the ring holds is written, with write(2)
+ * and no locks, then the process dies as before.  A flusher part way
+ * through a write is given SIGNAL_WAIT_MS to finish it.  A capture ends
+ * at the last block in the ring, without the index.
+ */
+static void flush_on_signal(int sig)
+{
+    unsigned long waited;
+    int claimed = FALSE;
+
+    if (commLog.isOpen)
+    {
+        for (waited = 0; !claimed && waited <= SIGNAL_WAIT_MS; ++waited)
+        {
+            claimed = atomic_compare_swap(&commLog.ringWriter, RING_IDLE, RING_SIGNAL);
+            if (!claimed)
+            {
+                sleep_ms(1);
+            }
+        }
+        if (claimed && commLog.head != commLog.tail)
+        {
+            write_ring(commLog.tail, commLog.head);
+            commLog.tail = commLog.head;
+        }
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static int start_flusher(void)
+{
+    if (!event_init(&commLog.wake))
+    {
+        return FALSE;
+    }
+    if (!event_init(&commLog.space))
+    {
+        event_destroy(&commLog.wake);
+        return FALSE;
+    }
+    if (!thread_start(&commLog.flusher, flusher_thread, NULL))
+    {
+        event_destroy(&commLog.space);
+        event_destroy(&commLog.wake);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// ringSize and flushIntervalMs of 0 take the defaults
+// returns FALSE if the log could not be opened, logging is then off
+int comm_log_open(const char *fname, COMM_LOG_FORMAT format, unsigned long ringSize, unsigned long flushIntervalMs)
+{
+    static int exitHooked = FALSE;
+    unsigned int k;
+
+    comm_log_close();
+    memset(&commLog, 0, sizeof(commLog));
+    commLog.format = format;
+    commLog.size = ringSize ? ringSize : COMM_LOG_RING_SIZE;
+    commLog.flushIntervalMs = flushIntervalMs ? flushIntervalMs : COMM_LOG_FLUSH_MS;
+    commLog.ring = (char *)malloc(commLog.size);
+    // the ring is written with write(2), so nothing waits in the stream's buffer
+    commLog.file = fopen(fname, (COMM_LOG_CAPTURE == format) ? "wb" : "w");
+    if (commLog.file)
+    {
+#ifdef _WIN32
+        commLog.fd = _fileno(commLog.file);
+#else // _WIN32
+        commLog.fd = fileno(commLog.file);
+#endif // _WIN32
+    }
+    if (NULL == commLog.ring || NULL == commLog.file)
+    {
+        if (commLog.file)
+        {
+            fclose(commLog.file);
+        }
+        free(commLog.ring);
+        memset(&commLog, 0, sizeof(commLog));
+        return FALSE;
+    }
+    mutex_init(&commLog.lock);
+    mutex_init(&commLog.flushLock);
+    mutex_init(&commLog.captureLock);
+    if (!start_flusher())
+    {
+        mutex_destroy(&commLog.captureLock);
+        mutex_destroy(&commLog.flushLock);
+        mutex_destroy(&commLog.lock);
+        fclose(commLog.file);
+        free(commLog.ring);
+        memset(&commLog, 0, sizeof(commLog));
+        return FALSE;
+    }
+    commLog.isOpen = TRUE;
+
+    if (COMM_LOG_CAPTURE == format)
+    {
+        commLog.startTime = time_now_us();
+        mutex_lock(&commLog.captureLock);
+        k = capture_writer_init(&commLog.capture, capture_sink, NULL, (TIME_US)time(NULL) * 1000000, 0);
+        mutex_unlock(&commLog.captureLock);
+        if (!k)
+        {
+            comm_log_close();
+            return FALSE;
+        }
+    }
+
+    if (!exitHooked)
+    {
+        exitHooked = TRUE;
+        atexit(comm_log_close);
+        for (k = 0; k < sizeof(flushSignals) / sizeof(flushSignals[0]); ++k)
+        {
+            signal(flushSignals[k], flush_on_signal);
+        }
+    }
+    return TRUE;
+}
+
+// write out everything logged so far, before returning
+void comm_log_flush(void)
+{
+    if (commLog.isOpen)
+    {
+        if (COMM_LOG_CAPTURE == commLog.format)
+        {
+            mutex_lock(&commLog.captureLock);
+            capture_flush_block(&commLog.capture);
+            mutex_unlock(&commLog.captureLock);
+        }
+        flush_ring();
+    }
+}
+
+void comm_log_close(void)
+{
+    if (!commLog.isOpen)
+    {
+        return;
+    }
+    if (COMM_LOG_CAPTURE == commLog.format)
+    {
+        // the flusher is still running to make room for the index
+        mutex_lock(&commLog.captureLock);
+        capture_writer_finish(&commLog.capture);
+        mutex_unlock(&commLog.captureLock);
+    }
+    commLog.stop = TRUE;
+    event_signal(&commLog.wake);
+    thread_join(&commLog.flusher);
+    commLog.isOpen = FALSE;
+    fclose(commLog.file);
+    event_destroy(&commLog.space);
+    event_destroy(&commLog.wake);
+    mutex_destroy(&commLog.captureLock);
+    mutex_destroy(&commLog.flushLock);
+    mutex_destroy(&commLog.lock);
+    free(commLog.ring);
+    memset(&commLog, 0, sizeof(commLog));
+}
+
+// one "[marker]data[/marker]" line, as the log has always been written
+static void write_line(const char *marker, const char *data, unsigned long dataLen)
+{
+    unsigned long markerLen;
+    unsigned long lineLen;
+    unsigned long used;
+
+    markerLen = (unsigned long)strlen(marker);
+    // a line has to fit the ring with room to spare
+    if (2 * markerLen + 6 + dataLen > commLog.size / 2)
+    {
+        dataLen = (2 * markerLen + 6 < commLog.size / 2) ? commLog.size / 2 - 2 * markerLen - 6 : 0;
+    }
+    lineLen = 2 * markerLen + 6 + dataLen;
+
+    mutex_lock(&commLog.lock);
+    if (ring_wait_for_room(lineLen))
+    {
+        ring_put("[", 1);
+        ring_put(marker, markerLen);
+        ring_put("]", 1);
+        ring_put(data, dataLen);
+        ring_put("[/", 2);
+        ring_put(marker, markerLen);
+        ring_put("]\n", 2);
+    }
+    used = commLog.head - commLog.tail;
+    mutex_unlock(&commLog.lock);
+
+    if (used >= commLog.size / 2)
+    {
+        event_signal(&commLog.wake);
+    }
+}
+
+// when is a time_now_us() reading taken as the traffic happened
+void comm_log_record(int type, unsigned long port, const char *data, unsigned long length, TIME_US when)
+{
+    if (!commLog.isOpen)
+    {
+        return;
+    }
+    if (COMM_LOG_CAPTURE == commLog.format)
+    {
+        mutex_lock(&commLog.captureLock);
+        (void)capture_write(&commLog.capture, type, port,
+                            (when > commLog.startTime) ? when - commLog.startTime : 0, data, length);
+        mutex_unlock(&commLog.captureLock);
+    }
+    else if (CAPTURE_TX == type)
+    {
+        write_line("TX", data, length);
+    }
+    else if (CAPTURE_RX == type)
+    {
+        write_line("RX", data, length);
+    }
+    // the text log has no place for the prompt time, the '>' is in the RX line
+}
+
+// a note in the log, in a capture it becomes a "marker:data" mark record
+void write_comm_log(const char *marker, const char *data)
+{
+    char note[256];
+    unsigned long markerLen;
+    unsigned long dataLen;
+
+    if (!commLog.isOpen)
+    {
+        return;
+    }
+    if (COMM_LOG_CAPTURE != commLog.format)
+    {
+        write_line(marker, data, (unsigned long)strlen(data));
+        return;
+    }
+    markerLen = (unsigned long)strlen(marker);
+    dataLen = (unsigned long)strlen(data);
+    if (markerLen > sizeof(note) - 1)
+    {
+        markerLen = sizeof(note) - 1;
+    }
+    if (dataLen > sizeof(note) - 1 - markerLen)
+    {
+        dataLen = sizeof(note) - 1 - markerLen;
+    }
+    memcpy(note, marker, markerLen);
+    note[markerLen] = ':';
+    memcpy(note + markerLen + 1, data, dataLen);
+    comm_log_record(CAPTURE_MARK, 0, note, markerLen + 1 + dataLen, time_now_us());
+}
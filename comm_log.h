@@ -0,0 +1,43 @@
+#ifndef COMM_LOG_H
+#define COMM_LOG_H
+
+#include "platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define COMM_LOG_FILE_NAME      "comm_log.txt"
+#define COMM_LOG_CAPTURE_NAME   "comm_log.cap"
+#define COMM_LOG_RING_SIZE      (256 * 1024)    // bytes held before writers wait for the flush
+#define COMM_LOG_FLUSH_MS       250             // longest a line stays in memory
+
+typedef enum
+{
+    COMM_LOG_TEXT,          // "[TX]...[/TX]" lines
+    COMM_LOG_CAPTURE        // timestamped binary capture, see capture.h
+} COMM_LOG_FORMAT;
+
+/*
+ * The interface traffic log.  Lines go into an in-memory ring and a
+ * background thread writes them out in large blocks, every flush
+ * interval or as soon as the ring is half full.  What is left is written
+ * on comm_log_close and at exit.  When SIGINT, SIGTERM, SIGABRT or SIGSEGV
+ * kills the process, what the ring holds is written; a program that
+ * takes SIGINT over hands the signal back to the log's handler once it
+ * is done with it, as main.c does after its first Ctrl-C.
+ *
+ * comm_log_record takes the CAPTURE_RECORD_TYPE of the traffic and the
+ * time it happened; the text log keeps only the bytes.
+ */
+int comm_log_open(const char *fname, COMM_LOG_FORMAT format, unsigned long ringSize, unsigned long flushIntervalMs);
+void comm_log_flush(void);
+void comm_log_close(void);
+void comm_log_record(int type, unsigned long port, const char *data, unsigned long length, TIME_US when);
+void write_comm_log(const char *marker, const char *data);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* COMM_LOG_H */
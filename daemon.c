@@ -0,0 +1,1089 @@
+#define _GNU_SOURCE             // accept4, pipe2
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "globals.h"
+#include "daemon.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "platform.h"
+#include "output_buffer.h"
+#include "live_values.h"
+#include "libscantool.h"
+
+#define DAEMON_ITEMS        0x100       // the trouble codes, then the Mode 01 PIDs 01 to FF
+#define DAEMON_CODES        0           // the item of the trouble codes
+#define DAEMON_ANSWER_SIZE  256         // an answer to start with, the codes grow it
+
+// what the bus answered for one item, kept while it is fresh
+typedef struct _DAEMON_ITEM
+{
+    int queued;                 // asked of the adapter's thread, the answer is not in
+    int ok;                     // the last answer came from the vehicle
+    TIME_US answered;           // when it came, 0 for never
+    OUTPUT_BUFFER answer;       // its lines: the kind, a tab, the fields after the age
+    OUTPUT_BUFFER reading;      // the adapter's thread's while queued
+    int readOk;
+} DAEMON_ITEM;
+
+typedef struct _DAEMON_ADAPTER
+{
+    int number;                 // from 1, as the clients name it
+    const char *device;
+    SCANTOOL *tool;
+    PLATFORM_THREAD thread;
+    int running;
+    PLATFORM_MUTEX lock;        // the queue, the done list and the vehicle
+    PLATFORM_EVENT work;        // to the thread: an item is queued, or stop
+    volatile unsigned long stopping;
+    int queue[DAEMON_ITEMS];    // a ring; an item is in it once at most
+    int queueHead;
+    int queueCount;
+    int done[DAEMON_ITEMS];     // read, for the event loop
+    int doneCount;
+    int ready;                  // -1 while connecting
+    char vin[64];
+    char modelYear[8];
+    int current;                // the thread's: the item being read, -1 while connecting
+    int wakeFd;                 // the event loop's pipe, a byte per answer
+    DAEMON_ITEM items[DAEMON_ITEMS];
+} DAEMON_ADAPTER;
+
+typedef struct _DAEMON_STREAM
+{
+    int item;
+    TIME_US period;
+    TIME_US next;
+    int waiting;                // the bus was asked, the answer is not in
+} DAEMON_STREAM;
+
+typedef struct _DAEMON_CLIENT
+{
+    int fd;                     // -1 for a free slot
+    int adapter;                // index of the adapter of the request under way, -1 for none
+    int waiting;                // items the request still waits for
+    int itemCount;
+    int items[DAEMON_ITEMS];    // of the request, in the order asked
+    unsigned char pending[DAEMON_ITEMS];
+    int streamCount;            // the request is a stream
+    DAEMON_STREAM streams[DAEMON_STREAMS_MAX];
+    char in[DAEMON_LINE_SIZE * 4];  // lines sent ahead wait here for the request under way
+    unsigned long inLen;
+    OUTPUT_BUFFER out;
+    unsigned long sent;
+    int writing;                // EPOLLOUT is on
+} DAEMON_CLIENT;
+
+typedef struct _DAEMON
+{
+    DAEMON_ADAPTER *adapters;
+    int adapterCount;
+    DAEMON_CLIENT *clients;
+    int epfd;
+    int listenFd;
+    int wake[2];                // the adapters' threads to the event loop
+    TIME_US fresh;
+    CANCEL_TOKEN stop;          // Ctrl-C or SIGTERM, its pipe is in the epoll set
+    unsigned long requests;     // lines the clients sent
+    unsigned long reads;        // items read from the bus
+    unsigned long remembered;   // items answered from memory
+    unsigned long joined;       // items asked for while already on their way
+} DAEMON;
+
+static CANCEL_TOKEN *interrupted;
+
+static void on_interrupt(int sig)
+{
+    signal(sig, SIG_DFL);
+    if (interrupted)
+    {
+        cancel_request(interrupted);
+    }
+}
+
+// the callbacks run on the adapter's thread, into the answer being read
+
+static void on_vehicle(void *context, const char *vin, const char *modelYear)
+{
+    DAEMON_ADAPTER *adapter = (DAEMON_ADAPTER *)context;
+
+    mutex_lock(&adapter->lock);
+    StringCchPrintf(adapter->vin, sizeof(adapter->vin), "%s", vin);
+    StringCchPrintf(adapter->modelYear, sizeof(adapter->modelYear), "%s", modelYear);
+    mutex_unlock(&adapter->lock);
+}
+
+static void on_value(void *context, int pid, const char *label, const char *value)
+{
+    DAEMON_ADAPTER *adapter = (DAEMON_ADAPTER *)context;
+    OUTPUT_BUFFER *reading;
+    char line[160];
+
+    // the codes read PID 01 for the MIL, which their answer has
+    if (adapter->current <= DAEMON_CODES)
+    {
+        return;
+    }
+    // a PID the sensors table shows twice comes twice
+    reading = &adapter->items[adapter->current].reading;
+    StringCchPrintf(line, sizeof(line), "value\t%02X\t%s\t%s\n", pid, label, value);
+    if (NULL == reading->buf || NULL == strstr(reading->buf, line))
+    {
+        outbuf_append(reading, line);
+    }
+}
+
+static void on_ecu(void *context, int ecu, int stored, int pending, int permanent)
+{
+    DAEMON_ADAPTER *adapter = (DAEMON_ADAPTER *)context;
+
+    outbuf_printf(&adapter->items[DAEMON_CODES].reading, "ecu\t%d\t%d\t%d\t%d\n", ecu, stored, pending, permanent);
+}
+
+static void on_trouble_code(void *context, const char *code, const char *description, int kinds, int ecus)
+{
+    DAEMON_ADAPTER *adapter = (DAEMON_ADAPTER *)context;
+    char names[32];
+
+    StringCchPrintf(names, sizeof(names), "%s%s%s%s%s",
+                    (kinds & SCANTOOL_CODE_STORED) ? "stored" : "",
+                    (kinds & SCANTOOL_CODE_STORED) && (kinds & ~SCANTOOL_CODE_STORED) ? "," : "",
+                    (kinds & SCANTOOL_CODE_PENDING) ? "pending" : "",
+                    (kinds & SCANTOOL_CODE_PENDING) && (kinds & SCANTOOL_CODE_PERMANENT) ? "," : "",
+                    (kinds & SCANTOOL_CODE_PERMANENT) ? "permanent" : "");
+    outbuf_printf(&adapter->items[DAEMON_CODES].reading, "code\t%s\t%s\t%d\t%s\n",
+                  code, names, ecus, description ? description : "");
+}
+
+static void on_message(void *context, const char *text)
+{
+    DAEMON_ADAPTER *adapter = (DAEMON_ADAPTER *)context;
+    int length = (int)strcspn(text, "\r\n");
+
+    if (adapter->current < 0)
+    {
+        fprintf(stderr, "%s: %.*s\n", adapter->device, length, text);
+    }
+    else
+    {
+        outbuf_printf(&adapter->items[adapter->current].reading, "note\t%.*s\n", length, text);
+    }
+}
+
+static void adapter_ready(DAEMON_ADAPTER *adapter, int ready)
+{
+    mutex_lock(&adapter->lock);
+    adapter->ready = ready;
+    mutex_unlock(&adapter->lock);
+}
+
+/*
+ * The adapter's thread: connect once, then read the items the event loop
+ * queues, one at a time, and hand each answer back through the done list.
+ * A read of an adapter that is not ready tries to connect again.
+ */
+static void adapter_thread(void *arg)
+{
+    DAEMON_ADAPTER *adapter = (DAEMON_ADAPTER *)arg;
+    SCANTOOL_SUMMARY summary;
+    DAEMON_ITEM *item;
+    int next;
+    int pid;
+    int rc;
+
+    adapter->current = -1;
+    rc = scantool_connect(adapter->tool);
+    adapter_ready(adapter, SCANTOOL_OK == rc);
+    while (!atomic_load_acquire(&adapter->stopping))
+    {
+        next = -1;
+        mutex_lock(&adapter->lock);
+        if (adapter->queueCount)
+        {
+            next = adapter->queue[adapter->queueHead];
+            adapter->queueHead = (adapter->queueHead + 1) % DAEMON_ITEMS;
+            --adapter->queueCount;
+        }
+        mutex_unlock(&adapter->lock);
+        if (next < 0)
+        {
+            (void)event_wait(&adapter->work, WAIT_FOREVER);
+            continue;
+        }
+
+        item = &adapter->items[next];
+        adapter->current = next;
+        outbuf_reset(&item->reading);
+        if (DAEMON_CODES == next)
+        {
+            rc = scantool_read_codes(adapter->tool, 0, &summary);
+            if (SCANTOOL_OK == rc)
+            {
+                outbuf_printf(&item->reading, "mil\t%s\n", summary.milOn ? "on" : "off");
+            }
+        }
+        else
+        {
+            pid = next;
+            rc = scantool_read_values(adapter->tool, &pid, 1, 0, &summary);
+            if (SCANTOOL_OK == rc && 0 == summary.samples)
+            {
+                outbuf_printf(&item->reading, "none\t%02X\n", pid);
+            }
+        }
+        adapter->current = -1;
+
+        mutex_lock(&adapter->lock);
+        item->readOk = (SCANTOOL_OK == rc) ? TRUE : FALSE;
+        adapter->done[adapter->doneCount++] = next;
+        adapter->ready = (SCANTOOL_ERROR != rc) ? TRUE : FALSE;
+        mutex_unlock(&adapter->lock);
+        if (write(adapter->wakeFd, "", 1) < 0)
+        {
+            // the pipe is full, the loop is already awake
+        }
+    }
+}
+
+static void client_close(DAEMON *daemon, DAEMON_CLIENT *client)
+{
+    epoll_ctl(daemon->epfd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+    outbuf_free(&client->out);
+    // the items it asked for are still read, for whoever asks next
+}
+
+// as much of the answers as the socket takes; a client that falls too far behind is dropped
+static void client_flush(DAEMON *daemon, DAEMON_CLIENT *client)
+{
+    struct epoll_event ev;
+    ssize_t written;
+    int writing;
+
+    while (client->sent < client->out.len)
+    {
+        written = send(client->fd, client->out.buf + client->sent, client->out.len - client->sent, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if (EAGAIN != errno && EWOULDBLOCK != errno)
+            {
+                client_close(daemon, client);
+                return;
+            }
+            break;
+        }
+        client->sent += (unsigned long)written;
+    }
+    if (client->sent == client->out.len)
+    {
+        outbuf_reset(&client->out);
+        client->sent = 0;
+    }
+    else if (client->out.len - client->sent > DAEMON_OUTPUT_MAX || client->out.overflow)
+    {
+        client_close(daemon, client);
+        return;
+    }
+    writing = (client->sent < client->out.len) ? TRUE : FALSE;
+    if (writing != client->writing)
+    {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | (writing ? EPOLLOUT : 0);
+        ev.data.ptr = client;
+        epoll_ctl(daemon->epfd, EPOLL_CTL_MOD, client->fd, &ev);
+        client->writing = writing;
+    }
+}
+
+// the answer lines of an item, with the adapter and the age put in after the kind
+static void client_answer(DAEMON_CLIENT *client, const DAEMON_ADAPTER *adapter, const DAEMON_ITEM *item, TIME_US now)
+{
+    unsigned long age = (unsigned long)((now - item->answered) / 1000);
+    const char *line = item->answer.buf;
+    const char *end;
+    int kind;
+
+    while (line && *line)
+    {
+        end = strchr(line, '\n');
+        if (NULL == end)
+        {
+            end = line + strlen(line);
+        }
+        kind = (int)strcspn(line, "\t");
+        if (line + kind < end)
+        {
+            outbuf_printf(&client->out, "%.*s\t%d\t%lu\t%.*s\n", kind, line, adapter->number, age,
+                          (int)(end - line - kind - 1), line + kind + 1);
+        }
+        line = *end ? end + 1 : end;
+    }
+}
+
+// TRUE if the item's answer is at most maxAge old; otherwise it is read, once however many ask
+static int ask_item(DAEMON *daemon, DAEMON_ADAPTER *adapter, int index, TIME_US maxAge)
+{
+    DAEMON_ITEM *item = &adapter->items[index];
+    TIME_US now = time_now_us();
+
+    if (item->ok && item->answered && now - item->answered <= maxAge)
+    {
+        ++daemon->remembered;
+        return TRUE;
+    }
+    if (item->queued)
+    {
+        ++daemon->joined;
+        return FALSE;
+    }
+    item->queued = TRUE;
+    ++daemon->reads;
+    mutex_lock(&adapter->lock);
+    adapter->queue[(adapter->queueHead + adapter->queueCount) % DAEMON_ITEMS] = index;
+    ++adapter->queueCount;
+    mutex_unlock(&adapter->lock);
+    event_signal(&adapter->work);
+    return FALSE;
+}
+
+// every item of the request is in, answer it
+static void client_reply(DAEMON *daemon, DAEMON_CLIENT *client)
+{
+    DAEMON_ADAPTER *adapter = &daemon->adapters[client->adapter];
+    TIME_US now = time_now_us();
+    int k;
+
+    for (k = 0; k < client->itemCount; ++k)
+    {
+        if (!adapter->items[client->items[k]].ok)
+        {
+            break;
+        }
+    }
+    if (k < client->itemCount)
+    {
+        outbuf_printf(&client->out, "error\tadapter %d is not ready\n", adapter->number);
+    }
+    else
+    {
+        for (k = 0; k < client->itemCount; ++k)
+        {
+            client_answer(client, adapter, &adapter->items[client->items[k]], now);
+        }
+        outbuf_append(&client->out, "ok\n");
+    }
+    client->adapter = -1;
+    client->itemCount = 0;
+}
+
+static TIME_US stream_max_age(DAEMON *daemon, const DAEMON_STREAM *stream)
+{
+    return (stream->period < daemon->fresh) ? stream->period : daemon->fresh;
+}
+
+// an answer for the stream went out, the next is due a period later
+static void stream_sent(DAEMON_STREAM *stream, TIME_US now)
+{
+    stream->waiting = FALSE;
+    stream->next += stream->period;
+    if (stream->next <= now)
+    {
+        // the bus could not keep up, keep the period from here
+        stream->next = now + stream->period;
+    }
+}
+
+// the streams that are due
+static void client_streams(DAEMON *daemon, DAEMON_CLIENT *client)
+{
+    DAEMON_ADAPTER *adapter = &daemon->adapters[client->adapter];
+    DAEMON_STREAM *stream;
+    TIME_US now = time_now_us();
+    int k;
+
+    for (k = 0; k < client->streamCount; ++k)
+    {
+        stream = &client->streams[k];
+        if (stream->waiting || stream->next > now)
+        {
+            continue;
+        }
+        if (ask_item(daemon, adapter, stream->item, stream_max_age(daemon, stream)))
+        {
+            client_answer(client, adapter, &adapter->items[stream->item], now);
+            stream_sent(stream, now);
+        }
+        else
+        {
+            stream->waiting = TRUE;
+        }
+    }
+}
+
+static void stream_end(DAEMON_CLIENT *client)
+{
+    client->streamCount = 0;
+    client->adapter = -1;
+}
+
+// an item came in: answer the requests and streams waiting for it
+static void item_answered(DAEMON *daemon, int adapterIndex, int index, TIME_US now)
+{
+    DAEMON_ADAPTER *adapter = &daemon->adapters[adapterIndex];
+    DAEMON_CLIENT *client;
+    int k;
+    int s;
+
+    for (k = 0; k < DAEMON_CLIENTS_MAX; ++k)
+    {
+        client = &daemon->clients[k];
+        if (client->fd < 0 || client->adapter != adapterIndex)
+        {
+            continue;
+        }
+        for (s = 0; s < client->streamCount; ++s)
+        {
+            if (client->streams[s].waiting && index == client->streams[s].item)
+            {
+                if (!adapter->items[index].ok)
+                {
+                    outbuf_printf(&client->out, "error\tadapter %d is not ready\n", adapter->number);
+                    stream_end(client);
+                    break;
+                }
+                client_answer(client, adapter, &adapter->items[index], now);
+                stream_sent(&client->streams[s], now);
+            }
+        }
+        if (client->pending[index])
+        {
+            client->pending[index] = FALSE;
+            if (0 == --client->waiting)
+            {
+                client_reply(daemon, client);
+            }
+        }
+    }
+}
+
+static void client_lines(DAEMON *daemon, DAEMON_CLIENT *client);
+
+// the answers the adapters' threads have handed back
+static void adapters_answered(DAEMON *daemon)
+{
+    DAEMON_ADAPTER *adapter;
+    DAEMON_ITEM *item;
+    OUTPUT_BUFFER swap;
+    int done[DAEMON_ITEMS];
+    int count;
+    int a;
+    int k;
+    TIME_US now = time_now_us();
+    char drain[64];
+
+    while (read(daemon->wake[0], drain, sizeof(drain)) > 0)
+    {
+    }
+    for (a = 0; a < daemon->adapterCount; ++a)
+    {
+        adapter = &daemon->adapters[a];
+        mutex_lock(&adapter->lock);
+        count = adapter->doneCount;
+        memcpy(done, adapter->done, count * sizeof(done[0]));
+        adapter->doneCount = 0;
+        for (k = 0; k < count; ++k)
+        {
+            item = &adapter->items[done[k]];
+            swap = item->answer;
+            item->answer = item->reading;
+            item->reading = swap;
+            item->ok = item->readOk;
+            item->answered = now;
+            item->queued = FALSE;
+        }
+        mutex_unlock(&adapter->lock);
+        for (k = 0; k < count; ++k)
+        {
+            item_answered(daemon, a, done[k], now);
+        }
+    }
+    for (k = 0; k < DAEMON_CLIENTS_MAX; ++k)
+    {
+        if (daemon->clients[k].fd >= 0)
+        {
+            // a request that was answered lets the next line in
+            client_lines(daemon, &daemon->clients[k]);
+        }
+    }
+}
+
+// the next word of a request, NULL at the end
+static char *next_word(char **cursor)
+{
+    char *word = *cursor;
+    char *end;
+
+    word += strspn(word, " \t");
+    if ('\0' == *word)
+    {
+        return NULL;
+    }
+    end = word + strcspn(word, " \t");
+    *cursor = *end ? end + 1 : end;
+    *end = '\0';
+    return word;
+}
+
+// a Mode 01 PID in hex, 0 if it is not one
+static int parse_pid(const char *word)
+{
+    char *end;
+    long pid = strtol(word, &end, 16);
+
+    return (end != word && ('\0' == *end || '@' == *end) && pid > 0 && pid < DAEMON_ITEMS) ? (int)pid : 0;
+}
+
+static void client_error(DAEMON_CLIENT *client, const char *text)
+{
+    outbuf_printf(&client->out, "error\t%s\n", text);
+}
+
+static void list_adapters(DAEMON *daemon, DAEMON_CLIENT *client)
+{
+    DAEMON_ADAPTER *adapter;
+    int k;
+
+    for (k = 0; k < daemon->adapterCount; ++k)
+    {
+        adapter = &daemon->adapters[k];
+        mutex_lock(&adapter->lock);
+        outbuf_printf(&client->out, "adapter\t%d\t0\t%s\t%s\t%s\t%s\n", adapter->number,
+                      (adapter->ready < 0) ? "connecting" : adapter->ready ? "ready" : "down", adapter->device, adapter->vin, adapter->modelYear);
+        mutex_unlock(&adapter->lock);
+    }
+    outbuf_append(&client->out, "ok\n");
+}
+
+// one line from a client
+static void client_request(DAEMON *daemon, DAEMON_CLIENT *client, char *line)
+{
+    DAEMON_ADAPTER *adapter;
+    DAEMON_STREAM *stream;
+    char *cursor = line;
+    char *command = next_word(&cursor);
+    char *word;
+    const char *at;
+    unsigned long ms;
+    int codes;
+    int streaming;
+    int number;
+    int pid;
+    int k;
+
+    if (NULL == command)
+    {
+        return;
+    }
+    ++daemon->requests;
+    if (0 == strcmp(command, "stop"))
+    {
+        if (client->streamCount)
+        {
+            stream_end(client);
+            outbuf_append(&client->out, "ok\n");
+        }
+        else
+        {
+            client_error(client, "nothing to stop");
+        }
+        return;
+    }
+    if (client->streamCount)
+    {
+        client_error(client, "streaming, stop first");
+        return;
+    }
+    if (0 == strcmp(command, "adapters"))
+    {
+        list_adapters(daemon, client);
+        return;
+    }
+    codes = (0 == strcmp(command, "codes")) ? TRUE : FALSE;
+    streaming = (0 == strcmp(command, "stream")) ? TRUE : FALSE;
+    if (!codes && !streaming && strcmp(command, "snapshot"))
+    {
+        client_error(client, "unknown request, send adapters, codes, snapshot, stream or stop");
+        return;
+    }
+    word = next_word(&cursor);
+    number = word ? atoi(word) : 0;
+    if (number < 1 || number > daemon->adapterCount)
+    {
+        client_error(client, "no such adapter");
+        return;
+    }
+    adapter = &daemon->adapters[number - 1];
+
+    client->itemCount = 0;
+    if (codes)
+    {
+        client->items[client->itemCount++] = DAEMON_CODES;
+    }
+    while (!codes && NULL != (word = next_word(&cursor)))
+    {
+        pid = parse_pid(word);
+        at = strchr(word, '@');
+        ms = at ? strtoul(at + 1, NULL, 10) : 0;
+        if (0 == pid || (streaming && 0 == ms) || (!streaming && at) ||
+            client->itemCount >= (streaming ? DAEMON_STREAMS_MAX : DAEMON_ITEMS))
+        {
+            client->itemCount = 0;
+            client_error(client, streaming ? "expected PID@ms, the PID in hex" : "expected PIDs in hex");
+            return;
+        }
+        if (streaming)
+        {
+            stream = &client->streams[client->itemCount];
+            stream->item = pid;
+            stream->period = (TIME_US)ms * 1000;
+            stream->next = time_now_us();
+            stream->waiting = FALSE;
+        }
+        client->items[client->itemCount++] = pid;
+    }
+    if (0 == client->itemCount)
+    {
+        client_error(client, "expected PIDs");
+        return;
+    }
+
+    client->adapter = number - 1;
+    if (streaming)
+    {
+        client->streamCount = client->itemCount;
+        client->itemCount = 0;
+        client_streams(daemon, client);
+        return;
+    }
+    client->waiting = 0;
+    for (k = 0; k < client->itemCount; ++k)
+    {
+        if (!client->pending[client->items[k]] &&
+            !ask_item(daemon, adapter, client->items[k], daemon->fresh))
+        {
+            client->pending[client->items[k]] = TRUE;
+            ++client->waiting;
+        }
+    }
+    if (0 == client->waiting)
+    {
+        client_reply(daemon, client);
+    }
+}
+
+// the complete lines while no request is under way; a stream only takes stop
+static void client_lines(DAEMON *daemon, DAEMON_CLIENT *client)
+{
+    char line[DAEMON_LINE_SIZE];
+    char *end;
+    unsigned long length;
+
+    while (client->fd >= 0 &&
+           (client->adapter < 0 || client->streamCount) &&
+           NULL != (end = (char *)memchr(client->in, '\n', client->inLen)))
+    {
+        length = (unsigned long)(end - client->in);
+        memcpy(line, client->in, length);
+        line[length] = '\0';
+        if (length && '\r' == line[length - 1])
+        {
+            line[length - 1] = '\0';
+        }
+        client->inLen -= length + 1;
+        memmove(client->in, end + 1, client->inLen);
+        client_request(daemon, client, line);
+    }
+    if (client->fd >= 0)
+    {
+        client_flush(daemon, client);
+    }
+}
+
+static void client_readable(DAEMON *daemon, DAEMON_CLIENT *client)
+{
+    ssize_t got;
+
+    if (sizeof(client->in) == client->inLen)
+    {
+        // a line too long, or too many sent ahead
+        client_error(client, "too much sent at once");
+        client_flush(daemon, client);
+        if (client->fd >= 0)
+        {
+            client_close(daemon, client);
+        }
+        return;
+    }
+    got = recv(client->fd, client->in + client->inLen, sizeof(client->in) - client->inLen, 0);
+    if (got < 0 && (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno))
+    {
+        return;
+    }
+    if (got <= 0)
+    {
+        client_close(daemon, client);
+        return;
+    }
+    client->inLen += (unsigned long)got;
+    client_lines(daemon, client);
+}
+
+static void client_accept(DAEMON *daemon)
+{
+    DAEMON_CLIENT *client = NULL;
+    struct epoll_event ev;
+    int fd;
+    int k;
+
+    while ((fd = accept4(daemon->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        for (k = 0; k < DAEMON_CLIENTS_MAX && NULL == client; ++k)
+        {
+            client = (daemon->clients[k].fd < 0) ? &daemon->clients[k] : NULL;
+        }
+        if (NULL == client)
+        {
+            // as many clients as it serves are connected
+            close(fd);
+            continue;
+        }
+        memset(client, 0, sizeof(*client));
+        client->adapter = -1;
+        if (!outbuf_init_dynamic(&client->out, OUTPUT_GROW_DEFAULT, 0))
+        {
+            close(fd);
+            client->fd = -1;
+            client = NULL;
+            continue;
+        }
+        client->fd = fd;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = client;
+        epoll_ctl(daemon->epfd, EPOLL_CTL_ADD, fd, &ev);
+        client = NULL;
+    }
+}
+
+static int adapter_start(DAEMON *daemon, DAEMON_ADAPTER *adapter, int baudRate)
+{
+    SCANTOOL_TRANSPORT transport;
+    SCANTOOL_CALLBACKS callbacks;
+    int k;
+
+    mutex_init(&adapter->lock);
+    if (!event_init(&adapter->work))
+    {
+        return FALSE;
+    }
+    for (k = 0; k < DAEMON_ITEMS; ++k)
+    {
+        if (!outbuf_init_dynamic(&adapter->items[k].answer, DAEMON_ANSWER_SIZE, 0) ||
+            !outbuf_init_dynamic(&adapter->items[k].reading, DAEMON_ANSWER_SIZE, 0))
+        {
+            return FALSE;
+        }
+    }
+    adapter->wakeFd = daemon->wake[1];
+    adapter->ready = -1;
+
+    memset(&transport, 0, sizeof(transport));
+    transport.kind = SCANTOOL_SERIAL;
+    transport.device = adapter->device;
+    transport.baudRate = baudRate;
+    transport.adapter = adapter->number - 1;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.vehicle = on_vehicle;
+    callbacks.value = on_value;
+    callbacks.ecu = on_ecu;
+    callbacks.trouble_code = on_trouble_code;
+    callbacks.message = on_message;
+    callbacks.context = adapter;
+    adapter->tool = scantool_open(&transport, &callbacks);
+    if (NULL == adapter->tool)
+    {
+        return FALSE;
+    }
+    adapter->running = thread_start(&adapter->thread, adapter_thread, adapter);
+    return adapter->running;
+}
+
+static void adapter_stop(DAEMON_ADAPTER *adapter)
+{
+    int k;
+
+    if (adapter->running)
+    {
+        atomic_store_release(&adapter->stopping, TRUE);
+        scantool_cancel(adapter->tool);
+        event_signal(&adapter->work);
+        thread_join(&adapter->thread);
+    }
+    scantool_close(adapter->tool);
+    for (k = 0; k < DAEMON_ITEMS; ++k)
+    {
+        outbuf_free(&adapter->items[k].answer);
+        outbuf_free(&adapter->items[k].reading);
+    }
+    event_destroy(&adapter->work);
+    mutex_destroy(&adapter->lock);
+}
+
+static int daemon_listen(DAEMON *daemon, const char *path)
+{
+    struct sockaddr_un address;
+    struct epoll_event ev;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        return FALSE;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    StringCchPrintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    daemon->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (daemon->listenFd < 0)
+    {
+        return FALSE;
+    }
+    // a socket left by a daemon that did not stop cleanly
+    unlink(path);
+    if (bind(daemon->listenFd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(daemon->listenFd, DAEMON_CLIENTS_MAX) < 0)
+    {
+        return FALSE;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &daemon->listenFd;
+    epoll_ctl(daemon->epfd, EPOLL_CTL_ADD, daemon->listenFd, &ev);
+    return TRUE;
+}
+
+int daemon_main(int argc, char *argv[])
+{
+    DAEMON daemon;
+    DAEMON_CLIENT *client;
+    struct epoll_event events[DAEMON_CLIENTS_MAX + 3];
+    struct epoll_event ev;
+    const char *path = DAEMON_SOCKET;
+    const char *publishName = NULL;
+    int publish = FALSE;
+    unsigned long freshMs = DAEMON_FRESH_MS;
+    int baudRate = 9600;
+    int started = 0;
+    int failed = FALSE;
+    int index;
+    int ready;
+    int timeout;
+    int k;
+    int s;
+    TIME_US now;
+    TIME_US next;
+
+    memset(&daemon, 0, sizeof(daemon));
+    daemon.listenFd = -1;
+    daemon.wake[0] = daemon.wake[1] = -1;
+    daemon.adapters = (DAEMON_ADAPTER *)calloc(DAEMON_ADAPTERS_MAX, sizeof(DAEMON_ADAPTER));
+    daemon.clients = (DAEMON_CLIENT *)calloc(DAEMON_CLIENTS_MAX, sizeof(DAEMON_CLIENT));
+    for (index = 0; index < argc; ++index)
+    {
+        if (0 == strcmp(argv[index], "-b") && index + 1 < argc)
+        {
+            baudRate = atoi(argv[++index]);
+        }
+        else if (0 == strcmp(argv[index], "-s") && index + 1 < argc)
+        {
+            path = argv[++index];
+        }
+        else if (0 == strcmp(argv[index], "-f") && index + 1 < argc)
+        {
+            freshMs = strtoul(argv[++index], NULL, 10);
+        }
+        else if (0 == strncmp(argv[index], "--publish", 9))
+        {
+            publish = TRUE;
+            publishName = ('=' == argv[index][9]) ? argv[index] + 10 : NULL;
+        }
+        else if (daemon.adapters && daemon.adapterCount < DAEMON_ADAPTERS_MAX)
+        {
+            daemon.adapters[daemon.adapterCount].number = daemon.adapterCount + 1;
+            daemon.adapters[daemon.adapterCount++].device = argv[index];
+        }
+    }
+    if (0 == daemon.adapterCount)
+    {
+        fprintf(stderr, "Usage: ScanTool --daemon [-b baud] [-s socket] [-f ms] [--publish[=name]] device ...\n");
+        free(daemon.adapters);
+        free(daemon.clients);
+        return 1;
+    }
+    daemon.fresh = (TIME_US)freshMs * 1000;
+    daemon.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (NULL == daemon.clients || daemon.epfd < 0 ||
+        pipe2(daemon.wake, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        fprintf(stderr, "Error: unable to set up the event loop\n");
+        failed = TRUE;
+    }
+    for (k = 0; k < DAEMON_CLIENTS_MAX && !failed; ++k)
+    {
+        daemon.clients[k].fd = -1;
+    }
+    if (!failed && !daemon_listen(&daemon, path))
+    {
+        fprintf(stderr, "Error: unable to listen on %s\n", path);
+        failed = TRUE;
+    }
+    if (!failed && publish && !live_publish_open(publishName))
+    {
+        fprintf(stderr, "Error: unable to publish the values in shared memory\n");
+        failed = TRUE;
+    }
+    // the adapters connect on their threads while the first clients come in
+    for (started = 0; !failed && started < daemon.adapterCount; ++started)
+    {
+        if (!adapter_start(&daemon, &daemon.adapters[started], baudRate))
+        {
+            fprintf(stderr, "Error: unable to start %s\n", daemon.adapters[started].device);
+            failed = TRUE;
+        }
+    }
+
+    if (!failed)
+    {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = daemon.wake;
+        epoll_ctl(daemon.epfd, EPOLL_CTL_ADD, daemon.wake[0], &ev);
+        cancel_init(&daemon.stop);
+        if (daemon.stop.wake[0] >= 0)
+        {
+            ev.data.ptr = NULL;
+            epoll_ctl(daemon.epfd, EPOLL_CTL_ADD, daemon.stop.wake[0], &ev);
+        }
+        interrupted = &daemon.stop;
+        signal(SIGINT, on_interrupt);
+        signal(SIGTERM, on_interrupt);
+        printf("Daemon: %d adapters on %s, answers kept %lu ms\n", daemon.adapterCount, path, freshMs);
+        fflush(stdout);
+
+        while (!cancel_requested(&daemon.stop))
+        {
+            // sleep until something comes in or the next stream is due
+            now = time_now_us();
+            next = 0;
+            for (k = 0; k < DAEMON_CLIENTS_MAX; ++k)
+            {
+                client = &daemon.clients[k];
+                for (s = 0; client->fd >= 0 && s < client->streamCount; ++s)
+                {
+                    if (!client->streams[s].waiting && (0 == next || client->streams[s].next < next))
+                    {
+                        next = client->streams[s].next;
+                    }
+                }
+            }
+            timeout = (0 == next) ? -1 : (next > now) ? (int)((next - now + 999) / 1000) : 0;
+            ready = epoll_wait(daemon.epfd, events, DAEMON_CLIENTS_MAX + 3, timeout);
+            if (cancel_requested(&daemon.stop))
+            {
+                break;
+            }
+            for (k = 0; k < ready; ++k)
+            {
+                if (&daemon.listenFd == events[k].data.ptr)
+                {
+                    client_accept(&daemon);
+                }
+                else if (daemon.wake == events[k].data.ptr)
+                {
+                    adapters_answered(&daemon);
+                }
+                else if (events[k].data.ptr)
+                {
+                    client = (DAEMON_CLIENT *)events[k].data.ptr;
+                    if (client->fd >= 0 && (events[k].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                    {
+                        client_readable(&daemon, client);
+                    }
+                    if (client->fd >= 0 && (events[k].events & EPOLLOUT))
+                    {
+                        client_flush(&daemon, client);
+                    }
+                }
+            }
+            for (k = 0; k < DAEMON_CLIENTS_MAX; ++k)
+            {
+                client = &daemon.clients[k];
+                if (client->fd >= 0 && client->streamCount)
+                {
+                    client_streams(&daemon, client);
+                    client_flush(&daemon, client);
+                }
+            }
+        }
+
+        printf("Daemon: %lu requests, %lu bus reads, %lu answered from memory, %lu joined a read under way\n",
+               daemon.requests, daemon.reads, daemon.remembered, daemon.joined);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        interrupted = NULL;
+        cancel_destroy(&daemon.stop);
+    }
+
+    for (k = 0; daemon.clients && k < DAEMON_CLIENTS_MAX; ++k)
+    {
+        if (daemon.clients[k].fd >= 0)
+        {
+            client_close(&daemon, &daemon.clients[k]);
+        }
+    }
+    for (k = 0; k < started; ++k)
+    {
+        adapter_stop(&daemon.adapters[k]);
+    }
+    live_publish_close();
+    if (daemon.listenFd >= 0)
+    {
+        close(daemon.listenFd);
+        unlink(path);
+    }
+    if (daemon.wake[0] >= 0)
+    {
+        close(daemon.wake[0]);
+        close(daemon.wake[1]);
+    }
+    if (daemon.epfd >= 0)
+    {
+        close(daemon.epfd);
+    }
+    free(daemon.adapters);
+    free(daemon.clients);
+    return failed ? 1 : 0;
+}
+
+#endif // __linux__
@@ -0,0 +1,49 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DAEMON_SOCKET       "/tmp/scantool.sock"
+#define DAEMON_FRESH_MS     500         // an answer younger than this is given again, not read again
+#define DAEMON_ADAPTERS_MAX 16
+#define DAEMON_CLIENTS_MAX  64
+#define DAEMON_STREAMS_MAX  16          // PIDs one client streams at once
+#define DAEMON_LINE_SIZE    512         // a request
+#define DAEMON_OUTPUT_MAX   (1024 * 1024)   // unsent answers before a client is dropped
+
+/*
+ * Keep adapters open and answer for them over a Unix domain socket:
+ *
+ *    ScanTool --daemon [-b baud] [-s socket] [-f ms] [--publish[=name]] device ...
+ *
+ * Each adapter is set up and its VIN read once, at start, on a thread of
+ * its own that then reads what clients ask for, one request at a time.
+ * A client connects to the socket (DAEMON_SOCKET unless -s) and sends
+ * lines; adapters are numbered from 1 in the order given:
+ *
+ *    adapters                      each adapter, its state and VIN
+ *    codes N                       the MIL and the trouble codes
+ *    snapshot N PID ...            the current values of the PIDs, in hex
+ *    stream N PID@ms ...           the values again every ms until stop
+ *    stop                          ends a stream
+ *
+ * Each answer is lines of tab separated fields, the kind, the adapter and
+ * the age of the answer in ms first, ending with "ok", or one "error"
+ * line.  The bus is asked once for a PID, or for the codes, however many
+ * clients want it at the time, and an answer younger than -f ms (default
+ * DAEMON_FRESH_MS) is given from memory.  With --publish every value
+ * read also goes to shared memory, see live_values.h; each adapter has
+ * its own range of the table, and each value and sample names the
+ * adapter, numbered from 0 there.  Ctrl-C or SIGTERM stops the daemon.
+ *
+ * Linux only.  Returns the process exit code.
+ */
+int daemon_main(int argc, char *argv[]);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* DAEMON_H */
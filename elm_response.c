@@ -0,0 +1,515 @@
+#ifdef WINDDK
+#include <windows.h>
+#include <strsafe.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <string.h>
+#include <ctype.h>
+#include "globals.h"
+#include "serial.h"
+#include "elm_response.h"
+#include "text_kernels.h"
+
+#define IS_LINE_END(c)  (RECORD_DELIMITER == (c) || LINE_DELIMITER == (c) || SPECIAL_DELIMITER == (c))
+
+static const struct
+{
+    const char *text;
+    int code;
+} elm_status_table[] =
+{
+    { "NO DATA",            ERR_NO_DATA },
+    { "BUS BUSY",           BUS_BUSY },
+    { "BUS ERROR",          BUS_ERROR },
+    { "BUS INIT: ...ERROR", BUS_INIT_ERROR },
+    { "UNABLE TO CONNECT",  UNABLE_TO_CONNECT },
+    { "CAN ERROR",          CAN_ERROR },
+    { "<DATA ERROR",        DATA_ERROR2 },
+    { "DATA ERROR",         DATA_ERROR },
+    { "BUFFER FULL",        BUFFER_FULL },
+    { "?",                  UNKNOWN_CMD },
+    { "ELM320",             INTERFACE_ELM320 },
+    { "ELM322",             INTERFACE_ELM322 },
+    { "ELM323",             INTERFACE_ELM323 },
+    { "ELM327",             INTERFACE_ELM327 },
+    { "SEARCHING",          HEX_DATA },
+    { "BUS INIT",           HEX_DATA },
+    { "STOPPED",            HEX_DATA },
+    { "OK",                 HEX_DATA },
+    { NULL,                 RUBBISH }
+};
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+void elm_tokenizer_init(ELM_TOKENIZER *tok, const char *buf, unsigned long size, int headerDigits)
+{
+    tok->buf = buf;
+    tok->size = buf ? size : 0;
+    tok->pos = 0;
+    tok->headerDigits = headerDigits;
+}
+
+// returns FALSE at the end of the buffer
+int elm_next_record(ELM_TOKENIZER *tok, ELM_RECORD *rec)
+{
+    const char *buf = tok->buf;
+    unsigned long end = tok->size;
+    unsigned long pos = tok->pos;
+    unsigned long start;
+    int hexDigits = 0;
+    int other = 0;
+
+    // skip the delimiters and padding between lines
+    while (pos < end && buf[pos] && (IS_LINE_END(buf[pos]) || ' ' == buf[pos]))
+    {
+        ++pos;
+    }
+    if (pos >= end || '\0' == buf[pos])
+    {
+        tok->pos = pos;
+        return FALSE;
+    }
+
+    memset(rec, 0, sizeof(*rec));
+    rec->frameIndex = -1;
+    if ('>' == buf[pos])
+    {
+        rec->type = ELM_RECORD_PROMPT;
+        rec->offset = pos;
+        rec->length = 1;
+        tok->pos = pos + 1;
+        return TRUE;
+    }
+
+    start = pos;
+    // "N:" segment prefix
+    if (pos + 1 < end && ':' == buf[pos + 1] && hex_value(buf[pos]) >= 0)
+    {
+        rec->frameIndex = hex_value(buf[pos]);
+        pos += 2;
+        while (pos < end && ' ' == buf[pos])
+        {
+            ++pos;
+        }
+    }
+    rec->offset = pos;
+
+    // one pass over the line, counting what it is made of
+    while (pos < end && buf[pos] && !IS_LINE_END(buf[pos]) && '>' != buf[pos])
+    {
+        if (hex_value(buf[pos]) >= 0)
+        {
+            ++hexDigits;
+        }
+        else if (' ' != buf[pos])
+        {
+            ++other;
+        }
+        ++pos;
+    }
+    tok->pos = pos;
+    while (pos > rec->offset && ' ' == buf[pos - 1])
+    {
+        --pos;
+    }
+    rec->length = pos - rec->offset;
+
+    if (other)
+    {
+        rec->type = ELM_RECORD_STATUS;
+        rec->offset = start;
+        rec->length = pos - start;
+        rec->frameIndex = -1;
+    }
+    else if (rec->frameIndex >= 0)
+    {
+        rec->type = ELM_RECORD_FRAME;
+    }
+    else if (3 == hexDigits)
+    {
+        rec->type = ELM_RECORD_BYTE_COUNT;
+        rec->value = (hex_value(buf[rec->offset]) << 8) |
+                     (hex_value(buf[rec->offset + 1]) << 4) |
+                     hex_value(buf[rec->offset + 2]);
+    }
+    else
+    {
+        rec->type = ELM_RECORD_DATA;
+        if (tok->headerDigits && hexDigits > tok->headerDigits)
+        {
+            int digits = 0;
+            // the header is the leading digits, spaces between them allowed
+            rec->headerOffset = rec->offset;
+            while (digits < tok->headerDigits)
+            {
+                if (' ' != buf[rec->offset])
+                {
+                    ++digits;
+                }
+                ++rec->offset;
+            }
+            rec->headerLength = rec->offset - rec->headerOffset;
+            while (rec->offset < pos && ' ' == buf[rec->offset])
+            {
+                ++rec->offset;
+            }
+            rec->length = pos - rec->offset;
+        }
+    }
+    return TRUE;
+}
+
+// decode ASCII hex into bytes, skipping spaces
+// returns the number of bytes, -1 if the text is not whole hex bytes
+int elm_decode_hex(const char *text, unsigned long length, unsigned char *out, int maxBytes)
+{
+    char packed[2 * ELM_MAX_MESSAGE];
+    unsigned long k;
+    int count = 0;
+    int hi = -1;
+    int digit;
+
+    // whole runs go to the vector kernels, once the spaces are out of the way
+    if (length <= sizeof(packed))
+    {
+        if (memchr(text, ' ', length))
+        {
+            memcpy(packed, text, length);
+            length = strip_spaces(packed, length);
+            text = packed;
+        }
+        if (length <= 2 * (unsigned long)maxBytes)
+        {
+            return hex_to_bytes(text, length, out) ? (int)(length / 2) : -1;
+        }
+    }
+    for (k = 0; k < length; ++k)
+    {
+        if (' ' == text[k])
+        {
+            continue;
+        }
+        digit = hex_value(text[k]);
+        if (digit < 0)
+        {
+            return -1;
+        }
+        if (hi < 0)
+        {
+            hi = digit;
+        }
+        else
+        {
+            if (count < maxBytes)
+            {
+                out[count] = (unsigned char)((hi << 4) | digit);
+            }
+            ++count;
+            hi = -1;
+        }
+    }
+    if (hi >= 0)
+    {
+        return -1;
+    }
+    return (count < maxBytes) ? count : maxBytes;
+}
+
+int elm_record_bytes(const ELM_TOKENIZER *tok, const ELM_RECORD *rec, unsigned char *out, int maxBytes)
+{
+    return elm_decode_hex(tok->buf + rec->offset, rec->length, out, maxBytes);
+}
+
+// map a status record to the process_response codes in serial.h
+int elm_status_code(const ELM_TOKENIZER *tok, const ELM_RECORD *rec)
+{
+    int k;
+    for (k = 0; elm_status_table[k].text; ++k)
+    {
+        unsigned long len = (unsigned long)strlen(elm_status_table[k].text);
+        if (rec->length >= len &&
+            0 == strncmp(tok->buf + rec->offset, elm_status_table[k].text, len))
+        {
+            break;
+        }
+    }
+    return elm_status_table[k].code;
+}
+
+void elm_reader_init(ELM_MESSAGE_READER *reader, const char *buf, unsigned long size, int headerDigits)
+{
+    elm_tokenizer_init(&reader->tok, buf, size, headerDigits);
+    reader->numPending = 0;
+    reader->more = FALSE;
+    reader->prompts = 0;
+}
+
+// continue with the next piece of a stream, responses still being assembled are kept
+void elm_reader_feed(ELM_MESSAGE_READER *reader, const char *buf, unsigned long size, int more)
+{
+    elm_tokenizer_init(&reader->tok, buf, size, reader->tok.headerDigits);
+    reader->more = more;
+}
+
+// add frame bytes to a message being assembled, dropping the padding after the announced length
+static void append_frame(ELM_MESSAGE *msg, const unsigned char *bytes, int count)
+{
+    int room = ((msg->expected < ELM_MAX_MESSAGE) ? msg->expected : ELM_MAX_MESSAGE) - msg->length;
+    if (count > room)
+    {
+        count = room;
+    }
+    if (count > 0)
+    {
+        memcpy(msg->data + msg->length, bytes, count);
+        msg->length += count;
+    }
+    ++msg->nextFrame;
+}
+
+static ELM_MESSAGE *open_pending(ELM_MESSAGE_READER *reader, int expected, const char *header, int headerLength)
+{
+    ELM_MESSAGE *msg;
+    if (reader->numPending >= ELM_MAX_PENDING)
+    {
+        return NULL;
+    }
+    msg = &reader->pending[reader->numPending++];
+    msg->length = 0;
+    msg->expected = expected;
+    msg->nextFrame = 0;
+    msg->multiFrame = TRUE;
+    msg->header = NULL;
+    msg->headerLength = 0;
+    if (header && headerLength <= ELM_MAX_HEADER)
+    {
+        memcpy(msg->headerText, header, headerLength);
+        msg->headerLength = headerLength;
+    }
+    return msg;
+}
+
+// hand out pending message k and close it
+static void take_pending(ELM_MESSAGE_READER *reader, int k, ELM_MESSAGE *msg)
+{
+    memcpy(msg, &reader->pending[k], sizeof(*msg));
+    msg->header = msg->headerLength ? msg->headerText : NULL;
+    --reader->numPending;
+    memmove(&reader->pending[k], &reader->pending[k + 1], (reader->numPending - k) * sizeof(ELM_MESSAGE));
+}
+
+/*
+ * Returns each complete response in the buffer once.  Multi-frame CAN
+ * responses without headers are matched to their byte count by frame
+ * index: ECUs answer in sequence, so frame N belongs to the first response
+ * still waiting for frame N.  With CAN headers on, ISO-TP frames are
+ * joined by header ID.  Incomplete responses are handed out at the end,
+ * unless the reader was told more input follows.
+ */
+int elm_next_message(ELM_MESSAGE_READER *reader, ELM_MESSAGE *msg)
+{
+    ELM_RECORD rec;
+    unsigned char bytes[ELM_MAX_MESSAGE];
+    int count;
+    int k;
+    int isCan = (3 == reader->tok.headerDigits || 8 == reader->tok.headerDigits);
+
+    while (elm_next_record(&reader->tok, &rec))
+    {
+        const char *header = rec.headerLength ? reader->tok.buf + rec.headerOffset : NULL;
+
+        switch (rec.type)
+        {
+        case ELM_RECORD_BYTE_COUNT:
+            (void)open_pending(reader, rec.value, NULL, 0);
+            break;
+
+        case ELM_RECORD_FRAME:
+            count = elm_record_bytes(&reader->tok, &rec, bytes, sizeof(bytes));
+            for (k = 0; count > 0 && k < reader->numPending; ++k)
+            {
+                if ((reader->pending[k].nextFrame & 0x0F) == rec.frameIndex)
+                {
+                    append_frame(&reader->pending[k], bytes, count);
+                    if (reader->pending[k].length >= reader->pending[k].expected)
+                    {
+                        take_pending(reader, k, msg);
+                        return TRUE;
+                    }
+                    break;
+                }
+            }
+            break;
+
+        case ELM_RECORD_DATA:
+            count = elm_record_bytes(&reader->tok, &rec, bytes, sizeof(bytes));
+            if (count <= 0)
+            {
+                break;
+            }
+            if (header && isCan)
+            {
+                // ISO-TP protocol control information
+                int pci = bytes[0] >> 4;
+                if (0 == pci)
+                {
+                    count = ((bytes[0] & 0x0F) < count - 1) ? (bytes[0] & 0x0F) : count - 1;
+                    memcpy(msg->data, bytes + 1, count);
+                }
+                else if (1 == pci && count > 2)
+                {
+                    ELM_MESSAGE *first = open_pending(reader, ((bytes[0] & 0x0F) << 8) | bytes[1], header, (int)rec.headerLength);
+                    if (first)
+                    {
+                        append_frame(first, bytes + 2, count - 2);
+                    }
+                    break;
+                }
+                else if (2 == pci)
+                {
+                    for (k = 0; k < reader->numPending; ++k)
+                    {
+                        ELM_MESSAGE *next = &reader->pending[k];
+                        if (next->headerLength == (int)rec.headerLength &&
+                            0 == memcmp(next->headerText, header, rec.headerLength) &&
+                            (next->nextFrame & 0x0F) == (bytes[0] & 0x0F))
+                        {
+                            append_frame(next, bytes + 1, count - 1);
+                            if (next->length >= next->expected)
+                            {
+                                take_pending(reader, k, msg);
+                                return TRUE;
+                            }
+                            break;
+                        }
+                    }
+                    break;
+                }
+                else
+                {
+                    break;  // flow control
+                }
+            }
+            else
+            {
+                if (header && count > 1)
+                {
+                    --count;    // J1850 and KWP frames end with a checksum
+                }
+                memcpy(msg->data, bytes, count);
+            }
+            msg->length = count;
+            msg->expected = count;
+            msg->nextFrame = 0;
+            msg->multiFrame = FALSE;
+            msg->header = header;
+            msg->headerLength = (int)rec.headerLength;
+            return TRUE;
+
+        case ELM_RECORD_PROMPT:
+            ++reader->prompts;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    // out of input, hand out what was assembled of the rest
+    if (reader->numPending && !reader->more)
+    {
+        take_pending(reader, 0, msg);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+#define IS_ANSWER(b)    (((b) >= 0x41 && (b) <= 0x4A) || 0x7F == (b))   // a mode 01-0A answer, or a refusal
+
+/*
+ * Whether the interface puts a header ID ahead of each line (ATH1),
+ * judged from the first line that answers an OBD request: an 11-bit CAN
+ * ID leaves an odd number of digits, a 29-bit one starts 18 DA, a legacy
+ * header has the answer byte fourth.  Echoed commands, byte counts and
+ * "N:" segments are passed over.  Returns the header digits, 0 if
+ * headers are off, -1 if no line tells.
+ */
+int elm_header_digits(const char *buf, unsigned long size)
+{
+    ELM_TOKENIZER tok;
+    ELM_RECORD rec;
+    char packed[2 * ELM_MAX_MESSAGE];
+    unsigned char bytes[4];
+    unsigned long length;
+
+    elm_tokenizer_init(&tok, buf, size, 0);
+    while (elm_next_record(&tok, &rec))
+    {
+        if (ELM_RECORD_DATA != rec.type || rec.length > sizeof(packed))
+        {
+            continue;
+        }
+        memcpy(packed, buf + rec.offset, rec.length);
+        length = strip_spaces(packed, rec.length);
+        if ((length & 1) && length > 3)
+        {
+            return 3;
+        }
+        if (length < 4 || !hex_to_bytes(packed, (length < 8) ? length & ~1UL : 8, bytes))
+        {
+            continue;
+        }
+        if (length >= 8 && 0x18 == bytes[0] && 0xDA == bytes[1])
+        {
+            return 8;
+        }
+        if (length >= 8 && (0x6B == bytes[1] || 0xF1 == bytes[1]) && IS_ANSWER(bytes[3]))
+        {
+            return 6;
+        }
+        if (IS_ANSWER(bytes[0]))
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// the header digits of the protocol AT DPN reports, 0 if it has no fixed header
+int elm_protocol_header_digits(int protocol)
+{
+    switch (protocol)
+    {
+    case 1:
+    case 2:
+    case 3:
+    case 4:
+    case 5:
+        return 6;   // J1850, ISO 9141 and KWP: priority, target and source
+    case 6:
+    case 8:
+        return 3;   // CAN, 11-bit ID
+    case 7:
+    case 9:
+        return 8;   // CAN, 29-bit ID
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef ELM_RESPONSE_H
+#define ELM_RESPONSE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ELM_MAX_MESSAGE    256  // bytes of one reassembled response
+#define ELM_MAX_PENDING    8    // multi-frame responses assembled at once, one per ECU
+#define ELM_MAX_HEADER     12   // header ID digits kept with a multi-frame response
+
+typedef enum
+{
+    ELM_RECORD_STATUS,      // text from the interface: NO DATA, SEARCHING..., OK, ?
+    ELM_RECORD_BYTE_COUNT,  // 3 digit length that starts a multi-frame CAN response
+    ELM_RECORD_FRAME,       // "N:" segment of a multi-frame CAN response
+    ELM_RECORD_DATA,        // one line of hex bytes, optionally led by a header ID
+    ELM_RECORD_PROMPT       // '>'
+} ELM_RECORD_TYPE;
+
+/*
+ * One token of an interface response.  Offsets point into the buffer
+ * that was tokenized; the text is never copied.  Hex payloads may still
+ * contain the spaces the interface puts between bytes.
+ */
+typedef struct _ELM_RECORD
+{
+    ELM_RECORD_TYPE type;
+    unsigned long offset;       // payload (or status text)
+    unsigned long length;
+    unsigned long headerOffset; // header ID, when headers are on
+    unsigned long headerLength;
+    int frameIndex;             // N of an "N:" segment, -1 otherwise
+    int value;                  // the count of a byte count record
+} ELM_RECORD;
+
+typedef struct _ELM_TOKENIZER
+{
+    const char *buf;
+    unsigned long size;
+    unsigned long pos;
+    int headerDigits;           // hex digits in a header ID (3 or 8 CAN, 6 others), 0 if headers are off
+} ELM_TOKENIZER;
+
+// a complete response from one ECU, single line or reassembled
+typedef struct _ELM_MESSAGE
+{
+    unsigned char data[ELM_MAX_MESSAGE];
+    int length;
+    int expected;               // length announced by a byte count or first frame
+    int nextFrame;              // frame index expected next while assembling
+    int multiFrame;
+    const char *header;         // header ID, NULL if headers are off
+    int headerLength;
+    char headerText[ELM_MAX_HEADER];    // copy of the header of a multi-frame response
+} ELM_MESSAGE;
+
+/*
+ * A single line response has its header pointing into the buffer being
+ * read; a multi-frame one carries its own copy, so it can be completed
+ * from a later buffer handed in with elm_reader_feed.
+ */
+typedef struct _ELM_MESSAGE_READER
+{
+    ELM_TOKENIZER tok;
+    ELM_MESSAGE pending[ELM_MAX_PENDING];
+    int numPending;
+    int more;                   // TRUE if more input follows the buffer, keep incomplete responses
+    unsigned long prompts;      // '>' seen, one per request answered
+} ELM_MESSAGE_READER;
+
+void elm_tokenizer_init(ELM_TOKENIZER *tok, const char *buf, unsigned long size, int headerDigits);
+int elm_next_record(ELM_TOKENIZER *tok, ELM_RECORD *rec);
+int elm_decode_hex(const char *text, unsigned long length, unsigned char *out, int maxBytes);
+int elm_record_bytes(const ELM_TOKENIZER *tok, const ELM_RECORD *rec, unsigned char *out, int maxBytes);
+int elm_status_code(const ELM_TOKENIZER *tok, const ELM_RECORD *rec);
+
+void elm_reader_init(ELM_MESSAGE_READER *reader, const char *buf, unsigned long size, int headerDigits);
+void elm_reader_feed(ELM_MESSAGE_READER *reader, const char *buf, unsigned long size, int more);
+int elm_next_message(ELM_MESSAGE_READER *reader, ELM_MESSAGE *msg);
+
+int elm_header_digits(const char *buf, unsigned long size);
+int elm_protocol_header_digits(int protocol);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* ELM_RESPONSE_H */
@@ -28,6 +28,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#ifndef _WIN32
+// the one Win32 type the portable code still uses
+typedef unsigned long DWORD;
+#endif // _WIN32
+
 #ifndef StringCchPrintf
 #define StringCchPrintf    snprintf
 #endif // StringCchPrintf
@@ -0,0 +1,713 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "globals.h"
+#include "lanes.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <net/if.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include "platform.h"
+#include "serial.h"
+#include "sensors.h"
+#include "trouble_code_reader.h"
+#include "session.h"
+#include "output_buffer.h"
+#include "topwork.h"
+
+#define CAN_FUNCTIONAL_ID   0x7DF       // to every ECU
+#define CAN_REQUEST_ID      0x7E0       // to one ECU, for the flow control
+#define CAN_RESPONSE_ID     0x7E8       // from the first ECU, up to MAX_ECUS from there
+#define CAN_PADDING         0x00
+#define CAN_ECU_TEXT_SIZE   (LANE_INPUT_SIZE / MAX_ECUS)
+
+typedef enum _LANE_KIND
+{
+    LANE_SERIAL,
+    LANE_TCP,
+    LANE_CAN
+} LANE_KIND;
+
+typedef enum _LANE_STATE
+{
+    LANE_CONNECTING,            // TCP: the connect is under way
+    LANE_WAITING,               // a command is out, its answer is coming in
+    LANE_DONE
+} LANE_STATE;
+
+// CAN: the ECUs' answers as the ELM327 prints them with headers off, in the order the ECUs first answered
+typedef struct _CAN_ANSWERS
+{
+    int count;
+    int ecus[MAX_ECUS];
+    char text[MAX_ECUS][CAN_ECU_TEXT_SIZE];
+    unsigned long length[MAX_ECUS];
+    int remaining[MAX_ECUS];    // bytes of a multi-frame answer still to come
+} CAN_ANSWERS;
+
+typedef struct _LANE
+{
+    const char *name;
+    LANE_KIND kind;
+    LANE_STATE state;
+    int fd;
+    int failed;
+    SCAN_SESSION session;
+    SCAN_MACHINE machine;
+    OUTPUT_BUFFER report;
+    TIME_US start;
+    TIME_US deadline;           // of the connect, or of the answer
+    char out[32];               // the command, the part not yet written
+    unsigned long outLen;
+    char in[LANE_INPUT_SIZE];
+    unsigned long inLen;
+    CAN_ANSWERS can;
+} LANE;
+
+typedef struct _LANES
+{
+    LANE *lanes;
+    int count;
+    int active;
+    int epfd;
+    CANCEL_TOKEN stop;          // Ctrl-C, its pipe is in the epoll set
+} LANES;
+
+static CANCEL_TOKEN *interrupted;
+
+static void on_interrupt(int sig)
+{
+    signal(sig, SIG_DFL);
+    if (interrupted)
+    {
+        cancel_request(interrupted);
+    }
+}
+
+static void lane_send(LANES *lanes, LANE *lane);
+
+static void set_events(LANES *lanes, LANE *lane, unsigned int events)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = lane;
+    epoll_ctl(lanes->epfd, EPOLL_CTL_MOD, lane->fd, &ev);
+}
+
+// the report goes out whole, the lanes finish in any order
+static void lane_finish(LANES *lanes, LANE *lane, const char *error)
+{
+    unsigned long ms = (unsigned long)((time_now_us() - lane->start) / 1000);
+
+    if (error)
+    {
+        outbuf_printf(&lane->report, "Error: %s\n", error);
+        lane->failed = TRUE;
+    }
+    else if (!write_scan_report(&lane->session, &lane->session.dtcs, &lane->report))
+    {
+        outbuf_append(&lane->report, "Error: trouble code report truncated\n");
+    }
+    outbuf_printf(&lane->report, "Sweep: %lu ms, %lu samples (%lu/s), %lu requests, %lu timeouts\n",
+                  ms, lane->session.samples, ms ? lane->session.samples * 1000 / ms : 0,
+                  lane->session.comport.requests, lane->session.comport.timeouts);
+    printf("== %s ==\n", lane->name);
+    fwrite(lane->report.buf, 1, lane->report.len, stdout);
+    fflush(stdout);
+
+    if (lane->fd >= 0)
+    {
+        epoll_ctl(lanes->epfd, EPOLL_CTL_DEL, lane->fd, NULL);
+        if (LANE_SERIAL == lane->kind)
+        {
+            close_comport(&lane->session.comport);
+        }
+        else
+        {
+            close(lane->fd);
+        }
+        lane->fd = -1;
+    }
+    lane->state = LANE_DONE;
+    --lanes->active;
+}
+
+// cancelled or out of time, the report has what was read so far
+static void lane_stopped(LANES *lanes, LANE *lane)
+{
+    outbuf_append(&lane->report, "Scan stopped before it was done, the report covers what was read\n");
+    lane_finish(lanes, lane, NULL);
+}
+
+// the answer to the current command, on to the next one
+static void lane_answer(LANES *lanes, LANE *lane, int response, const char *buf, unsigned long length)
+{
+    SCAN_STEP step = lane->machine.step;
+
+    scan_machine_answer(&lane->session, &lane->machine, response, buf, length);
+    if (SCAN_STEP_VIN == step)
+    {
+        session_vehicle(&lane->session, lane->machine.vin, lane->machine.modelYear);
+    }
+    lane_send(lanes, lane);
+}
+
+// what a short write left, EPOLLOUT brings us back for the rest
+static void lane_flush(LANES *lanes, LANE *lane)
+{
+    ssize_t written;
+
+    while (lane->outLen > 0)
+    {
+        written = write(lane->fd, lane->out, lane->outLen);
+        if (written < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if (EAGAIN == errno)
+            {
+                set_events(lanes, lane, EPOLLIN | EPOLLOUT);
+            }
+            return;
+        }
+        memmove(lane->out, lane->out + written, lane->outLen - written);
+        lane->outLen -= (unsigned long)written;
+    }
+    set_events(lanes, lane, EPOLLIN);
+}
+
+static void append_hex(char *text, unsigned long *length, unsigned long size, const unsigned char *data, int count)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    int k;
+
+    for (k = 0; k < count && *length + 4 < size; ++k)
+    {
+        if (k)
+        {
+            text[(*length)++] = ' ';
+        }
+        text[(*length)++] = digits[data[k] >> 4];
+        text[(*length)++] = digits[data[k] & 0x0F];
+    }
+    text[(*length)++] = RECORD_DELIMITER;
+}
+
+static void can_write(LANE *lane, canid_t id, const unsigned char *data, int count)
+{
+    struct can_frame frame;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = id;
+    frame.can_dlc = 8;
+    memset(frame.data, CAN_PADDING, sizeof(frame.data));
+    memcpy(frame.data, data, count);
+    (void)write(lane->fd, &frame, sizeof(frame));
+}
+
+// a request in one single frame to every ECU; FALSE if it is not hex or too long
+static int can_request(LANE *lane, const char *command)
+{
+    unsigned char data[8];
+    int count = 0;
+    unsigned int value;
+
+    while (command[0] && command[1] && count < 7)
+    {
+        if (1 != sscanf(command, "%2x", &value))
+        {
+            return FALSE;
+        }
+        data[++count] = (unsigned char)value;
+        command += 2;
+    }
+    if (*command || 0 == count)
+    {
+        return FALSE;
+    }
+    data[0] = (unsigned char)count;
+    can_write(lane, CAN_FUNCTIONAL_ID, data, count + 1);
+    return TRUE;
+}
+
+// one frame of an answer into its ECU's text; the flow control for a first frame goes straight out
+static void can_frame(LANE *lane, const struct can_frame *frame)
+{
+    static const unsigned char flowControl[] = { 0x30, 0x00, 0x00 };
+    CAN_ANSWERS *can = &lane->can;
+    int ecu = (int)(frame->can_id & CAN_SFF_MASK) - CAN_RESPONSE_ID;
+    const unsigned char *data = frame->data;
+    int slot;
+    int count;
+    char *text;
+    unsigned long *length;
+
+    for (slot = 0; slot < can->count && can->ecus[slot] != ecu; ++slot)
+    {
+    }
+    if (slot == can->count)
+    {
+        can->ecus[can->count++] = ecu;
+        can->length[slot] = 0;
+        can->remaining[slot] = 0;
+    }
+    text = can->text[slot];
+    length = &can->length[slot];
+    if (*length + 32 > CAN_ECU_TEXT_SIZE)
+    {
+        return;
+    }
+    switch (data[0] >> 4)
+    {
+    case 0:
+        // single frame
+        count = data[0] & 0x0F;
+        append_hex(text, length, CAN_ECU_TEXT_SIZE, data + 1, (count > 7) ? 7 : count);
+        break;
+    case 1:
+        // first frame: the byte count line and the first segment, as the ELM327 prints them
+        count = ((data[0] & 0x0F) << 8) | data[1];
+        *length += sprintf(text + *length, "%03X%c0: ", count, RECORD_DELIMITER);
+        append_hex(text, length, CAN_ECU_TEXT_SIZE, data + 2, 6);
+        can->remaining[slot] = count - 6;
+        can_write(lane, CAN_REQUEST_ID + ecu, flowControl, sizeof(flowControl));
+        break;
+    case 2:
+        // consecutive frame
+        if (can->remaining[slot] > 0)
+        {
+            count = (can->remaining[slot] > 7) ? 7 : can->remaining[slot];
+            *length += sprintf(text + *length, "%X: ", data[0] & 0x0F);
+            append_hex(text, length, CAN_ECU_TEXT_SIZE, data + 1, count);
+            can->remaining[slot] -= count;
+        }
+        break;
+    default:
+        break;
+    }
+    // the answers are in once the bus has been quiet for a while
+    lane->deadline = time_now_us() + LANE_CAN_QUIET_MS * 1000;
+}
+
+// CAN: the answers heard so far, as one ELM327 answer
+static void can_answer(LANES *lanes, LANE *lane)
+{
+    CAN_ANSWERS *can = &lane->can;
+    int slot;
+
+    lane->inLen = 0;
+    for (slot = 0; slot < can->count; ++slot)
+    {
+        memcpy(lane->in + lane->inLen, can->text[slot], can->length[slot]);
+        lane->inLen += can->length[slot];
+    }
+    if (0 == can->count)
+    {
+        lane->inLen = sprintf(lane->in, "NO DATA%c", RECORD_DELIMITER);
+    }
+    lane->inLen += sprintf(lane->in + lane->inLen, "%c>", RECORD_DELIMITER);
+    lane_answer(lanes, lane, DATA, lane->in, lane->inLen);
+}
+
+// the next command of the lane's scan, or its report once there are none
+static void lane_send(LANES *lanes, LANE *lane)
+{
+    unsigned long timeoutMs;
+    const char *command;
+
+    if (cancel_requested(&lane->session.cancel))
+    {
+        lane_stopped(lanes, lane);
+        return;
+    }
+    command = scan_machine_command(&lane->machine, &timeoutMs);
+    if (NULL == command)
+    {
+        lane_finish(lanes, lane, NULL);
+        return;
+    }
+    lane->state = LANE_WAITING;
+    lane->inLen = 0;
+    lane->deadline = time_now_us() + (TIME_US)timeoutMs * 1000;
+    if (lane->session.cancel.deadline && lane->session.cancel.deadline < lane->deadline)
+    {
+        lane->deadline = lane->session.cancel.deadline;
+    }
+    if (LANE_CAN == lane->kind)
+    {
+        memset(&lane->can, 0, sizeof(lane->can));
+        if (0 == strncmp(command, "ATDPN", 5))
+        {
+            // no interface in between: ISO 15765-4, 11-bit
+            lane->inLen = sprintf(lane->in, "6%c%c>", RECORD_DELIMITER, RECORD_DELIMITER);
+            lane_answer(lanes, lane, DATA, lane->in, lane->inLen);
+        }
+        else if (!can_request(lane, command))
+        {
+            lane->inLen = sprintf(lane->in, "?%c%c>", RECORD_DELIMITER, RECORD_DELIMITER);
+            lane_answer(lanes, lane, DATA, lane->in, lane->inLen);
+        }
+        return;
+    }
+    lane->outLen = sprintf(lane->out, "%s%c", command, RECORD_DELIMITER);
+    lane_flush(lanes, lane);
+}
+
+static void lane_readable(LANES *lanes, LANE *lane)
+{
+    struct can_frame frame;
+    ssize_t got;
+
+    if (LANE_CAN == lane->kind)
+    {
+        while (LANE_WAITING == lane->state &&
+               read(lane->fd, &frame, sizeof(frame)) == (ssize_t)sizeof(frame))
+        {
+            if (0 == (frame.can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_ERR_FLAG)))
+            {
+                can_frame(lane, &frame);
+            }
+        }
+        return;
+    }
+    for (;;)
+    {
+        // the last byte is kept for the terminator, input past a full buffer is dropped
+        got = read(lane->fd, lane->in + lane->inLen, sizeof(lane->in) - 1 - lane->inLen);
+        if (got < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        if (0 == got && LANE_TCP == lane->kind)
+        {
+            lane_finish(lanes, lane, "the adapter closed the connection");
+            return;
+        }
+        if (got <= 0)
+        {
+            break;
+        }
+        lane->in[lane->inLen + got] = '\0';
+        if (LANE_WAITING == lane->state && memchr(lane->in + lane->inLen, '>', got))
+        {
+            lane->inLen += got;
+            lane_answer(lanes, lane, DATA, lane->in, lane->inLen);
+            return;
+        }
+        lane->inLen += got;
+        if (lane->inLen == sizeof(lane->in) - 1)
+        {
+            lane->inLen = 0;
+        }
+    }
+}
+
+static void lane_event(LANES *lanes, LANE *lane, unsigned int events)
+{
+    int error = 0;
+    socklen_t length = sizeof(error);
+
+    if (LANE_CONNECTING == lane->state)
+    {
+        if (getsockopt(lane->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error)
+        {
+            lane_finish(lanes, lane, "unable to connect");
+            return;
+        }
+        set_events(lanes, lane, EPOLLIN);
+        lane_send(lanes, lane);
+        return;
+    }
+    if (events & EPOLLOUT)
+    {
+        lane_flush(lanes, lane);
+    }
+    if (LANE_DONE != lane->state && (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+    {
+        lane_readable(lanes, lane);
+    }
+}
+
+static void lane_timeout(LANES *lanes, LANE *lane)
+{
+    if (LANE_CONNECTING == lane->state)
+    {
+        lane_finish(lanes, lane, cancel_requested(&lane->session.cancel) ? "out of time connecting" : "timed out connecting");
+    }
+    else if (LANE_CAN == lane->kind)
+    {
+        can_answer(lanes, lane);
+    }
+    else
+    {
+        // as sendAndWaitForResponse, what came in without a prompt is still an answer
+        lane->in[lane->inLen] = '\0';
+        lane_answer(lanes, lane, lane->inLen ? DATA : EMPTY, lane->in, lane->inLen);
+    }
+}
+
+static int open_tcp(LANE *lane, const char *address)
+{
+    char host[256];
+    const char *colon = strrchr(address, ':');
+    struct addrinfo hints;
+    struct addrinfo *found;
+    int connected;
+
+    if (NULL == colon || (unsigned long)(colon - address) >= sizeof(host))
+    {
+        return FALSE;
+    }
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    // the lookup blocks, but only once per adapter and before the loop starts
+    if (0 != getaddrinfo(host, colon + 1, &hints, &found))
+    {
+        return FALSE;
+    }
+    lane->fd = socket(found->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    connected = (lane->fd >= 0 &&
+                 (0 == connect(lane->fd, found->ai_addr, found->ai_addrlen) || EINPROGRESS == errno));
+    freeaddrinfo(found);
+    lane->state = LANE_CONNECTING;
+    lane->deadline = time_now_us() + (TIME_US)ECU_TIMEOUT * 1000;
+    if (lane->session.cancel.deadline && lane->session.cancel.deadline < lane->deadline)
+    {
+        lane->deadline = lane->session.cancel.deadline;
+    }
+    return connected;
+}
+
+static int open_can(LANE *lane, const char *interface)
+{
+    struct ifreq ifr;
+    struct sockaddr_can addr;
+    struct can_filter filter;
+
+    lane->fd = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK, CAN_RAW);
+    if (lane->fd < 0)
+    {
+        return FALSE;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    StringCchCopy(ifr.ifr_name, sizeof(ifr.ifr_name), interface);
+    if (ioctl(lane->fd, SIOCGIFINDEX, &ifr) < 0)
+    {
+        return FALSE;
+    }
+    // only the ECUs' answers wake us up
+    filter.can_id = CAN_RESPONSE_ID;
+    filter.can_mask = (CAN_SFF_MASK & ~(MAX_ECUS - 1)) | CAN_EFF_FLAG;
+    setsockopt(lane->fd, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter));
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    return (0 == bind(lane->fd, (struct sockaddr *)&addr, sizeof(addr))) ? TRUE : FALSE;
+}
+
+// FALSE if the adapter cannot be opened
+static int lane_open(LANES *lanes, LANE *lane, int baudRate)
+{
+    struct epoll_event ev;
+    int opened;
+
+    if (0 == strncmp(lane->name, "tcp:", 4))
+    {
+        lane->kind = LANE_TCP;
+        opened = open_tcp(lane, lane->name + 4);
+    }
+    else if (0 == strncmp(lane->name, "can:", 4))
+    {
+        lane->kind = LANE_CAN;
+        opened = open_can(lane, lane->name + 4);
+    }
+    else
+    {
+        // the port as a scan opens it, the tty is already non-blocking
+        lane->kind = LANE_SERIAL;
+        lane->session.comport.device = lane->name;
+        lane->session.comport.baud_rate = baudRate;
+        opened = (0 == open_comport(&lane->session.comport) && READY == lane->session.comport.status);
+        lane->fd = opened ? lane->session.comport.fd : -1;
+    }
+    if (!opened)
+    {
+        if (lane->fd >= 0 && LANE_SERIAL != lane->kind)
+        {
+            close(lane->fd);
+        }
+        lane->fd = -1;
+        return FALSE;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (LANE_CONNECTING == lane->state) ? EPOLLOUT : EPOLLIN;
+    ev.data.ptr = lane;
+    return (0 == epoll_ctl(lanes->epfd, EPOLL_CTL_ADD, lane->fd, &ev)) ? TRUE : FALSE;
+}
+
+int lanes_main(int argc, char *argv[])
+{
+    LANES lanes;
+    LANE *lane;
+    struct epoll_event events[LANES_MAX];
+    int baudRate = 9600;
+    unsigned long deadlineMs = 0;
+    struct epoll_event ev;
+    int failed = 0;
+    int index;
+    int ready;
+    int timeout;
+    int k;
+    TIME_US now;
+    TIME_US next;
+    TIME_US start = time_now_us();
+
+    memset(&lanes, 0, sizeof(lanes));
+    lanes.lanes = (LANE *)calloc(LANES_MAX, sizeof(LANE));
+    lanes.epfd = epoll_create1(0);
+    if (NULL == lanes.lanes || lanes.epfd < 0)
+    {
+        fprintf(stderr, "Error: unable to set up the event loop\n");
+        free(lanes.lanes);
+        return 1;
+    }
+    for (index = 0; index < argc; ++index)
+    {
+        if (0 == strcmp(argv[index], "-b") && index + 1 < argc)
+        {
+            baudRate = atoi(argv[++index]);
+        }
+        else if (0 == strcmp(argv[index], "-t") && index + 1 < argc)
+        {
+            deadlineMs = strtoul(argv[++index], NULL, 10);
+        }
+        else if (lanes.count < LANES_MAX)
+        {
+            lanes.lanes[lanes.count++].name = argv[index];
+        }
+    }
+    if (0 == lanes.count)
+    {
+        fprintf(stderr, "Usage: ScanTool --lanes [-b baud] [-t ms] device|tcp:host:port|can:interface ...\n");
+        close(lanes.epfd);
+        free(lanes.lanes);
+        return 1;
+    }
+
+    // Ctrl-C wakes the loop through the token's pipe
+    cancel_init(&lanes.stop);
+    if (lanes.stop.wake[0] >= 0)
+    {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        epoll_ctl(lanes.epfd, EPOLL_CTL_ADD, lanes.stop.wake[0], &ev);
+    }
+    interrupted = &lanes.stop;
+    signal(SIGINT, on_interrupt);
+
+    for (k = 0; k < lanes.count; ++k)
+    {
+        lane = &lanes.lanes[k];
+        initializeSession(&lane->session);
+        outbuf_init_dynamic(&lane->report, OUTPUT_BUFFER_SIZE, 0);
+        lane->session.report = &lane->report;
+        cancel_deadline(&lane->session.cancel, deadlineMs);
+        lane->start = time_now_us();
+        lane->fd = -1;
+        lane->state = LANE_WAITING;
+        ++lanes.active;
+        // the machine marks the port ready, open_comport would close it first
+        if (!lane_open(&lanes, lane, baudRate))
+        {
+            lane_finish(&lanes, lane, "unable to open the adapter");
+            continue;
+        }
+        scan_machine_init(&lane->session, &lane->machine);
+        if (LANE_CONNECTING != lane->state)
+        {
+            lane_send(&lanes, lane);
+        }
+    }
+
+    while (lanes.active > 0)
+    {
+        // sleep until something comes in or the nearest deadline
+        now = time_now_us();
+        next = 0;
+        for (k = 0; k < lanes.count; ++k)
+        {
+            lane = &lanes.lanes[k];
+            if (LANE_DONE != lane->state && (0 == next || lane->deadline < next))
+            {
+                next = lane->deadline;
+            }
+        }
+        timeout = (next > now) ? (int)((next - now + 999) / 1000) : 0;
+        ready = epoll_wait(lanes.epfd, events, LANES_MAX, timeout);
+        if (cancel_requested(&lanes.stop))
+        {
+            for (k = 0; k < lanes.count; ++k)
+            {
+                lane = &lanes.lanes[k];
+                if (LANE_DONE != lane->state)
+                {
+                    cancel_request(&lane->session.cancel);
+                    lane_stopped(&lanes, lane);
+                }
+            }
+            break;
+        }
+        for (k = 0; k < ready; ++k)
+        {
+            lane = (LANE *)events[k].data.ptr;
+            if (lane && LANE_DONE != lane->state)
+            {
+                lane_event(&lanes, lane, events[k].events);
+            }
+        }
+        now = time_now_us();
+        for (k = 0; k < lanes.count; ++k)
+        {
+            lane = &lanes.lanes[k];
+            if (LANE_DONE != lane->state && lane->deadline <= now)
+            {
+                lane_timeout(&lanes, lane);
+            }
+        }
+    }
+
+    for (k = 0; k < lanes.count; ++k)
+    {
+        failed += lanes.lanes[k].failed ? 1 : 0;
+        outbuf_free(&lanes.lanes[k].report);
+        destroySession(&lanes.lanes[k].session);
+    }
+    printf("Lanes: %d adapters, %d failed, %lu ms\n", lanes.count, failed,
+           (unsigned long)((time_now_us() - start) / 1000));
+    signal(SIGINT, SIG_DFL);
+    interrupted = NULL;
+    cancel_destroy(&lanes.stop);
+    close(lanes.epfd);
+    free(lanes.lanes);
+    return failed ? 1 : 0;
+}
+
+#endif // __linux__
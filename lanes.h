@@ -0,0 +1,37 @@
+#ifndef LANES_H
+#define LANES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LANES_MAX           64
+#define LANE_INPUT_SIZE     4096        // an answer, the VIN and multi-ECU Mode 03 included
+#define LANE_CAN_QUIET_MS   50          // CAN: silence after the last frame that ends an answer, P2max
+
+/*
+ * Scan the vehicles on many adapters at once from one thread:
+ *
+ *    ScanTool --lanes [-b baud] [-t ms] adapter ...
+ *
+ * An adapter is a serial device (/dev/ttyUSB0, a pty), tcp:host:port for
+ * a WiFi or Ethernet ELM327, or can:interface for a SocketCAN interface
+ * spoken to directly, 11-bit ISO 15765-4.  Each one runs its own
+ * SCAN_MACHINE: init, discovery, sweep and trouble codes, one request at
+ * a time, moved on by its answers and deadlines from a single epoll
+ * loop.  Nothing waits but epoll, so an adapter that stops answering
+ * only costs its own deadlines.  Each vehicle's report is printed as its
+ * scan finishes, under a "== adapter ==" line.  With -t a scan stops
+ * after that many ms; Ctrl-C stops them all.  Either way the report
+ * covers what was read.
+ *
+ * Linux only.  Returns the process exit code: 0, or 1 if an adapter
+ * could not be opened.
+ */
+int lanes_main(int argc, char *argv[]);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* LANES_H */
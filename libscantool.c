@@ -0,0 +1,296 @@
+#ifdef WINDDK
+#include <windows.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "globals.h"
+#include "platform.h"
+#include "serial.h"
+#include "trouble_code_reader.h"
+#include "session.h"
+#include "capture.h"
+#include "replay_adapter.h"
+#include "text_kernels.h"
+#include "topwork.h"
+#include "libscantool.h"
+
+struct _SCANTOOL
+{
+    SCANTOOL_TRANSPORT transport;
+    SCANTOOL_CALLBACKS callbacks;
+    SCAN_SESSION session;
+    REPLAY_ADAPTER adapter;
+    unsigned long scans;
+    int connected;              // the adapter is set up and the VIN read
+};
+
+SCANTOOL *scantool_open(const SCANTOOL_TRANSPORT *transport, const SCANTOOL_CALLBACKS *callbacks)
+{
+    SCANTOOL *tool = (SCANTOOL *)calloc(1, sizeof(SCANTOOL));
+
+    if (NULL == tool)
+    {
+        return NULL;
+    }
+    tool->transport = *transport;
+    if (callbacks)
+    {
+        tool->callbacks = *callbacks;
+    }
+    if (SCANTOOL_REPLAY == transport->kind &&
+        !replay_adapter_init(&tool->adapter, transport->data, transport->size, transport->replaySpeed))
+    {
+        free(tool);
+        return NULL;
+    }
+    // pick the text kernels here rather than in the first scan
+    (void)text_kernels_level();
+
+    initializeSession(&tool->session);
+    tool->session.callbacks = &tool->callbacks;
+    session_live_link(&tool->session, transport->liveUsage);
+    tool->session.adapter = transport->adapter;
+    tool->session.comport.device = transport->device;
+    tool->session.comport.baud_rate = transport->baudRate;
+    if (SCANTOOL_REPLAY == transport->kind)
+    {
+        replay_adapter_attach(&tool->adapter, &tool->session.comport);
+    }
+    return tool;
+}
+
+// the codes the scan read, to the callbacks; returns how many codes
+static int report_trouble_codes(SCANTOOL *tool, const DTC_RESULT *dtcs)
+{
+    const SCANTOOL_CALLBACKS *callbacks = &tool->callbacks;
+    const SCAN_SESSION *session = &tool->session;
+    const FOUND_TROUBLE_CODE *found;
+    int ecu;
+    int k;
+
+    for (ecu = 0; callbacks->ecu && ecu < dtcs->numEcus; ++ecu)
+    {
+        callbacks->ecu(callbacks->context, ecu + 1, dtcs->ecus[ecu].count[DTC_STORED],
+                       dtcs->ecus[ecu].count[DTC_PENDING], dtcs->ecus[ecu].count[DTC_PERMANENT]);
+    }
+    for (k = 0; callbacks->trouble_code && k < session->numFoundCodes; ++k)
+    {
+        // the DTC_KIND bits are the SCANTOOL_CODE ones
+        found = &session->foundCodes[k];
+        callbacks->trouble_code(callbacks->context, found->code, found->description, found->kinds, found->foundCount);
+    }
+    return session->numFoundCodes;
+}
+
+// the counts of one call, from start on the transport's clock
+static void fill_summary(SCANTOOL *tool, const DTC_RESULT *dtcs, int codes, TIME_US start, SCANTOOL_SUMMARY *summary)
+{
+    SCAN_SESSION *session = &tool->session;
+
+    memset(summary, 0, sizeof(*summary));
+    summary->milOn = session->mil_is_on;
+    summary->reportedCodes = dtcs ? dtcs->reportedCount : session->reportedCodeCount;
+    summary->mismatch = dtcs ? dtcs->mismatch : FALSE;
+    summary->codes = codes;
+    summary->samples = session->samples;
+    summary->requests = session->comport.requests;
+    summary->timeouts = session->comport.timeouts;
+    summary->ms = (unsigned long)((comport_time(&session->comport) - start) / 1000);
+}
+
+// a cancel applies to one call
+static int finish_call(SCANTOOL *tool, int rc)
+{
+    if (SCANTOOL_OK == rc && cancel_requested(&tool->session.cancel))
+    {
+        rc = SCANTOOL_CANCELLED;
+    }
+    cancel_reset(&tool->session.cancel);
+    return rc;
+}
+
+int scantool_scan(SCANTOOL *tool, unsigned long deadlineMs, SCANTOOL_SUMMARY *summary)
+{
+    SCAN_SESSION *session = &tool->session;
+    const SCANTOOL_TRANSPORT *transport = &tool->transport;
+    const DTC_RESULT *dtcs;
+    char vin[64];
+    char modelYear[8];
+    TIME_US start;
+    int live = FALSE;
+    int codes;
+
+    memset(vin, 0, sizeof(vin));
+    memset(modelYear, 0, sizeof(modelYear));
+    if (tool->scans++)
+    {
+        resetSession(session);
+        if (SCANTOOL_REPLAY == transport->kind)
+        {
+            // from the top of the capture again
+            close_comport(&session->comport);
+            tool->connected = FALSE;
+        }
+    }
+    cancel_deadline(&session->cancel, deadlineMs);
+    start = comport_time(&session->comport);
+    if (SCANTOOL_STREAM == transport->kind)
+    {
+        dtcs = replay_stream(session, transport->fd);
+    }
+    else if (SCANTOOL_LOG == transport->kind &&
+             capture_is_capture(transport->data, transport->size))
+    {
+        dtcs = replay_capture(session, transport->data, transport->size);
+    }
+    else
+    {
+        // the port stays open from the last scan
+        live = (SCANTOOL_LOG != transport->kind) ? TRUE : FALSE;
+        workInit(session, live ? NULL : transport->data, live ? 0 : transport->size, transport->port,
+                 vin, sizeof(vin), modelYear, sizeof(modelYear));
+        if (READY == session->comport.status)
+        {
+            // no vehicle to tell of when the port or the input could not be read
+            session_vehicle(session, vin, modelYear);
+        }
+        process_all_codes(session);
+        dtcs = acquire_trouble_codes(session);
+        tool->connected = (live && READY == session->comport.status) ? TRUE : FALSE;
+    }
+    codes = report_trouble_codes(tool, dtcs);
+
+    if (summary)
+    {
+        fill_summary(tool, dtcs, codes, start, summary);
+        if (SCANTOOL_REPLAY == transport->kind)
+        {
+            // the adapter's clock starts over when the port opens
+            summary->ms = (unsigned long)(replay_adapter_time(&tool->adapter) / 1000);
+            summary->unanswered = tool->adapter.unmatched;
+        }
+    }
+    return finish_call(tool, (live && READY != session->comport.status) ? SCANTOOL_ERROR : SCANTOOL_OK);
+}
+
+int scantool_connect(SCANTOOL *tool)
+{
+    SCAN_SESSION *session = &tool->session;
+    char vin[64];
+    char modelYear[8];
+
+    memset(vin, 0, sizeof(vin));
+    memset(modelYear, 0, sizeof(modelYear));
+    if (SCANTOOL_SERIAL != tool->transport.kind && SCANTOOL_REPLAY != tool->transport.kind)
+    {
+        return SCANTOOL_ERROR;
+    }
+    if (tool->connected && READY == session->comport.status)
+    {
+        return SCANTOOL_OK;
+    }
+    workInit(session, NULL, 0, tool->transport.port, vin, sizeof(vin), modelYear, sizeof(modelYear));
+    if (READY != session->comport.status)
+    {
+        return SCANTOOL_ERROR;
+    }
+    session_vehicle(session, vin, modelYear);
+    // a cancelled init is done again by the next call
+    tool->connected = cancel_requested(&session->cancel) ? FALSE : TRUE;
+    return SCANTOOL_OK;
+}
+
+// the counts start over for each read, the connection carries on
+static int start_read(SCANTOOL *tool, unsigned long deadlineMs, TIME_US *start)
+{
+    SCAN_SESSION *session = &tool->session;
+
+    session->samples = 0;
+    session->comport.requests = 0;
+    session->comport.timeouts = 0;
+    cancel_deadline(&session->cancel, deadlineMs);
+    *start = comport_time(&session->comport);
+    return scantool_connect(tool);
+}
+
+int scantool_read_values(SCANTOOL *tool, const int *pids, int count, unsigned long deadlineMs, SCANTOOL_SUMMARY *summary)
+{
+    SCAN_SESSION *session = &tool->session;
+    TIME_US start;
+    int rc = start_read(tool, deadlineMs, &start);
+    int k;
+
+    for (k = 0; SCANTOOL_OK == rc && k < count && !cancel_requested(&session->cancel); ++k)
+    {
+        (void)read_current_data(session, pids[k]);
+    }
+    if (SCANTOOL_OK == rc && READY != session->comport.status)
+    {
+        rc = SCANTOOL_ERROR;
+    }
+    if (summary)
+    {
+        fill_summary(tool, NULL, 0, start, summary);
+    }
+    return finish_call(tool, rc);
+}
+
+int scantool_read_codes(SCANTOOL *tool, unsigned long deadlineMs, SCANTOOL_SUMMARY *summary)
+{
+    SCAN_SESSION *session = &tool->session;
+    const DTC_RESULT *dtcs = NULL;
+    TIME_US start;
+    int rc = start_read(tool, deadlineMs, &start);
+    int codes = 0;
+
+    if (SCANTOOL_OK == rc)
+    {
+        // the MIL and the stored code count first, as in a scan
+        session->mil_is_on = FALSE;
+        session->reportedCodeCount = -1;
+        (void)read_current_data(session, 1);
+        dtcs = acquire_trouble_codes(session);
+        codes = report_trouble_codes(tool, dtcs);
+        if (READY != session->comport.status)
+        {
+            rc = SCANTOOL_ERROR;
+        }
+    }
+    if (summary)
+    {
+        fill_summary(tool, dtcs, codes, start, summary);
+    }
+    return finish_call(tool, rc);
+}
+
+void scantool_cancel(SCANTOOL *tool)
+{
+    cancel_request(&tool->session.cancel);
+}
+
+void scantool_print_link_usage(SCANTOOL *tool, FILE *out)
+{
+    link_usage_print(&tool->session.comport.usage, out);
+}
+
+void scantool_close(SCANTOOL *tool)
+{
+    if (NULL == tool)
+    {
+        return;
+    }
+    if (SCANTOOL_SERIAL == tool->transport.kind || SCANTOOL_REPLAY == tool->transport.kind)
+    {
+        close_comport(&tool->session.comport);
+    }
+    if (SCANTOOL_REPLAY == tool->transport.kind)
+    {
+        replay_adapter_free(&tool->adapter);
+    }
+    destroySession(&tool->session);
+    free(tool);
+}
@@ -0,0 +1,111 @@
+#ifndef LIBSCANTOOL_H
+#define LIBSCANTOOL_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * libscantool: the scan behind ScanTool.exe, for programs that link it in.
+ *
+ * A SCANTOOL is one vehicle connection.  scantool_scan reads the VIN, the
+ * current data the vehicle supports and its trouble codes, and hands each
+ * result to the callbacks as it is decoded; nothing is printed.  The
+ * connection stays open between scans, so a service can keep it warm and
+ * scan again without reopening the port.  Each SCANTOOL owns all of its
+ * state: any number of them may scan at once, one thread per SCANTOOL.
+ * Link libscantool.a, built by make lib.
+ *
+ * The comm log, --stats and --trace instruments stay process-wide; they
+ * record nothing unless the program opens them.
+ */
+typedef struct _SCANTOOL SCANTOOL;
+
+typedef enum _SCANTOOL_TRANSPORT_KIND
+{
+    SCANTOOL_SERIAL,            // an ELM327 on a serial port or a pty
+    SCANTOOL_REPLAY,            // a capture, played through the emulated ELM327
+    SCANTOOL_LOG,               // a simulation log or a capture, decoded as it is
+    SCANTOOL_STREAM             // a log arriving on a descriptor: stdin, a pipe or a FIFO
+} SCANTOOL_TRANSPORT_KIND;
+
+typedef struct _SCANTOOL_TRANSPORT
+{
+    SCANTOOL_TRANSPORT_KIND kind;
+    const char *device;         // SERIAL: the port by name, NULL for port
+    int port;                   // SERIAL: COM<port>, /dev/ttyS<port - 1>
+    int baudRate;               // SERIAL: 0 for 9600
+    const char *data;           // REPLAY, LOG: the input, kept by the caller until scantool_close
+    unsigned long size;
+    double replaySpeed;         // REPLAY: 1 real time, N times faster, 0 as fast as possible
+    int fd;                     // STREAM: read to its end by each scan
+    int liveUsage;              // TRUE: the link usage to the link callback once a second, as --link
+    int adapter;                // from 0: with --publish, one of LIVE_ADAPTERS ranges per adapter of the process
+} SCANTOOL_TRANSPORT;
+
+// the kinds a trouble code was reported as, a bit each
+#define SCANTOOL_CODE_STORED        0x01    // Mode 03
+#define SCANTOOL_CODE_PENDING       0x02    // Mode 07
+#define SCANTOOL_CODE_PERMANENT     0x04    // Mode 0A
+
+// called on the thread of scantool_scan, or during the sweep on its decoder
+// thread, never two at once for one SCANTOOL; any of them may be NULL
+typedef struct _SCANTOOL_CALLBACKS
+{
+    void (*vehicle)(void *context, const char *vin, const char *modelYear);
+    void (*value)(void *context, int pid, const char *label, const char *value);
+    void (*ecu)(void *context, int ecu, int stored, int pending, int permanent);
+    // description is NULL for a code missing from the code list, ecus is how many reported it
+    void (*trouble_code)(void *context, const char *code, const char *description, int kinds, int ecus);
+    void (*message)(void *context, const char *text);   // warnings and errors, a line each
+    void (*link)(void *context, const char *line);      // with liveUsage, a "Link: ..." line once a second
+    void *context;
+} SCANTOOL_CALLBACKS;
+
+typedef struct _SCANTOOL_SUMMARY
+{
+    int milOn;
+    int reportedCodes;          // stored codes per Mode 01 PID 01, -1 if not read
+    int mismatch;               // TRUE if the stored codes read are not reportedCodes
+    int codes;                  // trouble codes passed to the callback
+    unsigned long samples;      // values passed to the callback
+    unsigned long requests;
+    unsigned long timeouts;     // requests answered with nothing
+    unsigned long ms;           // on the transport's clock, virtual for a replay
+    unsigned long unanswered;   // REPLAY: requests the capture has no answer for
+} SCANTOOL_SUMMARY;
+
+// scantool_scan and the reads
+#define SCANTOOL_OK             0
+#define SCANTOOL_CANCELLED      1   // cancelled or out of time, the results cover what was read
+#define SCANTOOL_ERROR          (-1)    // the transport could not be opened or read
+
+// NULL if out of memory or the capture cannot be replayed
+SCANTOOL *scantool_open(const SCANTOOL_TRANSPORT *transport, const SCANTOOL_CALLBACKS *callbacks);
+// deadlineMs 0 for none; summary may be NULL
+int scantool_scan(SCANTOOL *tool, unsigned long deadlineMs, SCANTOOL_SUMMARY *summary);
+/*
+ * The reads below are for a service that keeps the vehicle connected and
+ * asks for a little at a time.  They work on SERIAL and REPLAY transports
+ * and return SCANTOOL_ERROR on the others.  scantool_connect sets the
+ * adapter up and reads the VIN, for the vehicle callback, the first time
+ * only; the reads connect first if need be.  A summary covers one call.
+ */
+int scantool_connect(SCANTOOL *tool);
+// a Mode 01 request per PID, each value to the value callback
+int scantool_read_values(SCANTOOL *tool, const int *pids, int count, unsigned long deadlineMs, SCANTOOL_SUMMARY *summary);
+// PID 01 for the MIL, then the trouble codes to the ecu and trouble_code callbacks
+int scantool_read_codes(SCANTOOL *tool, unsigned long deadlineMs, SCANTOOL_SUMMARY *summary);
+// from any thread or a signal handler: stops the scan or read under way, or the next one
+void scantool_cancel(SCANTOOL *tool);
+// the "Link: ..." line of the last scan
+void scantool_print_link_usage(SCANTOOL *tool, FILE *out);
+void scantool_close(SCANTOOL *tool);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* LIBSCANTOOL_H */
@@ -0,0 +1,342 @@
+#ifdef WINDDK
+#include <windows.h>
+#include <strsafe.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <stdio.h>
+#include <string.h>
+#include "globals.h"
+#include "platform.h"
+#include "serial.h"
+#include "elm_response.h"
+#include "link_usage.h"
+
+// bits per second on the bus, 0 if the protocol is not known
+int link_protocol_bitrate(int protocol)
+{
+    switch (protocol)
+    {
+        case 1:
+            return 41600;
+        case 2:
+        case 3:
+        case 4:
+        case 5:
+            return 10400;
+        case 6:
+        case 7:
+            return 500000;
+        case 8:
+        case 9:
+            return 250000;
+    }
+    return 0;
+}
+
+// one frame carrying dataBytes, without bit stuffing
+static unsigned long frame_bits(int protocol, int dataBytes)
+{
+    switch (protocol)
+    {
+        case 1:
+        case 2:
+            // J1850: three header bytes and the CRC, about two bytes of SOF, EOD and in-frame response
+            return (unsigned long)(3 + dataBytes + 1 + 2) * 8;
+        case 3:
+        case 4:
+        case 5:
+            // ISO 9141-2 and KWP2000 are UART bytes: three header bytes and the checksum
+            return (unsigned long)(3 + dataBytes + 1) * 10;
+        case 6:
+        case 8:
+            // ISO 15765-4 pads every frame to eight bytes, plus the interframe space
+            return 47 + 64 + 3;
+        case 7:
+        case 9:
+            return 67 + 64 + 3;
+    }
+    return 0;
+}
+
+static void add_frame(LINK_USAGE *usage, int dataBytes)
+{
+    if (usage->protocol && dataBytes > 0)
+    {
+        ++usage->busFrames;
+        usage->busBits += frame_bits(usage->protocol, dataBytes);
+    }
+}
+
+// hex digits in the record, the bytes it puts on the bus
+static int record_bytes(const char *text, const ELM_RECORD *rec)
+{
+    unsigned long k;
+    int digits = 0;
+
+    for (k = 0; k < rec->length; ++k)
+    {
+        if (' ' != text[rec->offset + k])
+        {
+            ++digits;
+        }
+    }
+    return digits / 2;
+}
+
+// the frames of an answer; a byte count line means a multi-frame answer and a flow control frame from the interface
+static void add_answer(LINK_USAGE *usage, const char *text, const ELM_RECORD *rec)
+{
+    switch (rec->type)
+    {
+        case ELM_RECORD_DATA:
+        case ELM_RECORD_FRAME:
+            add_frame(usage, record_bytes(text, rec));
+            break;
+        case ELM_RECORD_BYTE_COUNT:
+            add_frame(usage, 3);
+            break;
+        default:
+            break;
+    }
+}
+
+// a command as sent, AT commands stay with the interface
+static void add_command(LINK_USAGE *usage, const char *command, unsigned long length)
+{
+    if (length >= 2 && 'A' == command[0] && 'T' == command[1])
+    {
+        return;
+    }
+    add_frame(usage, (int)(length / 2));
+}
+
+static TIME_US bits_time(PLATFORM_U64 bits, int rate)
+{
+    return rate ? (TIME_US)(bits * 1000000 / (unsigned long)rate) : 0;
+}
+
+static int baud_rate(const LINK_USAGE *usage)
+{
+    return usage->baudRate ? usage->baudRate : LINK_DEFAULT_BAUD;
+}
+
+/*
+ * One request of sendAndWaitForResponse: command without its CR, the
+ * answer as read, before compress_response, sent and done on the port's
+ * clock and wait the time it waited out for an answer no prompt ended,
+ * 0 when the prompt came.  The bytes move while the port waits, so the
+ * wait is split: the part moving the bytes explains, and the rest, the
+ * time-out's own cost.  The rest of an answer that did end is waiting
+ * on the answer.
+ */
+void link_usage_request(LINK_USAGE *usage, const char *command, const char *response, unsigned long length,
+                        TIME_US sent, TIME_US done, TIME_US wait)
+{
+    ELM_TOKENIZER tok;
+    ELM_RECORD rec;
+    unsigned long commandLength = (unsigned long)strlen(command);
+    unsigned long tx = commandLength + 1;
+    PLATFORM_U64 busBits = usage->busBits;
+    TIME_US serial;
+    TIME_US bus;
+    TIME_US covered;
+    int first = TRUE;
+
+    if (0 == usage->txBytes + usage->rxBytes)
+    {
+        usage->first = sent;
+    }
+    else if (sent > usage->last)
+    {
+        usage->idleTime += sent - usage->last;
+    }
+    add_command(usage, command, commandLength);
+    elm_tokenizer_init(&tok, response, length, 0);
+    while (elm_next_record(&tok, &rec))
+    {
+        // the echo, when it is on
+        if (first && rec.length == commandLength && 0 == memcmp(response + rec.offset, command, commandLength))
+        {
+            first = FALSE;
+            continue;
+        }
+        first = FALSE;
+        add_answer(usage, response, &rec);
+    }
+
+    ++usage->requests;
+    usage->txBytes += tx;
+    usage->rxBytes += length;
+    serial = bits_time((PLATFORM_U64)(tx + length) * LINK_SERIAL_BITS, baud_rate(usage));
+    bus = bits_time(usage->busBits - busBits, link_protocol_bitrate(usage->protocol));
+    usage->serialTime += serial;
+    usage->busTime += bus;
+    covered = serial + bus;
+    if (wait > covered)
+    {
+        usage->waitTime += wait - covered;
+        covered = wait;
+    }
+    if (done > sent + covered)
+    {
+        usage->responseTime += done - sent - covered;
+    }
+    usage->last = done;
+}
+
+/*
+ * Interface text as a stream hands it over, whole lines: the echo of a
+ * command, its answer, the prompt.  arrived is when the text came in and
+ * wait how long the stream kept us waiting for it.
+ */
+void link_usage_stream(LINK_USAGE *usage, const char *text, unsigned long length, TIME_US arrived, TIME_US wait)
+{
+    ELM_TOKENIZER tok;
+    ELM_RECORD rec;
+    PLATFORM_U64 bytes = 0;
+    PLATFORM_U64 busBits = usage->busBits;
+
+    // the wait for the first text is before the session started
+    if (0 == usage->txBytes + usage->rxBytes)
+    {
+        usage->first = arrived;
+    }
+    else
+    {
+        usage->idleTime += wait;
+    }
+    elm_tokenizer_init(&tok, text, length, 0);
+    while (elm_next_record(&tok, &rec))
+    {
+        if (ELM_RECORD_PROMPT == rec.type)
+        {
+            usage->inResponse = FALSE;
+        }
+        else if (!usage->inResponse)
+        {
+            usage->inResponse = TRUE;
+            ++usage->requests;
+            usage->txBytes += rec.length + 1;
+            bytes += rec.length + 1;
+            add_command(usage, text + rec.offset, rec.length);
+        }
+        else
+        {
+            add_answer(usage, text, &rec);
+        }
+    }
+    // all that is not a command came from the interface
+    usage->rxBytes += length - (unsigned long)bytes;
+    usage->serialTime += bits_time((PLATFORM_U64)length * LINK_SERIAL_BITS, baud_rate(usage));
+    usage->busTime += bits_time(usage->busBits - busBits, link_protocol_bitrate(usage->protocol));
+    usage->last = arrived;
+}
+
+// where most of the time went, the first named on a tie
+const char *link_usage_bottleneck(const LINK_USAGE *usage)
+{
+    const char *bottleneck = "serial link";
+    TIME_US most = usage->serialTime;
+
+    if (0 == usage->requests)
+    {
+        return "none";
+    }
+    if (usage->busTime > most)
+    {
+        bottleneck = "OBD bus";
+        most = usage->busTime;
+    }
+    if (usage->responseTime > most)
+    {
+        bottleneck = "waiting on answers";
+        most = usage->responseTime;
+    }
+    if (usage->waitTime > most)
+    {
+        bottleneck = "answers that timed out";
+        most = usage->waitTime;
+    }
+    if (usage->idleTime > most)
+    {
+        bottleneck = "idle between requests";
+    }
+    return bottleneck;
+}
+
+static unsigned long percent(TIME_US part, TIME_US whole)
+{
+    return whole ? (unsigned long)(part * 100 / whole) : 0;
+}
+
+// the "Link: ..." line, newline included
+void link_usage_format(const LINK_USAGE *usage, char *line, unsigned long size)
+{
+    TIME_US elapsed = usage->last - usage->first;
+    size_t used;
+
+    // a stream read faster than it was recorded still took the link its time
+    if (elapsed < usage->serialTime)
+    {
+        elapsed = usage->serialTime;
+    }
+    if (elapsed < usage->busTime)
+    {
+        elapsed = usage->busTime;
+    }
+
+#ifdef WIN_VS6
+    sprintf(line, "Link: %lu ms, %lu requests; serial %lu ms (%lu%%), %lu bytes out, %lu in at %d baud; ",
+#else // WIN_VS6
+    StringCchPrintf(line, size, "Link: %lu ms, %lu requests; serial %lu ms (%lu%%), %lu bytes out, %lu in at %d baud; ",
+#endif // WIN_VS6
+            (unsigned long)(elapsed / 1000), usage->requests,
+            (unsigned long)(usage->serialTime / 1000), percent(usage->serialTime, elapsed),
+            usage->txBytes, usage->rxBytes, baud_rate(usage));
+    used = strlen(line);
+    if (usage->protocol)
+    {
+#ifdef WIN_VS6
+        sprintf(line + used, "bus %lu ms (%lu%%), %lu frames, %lu bits on %s; ",
+#else // WIN_VS6
+        StringCchPrintf(line + used, size - used, "bus %lu ms (%lu%%), %lu frames, %lu bits on %s; ",
+#endif // WIN_VS6
+                (unsigned long)(usage->busTime / 1000), percent(usage->busTime, elapsed),
+                usage->busFrames, (unsigned long)usage->busBits,
+                get_protocol_string(INTERFACE_ELM327, usage->protocol));
+    }
+    else
+    {
+        StringCchCopy(line + used, size - used, "bus protocol unknown; ");
+    }
+    used = strlen(line);
+#ifdef WIN_VS6
+    sprintf(line + used, "timed out %lu ms (%lu%%); answers %lu ms (%lu%%); idle %lu ms (%lu%%); bottleneck: %s\n",
+#else // WIN_VS6
+    StringCchPrintf(line + used, size - used, "timed out %lu ms (%lu%%); answers %lu ms (%lu%%); idle %lu ms (%lu%%); bottleneck: %s\n",
+#endif // WIN_VS6
+            (unsigned long)(usage->waitTime / 1000), percent(usage->waitTime, elapsed),
+            (unsigned long)(usage->responseTime / 1000), percent(usage->responseTime, elapsed),
+            (unsigned long)(usage->idleTime / 1000), percent(usage->idleTime, elapsed),
+            link_usage_bottleneck(usage));
+}
+
+void link_usage_print(const LINK_USAGE *usage, FILE *out)
+{
+    char line[LINK_LINE_SIZE];
+
+    link_usage_format(usage, line, sizeof(line));
+    fputs(line, out);
+}
+
+// the usage so far to usage->live, at most once every LINK_LIVE_INTERVAL_US of the link's clock
+void link_usage_live(LINK_USAGE *usage)
+{
+    if (usage->live && usage->last - usage->lastLive >= LINK_LIVE_INTERVAL_US)
+    {
+        usage->lastLive = usage->last;
+        usage->live(usage->liveContext, usage);
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef LINK_USAGE_H
+#define LINK_USAGE_H
+
+#include <stdio.h>
+#include "platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LINK_SERIAL_BITS        10          // per byte on the serial link: start, 8 data, stop
+#define LINK_DEFAULT_BAUD       9600        // when the log does not say, what workInit opens the port at
+#define LINK_LIVE_INTERVAL_US   1000000     // between the lines link_usage_live passes on
+#define LINK_LINE_SIZE          512         // a "Link: ..." line, with its newline
+
+/*
+ * Where the time of a scan goes: moving bytes over the serial link,
+ * moving frames over the OBD bus, waiting on the answers, or waiting
+ * out the time-out of answers the prompt never ended.  Serial
+ * bytes are counted per direction; bus frames and bits are estimated
+ * from the answers for the protocol the interface reports to AT DPN,
+ * see get_protocol_string, with no bit stuffing and no inter-byte gaps.
+ * The bus is not estimated while the protocol is unknown.
+ *
+ * Idle time is the link unused between requests; for a stream it is the
+ * time spent waiting for the input instead.
+ */
+typedef struct _LINK_USAGE
+{
+    int protocol;               // ELM327 protocol number, 0 if not known
+    int baudRate;               // of the serial link, 0 for LINK_DEFAULT_BAUD
+    unsigned long requests;
+    unsigned long txBytes;      // to the interface
+    unsigned long rxBytes;      // from the interface
+    unsigned long busFrames;    // estimated, both directions
+    PLATFORM_U64 busBits;
+    TIME_US serialTime;         // the bytes at the baud rate
+    TIME_US busTime;            // the bits at the bus rate
+    TIME_US responseTime;       // of the answers the prompt ended, what moving the bytes does not explain
+    TIME_US waitTime;           // of the answers that timed out, what moving the bytes does not explain
+    TIME_US idleTime;
+    TIME_US first;              // the first request sent
+    TIME_US last;               // the last answer read
+    void (*live)(void *context, const struct _LINK_USAGE *usage);   // every LINK_LIVE_INTERVAL_US, NULL for none
+    void *liveContext;
+    TIME_US lastLive;
+    int inResponse;             // stream: past the echo of the command, until the prompt
+} LINK_USAGE;
+
+int link_protocol_bitrate(int protocol);
+void link_usage_request(LINK_USAGE *usage, const char *command, const char *response, unsigned long length,
+                        TIME_US sent, TIME_US done, TIME_US wait);
+void link_usage_stream(LINK_USAGE *usage, const char *text, unsigned long length, TIME_US arrived, TIME_US wait);
+const char *link_usage_bottleneck(const LINK_USAGE *usage);
+void link_usage_format(const LINK_USAGE *usage, char *line, unsigned long size);
+void link_usage_print(const LINK_USAGE *usage, FILE *out);
+void link_usage_live(LINK_USAGE *usage);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* LINK_USAGE_H */
@@ -0,0 +1,385 @@
+#ifdef WINDDK
+#include <windows.h>
+#include <strsafe.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif // _WIN32
+#include "globals.h"
+#include "platform.h"
+#include "live_values.h"
+
+#define LIVE_RING_MASK      (LIVE_RING_SIZE - 1)
+#define LIVE_READ_WAIT_US   100000  // for a value mid-write, far longer than even a preempted scan takes
+
+typedef struct _LIVE_PUBLISHER
+{
+    int isOpen;
+    char name[64];              // as the OS names the segment
+    PLATFORM_MUTEX lock;        // the scan's writes, one at a time
+    LIVE_MAP map;
+} LIVE_PUBLISHER;
+
+static LIVE_PUBLISHER publisher;
+
+// the segment's name as the OS wants it
+static void segment_name(char *buf, unsigned long size, const char *name)
+{
+#ifdef _WIN32
+#ifdef WIN_VS6
+    _snprintf(buf, size, "Local\\%s", name ? name : LIVE_NAME);
+#else // WIN_VS6
+    StringCchPrintf(buf, size, "Local\\%s", name ? name : LIVE_NAME);
+#endif // WIN_VS6
+#else // _WIN32
+    StringCchPrintf(buf, size, "/%s", name ? name : LIVE_NAME);
+#endif // _WIN32
+}
+
+// a copy that always fits, is always terminated and is one line
+static void copy_text(char *to, unsigned long size, const char *from)
+{
+    unsigned long length = from ? (unsigned long)strcspn(from, "\r\n") : 0;
+
+    if (length >= size)
+    {
+        length = size - 1;
+    }
+    memcpy(to, from, length);
+    to[length] = '\0';
+}
+
+#ifndef _WIN32
+// TRUE if the segment under the name was left by a scan that closed it or is gone
+static int segment_abandoned(const char *name)
+{
+    LIVE_MAP map;
+    const LIVE_SEGMENT *segment = live_attach(&map, name);
+    int abandoned;
+
+    if (NULL == segment)
+    {
+        // still being set up, or of another layout: not for us to remove
+        return FALSE;
+    }
+    abandoned = atomic_load_acquire((volatile unsigned long *)&segment->closed) ||
+                (kill((pid_t)segment->owner, 0) < 0 && ESRCH == errno);
+    live_detach(&map);
+    return abandoned;
+}
+#endif // _WIN32
+
+int live_publish_open(const char *name)
+{
+    LIVE_SEGMENT *segment;
+
+    if (publisher.isOpen)
+    {
+        return TRUE;
+    }
+    segment_name(publisher.name, sizeof(publisher.name), name);
+#ifdef _WIN32
+    // page file backed, it starts out zeroed
+    publisher.map.mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                              0, sizeof(LIVE_SEGMENT), publisher.name);
+    if (NULL == publisher.map.mapping)
+    {
+        return FALSE;
+    }
+    if (ERROR_ALREADY_EXISTS == GetLastError())
+    {
+        // another scan publishes under the name
+        CloseHandle(publisher.map.mapping);
+        return FALSE;
+    }
+    segment = (LIVE_SEGMENT *)MapViewOfFile(publisher.map.mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(LIVE_SEGMENT));
+    if (NULL == segment)
+    {
+        CloseHandle(publisher.map.mapping);
+        return FALSE;
+    }
+    memset(segment, 0, sizeof(*segment));
+    segment->owner = (unsigned long)GetCurrentProcessId();
+#else // _WIN32
+    publisher.map.fd = shm_open(publisher.name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (publisher.map.fd < 0 && EEXIST == errno && segment_abandoned(name))
+    {
+        // left by a scan that did not finish, made again zeroed
+        shm_unlink(publisher.name);
+        publisher.map.fd = shm_open(publisher.name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+    if (publisher.map.fd < 0)
+    {
+        // another scan publishes under the name
+        return FALSE;
+    }
+    if (ftruncate(publisher.map.fd, sizeof(LIVE_SEGMENT)) < 0)
+    {
+        close(publisher.map.fd);
+        shm_unlink(publisher.name);
+        return FALSE;
+    }
+    segment = (LIVE_SEGMENT *)mmap(NULL, sizeof(LIVE_SEGMENT), PROT_READ | PROT_WRITE, MAP_SHARED, publisher.map.fd, 0);
+    if (MAP_FAILED == (void *)segment)
+    {
+        close(publisher.map.fd);
+        shm_unlink(publisher.name);
+        return FALSE;
+    }
+    segment->owner = (unsigned long)getpid();
+#endif // _WIN32
+    segment->version = LIVE_VERSION;
+    segment->size = sizeof(LIVE_SEGMENT);
+    // the magic goes in last, a reader that finds it finds the rest
+    atomic_store_release(&segment->magic, LIVE_MAGIC);
+    publisher.map.segment = segment;
+    mutex_init(&publisher.lock);
+    publisher.isOpen = TRUE;
+    return TRUE;
+}
+
+void live_publish_close(void)
+{
+    if (!publisher.isOpen)
+    {
+        return;
+    }
+    mutex_lock(&publisher.lock);
+    publisher.isOpen = FALSE;
+    atomic_store_release(&publisher.map.segment->closed, TRUE);
+    mutex_unlock(&publisher.lock);
+#ifdef _WIN32
+    // the segment goes with the last handle to it
+    UnmapViewOfFile(publisher.map.segment);
+    CloseHandle(publisher.map.mapping);
+#else // _WIN32
+    munmap(publisher.map.segment, sizeof(LIVE_SEGMENT));
+    close(publisher.map.fd);
+    shm_unlink(publisher.name);
+#endif // _WIN32
+    publisher.map.segment = NULL;
+    mutex_destroy(&publisher.lock);
+}
+
+int live_publish_enabled(void)
+{
+    return publisher.isOpen;
+}
+
+/*
+ * Into the sensor's slot and the ring, each under its seq: odd, the
+ * fence, the data, then even again with release so the data is seen
+ * before the seq that vouches for it.
+ */
+void live_publish(int adapter, int slot, int pid, const char *label, long raw, const char *text)
+{
+    LIVE_SEGMENT *segment;
+    LIVE_VALUE *value;
+    LIVE_SAMPLE *sample;
+    unsigned long n;
+    TIME_US now;
+
+    if (!publisher.isOpen || slot < 0 || slot >= LIVE_SLOTS || adapter < 0 || adapter >= LIVE_ADAPTERS)
+    {
+        return;
+    }
+    slot += adapter * LIVE_SLOTS;
+    now = time_now_us();
+    mutex_lock(&publisher.lock);
+    if (!publisher.isOpen)
+    {
+        mutex_unlock(&publisher.lock);
+        return;
+    }
+    segment = publisher.map.segment;
+
+    value = &segment->values[slot];
+    atomic_store_release(&value->seq, value->seq + 1);
+    atomic_fence();
+    value->adapter = adapter;
+    value->pid = pid;
+    value->raw = raw;
+    value->time = now;
+    ++value->samples;
+    copy_text(value->label, sizeof(value->label), label);
+    copy_text(value->text, sizeof(value->text), text);
+    atomic_store_release(&value->seq, value->seq + 1);
+
+    n = segment->published;
+    sample = &segment->ring[n & LIVE_RING_MASK];
+    atomic_store_release(&sample->seq, 2 * n + 1);
+    atomic_fence();
+    sample->slot = slot;
+    sample->adapter = adapter;
+    sample->pid = pid;
+    sample->raw = raw;
+    sample->time = now;
+    copy_text(sample->text, sizeof(sample->text), text);
+    atomic_store_release(&sample->seq, 2 * n + 2);
+    atomic_store_release(&segment->published, n + 1);
+    mutex_unlock(&publisher.lock);
+}
+
+const LIVE_SEGMENT *live_attach(LIVE_MAP *map, const char *name)
+{
+    char osName[64];
+    LIVE_SEGMENT *segment;
+
+    memset(map, 0, sizeof(*map));
+    segment_name(osName, sizeof(osName), name);
+#ifdef _WIN32
+    map->mapping = OpenFileMapping(FILE_MAP_READ, FALSE, osName);
+    if (NULL == map->mapping)
+    {
+        return NULL;
+    }
+    segment = (LIVE_SEGMENT *)MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, sizeof(LIVE_SEGMENT));
+#else // _WIN32
+    {
+        struct stat st;
+
+        map->fd = shm_open(osName, O_RDONLY, 0);
+        if (map->fd < 0)
+        {
+            map->fd = -1;
+            return NULL;
+        }
+        segment = NULL;
+        if (0 == fstat(map->fd, &st) && st.st_size >= (off_t)sizeof(LIVE_SEGMENT))
+        {
+            segment = (LIVE_SEGMENT *)mmap(NULL, sizeof(LIVE_SEGMENT), PROT_READ, MAP_SHARED, map->fd, 0);
+            segment = (MAP_FAILED == (void *)segment) ? NULL : segment;
+        }
+    }
+#endif // _WIN32
+    map->segment = segment;
+    if (NULL == segment ||
+        LIVE_MAGIC != atomic_load_acquire(&segment->magic) ||
+        LIVE_VERSION != segment->version ||
+        sizeof(LIVE_SEGMENT) != segment->size)
+    {
+        live_detach(map);
+        return NULL;
+    }
+    return segment;
+}
+
+void live_detach(LIVE_MAP *map)
+{
+#ifdef _WIN32
+    if (map->segment)
+    {
+        UnmapViewOfFile(map->segment);
+    }
+    if (map->mapping)
+    {
+        CloseHandle(map->mapping);
+    }
+#else // _WIN32
+    if (map->segment)
+    {
+        munmap(map->segment, sizeof(LIVE_SEGMENT));
+    }
+    if (map->fd >= 0)
+    {
+        close(map->fd);
+    }
+#endif // _WIN32
+    memset(map, 0, sizeof(*map));
+#ifndef _WIN32
+    map->fd = -1;
+#endif // _WIN32
+}
+
+int live_read_value(const LIVE_SEGMENT *segment, int slot, LIVE_VALUE *out)
+{
+    volatile unsigned long *seq;
+    unsigned long before;
+    TIME_US giveUp = 0;
+
+    if (slot < 0 || slot >= LIVE_VALUES)
+    {
+        return FALSE;
+    }
+    seq = (volatile unsigned long *)&segment->values[slot].seq;
+    for (;;)
+    {
+        before = atomic_load_acquire(seq);
+        if (before & 1)
+        {
+            // being written, which takes the scan well under a microsecond;
+            // one that stays odd was left by a scan that died writing it
+            if (0 == giveUp)
+            {
+                giveUp = time_now_us() + LIVE_READ_WAIT_US;
+            }
+            else if (time_now_us() > giveUp)
+            {
+                return FALSE;
+            }
+            continue;
+        }
+        memcpy(out, (const void *)&segment->values[slot], sizeof(*out));
+        atomic_fence();
+        if (before == atomic_load_acquire(seq))
+        {
+            return (0 != before) ? TRUE : FALSE;
+        }
+    }
+}
+
+int live_next_sample(const LIVE_SEGMENT *segment, unsigned long *cursor, LIVE_SAMPLE *out, unsigned long *missed)
+{
+    volatile unsigned long *seq;
+    unsigned long published;
+    unsigned long n;
+    unsigned long expected;
+
+    for (;;)
+    {
+        published = atomic_load_acquire((volatile unsigned long *)&segment->published);
+        n = *cursor;
+        if (n >= published)
+        {
+            return FALSE;
+        }
+        if (published - n > LIVE_RING_SIZE)
+        {
+            // lapped, the oldest sample still in the ring is next
+            if (missed)
+            {
+                *missed += published - LIVE_RING_SIZE - n;
+            }
+            n = published - LIVE_RING_SIZE;
+        }
+        seq = (volatile unsigned long *)&segment->ring[n & LIVE_RING_MASK].seq;
+        expected = 2 * n + 2;
+        if (expected == atomic_load_acquire(seq))
+        {
+            memcpy(out, (const void *)&segment->ring[n & LIVE_RING_MASK], sizeof(*out));
+            atomic_fence();
+            if (expected == atomic_load_acquire(seq))
+            {
+                *cursor = n + 1;
+                return TRUE;
+            }
+        }
+        // written over as it was read
+        if (missed)
+        {
+            ++*missed;
+        }
+        *cursor = n + 1;
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef LIVE_VALUES_H
+#define LIVE_VALUES_H
+
+#ifdef _WIN32
+#include <windows.h>
+#endif // _WIN32
+#include "platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIVE_NAME           "scantool_live"     // the segment, /dev/shm/scantool_live or Local\scantool_live
+#define LIVE_MAGIC          0x4556494CUL        // "LIVE"
+#define LIVE_VERSION        3
+#define LIVE_SLOTS          96                  // an adapter's, a row of the sensors table each, MAX_SENSORS
+#define LIVE_ADAPTERS       16                  // of one scan process, DAEMON_ADAPTERS_MAX
+#define LIVE_VALUES         (LIVE_ADAPTERS * LIVE_SLOTS)
+#define LIVE_RING_SIZE      4096                // recent samples, a power of two
+#define LIVE_LABEL_SIZE     48
+#define LIVE_TEXT_SIZE      64                  // the value as shown, SCREEN_BUF_SIZE
+
+/*
+ * The latest value of one sensor on one adapter.  seq is odd while the
+ * scan writes it; a reader copies the value and keeps the copy only if
+ * seq was even and the same before and after.
+ */
+typedef struct _LIVE_VALUE
+{
+    volatile unsigned long seq;
+    int adapter;                // from 0, as the scan numbers its adapters
+    int pid;
+    long raw;                   // the value bytes as read, before the formula
+    TIME_US time;               // time_now_us when decoded, the same clock in every process
+    unsigned long samples;      // of this sensor since the segment was made
+    char label[LIVE_LABEL_SIZE];
+    char text[LIVE_TEXT_SIZE];
+} LIVE_VALUE;
+
+/*
+ * A sample in the ring.  Sample n goes in ring[n % LIVE_RING_SIZE] and
+ * its seq is 2n + 1 while written, 2n + 2 once written.  The scan never
+ * waits for a reader: one that falls LIVE_RING_SIZE behind finds its
+ * samples written over and skips ahead.
+ */
+typedef struct _LIVE_SAMPLE
+{
+    volatile unsigned long seq;
+    int slot;                   // of values[]
+    int adapter;
+    int pid;
+    long raw;
+    TIME_US time;
+    char text[LIVE_TEXT_SIZE];
+} LIVE_SAMPLE;
+
+typedef struct _LIVE_SEGMENT
+{
+    unsigned long magic;
+    unsigned long version;
+    unsigned long size;         // of the segment, as this layout has it
+    volatile unsigned long published;   // samples written to the ring so far
+    volatile unsigned long closed;      // TRUE once the scan is done with it
+    unsigned long owner;        // process id of the scan
+    LIVE_VALUE values[LIVE_VALUES];     // adapter a's from a * LIVE_SLOTS
+    LIVE_SAMPLE ring[LIVE_RING_SIZE];
+} LIVE_SEGMENT;
+
+/*
+ * Publishes every decoded value in shared memory for local readers:
+ * dashboards, loggers and alerting read what the scan already decodes
+ * instead of polling the vehicle themselves.  Readers map the segment
+ * and never write to it, so any number of them read at their own pace
+ * and the scan never waits for one.
+ *
+ * Publishing is off until live_publish_open; the scan's writes are
+ * serialized, so sessions on several threads may publish, each adapter's
+ * values in a range of their own and its samples marked with it.  One process
+ * publishes under a name: live_publish_open fails while another does,
+ * and makes the segment again only if the scan that left it closed it
+ * or is gone.  The segment is removed by live_publish_close, once the
+ * scans are over; readers that still have it mapped see closed set.
+ */
+int live_publish_open(const char *name);   // NULL for LIVE_NAME
+void live_publish_close(void);
+int live_publish_enabled(void);
+// slot is the row of the sensors table, adapter picks the range of values[] it goes in
+void live_publish(int adapter, int slot, int pid, const char *label, long raw, const char *text);
+
+// the reader's side
+typedef struct _LIVE_MAP
+{
+    LIVE_SEGMENT *segment;
+#ifdef _WIN32
+    HANDLE mapping;
+#else // _WIN32
+    int fd;
+#endif // _WIN32
+} LIVE_MAP;
+
+// NULL if no scan publishes under the name, or it was built with another layout
+const LIVE_SEGMENT *live_attach(LIVE_MAP *map, const char *name);
+void live_detach(LIVE_MAP *map);
+// TRUE if the slot of values[] has a value, copied to out; FALSE as well
+// if it stays mid-write, as it does when the scan died writing it
+int live_read_value(const LIVE_SEGMENT *segment, int slot, LIVE_VALUE *out);
+// the sample at *cursor, TRUE if there was one; *missed counts the samples written over first
+int live_next_sample(const LIVE_SEGMENT *segment, unsigned long *cursor, LIVE_SAMPLE *out, unsigned long *missed);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* LIVE_VALUES_H */
@@ -24,29 +24,185 @@
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include "topwork.h"
-#include "serial.h"
+#include <signal.h>
+#include "platform.h"
 #include "sensors.h"
-#include "trouble_code_reader.h"
+#include "output_buffer.h"
+#include "mapped_file.h"
+#include "capture.h"
+#include "comm_log.h"
+#include "replay_adapter.h"
+#include "scan_stats.h"
+#include "scan_trace.h"
+#include "live_values.h"
+#include "batch.h"
+#include "lanes.h"
+#include "daemon.h"
+#include "libscantool.h"
+
+static SCANTOOL *interrupted;          // the scan Ctrl-C stops
+static void (*previousInterrupt)(int); // the comm log's when it is open, else SIG_DFL
+
+// the first Ctrl-C stops the scan and the report covers what was read, a second one ends
+// the program through the handler before, so the comm log still writes out what it holds
+static void on_interrupt(int sig)
+{
+    signal(sig, previousInterrupt);
+    if (interrupted)
+    {
+        scantool_cancel(interrupted);
+    }
+}
+
+// the trouble code report, held back until the scan has the MIL status for its heading
+typedef struct _REPORT
+{
+    OUTPUT_BUFFER ecus;
+    OUTPUT_BUFFER codes;
+} REPORT;
+
+static void on_vehicle(void *context, const char *vin, const char *modelYear)
+{
+    (void)context;
+    printf("Vehicle VIN: %s  Model year: %s\n", vin, modelYear);
+}
+
+static void on_value(void *context, int pid, const char *label, const char *value)
+{
+    (void)context;
+    (void)pid;
+    printf("%s %s\n", label, value);
+}
+
+static void on_ecu(void *context, int ecu, int stored, int pending, int permanent)
+{
+    outbuf_printf(&((REPORT *)context)->ecus, "ECU %d: %d stored, %d pending, %d permanent\n",
+                  ecu, stored, pending, permanent);
+}
+
+static void on_trouble_code(void *context, const char *code, const char *description, int kinds, int ecus)
+{
+    const char *pending = (kinds & SCANTOOL_CODE_PENDING) ? " [Pending]" : "";
+    const char *permanent = (kinds & SCANTOOL_CODE_PERMANENT) ? " [Permanent]" : "";
+
+    if (description)
+    {
+        outbuf_printf(&((REPORT *)context)->codes, "%s(%d) %s%s%s\n", code, ecus, description, pending, permanent);
+    }
+    else
+    {
+        outbuf_printf(&((REPORT *)context)->codes, "%s Not Found%s%s\n", code, pending, permanent);
+    }
+}
+
+static void on_message(void *context, const char *text)
+{
+    (void)context;
+    fputs(text, stdout);
+}
+
+static void on_link(void *context, const char *line)
+{
+    (void)context;
+    fputs(line, stdout);
+}
+
+// what the scan cost on the port's clock, for timing adapters and ECUs
+static void print_sweep(SCANTOOL *tool, const SCANTOOL_SUMMARY *summary)
+{
+    printf("Sweep: %lu ms, %lu samples (%lu/s), %lu requests, %lu timeouts\n",
+           summary->ms, summary->samples, summary->ms ? summary->samples * 1000 / summary->ms : 0,
+           summary->requests, summary->timeouts);
+    scantool_print_link_usage(tool, stdout);
+}
 
 
 int main(int argc, char *argv[])
 {
-    char vin[64];
-    char modelYear[8];
     char *fname = NULL;
     int index = 1;
     int comPortNumber=7;
-    char *simData = NULL;
-    unsigned long simSize = 0;
+    const char *comPortDevice = NULL;
+#ifdef LOG_COMMS
+    int binaryLog = FALSE;
+#endif
+    MAPPED_FILE simFile;
+    int streamFd = -1;
+    double replaySpeed = -1.0;     // below 0: capture replayed without the adapter
+    int showStats = FALSE;
+    const char *statsFile = NULL;
+    int publish = FALSE;
+    const char *publishName = NULL;
+    int liveLink = FALSE;
+    unsigned long deadlineMs = 0;
+#ifdef TRACE_SCAN
+    int trace = FALSE;
+    const char *traceFile = NULL;
+#endif
+    TIME_US startTime;
+    SCANTOOL_TRANSPORT transport;
+    SCANTOOL_CALLBACKS callbacks;
+    SCANTOOL_SUMMARY summary;
+    SCANTOOL *tool;
+    REPORT report;
+    int rc;
+
+    if (argc > 1 && 0 == strcmp(argv[1], "--batch"))
+    {
+        // many files on all the processors, see batch.h
+        return batch_main(argc - 2, argv + 2);
+    }
+#ifdef __linux__
+    if (argc > 1 && 0 == strcmp(argv[1], "--lanes"))
+    {
+        // many adapters from one event loop, see lanes.h
+        return lanes_main(argc - 2, argv + 2);
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "--daemon"))
+    {
+        // adapters kept open for local clients, see daemon.h
+        return daemon_main(argc - 2, argv + 2);
+    }
+#endif // __linux__
+
+    memset(&simFile, 0, sizeof(simFile));
     while (argc > index)
     {
-        FILE *inFile = NULL;
         char *parm = argv[index];
         if ('-' == *parm)
         {
             ++parm;    // skip dash
-            if ('i' == *parm)
+            if ('-' == *parm && 0 == strncmp(parm + 1, "stats", 5))
+            {
+                // per command counters and latencies, --stats=file.json names the dump
+                showStats = TRUE;
+                statsFile = ('=' == parm[6]) ? parm + 7 : NULL;
+            }
+            else if ('-' == *parm && 0 == strncmp(parm + 1, "publish", 7))
+            {
+                // every value to shared memory for local readers, --publish=name names the segment
+                publish = TRUE;
+                publishName = ('=' == parm[8]) ? parm + 9 : NULL;
+            }
+            else if ('-' == *parm && 0 == strcmp(parm + 1, "link"))
+            {
+                // the link usage once a second while scanning, not only at the end
+                liveLink = TRUE;
+            }
+            else if ('-' == *parm && 0 == strncmp(parm + 1, "deadline=", 9))
+            {
+                // the scan stops after this many ms, the report covers what was read by then
+                deadlineMs = strtoul(parm + 10, NULL, 10);
+            }
+#ifdef TRACE_SCAN
+            else if ('-' == *parm && 0 == strncmp(parm + 1, "trace", 5))
+            {
+                // a timeline for Perfetto, --trace=file.json names it
+                trace = TRUE;
+                traceFile = ('=' == parm[6]) ? parm + 7 : NULL;
+            }
+#endif
+            else if ('i' == *parm)
             {
                 ++parm;    // skip i
                 // if the next character is a NULL, then the user put a space between the -i and the name
@@ -70,6 +226,13 @@ int main(int argc, char *argv[])
                     }
                 }
             }
+#ifdef LOG_COMMS
+            else if ('b' == *parm)
+            {
+                // log the interface traffic as a timestamped capture
+                binaryLog = TRUE;
+            }
+#endif
             else if ('c' == *parm)
             {
                 ++parm;
@@ -94,66 +257,202 @@ int main(int argc, char *argv[])
                         ++parm;
                     }
                 }
-                if (NULL == parm ||
-                    1 != sscanf(parm, "%d", &comPortNumber))
+                if (NULL == parm)
                 {
                     comPortNumber = 7;
                 }
+                else if (1 != sscanf(parm, "%d", &comPortNumber))
+                {
+                    // not a number, the port by name: /dev/ttyUSB0, a pty, \\.\COM12
+                    comPortNumber = 0;
+                    comPortDevice = parm;
+                }
             }
-        }
-
-        if (fname)
-        {
-            // see if the file name is valid - read only
-            inFile = fopen(fname, "r");
-            if (inFile)
+            else if ('r' == *parm)
             {
-                // go to end of file
-                fseek(inFile, 0, SEEK_END);
-                // find file size, plus one for NULL terminator
-                simSize = ftell(inFile) + 1;
-                // reset pointer to start of file
-                fseek(inFile, 0, SEEK_SET);
-                if (simSize > 1)
+                // play the capture through the live code path: 1 real time, N times faster, 0 as fast as possible
+                ++parm;
+                if (0 == *parm)
                 {
-                    // if there is a nonzero size, the allocate
-                    simData = (char *)malloc(simSize);
-                    if (simData)
-                    {
-                        // if allocation good, then read in the data
-                        simSize = fread(simData, 1, simSize, inFile);
-                        // and NULL terminate
-                        simData[simSize] = 0;
-                    }
-                    else
-                    {
-                        // malloc failure, reset the size
-                        simSize = 0;
-                    }
+                    ++index;
+                    parm = (argc > index) ? argv[index] : NULL;
                 }
-                else
+                else if ('=' == *parm)
                 {
-                    simSize = 0;
+                    ++parm;
+                }
+                if (NULL == parm ||
+                    1 != sscanf(parm, "%lf", &replaySpeed) ||
+                    replaySpeed < 0.0)
+                {
+                    replaySpeed = REPLAY_FAST;
                 }
-
-                fclose(inFile);
             }
         }
+
         ++index;
     }
 
-    printf("Starting with com port %d\n", comPortNumber);
-    workInit(simData, simSize, comPortNumber, vin, sizeof(vin), modelYear, sizeof(modelYear)); // initialize everything
-    printf("Vehicle VIN: %s  Model year: %s\n", vin, modelYear);
+    if (fname)
+    {
+        // map the file read only, it is paged in as the replay reaches it.
+        // stdin, pipes and FIFOs cannot be mapped and are replayed as they are read
+        if ((0 == strcmp(fname, "-") || !map_file(&simFile, fname)) &&
+            (streamFd = open_input_stream(fname)) < 0)
+        {
+            printf("Error: unable to open %s, using live data\n", fname);
+        }
+    }
+
+    memset(&report, 0, sizeof(report));
+    outbuf_init_dynamic(&report.ecus, OUTPUT_BUFFER_SIZE, 0);
+    outbuf_init_dynamic(&report.codes, OUTPUT_BUFFER_SIZE, 0);
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.vehicle = on_vehicle;
+    callbacks.value = on_value;
+    callbacks.ecu = on_ecu;
+    callbacks.trouble_code = on_trouble_code;
+    callbacks.message = on_message;
+    callbacks.link = on_link;
+    callbacks.context = &report;
+
+    memset(&transport, 0, sizeof(transport));
+    transport.liveUsage = liveLink;
+    if (streamFd >= 0)
+    {
+        transport.kind = SCANTOOL_STREAM;
+        transport.fd = streamFd;
+    }
+    else if (simFile.data)
+    {
+        transport.kind = (replaySpeed >= 0.0 && capture_is_capture(simFile.data, simFile.size)) ? SCANTOOL_REPLAY : SCANTOOL_LOG;
+        transport.data = simFile.data;
+        transport.size = simFile.size;
+        transport.replaySpeed = replaySpeed;
+    }
+    else
+    {
+        transport.kind = SCANTOOL_SERIAL;
+        transport.device = comPortDevice;
+        transport.port = comPortNumber;
+    }
+    tool = scantool_open(&transport, &callbacks);
+    if (NULL == tool && SCANTOOL_REPLAY == transport.kind)
+    {
+        printf("Error: unable to replay %s through the adapter\n", fname);
+        transport.kind = SCANTOOL_LOG;
+        tool = scantool_open(&transport, &callbacks);
+    }
+    if (NULL == tool)
+    {
+        printf("Error: not enough memory to scan\n");
+        return 1;
+    }
 
-    process_all_codes(simData);
+    if (showStats)
+    {
+        scan_stats_open(statsFile);
+    }
+    if (publish && !live_publish_open(publishName))
+    {
+        printf("Error: unable to publish the values in shared memory\n");
+    }
+#ifdef TRACE_SCAN
+    if (trace)
+    {
+        scan_trace_open(traceFile);
+        TRACE_THREAD_NAME("scan");
+    }
+#endif
 
-    getStoredDiagnosticCodes();
+#ifdef LOG_COMMS
+    // log whatever the port talks to, the adapter included
+    if (SCANTOOL_REPLAY == transport.kind || SCANTOOL_SERIAL == transport.kind)
+    {
+        char temp_buf[64];
+        time_t now = time(NULL);
+        strftime(temp_buf, sizeof(temp_buf), "%Y-%m-%d %H:%M:%S", localtime(&now));
+        if (comm_log_open(binaryLog ? COMM_LOG_CAPTURE_NAME : COMM_LOG_FILE_NAME,
+                          binaryLog ? COMM_LOG_CAPTURE : COMM_LOG_TEXT,
+                          COMM_LOG_RING_SIZE, COMM_LOG_FLUSH_MS))
+        {
+            write_comm_log("START_TIME", temp_buf);
+        }
+    }
+#endif
 
-    if (NULL == simData)
+    interrupted = tool;
+    previousInterrupt = signal(SIGINT, on_interrupt);
+    if (SIG_ERR == previousInterrupt)
+    {
+        previousInterrupt = SIG_DFL;
+    }
+    startTime = time_now_us();
+    if (SCANTOOL_SERIAL == transport.kind ||
+        (SCANTOOL_LOG == transport.kind && !capture_is_capture(simFile.data, simFile.size)))
+    {
+        if (comPortDevice)
+        {
+            printf("Starting with %s\n", comPortDevice);
+        }
+        else
+        {
+            printf("Starting with com port %d\n", comPortNumber);
+        }
+    }
+    rc = scantool_scan(tool, deadlineMs, &summary);
+    if (SCANTOOL_STREAM == transport.kind)
+    {
+        close_input_stream(streamFd);
+        scantool_print_link_usage(tool, stdout);
+    }
+    if (SCANTOOL_CANCELLED == rc)
+    {
+        printf("Scan stopped before it was done, the report covers what was read\n");
+    }
+    TRACE_BEGIN();
+    fwrite(report.ecus.buf, 1, report.ecus.len, stdout);
+    if (summary.mismatch)
+    {
+        printf("Vehicle reported %d stored codes, but returned a different number\n", summary.reportedCodes);
+    }
+    printf("Trouble codes (MIL=%s):\n", summary.milOn ? "On" : "Off");
+    fwrite(report.codes.buf, 1, report.codes.len, stdout);
+    if (0 == summary.codes)
+    {
+        printf("None\n");
+    }
+    TRACE_END("sink", "report", NULL);
+
+    if (SCANTOOL_REPLAY == transport.kind)
+    {
+        printf("Scan took %lu ms on the adapter clock, %lu ms real time, %lu of %lu requests unanswered\n",
+               summary.ms, (unsigned long)((time_now_us() - startTime) / 1000), summary.unanswered, summary.requests);
+        print_sweep(tool, &summary);
+    }
+    else if (SCANTOOL_SERIAL == transport.kind)
+    {
+        print_sweep(tool, &summary);
+    }
+    if (showStats)
     {
-        close_comport();
+        scan_stats_summary(stdout);
+        scan_stats_close();
     }
+    live_publish_close();
+    signal(SIGINT, previousInterrupt);
+    interrupted = NULL;
+    scantool_close(tool);
+    outbuf_free(&report.ecus);
+    outbuf_free(&report.codes);
+    unmap_file(&simFile);
+#ifdef LOG_COMMS
+    comm_log_close();
+#endif
+#ifdef TRACE_SCAN
+    // after the comm log, so its flusher thread is done
+    scan_trace_close();
+#endif
 
     return 0;
 }
@@ -0,0 +1,162 @@
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else // _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif // _WIN32
+#include <stdio.h>
+#include <string.h>
+#include "globals.h"
+#include "mapped_file.h"
+
+// returns FALSE if the file cannot be mapped or is empty
+int map_file(MAPPED_FILE *mf, const char *fname)
+{
+#ifdef _WIN32
+    LARGE_INTEGER fileSize;
+
+    memset(mf, 0, sizeof(*mf));
+    mf->file = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                          FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (INVALID_HANDLE_VALUE == mf->file)
+    {
+        return FALSE;
+    }
+    // a view has to fit the address space, and an empty file cannot be mapped
+    if (!GetFileSizeEx(mf->file, &fileSize) ||
+        0 == fileSize.QuadPart ||
+        (ULONGLONG)fileSize.QuadPart > (SIZE_T)-1 ||
+        (ULONGLONG)fileSize.QuadPart > (unsigned long)-1)
+    {
+        unmap_file(mf);
+        return FALSE;
+    }
+    mf->mapping = CreateFileMapping(mf->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (NULL == mf->mapping)
+    {
+        unmap_file(mf);
+        return FALSE;
+    }
+    mf->data = (const char *)MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (NULL == mf->data)
+    {
+        unmap_file(mf);
+        return FALSE;
+    }
+    mf->size = (unsigned long)fileSize.QuadPart;
+    return TRUE;
+#else // _WIN32
+    struct stat st;
+    void *data;
+
+    memset(mf, 0, sizeof(*mf));
+    // a FIFO is left unopened, opening it would hold up its writer
+    if (0 != stat(fname, &st) ||
+        !S_ISREG(st.st_mode) ||
+        0 == st.st_size ||
+        (unsigned long long)st.st_size > (unsigned long)-1)
+    {
+        return FALSE;
+    }
+    mf->fd = open(fname, O_RDONLY);
+    if (mf->fd < 0)
+    {
+        return FALSE;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, mf->fd, 0);
+    if (MAP_FAILED == data)
+    {
+        unmap_file(mf);
+        return FALSE;
+    }
+    // read ahead, and let pages that were passed over go first
+    (void)madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    mf->data = (const char *)data;
+    mf->size = (unsigned long)st.st_size;
+    return TRUE;
+#endif // _WIN32
+}
+
+void unmap_file(MAPPED_FILE *mf)
+{
+#ifdef _WIN32
+    if (mf->data)
+    {
+        UnmapViewOfFile(mf->data);
+    }
+    if (mf->mapping)
+    {
+        CloseHandle(mf->mapping);
+    }
+    if (mf->file && INVALID_HANDLE_VALUE != mf->file)
+    {
+        CloseHandle(mf->file);
+    }
+#else // _WIN32
+    if (mf->data)
+    {
+        munmap((void *)mf->data, mf->size);
+    }
+    if (mf->fd > 0)
+    {
+        close(mf->fd);
+    }
+#endif // _WIN32
+    memset(mf, 0, sizeof(*mf));
+}
+
+// returns a descriptor to read with stream_read, -1 on failure
+int open_input_stream(const char *fname)
+{
+#ifdef _WIN32
+    if (0 == strcmp(fname, "-"))
+    {
+        // the capture is raw text, keep its line ends as they are
+        _setmode(_fileno(stdin), _O_BINARY);
+        return _fileno(stdin);
+    }
+    return _open(fname, _O_RDONLY | _O_BINARY);
+#else // _WIN32
+    if (0 == strcmp(fname, "-"))
+    {
+        return fileno(stdin);
+    }
+    return open(fname, O_RDONLY);
+#endif // _WIN32
+}
+
+// returns what is available, up to size; 0 at the end of the stream, -1 on error
+long stream_read(int fd, char *buf, unsigned long size)
+{
+#ifdef _WIN32
+    return _read(fd, buf, (unsigned int)size);
+#else // _WIN32
+    ssize_t got;
+    do
+    {
+        got = read(fd, buf, size);
+    } while (got < 0 && EINTR == errno);
+    return (long)got;
+#endif // _WIN32
+}
+
+void close_input_stream(int fd)
+{
+#ifdef _WIN32
+    if (fd != _fileno(stdin))
+    {
+        _close(fd);
+    }
+#else // _WIN32
+    if (fd != fileno(stdin))
+    {
+        close(fd);
+    }
+#endif // _WIN32
+}
@@ -0,0 +1,41 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#ifdef _WIN32
+#include <windows.h>
+#endif // _WIN32
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A file mapped read-only.  Pages are read in as the data is touched,
+ * with a sequential access hint, so nothing is loaded up front.  The
+ * data is not NUL terminated; size bounds every use of it.
+ */
+typedef struct _MAPPED_FILE
+{
+    const char *data;
+    unsigned long size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else // _WIN32
+    int fd;
+#endif // _WIN32
+} MAPPED_FILE;
+
+int map_file(MAPPED_FILE *mf, const char *fname);
+void unmap_file(MAPPED_FILE *mf);
+
+// inputs that cannot be mapped are read as a stream, "-" is stdin
+int open_input_stream(const char *fname);
+long stream_read(int fd, char *buf, unsigned long size);
+void close_input_stream(int fd);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* MAPPED_FILE_H */
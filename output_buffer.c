@@ -0,0 +1,191 @@
+#ifdef WINDDK
+#include <windows.h>
+#include <strsafe.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "globals.h"
+#include "output_buffer.h"
+
+#ifdef WIN_VS6
+#define vsnprintf _vsnprintf
+#endif // WIN_VS6
+
+void outbuf_init(OUTPUT_BUFFER *out, char *buf, unsigned long bufSize)
+{
+    memset(out, 0, sizeof(*out));
+    out->buf = buf;
+    out->size = bufSize;
+    if (bufSize)
+    {
+        buf[0] = '\0';
+    }
+}
+
+int outbuf_init_dynamic(OUTPUT_BUFFER *out, unsigned long initialSize, unsigned long maxSize)
+{
+    memset(out, 0, sizeof(*out));
+    if (0 == initialSize)
+    {
+        initialSize = OUTPUT_GROW_DEFAULT;
+    }
+    out->buf = (char *)malloc(initialSize);
+    if (NULL == out->buf)
+    {
+        return FALSE;
+    }
+    out->buf[0] = '\0';
+    out->size = initialSize;
+    out->maxSize = maxSize;
+    out->dynamic = TRUE;
+    return TRUE;
+}
+
+void outbuf_free(OUTPUT_BUFFER *out)
+{
+    if (out->dynamic && out->buf)
+    {
+        free(out->buf);
+    }
+    memset(out, 0, sizeof(*out));
+}
+
+void outbuf_reset(OUTPUT_BUFFER *out)
+{
+    out->len = 0;
+    out->overflow = FALSE;
+    if (out->size)
+    {
+        out->buf[0] = '\0';
+    }
+}
+
+// make room for at least need more bytes of text plus the terminator
+static int outbuf_grow(OUTPUT_BUFFER *out, unsigned long need)
+{
+    unsigned long newSize = out->size;
+    char *newBuf;
+
+    if (!out->dynamic)
+    {
+        return FALSE;
+    }
+    while (newSize < out->len + need + 1)
+    {
+        newSize *= 2;
+    }
+    if (out->maxSize && newSize > out->maxSize)
+    {
+        newSize = out->maxSize;
+        if (newSize <= out->size)
+        {
+            return FALSE;
+        }
+    }
+    newBuf = (char *)realloc(out->buf, newSize);
+    if (NULL == newBuf)
+    {
+        return FALSE;
+    }
+    out->buf = newBuf;
+    out->size = newSize;
+    return (out->len + need + 1 <= newSize) ? TRUE : FALSE;
+}
+
+int outbuf_append(OUTPUT_BUFFER *out, const char *text)
+{
+    unsigned long textLen = (unsigned long)strlen(text);
+
+    if (out->len + textLen + 1 > out->size &&
+        !outbuf_grow(out, textLen))
+    {
+        out->overflow = TRUE;
+        if (out->size == 0)
+        {
+            return FALSE;
+        }
+        textLen = out->size - out->len - 1;
+    }
+    memcpy(out->buf + out->len, text, textLen);
+    out->len += textLen;
+    out->buf[out->len] = '\0';
+    return !out->overflow;
+}
+
+int outbuf_printf(OUTPUT_BUFFER *out, const char *format, ...)
+{
+    va_list args;
+    unsigned long avail;
+    int written;
+
+    if (out->size == 0)
+    {
+        out->overflow = TRUE;
+        return FALSE;
+    }
+    for (;;)
+    {
+        avail = out->size - out->len;
+        va_start(args, format);
+        written = vsnprintf(out->buf + out->len, avail, format, args);
+        va_end(args);
+        if (written >= 0 && (unsigned long)written < avail)
+        {
+            out->len += written;
+            return !out->overflow;
+        }
+        // a negative count gives no size hint, so ask for double the space
+        if (!outbuf_grow(out, (written >= 0) ? (unsigned long)written : out->size))
+        {
+            break;
+        }
+    }
+    // keep what fit
+    out->buf[out->size - 1] = '\0';
+    out->len = out->size - 1;
+    out->overflow = TRUE;
+    return FALSE;
+}
+
+// hand out the space at the cursor to a producer that writes into (buf, bufSize)
+char *outbuf_reserve(OUTPUT_BUFFER *out, unsigned long want, unsigned long *avail)
+{
+    if (out->len + want + 1 > out->size)
+    {
+        (void)outbuf_grow(out, want);
+    }
+    *avail = out->size - out->len;
+    if (*avail == 0)
+    {
+        out->overflow = TRUE;
+        return NULL;
+    }
+    return out->buf + out->len;
+}
+
+// advance the cursor over the text written into reserved space
+void outbuf_commit(OUTPUT_BUFFER *out)
+{
+    unsigned long avail = out->size - out->len;
+    const char *end = (const char *)memchr(out->buf + out->len, '\0', avail);
+
+    if (end)
+    {
+        out->len = (unsigned long)(end - out->buf);
+        if (out->len == out->size - 1)
+        {
+            out->overflow = TRUE;   // the producer may have been cut short
+        }
+    }
+    else
+    {
+        out->len = out->size - 1;
+        out->buf[out->len] = '\0';
+        out->overflow = TRUE;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OUTPUT_GROW_DEFAULT   4096
+
+/*
+ * Text sink with an explicit cursor.  A fixed buffer truncates and sets
+ * overflow; a dynamic buffer doubles until maxSize (0 = no limit).
+ * The text is always NUL terminated at the cursor.
+ */
+typedef struct _OUTPUT_BUFFER
+{
+    char *buf;
+    unsigned long size;     // bytes allocated, including the terminator
+    unsigned long len;      // cursor: bytes of text written so far
+    unsigned long maxSize;
+    int dynamic;            // TRUE if buf is owned and may be reallocated
+    int overflow;           // TRUE once any text has been dropped
+} OUTPUT_BUFFER;
+
+void outbuf_init(OUTPUT_BUFFER *out, char *buf, unsigned long bufSize);
+int outbuf_init_dynamic(OUTPUT_BUFFER *out, unsigned long initialSize, unsigned long maxSize);
+void outbuf_free(OUTPUT_BUFFER *out);
+void outbuf_reset(OUTPUT_BUFFER *out);
+int outbuf_append(OUTPUT_BUFFER *out, const char *text);
+int outbuf_printf(OUTPUT_BUFFER *out, const char *format, ...);
+char *outbuf_reserve(OUTPUT_BUFFER *out, unsigned long want, unsigned long *avail);
+void outbuf_commit(OUTPUT_BUFFER *out);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* OUTPUT_BUFFER_H */
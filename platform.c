@@ -0,0 +1,553 @@
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else // _WIN32
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif // __linux__
+#endif // _WIN32
+#include <string.h>
+#include "globals.h"
+#include "platform.h"
+
+// TRUE once cancel_request was called or the deadline passed; a NULL token never is
+int cancel_requested(CANCEL_TOKEN *token)
+{
+    if (NULL == token)
+    {
+        return FALSE;
+    }
+    if (atomic_load_acquire(&token->cancelled))
+    {
+        return TRUE;
+    }
+    return (token->deadline && time_now_us() >= token->deadline) ? TRUE : FALSE;
+}
+
+// cancelled ms from now, 0 for no deadline
+void cancel_deadline(CANCEL_TOKEN *token, unsigned long ms)
+{
+    token->deadline = ms ? time_now_us() + (TIME_US)ms * 1000 : 0;
+}
+
+// ms, or less if the deadline comes first
+static unsigned long cancel_bound(CANCEL_TOKEN *token, unsigned long ms)
+{
+    TIME_US now;
+
+    if (token->deadline)
+    {
+        now = time_now_us();
+        if (now >= token->deadline)
+        {
+            return 0;
+        }
+        if ((token->deadline - now + 999) / 1000 < ms)
+        {
+            return (unsigned long)((token->deadline - now + 999) / 1000);
+        }
+    }
+    return ms;
+}
+
+#ifdef _WIN32
+
+static unsigned __stdcall thread_entry(void *arg)
+{
+    PLATFORM_THREAD *thread = (PLATFORM_THREAD *)arg;
+    thread->func(thread->arg);
+    return 0;
+}
+
+// returns FALSE if the thread could not be started
+int thread_start(PLATFORM_THREAD *thread, THREAD_FUNC func, void *arg)
+{
+    thread->func = func;
+    thread->arg = arg;
+    // _beginthreadex, not CreateThread, so the C runtime is set up for the thread
+    thread->handle = (HANDLE)_beginthreadex(NULL, 0, thread_entry, thread, 0, NULL);
+    return (NULL != thread->handle) ? TRUE : FALSE;
+}
+
+void thread_join(PLATFORM_THREAD *thread)
+{
+    if (thread->handle)
+    {
+        WaitForSingleObject(thread->handle, INFINITE);
+        CloseHandle(thread->handle);
+        thread->handle = NULL;
+    }
+}
+
+unsigned long thread_id(void)
+{
+    return (unsigned long)GetCurrentThreadId();
+}
+
+int cpu_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (info.dwNumberOfProcessors > 0) ? (int)info.dwNumberOfProcessors : 1;
+}
+
+void mutex_init(PLATFORM_MUTEX *mutex)
+{
+    InitializeCriticalSection(&mutex->cs);
+}
+
+void mutex_destroy(PLATFORM_MUTEX *mutex)
+{
+    DeleteCriticalSection(&mutex->cs);
+}
+
+void mutex_lock(PLATFORM_MUTEX *mutex)
+{
+    EnterCriticalSection(&mutex->cs);
+}
+
+void mutex_unlock(PLATFORM_MUTEX *mutex)
+{
+    LeaveCriticalSection(&mutex->cs);
+}
+
+int mutex_trylock(PLATFORM_MUTEX *mutex)
+{
+    return TryEnterCriticalSection(&mutex->cs) ? TRUE : FALSE;
+}
+
+int event_init(PLATFORM_EVENT *event)
+{
+    event->handle = CreateEvent(NULL, FALSE, FALSE, NULL);
+    return (NULL != event->handle) ? TRUE : FALSE;
+}
+
+void event_destroy(PLATFORM_EVENT *event)
+{
+    CloseHandle(event->handle);
+}
+
+void event_signal(PLATFORM_EVENT *event)
+{
+    SetEvent(event->handle);
+}
+
+// returns TRUE if signalled, FALSE on timeout
+int event_wait(PLATFORM_EVENT *event, unsigned long timeoutMs)
+{
+    return (WAIT_OBJECT_0 == WaitForSingleObject(event->handle,
+                                                 (WAIT_FOREVER == timeoutMs) ? INFINITE : timeoutMs)) ? TRUE : FALSE;
+}
+
+TIME_US time_now_us(void)
+{
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER now;
+
+    if (0 == frequency.QuadPart)
+    {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&now);
+    // split the division so the multiply does not overflow
+    return (TIME_US)(now.QuadPart / frequency.QuadPart) * 1000000 +
+           (TIME_US)(now.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+// the interlocked calls are full barriers, and are in every version of the SDK
+unsigned long atomic_load_acquire(volatile unsigned long *value)
+{
+    return (unsigned long)InterlockedExchangeAdd((LPLONG)value, 0);
+}
+
+void atomic_store_release(volatile unsigned long *value, unsigned long newValue)
+{
+    (void)InterlockedExchange((LPLONG)value, (LONG)newValue);
+}
+
+int atomic_compare_swap(volatile unsigned long *value, unsigned long expected, unsigned long newValue)
+{
+#ifdef WIN_VS6
+    return (PVOID)expected == InterlockedCompareExchange((PVOID *)value, (PVOID)newValue, (PVOID)expected);
+#else // WIN_VS6
+    return (LONG)expected == InterlockedCompareExchange((LPLONG)value, (LONG)newValue, (LONG)expected);
+#endif // WIN_VS6
+}
+
+void atomic_fence(void)
+{
+#ifdef WIN_VS6
+    LONG barrier = 0;
+
+    (void)InterlockedExchange(&barrier, 0);
+#else // WIN_VS6
+    MemoryBarrier();
+#endif // WIN_VS6
+}
+
+void sleep_ms(unsigned long ms)
+{
+    Sleep(ms);
+}
+
+// returns FALSE if the wake event could not be made, the token then only cuts waits short at the deadline
+int cancel_init(CANCEL_TOKEN *token)
+{
+    memset(token, 0, sizeof(*token));
+    token->wake = CreateEvent(NULL, TRUE, FALSE, NULL);
+    return (NULL != token->wake) ? TRUE : FALSE;
+}
+
+void cancel_destroy(CANCEL_TOKEN *token)
+{
+    if (token->wake)
+    {
+        CloseHandle(token->wake);
+        token->wake = NULL;
+    }
+}
+
+// from any thread, the console control handler included
+void cancel_request(CANCEL_TOKEN *token)
+{
+    atomic_store_release(&token->cancelled, TRUE);
+    if (token->wake)
+    {
+        SetEvent(token->wake);
+    }
+}
+
+// ready for another run: not cancelled, no deadline
+void cancel_reset(CANCEL_TOKEN *token)
+{
+    atomic_store_release(&token->cancelled, FALSE);
+    token->deadline = 0;
+    if (token->wake)
+    {
+        ResetEvent(token->wake);
+    }
+}
+
+// sleeps ms unless cancelled first; TRUE if cancelled
+int cancel_wait(CANCEL_TOKEN *token, unsigned long ms)
+{
+    if (NULL == token)
+    {
+        Sleep(ms);
+        return FALSE;
+    }
+    ms = cancel_bound(token, ms);
+    if (token->wake)
+    {
+        WaitForSingleObject(token->wake, ms);
+    }
+    else
+    {
+        Sleep(ms);
+    }
+    return cancel_requested(token);
+}
+
+#else // _WIN32
+
+static void *thread_entry(void *arg)
+{
+    PLATFORM_THREAD *thread = (PLATFORM_THREAD *)arg;
+    thread->func(thread->arg);
+    return NULL;
+}
+
+// returns FALSE if the thread could not be started
+int thread_start(PLATFORM_THREAD *thread, THREAD_FUNC func, void *arg)
+{
+    thread->func = func;
+    thread->arg = arg;
+    return (0 == pthread_create(&thread->handle, NULL, thread_entry, thread)) ? TRUE : FALSE;
+}
+
+void thread_join(PLATFORM_THREAD *thread)
+{
+    pthread_join(thread->handle, NULL);
+}
+
+unsigned long thread_id(void)
+{
+#ifdef __linux__
+    // the ID ps and top show, pthread_self is an address
+    return (unsigned long)syscall(SYS_gettid);
+#else // __linux__
+    return (unsigned long)pthread_self();
+#endif // __linux__
+}
+
+int cpu_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (int)count : 1;
+}
+
+void mutex_init(PLATFORM_MUTEX *mutex)
+{
+    pthread_mutex_init(&mutex->mutex, NULL);
+}
+
+void mutex_destroy(PLATFORM_MUTEX *mutex)
+{
+    pthread_mutex_destroy(&mutex->mutex);
+}
+
+void mutex_lock(PLATFORM_MUTEX *mutex)
+{
+    pthread_mutex_lock(&mutex->mutex);
+}
+
+void mutex_unlock(PLATFORM_MUTEX *mutex)
+{
+    pthread_mutex_unlock(&mutex->mutex);
+}
+
+int mutex_trylock(PLATFORM_MUTEX *mutex)
+{
+    return (0 == pthread_mutex_trylock(&mutex->mutex)) ? TRUE : FALSE;
+}
+
+int event_init(PLATFORM_EVENT *event)
+{
+    pthread_condattr_t attr;
+
+    event->signalled = FALSE;
+    if (0 != pthread_mutex_init(&event->mutex, NULL))
+    {
+        return FALSE;
+    }
+    // time outs are measured on the monotonic clock, not the wall clock
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (0 != pthread_cond_init(&event->cond, &attr))
+    {
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_destroy(&event->mutex);
+        return FALSE;
+    }
+    pthread_condattr_destroy(&attr);
+    return TRUE;
+}
+
+void event_destroy(PLATFORM_EVENT *event)
+{
+    pthread_cond_destroy(&event->cond);
+    pthread_mutex_destroy(&event->mutex);
+}
+
+void event_signal(PLATFORM_EVENT *event)
+{
+    pthread_mutex_lock(&event->mutex);
+    event->signalled = TRUE;
+    pthread_cond_signal(&event->cond);
+    pthread_mutex_unlock(&event->mutex);
+}
+
+// returns TRUE if signalled, FALSE on timeout
+int event_wait(PLATFORM_EVENT *event, unsigned long timeoutMs)
+{
+    struct timespec until;
+    int rc = 0;
+    int signalled;
+
+    if (WAIT_FOREVER != timeoutMs)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_sec += timeoutMs / 1000;
+        until.tv_nsec += (long)(timeoutMs % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000)
+        {
+            until.tv_nsec -= 1000000000;
+            ++until.tv_sec;
+        }
+    }
+    pthread_mutex_lock(&event->mutex);
+    while (!event->signalled && ETIMEDOUT != rc)
+    {
+        rc = (WAIT_FOREVER == timeoutMs) ? pthread_cond_wait(&event->cond, &event->mutex)
+                                         : pthread_cond_timedwait(&event->cond, &event->mutex, &until);
+    }
+    signalled = event->signalled;
+    event->signalled = FALSE;
+    pthread_mutex_unlock(&event->mutex);
+    return signalled;
+}
+
+TIME_US time_now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (TIME_US)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void sleep_ms(unsigned long ms)
+{
+    struct timespec delay;
+    delay.tv_sec = ms / 1000;
+    delay.tv_nsec = (long)(ms % 1000) * 1000000;
+    while (0 != nanosleep(&delay, &delay) && EINTR == errno)
+    {
+    }
+}
+
+// returns FALSE if the pipe could not be made, the token then only cuts waits short at the deadline
+int cancel_init(CANCEL_TOKEN *token)
+{
+    int k;
+
+    memset(token, 0, sizeof(*token));
+    if (0 != pipe(token->wake))
+    {
+        token->wake[0] = token->wake[1] = -1;
+        return FALSE;
+    }
+    for (k = 0; k < 2; ++k)
+    {
+        // a second request must not block on a full pipe, a child must not keep it
+        fcntl(token->wake[k], F_SETFL, O_NONBLOCK);
+        fcntl(token->wake[k], F_SETFD, FD_CLOEXEC);
+    }
+    return TRUE;
+}
+
+void cancel_destroy(CANCEL_TOKEN *token)
+{
+    if (token->wake[0] >= 0)
+    {
+        close(token->wake[0]);
+        close(token->wake[1]);
+        token->wake[0] = token->wake[1] = -1;
+    }
+}
+
+// from any thread or a signal handler; the pipe is never read, so it stays readable
+void cancel_request(CANCEL_TOKEN *token)
+{
+    int saved = errno;
+
+    atomic_store_release(&token->cancelled, TRUE);
+    if (token->wake[1] >= 0)
+    {
+        (void)write(token->wake[1], "", 1);
+    }
+    errno = saved;
+}
+
+// ready for another run: not cancelled, no deadline, the pipe drained
+void cancel_reset(CANCEL_TOKEN *token)
+{
+    char drain[16];
+
+    atomic_store_release(&token->cancelled, FALSE);
+    token->deadline = 0;
+    if (token->wake[0] >= 0)
+    {
+        while (read(token->wake[0], drain, sizeof(drain)) > 0)
+        {
+        }
+    }
+}
+
+// poll on fd, and on the pipe if there is one, for up to ms or WAIT_FOREVER; other signals do not shorten it
+static int cancel_poll(CANCEL_TOKEN *token, int fd, short events, unsigned long ms)
+{
+    struct pollfd fds[2];
+    int count = 0;
+    int ready;
+    TIME_US end = time_now_us() + (TIME_US)ms * 1000;
+    TIME_US now;
+    int forever = (WAIT_FOREVER == ms) ? TRUE : FALSE;
+
+    if (fd >= 0)
+    {
+        fds[count].fd = fd;
+        fds[count].events = events;
+        ++count;
+    }
+    if (token->wake[0] >= 0)
+    {
+        fds[count].fd = token->wake[0];
+        fds[count].events = POLLIN;
+        ++count;
+    }
+    for (;;)
+    {
+        ready = poll(fds, count, forever ? -1 : (int)ms);
+        if (ready >= 0 || EINTR != errno || cancel_requested(token))
+        {
+            break;
+        }
+        if (forever)
+        {
+            continue;
+        }
+        now = time_now_us();
+        ms = (now < end) ? (unsigned long)((end - now + 999) / 1000) : 0;
+    }
+    return (ready > 0 && fd >= 0 && fds[0].revents) ? TRUE : FALSE;
+}
+
+// sleeps ms unless cancelled first; TRUE if cancelled
+int cancel_wait(CANCEL_TOKEN *token, unsigned long ms)
+{
+    if (NULL == token)
+    {
+        sleep_ms(ms);
+        return FALSE;
+    }
+    cancel_poll(token, -1, 0, cancel_bound(token, ms));
+    return cancel_requested(token);
+}
+
+// waits up to ms for events on fd: 1 once they come, 0 if they did not, -1 if cancelled
+int cancel_wait_fd(CANCEL_TOKEN *token, int fd, short events, unsigned long ms)
+{
+    int ready;
+
+    if (NULL == token)
+    {
+        struct pollfd one;
+
+        one.fd = fd;
+        one.events = events;
+        return (poll(&one, 1, (int)ms) > 0) ? 1 : 0;
+    }
+    ready = cancel_poll(token, fd, events, cancel_bound(token, ms));
+    if (cancel_requested(token))
+    {
+        return -1;
+    }
+    return ready ? 1 : 0;
+}
+
+unsigned long atomic_load_acquire(volatile unsigned long *value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+void atomic_store_release(volatile unsigned long *value, unsigned long newValue)
+{
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+}
+
+int atomic_compare_swap(volatile unsigned long *value, unsigned long expected, unsigned long newValue)
+{
+    return __atomic_compare_exchange_n(value, &expected, newValue, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ? TRUE : FALSE;
+}
+
+void atomic_fence(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#endif // _WIN32
@@ -0,0 +1,120 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else // _WIN32
+#include <pthread.h>
+#endif // _WIN32
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef _MSC_VER
+typedef unsigned __int64 PLATFORM_U64;
+#else // _MSC_VER
+typedef unsigned long long PLATFORM_U64;
+#endif // _MSC_VER
+
+typedef PLATFORM_U64 TIME_US;   // microseconds
+
+// a variable each thread has its own copy of
+#ifdef _MSC_VER
+#define THREAD_LOCAL    __declspec(thread)
+#else // _MSC_VER
+#define THREAD_LOCAL    __thread
+#endif // _MSC_VER
+
+typedef void (*THREAD_FUNC)(void *arg);
+
+typedef struct _PLATFORM_THREAD
+{
+#ifdef _WIN32
+    HANDLE handle;
+#else // _WIN32
+    pthread_t handle;
+#endif // _WIN32
+    THREAD_FUNC func;
+    void *arg;
+} PLATFORM_THREAD;
+
+typedef struct _PLATFORM_MUTEX
+{
+#ifdef _WIN32
+    CRITICAL_SECTION cs;
+#else // _WIN32
+    pthread_mutex_t mutex;
+#endif // _WIN32
+} PLATFORM_MUTEX;
+
+// auto-reset: one wait returns per signal, signals do not queue up
+typedef struct _PLATFORM_EVENT
+{
+#ifdef _WIN32
+    HANDLE handle;
+#else // _WIN32
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int signalled;
+#endif // _WIN32
+} PLATFORM_EVENT;
+
+#define WAIT_FOREVER    ((unsigned long)-1)
+
+// a stop another thread or a signal handler asks for, and the waits it cuts short
+typedef struct _CANCEL_TOKEN
+{
+    volatile unsigned long cancelled;
+    TIME_US deadline;           // cancelled from then on, 0 for never
+#ifdef _WIN32
+    HANDLE wake;                // manual reset, set once cancelled
+#else // _WIN32
+    int wake[2];                // a pipe, readable once cancelled
+#endif // _WIN32
+} CANCEL_TOKEN;
+
+// the thread structure must stay put until thread_join
+int thread_start(PLATFORM_THREAD *thread, THREAD_FUNC func, void *arg);
+void thread_join(PLATFORM_THREAD *thread);
+unsigned long thread_id(void);     // of the calling thread, as the OS numbers it
+int cpu_count(void);               // processors online, at least 1
+
+void mutex_init(PLATFORM_MUTEX *mutex);
+void mutex_destroy(PLATFORM_MUTEX *mutex);
+void mutex_lock(PLATFORM_MUTEX *mutex);
+void mutex_unlock(PLATFORM_MUTEX *mutex);
+int mutex_trylock(PLATFORM_MUTEX *mutex);   // TRUE if the lock was taken
+
+int event_init(PLATFORM_EVENT *event);
+void event_destroy(PLATFORM_EVENT *event);
+void event_signal(PLATFORM_EVENT *event);
+int event_wait(PLATFORM_EVENT *event, unsigned long timeoutMs);
+
+// for a value one thread writes and another reads, as with the SPSC ring
+unsigned long atomic_load_acquire(volatile unsigned long *value);
+void atomic_store_release(volatile unsigned long *value, unsigned long newValue);
+// TRUE if *value was expected and is now newValue
+int atomic_compare_swap(volatile unsigned long *value, unsigned long expected, unsigned long newValue);
+// no load or store moves across it, as a seqlock needs around its data
+void atomic_fence(void);
+
+TIME_US time_now_us(void);
+void sleep_ms(unsigned long ms);
+
+int cancel_init(CANCEL_TOKEN *token);
+void cancel_destroy(CANCEL_TOKEN *token);
+void cancel_request(CANCEL_TOKEN *token);      // safe in a signal handler
+void cancel_deadline(CANCEL_TOKEN *token, unsigned long ms);
+int cancel_requested(CANCEL_TOKEN *token);
+void cancel_reset(CANCEL_TOKEN *token);
+int cancel_wait(CANCEL_TOKEN *token, unsigned long ms);
+#ifndef _WIN32
+int cancel_wait_fd(CANCEL_TOKEN *token, int fd, short events, unsigned long ms);
+#endif // _WIN32
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* PLATFORM_H */
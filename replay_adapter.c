@@ -0,0 +1,340 @@
+#ifdef WINDDK
+#include <windows.h>
+#include <strsafe.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "globals.h"
+#include "platform.h"
+#include "serial.h"
+#include "capture.h"
+#include "replay_adapter.h"
+
+#define REPLAY_GROWTH   256
+
+// make room for one more element, FALSE if out of memory
+static int grow(void **array, long *max, long count, size_t elemSize)
+{
+    long newMax;
+    void *newArray;
+
+    if (count < *max)
+    {
+        return TRUE;
+    }
+    newMax = *max ? *max * 2 : REPLAY_GROWTH;
+    newArray = realloc(*array, newMax * elemSize);
+    if (NULL == newArray)
+    {
+        return FALSE;
+    }
+    *array = newArray;
+    *max = newMax;
+    return TRUE;
+}
+
+// the command as matched: upper case, without the CR or spaces
+static void command_key(char *key, const unsigned char *data, unsigned long length)
+{
+    unsigned long k;
+    int n = 0;
+
+    for (k = 0; k < length && n < REPLAY_MAX_COMMAND - 1; ++k)
+    {
+        if (RECORD_DELIMITER == data[k] || LINE_DELIMITER == data[k])
+        {
+            break;
+        }
+        if (' ' != data[k])
+        {
+            key[n++] = (char)toupper(data[k]);
+        }
+    }
+    key[n] = '\0';
+}
+
+static unsigned int command_hash(const char *key)
+{
+    unsigned int hash = 0;
+
+    while (*key)
+    {
+        hash = hash * 31 + (unsigned char)*key++;
+    }
+    return hash % REPLAY_BUCKETS;
+}
+
+static long find_command(const REPLAY_ADAPTER *adapter, const char *key)
+{
+    long cmd;
+
+    for (cmd = adapter->buckets[command_hash(key)]; cmd >= 0; cmd = adapter->commands[cmd].hashNext)
+    {
+        if (0 == strcmp(adapter->commands[cmd].text, key))
+        {
+            return cmd;
+        }
+    }
+    return -1;
+}
+
+// start an exchange for the command, FALSE if out of memory
+static int add_exchange(REPLAY_ADAPTER *adapter, const char *key)
+{
+    long cmd = find_command(adapter, key);
+    REPLAY_EXCHANGE *exchange;
+
+    if (cmd < 0)
+    {
+        REPLAY_COMMAND *command;
+        unsigned int bucket = command_hash(key);
+
+        if (!grow((void **)&adapter->commands, &adapter->maxCommands, adapter->numCommands, sizeof(REPLAY_COMMAND)))
+        {
+            return FALSE;
+        }
+        cmd = adapter->numCommands++;
+        command = &adapter->commands[cmd];
+        StringCchCopy(command->text, sizeof(command->text), key);
+        command->first = -1;
+        command->last = -1;
+        command->hashNext = adapter->buckets[bucket];
+        adapter->buckets[bucket] = cmd;
+    }
+    if (!grow((void **)&adapter->exchanges, &adapter->maxExchanges, adapter->numExchanges, sizeof(REPLAY_EXCHANGE)))
+    {
+        return FALSE;
+    }
+    exchange = &adapter->exchanges[adapter->numExchanges];
+    exchange->firstChunk = adapter->numChunks;
+    exchange->numChunks = 0;
+    exchange->nextSame = -1;
+    if (adapter->commands[cmd].last >= 0)
+    {
+        adapter->exchanges[adapter->commands[cmd].last].nextSame = adapter->numExchanges;
+    }
+    else
+    {
+        adapter->commands[cmd].first = adapter->numExchanges;
+        adapter->commands[cmd].cursor = adapter->numExchanges;
+    }
+    adapter->commands[cmd].last = adapter->numExchanges;
+    ++adapter->numExchanges;
+    return TRUE;
+}
+
+static int adapter_open(COMPORT *port)
+{
+    REPLAY_ADAPTER *adapter = (REPLAY_ADAPTER *)port->context;
+    long cmd;
+
+    // every open plays the capture from the top again
+    for (cmd = 0; cmd < adapter->numCommands; ++cmd)
+    {
+        adapter->commands[cmd].cursor = adapter->commands[cmd].first;
+    }
+    adapter->now = 0;
+    adapter->sentAt = 0;
+    adapter->pending = -1;
+    adapter->nextChunk = 0;
+    adapter->chunkUsed = 0;
+    adapter->noData.data = NULL;
+    adapter->requests = 0;
+    adapter->unmatched = 0;
+    return 0;
+}
+
+static void adapter_close(COMPORT *port)
+{
+    ((REPLAY_ADAPTER *)port->context)->pending = -1;
+}
+
+static void adapter_write(COMPORT *port, const char *data, unsigned long length)
+{
+    REPLAY_ADAPTER *adapter = (REPLAY_ADAPTER *)port->context;
+    char key[REPLAY_MAX_COMMAND];
+    long cmd;
+
+    command_key(key, (const unsigned char *)data, length);
+    cmd = find_command(adapter, key);
+    ++adapter->requests;
+    adapter->sentAt = adapter->now;
+    adapter->nextChunk = 0;
+    adapter->chunkUsed = 0;
+    if (cmd < 0)
+    {
+        // what an ELM327 with echo on says when no ECU answers
+#ifdef WIN_VS6
+        sprintf(adapter->noDataText, "%s\rNO DATA\r\r>", key);
+#else // WIN_VS6
+        StringCchPrintf(adapter->noDataText, sizeof(adapter->noDataText), "%s\rNO DATA\r\r>", key);
+#endif // WIN_VS6
+        adapter->noData.data = (const unsigned char *)adapter->noDataText;
+        adapter->noData.length = (unsigned long)strlen(adapter->noDataText);
+        adapter->noData.delay = 0;
+        adapter->pending = -1;
+        ++adapter->unmatched;
+        return;
+    }
+    adapter->pending = adapter->commands[cmd].cursor;
+    if (adapter->exchanges[adapter->pending].nextSame >= 0)
+    {
+        adapter->commands[cmd].cursor = adapter->exchanges[adapter->pending].nextSame;
+    }
+}
+
+static unsigned long adapter_read(COMPORT *port, char *buf, unsigned long size)
+{
+    REPLAY_ADAPTER *adapter = (REPLAY_ADAPTER *)port->context;
+    const REPLAY_CHUNK *chunk;
+    unsigned long count = 0;
+    unsigned long take;
+    long numChunks;
+
+    if (adapter->pending >= 0)
+    {
+        chunk = &adapter->chunks[adapter->exchanges[adapter->pending].firstChunk];
+        numChunks = adapter->exchanges[adapter->pending].numChunks;
+    }
+    else
+    {
+        chunk = &adapter->noData;
+        numChunks = adapter->noData.data ? 1 : 0;
+    }
+
+    // everything due by now, in the order it came in
+    while (count < size &&
+           adapter->nextChunk < numChunks &&
+           adapter->sentAt + chunk[adapter->nextChunk].delay <= adapter->now)
+    {
+        take = chunk[adapter->nextChunk].length - adapter->chunkUsed;
+        if (take > size - count)
+        {
+            take = size - count;
+        }
+        memcpy(buf + count, chunk[adapter->nextChunk].data + adapter->chunkUsed, take);
+        count += take;
+        adapter->chunkUsed += take;
+        if (adapter->chunkUsed == chunk[adapter->nextChunk].length)
+        {
+            ++adapter->nextChunk;
+            adapter->chunkUsed = 0;
+        }
+    }
+    return count;
+}
+
+static void adapter_wait(COMPORT *port, unsigned long ms)
+{
+    REPLAY_ADAPTER *adapter = (REPLAY_ADAPTER *)port->context;
+
+    adapter->now += (TIME_US)ms * 1000;
+    if (adapter->speed > 0.0)
+    {
+        (void)cancel_wait(port->cancel, (unsigned long)(ms / adapter->speed));
+    }
+}
+
+static TIME_US adapter_now(COMPORT *port)
+{
+    return ((REPLAY_ADAPTER *)port->context)->now;
+}
+
+static const TRANSPORT_OPS adapterOps =
+{
+    adapter_open,
+    adapter_close,
+    adapter_write,
+    adapter_read,
+    adapter_wait,
+    adapter_now
+};
+
+/*
+ * Sort the capture into exchanges: each command and the bytes received
+ * until the next one.  Traffic before the first command is dropped.
+ * returns FALSE if buf is not a capture or there is not enough memory
+ */
+int replay_adapter_init(REPLAY_ADAPTER *adapter, const char *buf, unsigned long size, double speed)
+{
+    CAPTURE_READER reader;
+    CAPTURE_RECORD rec;
+    TIME_US sentAt = 0;
+    char key[REPLAY_MAX_COMMAND];
+    int k;
+
+    memset(adapter, 0, sizeof(*adapter));
+    for (k = 0; k < REPLAY_BUCKETS; ++k)
+    {
+        adapter->buckets[k] = -1;
+    }
+    adapter->speed = speed;
+    adapter->pending = -1;
+    if (!capture_reader_init(&reader, buf, size))
+    {
+        return FALSE;
+    }
+
+    while (capture_next(&reader, &rec))
+    {
+        if (CAPTURE_TX == rec.type)
+        {
+            command_key(key, rec.data, rec.length);
+            if (!add_exchange(adapter, key))
+            {
+                replay_adapter_free(adapter);
+                return FALSE;
+            }
+            sentAt = rec.time;
+        }
+        else if (CAPTURE_RX == rec.type &&
+                 adapter->numExchanges > 0 &&
+                 rec.length > 0)
+        {
+            REPLAY_CHUNK *chunk;
+
+            if (!grow((void **)&adapter->chunks, &adapter->maxChunks, adapter->numChunks, sizeof(REPLAY_CHUNK)))
+            {
+                replay_adapter_free(adapter);
+                return FALSE;
+            }
+            chunk = &adapter->chunks[adapter->numChunks++];
+            chunk->data = rec.data;
+            chunk->length = rec.length;
+            chunk->delay = rec.time - sentAt;
+            ++adapter->exchanges[adapter->numExchanges - 1].numChunks;
+        }
+    }
+    return TRUE;
+}
+
+void replay_adapter_free(REPLAY_ADAPTER *adapter)
+{
+    free(adapter->chunks);
+    free(adapter->exchanges);
+    free(adapter->commands);
+    adapter->chunks = NULL;
+    adapter->exchanges = NULL;
+    adapter->commands = NULL;
+    adapter->numChunks = 0;
+    adapter->numExchanges = 0;
+    adapter->numCommands = 0;
+}
+
+// the port then talks to the adapter, open_comport and the rest as usual
+void replay_adapter_attach(REPLAY_ADAPTER *adapter, COMPORT *port)
+{
+    port->ops = &adapterOps;
+    port->context = adapter;
+}
+
+// virtual us since the port was opened
+TIME_US replay_adapter_time(const REPLAY_ADAPTER *adapter)
+{
+    return adapter->now;
+}
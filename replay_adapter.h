@@ -0,0 +1,82 @@
+#ifndef REPLAY_ADAPTER_H
+#define REPLAY_ADAPTER_H
+
+#include "platform.h"
+#include "serial.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REPLAY_MAX_COMMAND  16      // command text kept per request, without the CR
+#define REPLAY_BUCKETS      256     // command hash buckets
+#define REPLAY_FAST         0.0     // speed: never sleep, only the virtual clock moves
+
+typedef struct _REPLAY_CHUNK
+{
+    const unsigned char *data;      // in the capture
+    unsigned long length;
+    TIME_US delay;                  // after the command went out
+} REPLAY_CHUNK;
+
+typedef struct _REPLAY_EXCHANGE
+{
+    long firstChunk;
+    long numChunks;
+    long nextSame;                  // next exchange for the same command, -1 at the end
+} REPLAY_EXCHANGE;
+
+typedef struct _REPLAY_COMMAND
+{
+    char text[REPLAY_MAX_COMMAND];
+    long first;                     // exchanges in capture order
+    long last;
+    long cursor;                    // the next one to play
+    long hashNext;
+} REPLAY_COMMAND;
+
+/*
+ * A virtual adapter that answers each command with the response the
+ * capture recorded for it.  The nth request for a command gets its nth
+ * recorded answer, the last one over again when the capture runs out,
+ * and "NO DATA" if the command never appeared.  Response bytes become
+ * readable at their recorded delay after the command, on a virtual clock
+ * that advances only when the caller waits: at speed 1 the wait sleeps
+ * in real time, at speed N it sleeps 1/N of it, at REPLAY_FAST not at
+ * all.  The same capture and the same code therefore always give the
+ * same scan, at any speed.
+ */
+typedef struct _REPLAY_ADAPTER
+{
+    REPLAY_CHUNK *chunks;
+    long numChunks;
+    long maxChunks;
+    REPLAY_EXCHANGE *exchanges;
+    long numExchanges;
+    long maxExchanges;
+    REPLAY_COMMAND *commands;
+    long numCommands;
+    long maxCommands;
+    long buckets[REPLAY_BUCKETS];
+    double speed;
+    TIME_US now;                    // virtual us since the port was opened
+    TIME_US sentAt;                 // virtual time of the last command
+    long pending;                   // exchange being answered, -1 if none
+    long nextChunk;                 // of the pending exchange
+    unsigned long chunkUsed;
+    REPLAY_CHUNK noData;
+    char noDataText[REPLAY_MAX_COMMAND + 16];
+    unsigned long requests;
+    unsigned long unmatched;        // requests answered with NO DATA
+} REPLAY_ADAPTER;
+
+int replay_adapter_init(REPLAY_ADAPTER *adapter, const char *buf, unsigned long size, double speed);
+void replay_adapter_free(REPLAY_ADAPTER *adapter);
+void replay_adapter_attach(REPLAY_ADAPTER *adapter, COMPORT *port);
+TIME_US replay_adapter_time(const REPLAY_ADAPTER *adapter);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* REPLAY_ADAPTER_H */
@@ -0,0 +1,471 @@
+#ifdef WINDDK
+#include <windows.h>
+#include <strsafe.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "globals.h"
+#include "platform.h"
+#include "scan_stats.h"
+
+#define STATS_MODES     0x10                // OBD modes 00-0F, each with its own table row
+#define STATS_OTHER     STATS_MODES         // the row for AT commands and everything else
+#define STATS_PIDS      256
+
+typedef struct _STATS_ECU
+{
+    char id[12];            // header ID, empty when headers are off
+    unsigned long answers;
+} STATS_ECU;
+
+typedef struct _STATS_ENTRY
+{
+    int mode;               // STATS_OTHER for anything but an OBD request
+    int pid;                // STATS_NO_PID if the request has none
+    unsigned long requests;
+    unsigned long timeouts;     // nothing came back
+    unsigned long noData;       // "NO DATA" came back
+    unsigned long noPrompt;     // something came back, but not the prompt
+    unsigned long txBytes;
+    unsigned long rxBytes;
+    LATENCY_HISTOGRAM firstByte;    // command sent to the first byte seen
+    LATENCY_HISTOGRAM prompt;       // command sent to the '>' seen
+    int numEcus;
+    STATS_ECU ecus[STATS_MAX_ECUS];
+} STATS_ENTRY;
+
+typedef struct _SCAN_STATS
+{
+    int isOpen;
+    char fname[256];
+    PLATFORM_MUTEX lock;
+    unsigned long requests;
+    unsigned long timeouts;
+    unsigned long noData;
+    unsigned long noPrompt;
+    unsigned long txBytes;
+    unsigned long rxBytes;
+    unsigned long answers;
+    // allocated as each mode and pid is first seen, a pid of STATS_NO_PID is the last column
+    STATS_ENTRY *entries[STATS_MODES + 1][STATS_PIDS + 1];
+} SCAN_STATS;
+
+static SCAN_STATS scanStats;
+static volatile sig_atomic_t dumpRequested;
+
+static int bucket_index(TIME_US value)
+{
+    int shift = 0;
+
+    while ((value >> shift) >= 2 * STATS_SUB_BUCKETS)
+    {
+        ++shift;
+    }
+    if (shift > STATS_MAX_SHIFT)
+    {
+        return STATS_BUCKETS - 1;
+    }
+    return shift * STATS_SUB_BUCKETS + (int)(value >> shift);
+}
+
+// the highest value counted in a bucket
+static TIME_US bucket_value(int index)
+{
+    int shift = (index < 2 * STATS_SUB_BUCKETS) ? 0 : index / STATS_SUB_BUCKETS - 1;
+
+    return ((TIME_US)(index - shift * STATS_SUB_BUCKETS) << shift) + ((TIME_US)1 << shift) - 1;
+}
+
+static void histogram_record(LATENCY_HISTOGRAM *hist, TIME_US value)
+{
+    if (0 == hist->count || value < hist->min)
+    {
+        hist->min = value;
+    }
+    if (value > hist->max)
+    {
+        hist->max = value;
+    }
+    ++hist->count;
+    hist->sum += value;
+    ++hist->buckets[bucket_index(value)];
+}
+
+// percent of 100 gives the max
+static TIME_US histogram_percentile(const LATENCY_HISTOGRAM *hist, double percent)
+{
+    unsigned long target = (unsigned long)(hist->count * percent / 100.0 + 0.5);
+    unsigned long seen = 0;
+    int k;
+
+    if (0 == target)
+    {
+        target = 1;
+    }
+    for (k = 0; k < STATS_BUCKETS; ++k)
+    {
+        seen += hist->buckets[k];
+        if (seen >= target)
+        {
+            TIME_US value = bucket_value(k);
+            return (value < hist->max) ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+// the mode and pid of an OBD request such as "010C" or "03", STATS_OTHER otherwise
+static void command_key(const char *command, int *mode, int *pid)
+{
+    int digits[4];
+    int n = 0;
+
+    *mode = STATS_OTHER;
+    *pid = STATS_NO_PID;
+    for (; *command && '\r' != *command && n < 4; ++command)
+    {
+        if (' ' == *command)
+        {
+            continue;
+        }
+        if (!isxdigit((unsigned char)*command))
+        {
+            return;
+        }
+        digits[n++] = isdigit((unsigned char)*command) ? *command - '0' : toupper((unsigned char)*command) - 'A' + 10;
+    }
+    if (n < 2 || 1 == (n & 1) || digits[0] * 16 + digits[1] >= STATS_MODES)
+    {
+        return;
+    }
+    *mode = digits[0] * 16 + digits[1];
+    if (4 == n)
+    {
+        *pid = digits[2] * 16 + digits[3];
+    }
+}
+
+// call with the lock held, NULL if out of memory
+static STATS_ENTRY *find_entry(int mode, int pid)
+{
+    STATS_ENTRY **slot;
+
+    if (mode < 0 || mode > STATS_OTHER)
+    {
+        mode = STATS_OTHER;
+    }
+    if (pid < 0 || pid >= STATS_PIDS)
+    {
+        pid = STATS_NO_PID;
+    }
+    slot = &scanStats.entries[mode][(STATS_NO_PID == pid) ? STATS_PIDS : pid];
+    if (NULL == *slot)
+    {
+        *slot = (STATS_ENTRY *)calloc(1, sizeof(STATS_ENTRY));
+        if (*slot)
+        {
+            (*slot)->mode = mode;
+            (*slot)->pid = pid;
+        }
+    }
+    return *slot;
+}
+
+#ifdef SIGUSR1
+// written out by the next request, files cannot be written from a handler
+static void dump_on_signal(int sig)
+{
+    (void)sig;
+    dumpRequested = TRUE;
+}
+#endif // SIGUSR1
+
+static void write_dump(void)
+{
+    FILE *out = fopen(scanStats.fname, "w");
+
+    if (out)
+    {
+        scan_stats_write_json(out);
+        fclose(out);
+    }
+}
+
+// starts collecting, the JSON goes to fname, or SCAN_STATS_FILE_NAME if NULL
+int scan_stats_open(const char *fname)
+{
+    static int exitHooked = FALSE;
+
+    scan_stats_close();
+    memset(&scanStats, 0, sizeof(scanStats));
+    StringCchCopy(scanStats.fname, sizeof(scanStats.fname), fname ? fname : SCAN_STATS_FILE_NAME);
+    scanStats.fname[sizeof(scanStats.fname) - 1] = '\0';
+    mutex_init(&scanStats.lock);
+    scanStats.isOpen = TRUE;
+
+    if (!exitHooked)
+    {
+        exitHooked = TRUE;
+        atexit(scan_stats_close);
+#ifdef SIGUSR1
+        signal(SIGUSR1, dump_on_signal);
+#endif // SIGUSR1
+    }
+    return TRUE;
+}
+
+// writes the JSON and frees the statistics
+void scan_stats_close(void)
+{
+    int mode, pid;
+
+    if (!scanStats.isOpen)
+    {
+        return;
+    }
+    write_dump();
+    scanStats.isOpen = FALSE;
+    mutex_destroy(&scanStats.lock);
+    for (mode = 0; mode <= STATS_OTHER; ++mode)
+    {
+        for (pid = 0; pid <= STATS_PIDS; ++pid)
+        {
+            free(scanStats.entries[mode][pid]);
+        }
+    }
+    memset(&scanStats, 0, sizeof(scanStats));
+}
+
+int scan_stats_enabled(void)
+{
+    return scanStats.isOpen;
+}
+
+// firstByte and prompt are 0 if the read saw no data, or no prompt
+void scan_stats_request(const char *command, TIME_US sent, TIME_US firstByte, TIME_US prompt,
+                        unsigned long txBytes, unsigned long rxBytes, int noData)
+{
+    STATS_ENTRY *entry;
+    int mode, pid;
+
+    if (!scanStats.isOpen)
+    {
+        return;
+    }
+    command_key(command, &mode, &pid);
+
+    mutex_lock(&scanStats.lock);
+    ++scanStats.requests;
+    scanStats.txBytes += txBytes;
+    scanStats.rxBytes += rxBytes;
+    entry = find_entry(mode, pid);
+    if (entry)
+    {
+        ++entry->requests;
+        entry->txBytes += txBytes;
+        entry->rxBytes += rxBytes;
+        if (0 == firstByte)
+        {
+            ++entry->timeouts;
+            ++scanStats.timeouts;
+        }
+        else
+        {
+            histogram_record(&entry->firstByte, (firstByte > sent) ? firstByte - sent : 0);
+            if (0 == prompt)
+            {
+                ++entry->noPrompt;
+                ++scanStats.noPrompt;
+            }
+            else
+            {
+                histogram_record(&entry->prompt, (prompt > sent) ? prompt - sent : 0);
+            }
+        }
+        if (noData)
+        {
+            ++entry->noData;
+            ++scanStats.noData;
+        }
+    }
+    mutex_unlock(&scanStats.lock);
+
+    if (dumpRequested)
+    {
+        dumpRequested = FALSE;
+        write_dump();
+    }
+}
+
+// one ECU's answer to an OBD request, header NULL if headers are off
+void scan_stats_answer(int mode, int pid, const char *header, int headerLength)
+{
+    STATS_ENTRY *entry;
+    int k;
+
+    if (!scanStats.isOpen)
+    {
+        return;
+    }
+    if (NULL == header || headerLength < 0)
+    {
+        headerLength = 0;
+    }
+    if (headerLength >= (int)sizeof(entry->ecus[0].id))
+    {
+        headerLength = sizeof(entry->ecus[0].id) - 1;
+    }
+
+    mutex_lock(&scanStats.lock);
+    ++scanStats.answers;
+    entry = find_entry(mode, pid);
+    if (entry)
+    {
+        for (k = 0; k < entry->numEcus; ++k)
+        {
+            if ((int)strlen(entry->ecus[k].id) == headerLength &&
+                0 == strncmp(entry->ecus[k].id, header ? header : "", headerLength))
+            {
+                break;
+            }
+        }
+        if (k == entry->numEcus && k < STATS_MAX_ECUS)
+        {
+            memcpy(entry->ecus[k].id, header ? header : "", headerLength);
+            entry->ecus[k].id[headerLength] = '\0';
+            ++entry->numEcus;
+        }
+        if (k < entry->numEcus)
+        {
+            ++entry->ecus[k].answers;
+        }
+    }
+    mutex_unlock(&scanStats.lock);
+}
+
+static void entry_label(const STATS_ENTRY *entry, char *label, unsigned long size)
+{
+    if (STATS_OTHER == entry->mode)
+    {
+        StringCchCopy(label, size, "AT");
+    }
+    else if (STATS_NO_PID == entry->pid)
+    {
+#ifdef WIN_VS6
+        sprintf(label, "%02X", entry->mode);
+#else // WIN_VS6
+        StringCchPrintf(label, size, "%02X", entry->mode);
+#endif // WIN_VS6
+    }
+    else
+    {
+#ifdef WIN_VS6
+        sprintf(label, "%02X%02X", entry->mode, entry->pid);
+#else // WIN_VS6
+        StringCchPrintf(label, size, "%02X%02X", entry->mode, entry->pid);
+#endif // WIN_VS6
+    }
+}
+
+static void write_histogram(FILE *out, const char *name, const LATENCY_HISTOGRAM *hist)
+{
+    if (0 == hist->count)
+    {
+        fprintf(out, "\"%s\": {\"count\": 0}", name);
+        return;
+    }
+    fprintf(out, "\"%s\": {\"count\": %lu, \"min\": %lu, \"mean\": %.1f, \"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"max\": %lu}",
+            name, hist->count, (unsigned long)hist->min, (double)hist->sum / hist->count,
+            (unsigned long)histogram_percentile(hist, 50.0), (unsigned long)histogram_percentile(hist, 90.0),
+            (unsigned long)histogram_percentile(hist, 99.0), (unsigned long)hist->max);
+}
+
+// latencies are in us on the port's clock, virtual for the replay adapter
+int scan_stats_write_json(FILE *out)
+{
+    int mode, pid, k;
+    int first = TRUE;
+
+    if (!scanStats.isOpen)
+    {
+        return FALSE;
+    }
+    mutex_lock(&scanStats.lock);
+    fprintf(out, "{\n  \"requests\": %lu, \"timeouts\": %lu, \"no_data\": %lu, \"no_prompt\": %lu,\n"
+                 "  \"tx_bytes\": %lu, \"rx_bytes\": %lu, \"answers\": %lu,\n  \"commands\": [",
+            scanStats.requests, scanStats.timeouts, scanStats.noData, scanStats.noPrompt,
+            scanStats.txBytes, scanStats.rxBytes, scanStats.answers);
+    for (mode = 0; mode <= STATS_OTHER; ++mode)
+    {
+        for (pid = 0; pid <= STATS_PIDS; ++pid)
+        {
+            const STATS_ENTRY *entry = scanStats.entries[mode][pid];
+            char label[8];
+
+            if (NULL == entry)
+            {
+                continue;
+            }
+            entry_label(entry, label, sizeof(label));
+            fprintf(out, "%s\n    {\"command\": \"%s\", \"requests\": %lu, \"timeouts\": %lu, \"no_data\": %lu, \"no_prompt\": %lu, "
+                         "\"tx_bytes\": %lu, \"rx_bytes\": %lu,\n     ",
+                    first ? "" : ",", label, entry->requests, entry->timeouts, entry->noData, entry->noPrompt,
+                    entry->txBytes, entry->rxBytes);
+            write_histogram(out, "first_byte_us", &entry->firstByte);
+            fprintf(out, ",\n     ");
+            write_histogram(out, "prompt_us", &entry->prompt);
+            fprintf(out, ",\n     \"ecus\": [");
+            for (k = 0; k < entry->numEcus; ++k)
+            {
+                fprintf(out, "%s{\"ecu\": \"%s\", \"answers\": %lu}", k ? ", " : "",
+                        entry->ecus[k].id, entry->ecus[k].answers);
+            }
+            fprintf(out, "]}");
+            first = FALSE;
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+    mutex_unlock(&scanStats.lock);
+    return TRUE;
+}
+
+// one line per command, for the --stats option
+void scan_stats_summary(FILE *out)
+{
+    int mode, pid;
+
+    if (!scanStats.isOpen)
+    {
+        return;
+    }
+    mutex_lock(&scanStats.lock);
+    fprintf(out, "Command  Requests  Timeouts  No data  ECUs   First byte ms p50/p99    Prompt ms p50/p99\n");
+    for (mode = 0; mode <= STATS_OTHER; ++mode)
+    {
+        for (pid = 0; pid <= STATS_PIDS; ++pid)
+        {
+            const STATS_ENTRY *entry = scanStats.entries[mode][pid];
+            char label[8];
+
+            if (NULL == entry || 0 == entry->requests)
+            {
+                continue;
+            }
+            entry_label(entry, label, sizeof(label));
+            fprintf(out, "%-7s  %8lu  %8lu  %7lu  %4d  %10.1f/%-10.1f %9.1f/%-9.1f\n",
+                    label, entry->requests, entry->timeouts, entry->noData, entry->numEcus,
+                    histogram_percentile(&entry->firstByte, 50.0) / 1000.0, histogram_percentile(&entry->firstByte, 99.0) / 1000.0,
+                    histogram_percentile(&entry->prompt, 50.0) / 1000.0, histogram_percentile(&entry->prompt, 99.0) / 1000.0);
+        }
+    }
+    fprintf(out, "Total: %lu requests, %lu timeouts, %lu no data, %lu bytes out, %lu bytes in, %lu answers\n",
+            scanStats.requests, scanStats.timeouts, scanStats.noData,
+            scanStats.txBytes, scanStats.rxBytes, scanStats.answers);
+    mutex_unlock(&scanStats.lock);
+}
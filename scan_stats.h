@@ -0,0 +1,57 @@
+#ifndef SCAN_STATS_H
+#define SCAN_STATS_H
+
+#include <stdio.h>
+#include "platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SCAN_STATS_FILE_NAME    "scan_stats.json"
+
+#define STATS_NO_PID            -1      // a request without a pid: Mode 03, 07, 0A, AT commands
+#define STATS_MAX_ECUS          8       // per command, per ISO15765-4
+#define STATS_SUB_BUCKETS       16      // per power of two, about 6% resolution
+#define STATS_MAX_SHIFT         22      // latencies cap at 2^27 us, a little over two minutes
+#define STATS_BUCKETS           ((STATS_MAX_SHIFT + 2) * STATS_SUB_BUCKETS)
+
+/*
+ * HDR-style latency histogram: values below 2 * STATS_SUB_BUCKETS are
+ * counted exactly, above that each power of two is split in
+ * STATS_SUB_BUCKETS, so a percentile is good to a few percent whatever
+ * the range.  min, max and the sum are exact.
+ */
+typedef struct _LATENCY_HISTOGRAM
+{
+    unsigned long count;
+    TIME_US min;
+    TIME_US max;
+    TIME_US sum;
+    unsigned int buckets[STATS_BUCKETS];
+} LATENCY_HISTOGRAM;
+
+/*
+ * Statistics of the interface traffic, per command and, for the answers,
+ * per ECU.  Requests are counted by sendAndWaitForResponse, which polls
+ * the interface from the moment the command is written: the latencies
+ * are to the first byte and to the prompt, to within a poll, and per
+ * command rather than per ECU since the ECUs share the one answer.
+ *
+ * Collection is off until scan_stats_open.  The JSON is written on
+ * scan_stats_close, at exit, and on SIGUSR1 at the next request.
+ */
+int scan_stats_open(const char *fname);
+void scan_stats_close(void);
+int scan_stats_enabled(void);
+void scan_stats_request(const char *command, TIME_US sent, TIME_US firstByte, TIME_US prompt,
+                        unsigned long txBytes, unsigned long rxBytes, int noData);
+void scan_stats_answer(int mode, int pid, const char *header, int headerLength);
+int scan_stats_write_json(FILE *out);
+void scan_stats_summary(FILE *out);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* SCAN_STATS_H */
@@ -0,0 +1,260 @@
+#ifdef WINDDK
+#include <windows.h>
+#include <strsafe.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "globals.h"
+#include "platform.h"
+#include "scan_trace.h"
+
+#ifdef TRACE_SCAN
+
+typedef struct _TRACE_EVENT
+{
+    const char *category;       // static strings, only the pointer is kept
+    const char *name;
+    TIME_US start;
+    TIME_US duration;
+    char detail[TRACE_DETAIL_SIZE];
+} TRACE_EVENT;
+
+// one per thread, only that thread writes to it
+typedef struct _TRACE_BUFFER
+{
+    unsigned long tid;
+    const char *threadName;
+    TRACE_EVENT *events;
+    unsigned long count;
+    unsigned long dropped;
+    int depth;
+    TIME_US open[TRACE_MAX_DEPTH];
+    struct _TRACE_BUFFER *next;
+} TRACE_BUFFER;
+
+typedef struct _SCAN_TRACE
+{
+    int isOpen;
+    char fname[256];
+    PLATFORM_MUTEX lock;        // the list of buffers
+    TRACE_BUFFER *buffers;
+    TIME_US start;
+    int generation;             // a thread's buffer from an earlier trace is not used again
+} SCAN_TRACE;
+
+volatile int scanTraceOn;
+static SCAN_TRACE scanTrace;
+static THREAD_LOCAL TRACE_BUFFER *threadBuffer;
+static THREAD_LOCAL int threadGeneration;
+
+// the calling thread's buffer, allocated on its first span; NULL if out of memory
+static TRACE_BUFFER *thread_buffer(void)
+{
+    TRACE_BUFFER *buffer;
+
+    if (!scanTrace.isOpen)
+    {
+        return NULL;
+    }
+    if (threadBuffer && threadGeneration == scanTrace.generation)
+    {
+        return threadBuffer;
+    }
+    threadBuffer = NULL;
+    threadGeneration = scanTrace.generation;
+    buffer = (TRACE_BUFFER *)calloc(1, sizeof(TRACE_BUFFER));
+    if (NULL == buffer)
+    {
+        return NULL;
+    }
+    buffer->events = (TRACE_EVENT *)malloc(TRACE_EVENTS_PER_THREAD * sizeof(TRACE_EVENT));
+    if (NULL == buffer->events)
+    {
+        free(buffer);
+        return NULL;
+    }
+    buffer->tid = thread_id();
+    mutex_lock(&scanTrace.lock);
+    buffer->next = scanTrace.buffers;
+    scanTrace.buffers = buffer;
+    mutex_unlock(&scanTrace.lock);
+    threadBuffer = buffer;
+    return buffer;
+}
+
+void trace_begin(void)
+{
+    TRACE_BUFFER *buffer = thread_buffer();
+
+    if (buffer)
+    {
+        // spans nested too deep are not recorded, but still pair up
+        if (buffer->depth < TRACE_MAX_DEPTH)
+        {
+            buffer->open[buffer->depth] = time_now_us();
+        }
+        ++buffer->depth;
+    }
+}
+
+// detail is copied, category and name must outlive the trace
+void trace_end(const char *category, const char *name, const char *detail)
+{
+    TRACE_BUFFER *buffer = thread_buffer();
+    TRACE_EVENT *event;
+
+    if (NULL == buffer || 0 == buffer->depth)
+    {
+        return;
+    }
+    if (--buffer->depth >= TRACE_MAX_DEPTH)
+    {
+        return;
+    }
+    if (buffer->count >= TRACE_EVENTS_PER_THREAD)
+    {
+        ++buffer->dropped;
+        return;
+    }
+    event = &buffer->events[buffer->count++];
+    event->category = category;
+    event->name = name;
+    event->start = buffer->open[buffer->depth];
+    event->duration = time_now_us() - event->start;
+    if (detail)
+    {
+        StringCchCopy(event->detail, sizeof(event->detail), detail);
+        event->detail[sizeof(event->detail) - 1] = '\0';
+    }
+    else
+    {
+        event->detail[0] = '\0';
+    }
+}
+
+// shown as the thread's name in the viewer
+void trace_thread_name(const char *name)
+{
+    TRACE_BUFFER *buffer = thread_buffer();
+
+    if (buffer)
+    {
+        buffer->threadName = name;
+    }
+}
+
+// commands and PIDs, but keep the JSON valid whatever comes
+static void write_detail(FILE *out, const char *detail)
+{
+    for (; *detail; ++detail)
+    {
+        if ('"' == *detail || '\\' == *detail)
+        {
+            fputc('\\', out);
+            fputc(*detail, out);
+        }
+        else if ((unsigned char)*detail < ' ')
+        {
+            fprintf(out, "\\u%04X", (unsigned char)*detail);
+        }
+        else
+        {
+            fputc(*detail, out);
+        }
+    }
+}
+
+static void write_trace(void)
+{
+    const TRACE_BUFFER *buffer;
+    unsigned long dropped = 0;
+    unsigned long k;
+    FILE *out = fopen(scanTrace.fname, "w");
+
+    if (NULL == out)
+    {
+        return;
+    }
+    fprintf(out, "{\"displayTimeUnit\": \"ms\",\n\"traceEvents\": [\n"
+                 "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"ScanTool\"}}");
+    for (buffer = scanTrace.buffers; buffer; buffer = buffer->next)
+    {
+        if (buffer->threadName)
+        {
+            fprintf(out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %lu, \"args\": {\"name\": \"%s\"}}",
+                    buffer->tid, buffer->threadName);
+        }
+        for (k = 0; k < buffer->count; ++k)
+        {
+            const TRACE_EVENT *event = &buffer->events[k];
+            fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %lu, \"dur\": %lu, \"pid\": 1, \"tid\": %lu",
+                    event->name, event->category,
+                    (unsigned long)((event->start > scanTrace.start) ? event->start - scanTrace.start : 0),
+                    (unsigned long)event->duration, buffer->tid);
+            if (event->detail[0])
+            {
+                fprintf(out, ", \"args\": {\"detail\": \"");
+                write_detail(out, event->detail);
+                fprintf(out, "\"}");
+            }
+            fprintf(out, "}");
+        }
+        dropped += buffer->dropped;
+    }
+    fprintf(out, "\n],\n\"otherData\": {\"dropped\": %lu}}\n", dropped);
+    fclose(out);
+}
+
+// starts recording, the trace goes to fname, or SCAN_TRACE_FILE_NAME if NULL
+int scan_trace_open(const char *fname)
+{
+    static int exitHooked = FALSE;
+    int generation = scanTrace.generation;
+
+    scan_trace_close();
+    memset(&scanTrace, 0, sizeof(scanTrace));
+    StringCchCopy(scanTrace.fname, sizeof(scanTrace.fname), fname ? fname : SCAN_TRACE_FILE_NAME);
+    scanTrace.fname[sizeof(scanTrace.fname) - 1] = '\0';
+    mutex_init(&scanTrace.lock);
+    scanTrace.generation = generation + 1;
+    scanTrace.start = time_now_us();
+    scanTrace.isOpen = TRUE;
+    scanTraceOn = TRUE;
+
+    if (!exitHooked)
+    {
+        exitHooked = TRUE;
+        atexit(scan_trace_close);
+    }
+    return TRUE;
+}
+
+// writes the trace; call once the threads being traced are done
+void scan_trace_close(void)
+{
+    TRACE_BUFFER *buffer;
+    int generation = scanTrace.generation;
+
+    if (!scanTrace.isOpen)
+    {
+        return;
+    }
+    scanTraceOn = FALSE;
+    write_trace();
+    mutex_destroy(&scanTrace.lock);
+    while (scanTrace.buffers)
+    {
+        buffer = scanTrace.buffers;
+        scanTrace.buffers = buffer->next;
+        free(buffer->events);
+        free(buffer);
+    }
+    memset(&scanTrace, 0, sizeof(scanTrace));
+    scanTrace.generation = generation;
+}
+
+#endif // TRACE_SCAN
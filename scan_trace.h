@@ -0,0 +1,48 @@
+#ifndef SCAN_TRACE_H
+#define SCAN_TRACE_H
+
+#include "platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SCAN_TRACE_FILE_NAME    "scan_trace.json"
+#define TRACE_EVENTS_PER_THREAD (32 * 1024)     // spans a thread keeps, later ones are counted as dropped
+#define TRACE_MAX_DEPTH         16              // spans open at once on a thread
+#define TRACE_DETAIL_SIZE       16              // bytes of detail kept per span, such as the command
+
+/*
+ * A timeline of the scan as Chrome trace-event JSON, for chrome://tracing
+ * or Perfetto.  Every span is a complete ("X") event with the OS thread
+ * ID.  Each thread records into its own buffer, allocated once on its
+ * first span, so recording takes no lock.  The file is written on
+ * scan_trace_close and at exit.
+ *
+ * TRACE_BEGIN and TRACE_END pair up on the same thread, innermost first,
+ * and cost one test of a flag while tracing is off.  Built without
+ * TRACE_SCAN they compile to nothing.
+ */
+#ifdef TRACE_SCAN
+extern volatile int scanTraceOn;
+
+#define TRACE_BEGIN()                       (scanTraceOn ? trace_begin() : (void)0)
+#define TRACE_END(category, name, detail)   (scanTraceOn ? trace_end(category, name, detail) : (void)0)
+#define TRACE_THREAD_NAME(name)             (scanTraceOn ? trace_thread_name(name) : (void)0)
+
+int scan_trace_open(const char *fname);
+void scan_trace_close(void);
+void trace_begin(void);
+void trace_end(const char *category, const char *name, const char *detail);
+void trace_thread_name(const char *name);
+#else // TRACE_SCAN
+#define TRACE_BEGIN()                       ((void)0)
+#define TRACE_END(category, name, detail)   ((void)0)
+#define TRACE_THREAD_NAME(name)             ((void)0)
+#endif // TRACE_SCAN
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* SCAN_TRACE_H */
@@ -21,8 +21,10 @@
 #include "serial.h"
 #include "sensors.h"
 #include "trouble_code_reader.h"
-
-static char *globalSimBuffer=NULL;
+#include "session.h"
+#include "output_buffer.h"
+#include "scan_trace.h"
+#include "live_values.h"
 
 typedef struct
 {
@@ -33,7 +35,6 @@ typedef struct
     int max_data_value;
     void (*formula)(int raw_data, char *buf, unsigned long bufSize);
     char label[32];
-    char screen_buf[64];
     int enabled;
     int bytes; // number of data bytes expected from vehicle
 } SENSOR;
@@ -81,96 +82,160 @@ static void abs_tp_formula(int data, char *buf, unsigned long bufSize);
 static void tac_pct_formula(int data, char *buf, unsigned long bufSize);
 static void mil_time_formula(int data, char *buf, unsigned long bufSize);
 static void clr_time_formula(int data, char *buf, unsigned long bufSize);
-static void process_trouble_codes(int data, char *buf, unsigned long bufSize);
+static void mil_status_formula(int data, char *buf, unsigned long bufSize);
 
-static SENSOR sensors[] =
+static const SENSOR sensors[] =
 {
-    //pid    IDC_x                             List Bar  max formula                       label                              screen_buffer     enabled   bytes
-    { "01",  IDC_TROUBLECODESLIST,             1,   0,  0,  process_trouble_codes,         "Trouble codes:",                  "",               1,        4},
-    { "03",  IDC_FUELSYSTEM1STATUSVALUE,       0,   0,  0,  fuel_system1_status_formula,   "Fuel System 1 Status:",           "",               1,        2},
-    { "03",  0,                                0,   0,  0,  fuel_system2_status_formula,   "Fuel System 2 Status:",           "",               1,        2},
-    { "04",  IDC_CALCULATEDLOADVALUE,          0,   0,  0,  engine_load_formula,           "Calculated Load Value:",          "",               1,        1},
-    { "05",  IDC_COOLANTTEMPVALUE,             0,   0,  0,  coolant_temp_formula,          "Coolant Temperature:",            "",               1,        1},
-    { "06",  0,                                0,   0,  0,  short_term_fuel_trim_formula,  "Short Term Fuel Trim (Bank 1):",  "",               1,        2},
-    { "07",  0,                                0,   0,  0,  long_term_fuel_trim_formula,   "Long Term Fuel Trim (Bank 1):",   "",               1,        2},
-    { "08",  0,                                0,   0,  0,  short_term_fuel_trim_formula,  "Short Term Fuel Trim (Bank 2):",  "",               1,        2},
-    { "09",  0,                                0,   0,  0,  long_term_fuel_trim_formula,   "Long Term Fuel Trim (Bank 2):",   "",               1,        2},
-    { "0A",  0,                                0,   0,  0,  fuel_pressure_formula,         "Fuel Pressure (gauge):",          "",               1,        1},
-    { "0B",  IDC_INTAKEMANIFOLDPRESSUREVALUE,  0,   0,  0,  intake_pressure_formula,       "Intake Manifold Pressure:",       "",               1,        1},
-    { "0C",  IDC_RPMNUMVALUE,                  0,   0,  0,  engine_rpm_formula,            "Engine RPM:",                     "",               1,        2},
-    { "0D",  IDC_SPEEDNUMVALUE,                0,   0,  0,  vehicle_speed_formula,         "Vehicle Speed:",                  "",               1,        1},
-    { "0E",  0,                                0,   0,  0,  timing_advance_formula,        "Timing Advance (Cyl. #1):",       "",               1,        1},
-    { "0F",  IDC_INTAKEAIRTEMPVALUE,           0,   0,  0,  intake_air_temp_formula,       "Intake Air Temperature:",         "",               1,        1},
-    { "10",  0,                                0,   0,  0,  air_flow_rate_formula,         "Air Flow Rate (MAF sensor):",     "",               1,        2},
-    { "12",  0,                                0,   0,  0,  secondary_air_status_formula,  "Secondary air status:",           "",               1,        1},
-    { "14",  IDC_O2SENSOR1BANK1VALUE,          0,   0,  0,  o2_sensor_formula,             "O2 Sensor 1, Bank 1:",            "",               1,        2},
-    { "15",  IDC_O2SENSOR2BANK1VALUE,          0,   0,  0,  o2_sensor_formula,             "O2 Sensor 2, Bank 1:",            "",               1,        2},
-    { "16",  0,                                0,   0,  0,  o2_sensor_formula,             "O2 Sensor 3, Bank 1:",            "",               1,        2},
-    { "17",  0,                                0,   0,  0,  o2_sensor_formula,             "O2 Sensor 4, Bank 1:",            "",               1,        2},
-    { "18",  IDC_O2SENSOR1BANK2VALUE,          0,   0,  0,  o2_sensor_formula,             "O2 Sensor 1, Bank 2:",            "",               1,        2},
-    { "19",  IDC_O2SENSOR2BANK2VALUE,          0,   0,  0,  o2_sensor_formula,             "O2 Sensor 2, Bank 2:",            "",               1,        2},
-    { "1A",  0,                                0,   0,  0,  o2_sensor_formula,             "O2 Sensor 3, Bank 2:",            "",               1,        2},
-    { "1B",  0,                                0,   0,  0,  o2_sensor_formula,             "O2 Sensor 4, Bank 2:",            "",               1,        2},
-    { "1C",  IDC_OBDCONFORMSTOVALUE,           0,   0,  0,  obd_requirements_formula,      "OBD conforms to:",                "",               1,        1},
-    { "1E",  0,                                0,   0,  0,  pto_status_formula,            "Power Take-Off Status:",          "",               1,        1},
-    { "1F",  IDC_TIMESINCEENGINESTARTVALUE,    0,   0,  0,  engine_run_time_formula,       "Time Since Engine Start:",        "",               1,        2},
-    { "21",  IDC_DISTANCESINCEMILVALUE,        0,   0,  0,  mil_distance_formula,          "Distance since MIL activated:",   "",               1,        2},
-    { "22",  0,                                0,   0,  0,  frp_relative_formula,          "FRP rel. to manifold vacuum:",    "",               1,        2},    // fuel rail pressure relative to manifold vacuum
-    { "23",  0,                                0,   0,  0,  frp_widerange_formula,         "Fuel Pressure (gauge):",          "",               1,        2},    // fuel rail pressure (gauge), wide range
-    { "24",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 1, Bank 1 (WR):",       "",               1,        4},    // o2 sensors (wide range), voltage
-    { "25",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 2, Bank 1 (WR):",       "",               1,        4},
-    { "26",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 3, Bank 1 (WR):",       "",               1,        4},
-    { "27",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 4, Bank 1 (WR):",       "",               1,        4},
-    { "28",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 1, Bank 2 (WR):",       "",               1,        4},
-    { "29",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 2, Bank 2 (WR):",       "",               1,        4},
-    { "2A",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 3, Bank 2 (WR):",       "",               1,        4},
-    { "2B",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 4, Bank 2 (WR):",       "",               1,        4},
-    { "2C",  0,                                0,   0,  0,  commanded_egr_formula,         "Commanded EGR:",                  "",               1,        1},
-    { "2D",  0,                                0,   0,  0,  egr_error_formula,             "EGR Error:",                      "",               1,        1},
-    { "2E",  0,                                0,   0,  0,  evap_pct_formula,              "Commanded Evaporative Purge:",    "",               1,        1},
-    { "2F",  IDC_FUELNUMVALUE,                 0,   0,  0,  fuel_level_formula,            "Fuel Level Input:",               "",               1,        1},
-    { "30",  IDC_WARMUPSSINCECURESETLABEL,     0,   0,  0,  warm_ups_formula,              "Warm-ups since ECU reset:",       "",               1,        1},
-    { "31",  IDC_DISTANCEECURESETVALUE,        0,   0,  0,  clr_distance_formula,          "Distance since ECU reset:",       "",               1,        2},
-    { "32",  0,                                0,   0,  0,  evap_vp_formula,               "Evap System Vapor Pressure:",     "",               1,        2},
-    { "33",  IDC_BAROMETRICPRESSUREVALUE,      0,   0,  0,  baro_pressure_formula,         "Barometric Pressure (absolute):", "",               1,        1},
-    { "34",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 1, Bank 1 (WR):",       "",               1,        4},   // o2 sensors (wide range), current
-    { "35",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 2, Bank 1 (WR):",       "",               1,        4},
-    { "36",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 3, Bank 1 (WR):",       "",               1,        4},
-    { "37",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 4, Bank 1 (WR):",       "",               1,        4},
-    { "38",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 1, Bank 2 (WR):",       "",               1,        4},
-    { "39",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 2, Bank 2 (WR):",       "",               1,        4},
-    { "3A",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 3, Bank 2 (WR):",       "",               1,        4},
-    { "3B",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 4, Bank 2 (WR):",       "",               1,        4},
-    { "3C",  0,                                0,   0,  0,  cat_temp_formula,              "CAT Temperature, B1S1:",          "",               1,        2},
-    { "3D",  0,                                0,   0,  0,  cat_temp_formula,              "CAT Temperature, B2S1:",          "",               1,        2},
-    { "3E",  0,                                0,   0,  0,  cat_temp_formula,              "CAT Temperature, B1S2:",          "",               1,        2},
-    { "3F",  0,                                0,   0,  0,  cat_temp_formula,              "CAT Temperature, B2S2:",          "",               1,        2},
-    { "42",  IDC_ECUVOLTAGEVALUE,              0,   0,  0,  ecu_voltage_formula,           "ECU voltage:",                    "",               1,        2},
-    { "43",  IDC_ABSENGINELOADVALUE,           0,   0,  0,  abs_load_formula,              "Absolute Engine Load:",           "",               1,        2},
-    { "44",  0,                                0,   0,  0,  eq_ratio_formula,              "Commanded Equivalence Ratio:",    "",               1,        2},
-    { "45",  IDC_THROTTLENUMVALUE,             0,   0,  0,  relative_tp_formula,           "Relative Throttle Position:",     "",               1,        1},
-    { "46",  IDC_AMBIENTAIRTEMPVALUE,          0,   0,  0,  amb_air_temp_formula,          "Ambient Air Temperature:",        "",               1,        1},  // same scaling as $0F
-    { "47",  0,                                0,   0,  0,  abs_tp_formula,                "Absolute Throttle Position B:",   "",               1,        1},
-    { "48",  0,                                0,   0,  0,  abs_tp_formula,                "Absolute Throttle Position C:",   "",               1,        1},
-    { "49",  0,                                0,   0,  0,  abs_tp_formula,                "Accelerator Pedal Position D:",   "",               1,        1},
-    { "4A",  0,                                0,   0,  0,  abs_tp_formula,                "Accelerator Pedal Position E:",   "",               1,        1},
-    { "4B",  0,                                0,   0,  0,  abs_tp_formula,                "Accelerator Pedal Position F:",   "",               1,        1},
-    { "4C",  0,                                0,   0,  0,  tac_pct_formula,               "Comm. Throttle Actuator Cntrl:",  "",               1,        1}, // commanded TAC
-    { "4D",  IDC_ENGINERUNMILVALUE,            0,   0,  0,  mil_time_formula,              "Engine running while MIL on:",    "",               1,        2}, // minutes run by the engine while MIL activated
-    { "4E",  IDC_TIMESINCEDTCLEAREDVALUE,      0,   0,  0,  clr_time_formula,              "Time since DTCs cleared:",        "",               1,        2},
+    //pid    IDC_x                             List Bar  max formula                       label                              enabled   bytes
+    { "01",  IDC_TROUBLECODESLIST,             1,   0,  0,  mil_status_formula,            "Trouble codes:",                  1,        4},
+    { "03",  IDC_FUELSYSTEM1STATUSVALUE,       0,   0,  0,  fuel_system1_status_formula,   "Fuel System 1 Status:",           1,        2},
+    { "03",  0,                                0,   0,  0,  fuel_system2_status_formula,   "Fuel System 2 Status:",           1,        2},
+    { "04",  IDC_CALCULATEDLOADVALUE,          0,   0,  0,  engine_load_formula,           "Calculated Load Value:",          1,        1},
+    { "05",  IDC_COOLANTTEMPVALUE,             0,   0,  0,  coolant_temp_formula,          "Coolant Temperature:",            1,        1},
+    { "06",  0,                                0,   0,  0,  short_term_fuel_trim_formula,  "Short Term Fuel Trim (Bank 1):",  1,        2},
+    { "07",  0,                                0,   0,  0,  long_term_fuel_trim_formula,   "Long Term Fuel Trim (Bank 1):",   1,        2},
+    { "08",  0,                                0,   0,  0,  short_term_fuel_trim_formula,  "Short Term Fuel Trim (Bank 2):",  1,        2},
+    { "09",  0,                                0,   0,  0,  long_term_fuel_trim_formula,   "Long Term Fuel Trim (Bank 2):",   1,        2},
+    { "0A",  0,                                0,   0,  0,  fuel_pressure_formula,         "Fuel Pressure (gauge):",          1,        1},
+    { "0B",  IDC_INTAKEMANIFOLDPRESSUREVALUE,  0,   0,  0,  intake_pressure_formula,       "Intake Manifold Pressure:",       1,        1},
+    { "0C",  IDC_RPMNUMVALUE,                  0,   0,  0,  engine_rpm_formula,            "Engine RPM:",                     1,        2},
+    { "0D",  IDC_SPEEDNUMVALUE,                0,   0,  0,  vehicle_speed_formula,         "Vehicle Speed:",                  1,        1},
+    { "0E",  0,                                0,   0,  0,  timing_advance_formula,        "Timing Advance (Cyl. #1):",       1,        1},
+    { "0F",  IDC_INTAKEAIRTEMPVALUE,           0,   0,  0,  intake_air_temp_formula,       "Intake Air Temperature:",         1,        1},
+    { "10",  0,                                0,   0,  0,  air_flow_rate_formula,         "Air Flow Rate (MAF sensor):",     1,        2},
+    { "12",  0,                                0,   0,  0,  secondary_air_status_formula,  "Secondary air status:",           1,        1},
+    { "14",  IDC_O2SENSOR1BANK1VALUE,          0,   0,  0,  o2_sensor_formula,             "O2 Sensor 1, Bank 1:",            1,        2},
+    { "15",  IDC_O2SENSOR2BANK1VALUE,          0,   0,  0,  o2_sensor_formula,             "O2 Sensor 2, Bank 1:",            1,        2},
+    { "16",  0,                                0,   0,  0,  o2_sensor_formula,             "O2 Sensor 3, Bank 1:",            1,        2},
+    { "17",  0,                                0,   0,  0,  o2_sensor_formula,             "O2 Sensor 4, Bank 1:",            1,        2},
+    { "18",  IDC_O2SENSOR1BANK2VALUE,          0,   0,  0,  o2_sensor_formula,             "O2 Sensor 1, Bank 2:",            1,        2},
+    { "19",  IDC_O2SENSOR2BANK2VALUE,          0,   0,  0,  o2_sensor_formula,             "O2 Sensor 2, Bank 2:",            1,        2},
+    { "1A",  0,                                0,   0,  0,  o2_sensor_formula,             "O2 Sensor 3, Bank 2:",            1,        2},
+    { "1B",  0,                                0,   0,  0,  o2_sensor_formula,             "O2 Sensor 4, Bank 2:",            1,        2},
+    { "1C",  IDC_OBDCONFORMSTOVALUE,           0,   0,  0,  obd_requirements_formula,      "OBD conforms to:",                1,        1},
+    { "1E",  0,                                0,   0,  0,  pto_status_formula,            "Power Take-Off Status:",          1,        1},
+    { "1F",  IDC_TIMESINCEENGINESTARTVALUE,    0,   0,  0,  engine_run_time_formula,       "Time Since Engine Start:",        1,        2},
+    { "21",  IDC_DISTANCESINCEMILVALUE,        0,   0,  0,  mil_distance_formula,          "Distance since MIL activated:",   1,        2},
+    { "22",  0,                                0,   0,  0,  frp_relative_formula,          "FRP rel. to manifold vacuum:",    1,        2},    // fuel rail pressure relative to manifold vacuum
+    { "23",  0,                                0,   0,  0,  frp_widerange_formula,         "Fuel Pressure (gauge):",          1,        2},    // fuel rail pressure (gauge), wide range
+    { "24",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 1, Bank 1 (WR):",       1,        4},    // o2 sensors (wide range), voltage
+    { "25",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 2, Bank 1 (WR):",       1,        4},
+    { "26",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 3, Bank 1 (WR):",       1,        4},
+    { "27",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 4, Bank 1 (WR):",       1,        4},
+    { "28",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 1, Bank 2 (WR):",       1,        4},
+    { "29",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 2, Bank 2 (WR):",       1,        4},
+    { "2A",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 3, Bank 2 (WR):",       1,        4},
+    { "2B",  0,                                0,   0,  0,  o2_sensor_wrv_formula,         "O2 Sensor 4, Bank 2 (WR):",       1,        4},
+    { "2C",  0,                                0,   0,  0,  commanded_egr_formula,         "Commanded EGR:",                  1,        1},
+    { "2D",  0,                                0,   0,  0,  egr_error_formula,             "EGR Error:",                      1,        1},
+    { "2E",  0,                                0,   0,  0,  evap_pct_formula,              "Commanded Evaporative Purge:",    1,        1},
+    { "2F",  IDC_FUELNUMVALUE,                 0,   0,  0,  fuel_level_formula,            "Fuel Level Input:",               1,        1},
+    { "30",  IDC_WARMUPSSINCECURESETLABEL,     0,   0,  0,  warm_ups_formula,              "Warm-ups since ECU reset:",       1,        1},
+    { "31",  IDC_DISTANCEECURESETVALUE,        0,   0,  0,  clr_distance_formula,          "Distance since ECU reset:",       1,        2},
+    { "32",  0,                                0,   0,  0,  evap_vp_formula,               "Evap System Vapor Pressure:",     1,        2},
+    { "33",  IDC_BAROMETRICPRESSUREVALUE,      0,   0,  0,  baro_pressure_formula,         "Barometric Pressure (absolute):", 1,        1},
+    { "34",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 1, Bank 1 (WR):",       1,        4},   // o2 sensors (wide range), current
+    { "35",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 2, Bank 1 (WR):",       1,        4},
+    { "36",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 3, Bank 1 (WR):",       1,        4},
+    { "37",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 4, Bank 1 (WR):",       1,        4},
+    { "38",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 1, Bank 2 (WR):",       1,        4},
+    { "39",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 2, Bank 2 (WR):",       1,        4},
+    { "3A",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 3, Bank 2 (WR):",       1,        4},
+    { "3B",  0,                                0,   0,  0,  o2_sensor_wrc_formula,         "O2 Sensor 4, Bank 2 (WR):",       1,        4},
+    { "3C",  0,                                0,   0,  0,  cat_temp_formula,              "CAT Temperature, B1S1:",          1,        2},
+    { "3D",  0,                                0,   0,  0,  cat_temp_formula,              "CAT Temperature, B2S1:",          1,        2},
+    { "3E",  0,                                0,   0,  0,  cat_temp_formula,              "CAT Temperature, B1S2:",          1,        2},
+    { "3F",  0,                                0,   0,  0,  cat_temp_formula,              "CAT Temperature, B2S2:",          1,        2},
+    { "42",  IDC_ECUVOLTAGEVALUE,              0,   0,  0,  ecu_voltage_formula,           "ECU voltage:",                    1,        2},
+    { "43",  IDC_ABSENGINELOADVALUE,           0,   0,  0,  abs_load_formula,              "Absolute Engine Load:",           1,        2},
+    { "44",  0,                                0,   0,  0,  eq_ratio_formula,              "Commanded Equivalence Ratio:",    1,        2},
+    { "45",  IDC_THROTTLENUMVALUE,             0,   0,  0,  relative_tp_formula,           "Relative Throttle Position:",     1,        1},
+    { "46",  IDC_AMBIENTAIRTEMPVALUE,          0,   0,  0,  amb_air_temp_formula,          "Ambient Air Temperature:",        1,        1},  // same scaling as $0F
+    { "47",  0,                                0,   0,  0,  abs_tp_formula,                "Absolute Throttle Position B:",   1,        1},
+    { "48",  0,                                0,   0,  0,  abs_tp_formula,                "Absolute Throttle Position C:",   1,        1},
+    { "49",  0,                                0,   0,  0,  abs_tp_formula,                "Accelerator Pedal Position D:",   1,        1},
+    { "4A",  0,                                0,   0,  0,  abs_tp_formula,                "Accelerator Pedal Position E:",   1,        1},
+    { "4B",  0,                                0,   0,  0,  abs_tp_formula,                "Accelerator Pedal Position F:",   1,        1},
+    { "4C",  0,                                0,   0,  0,  tac_pct_formula,               "Comm. Throttle Actuator Cntrl:",  1,        1}, // commanded TAC
+    { "4D",  IDC_ENGINERUNMILVALUE,            0,   0,  0,  mil_time_formula,              "Engine running while MIL on:",    1,        2}, // minutes run by the engine while MIL activated
+    { "4E",  IDC_TIMESINCEDTCLEAREDVALUE,      0,   0,  0,  clr_time_formula,              "Time since DTCs cleared:",        1,        2},
 #ifndef WIN_GUI
-    { "0C",  IDC_ENGINERPMVALUE,               0,   1,  16383,  engine_rpm_formula,            "Engine RPM:",                     "",               1,        2},
-    { "0D",  IDC_VEHICLESPEEDVALUE,            0,   1,  255,  vehicle_speed_formula,         "Vehicle Speed:",                  "",               1,        1},
-    { "2F",  IDC_FUELEVELVALUE,                0,   1,  100,  fuel_level_formula,            "Fuel Level Input:",               "",               1,        1},
-    { "45",  IDC_RELTHROTTLEVALUE,             0,   1,  100,  relative_tp_formula,           "Relative Throttle Position:",     "",               1,        1},
+    { "0C",  IDC_ENGINERPMVALUE,               0,   1,  16383,  engine_rpm_formula,            "Engine RPM:",                     1,        2},
+    { "0D",  IDC_VEHICLESPEEDVALUE,            0,   1,  255,  vehicle_speed_formula,         "Vehicle Speed:",                  1,        1},
+    { "2F",  IDC_FUELEVELVALUE,                0,   1,  100,  fuel_level_formula,            "Fuel Level Input:",               1,        1},
+    { "45",  IDC_RELTHROTTLEVALUE,             0,   1,  100,  relative_tp_formula,           "Relative Throttle Position:",     1,        1},
 #endif  // WIN_GUI
-    { "",    0,                                0,   0,  0,     NULL,                          "",                                "",               0,        0}
+    { "",    0,                                0,   0,  0,     NULL,                          "",                                0,        0}
 };
 
 // Options
-static int system_of_measurements = IMPERIAL;
+static const int system_of_measurements = IMPERIAL;
+
+// data bytes of the Mode 01 pid, 0 if no sensor decodes it
+int sensor_bytes(int pid)
+{
+    char hexValue[PID_SIZE+1];
+    int bytes = 0;
+    int index;
+
+#ifdef WIN_VS6
+    sprintf(hexValue, "%02X", pid);
+#else // WIN_VS6
+    StringCchPrintf(hexValue, sizeof(hexValue), "%02X", pid);
+#endif // WIN_VS6
+    for (index = 0; sensors[index].pid[0]; ++index)
+    {
+        if (0 == strncmp(hexValue, sensors[index].pid, PID_SIZE) &&
+            sensors[index].bytes > bytes)
+        {
+            bytes = sensors[index].bytes;
+        }
+    }
+    return bytes;
+}
+
+// entries in the sensor table, for tools that walk every formula
+int sensor_count(void)
+{
+    int count = 0;
+
+    while (sensors[count].pid[0])
+    {
+        ++count;
+    }
+    return count;
+}
+
+const char *sensor_label(int index)
+{
+    return sensors[index].label;
+}
+
+const char *sensor_pid(int index)
+{
+    return sensors[index].pid;
+}
+
+// data bytes the sensor decodes
+int sensor_data_bytes(int index)
+{
+    return sensors[index].bytes;
+}
+
+// the display text of a raw value, as the sensor's formula writes it
+void sensor_format(int index, int raw, char *buf, unsigned long bufSize)
+{
+    if (sensors[index].formula)
+    {
+        sensors[index].formula(raw, buf, bufSize);
+    }
+    else if (bufSize)
+    {
+        *buf = '\0';
+    }
+}
 
-int codeIsDisplayed(unsigned long index)
+int codeIsDisplayed(SCAN_SESSION *session, unsigned long index)
 {
     int rc = 0;
     char hexValue[16];
@@ -181,8 +246,8 @@ int codeIsDisplayed(unsigned long index)
 #endif // WIN_VS6
 
     index = 0;
-    // until we get a stop work order or run out of pids in the list
-    while ((0 == stopWork) && sensors[index].pid[0])
+    // until we run out of pids in the list; a lookup is too short to need a cancel check
+    while (sensors[index].pid[0])
     {
         // check to see if the pids match
         if (0 == strncmp(hexValue, sensors[index].pid, PID_SIZE))
@@ -203,41 +268,107 @@ int codeIsDisplayed(unsigned long index)
 }
 
 
-void process_and_display_data(char *buf, char *simBuffer)
+// run a sensor formula at the cursor of out, returns where its text starts
+static char *append_sensor_value(OUTPUT_BUFFER *out, const SENSOR *sensor, int data)
+{
+    unsigned long avail;
+    char *value = outbuf_reserve(out, SCREEN_BUF_SIZE, &avail);
+
+    if (value)
+    {
+        // all routines null terminate the buffer
+        TRACE_BEGIN();
+        sensor->formula(data, value, avail);
+        TRACE_END("decode", "format", sensor->pid);
+        outbuf_commit(out);
+    }
+    return value;
+}
+
+
+/*
+ * One ECU's answer to Mode 01 PID 01.  Each ECU reports its own MIL and
+ * stored code count, so over the answers to one request the MIL is on if
+ * any has it on and the counts add up.  The caller sets statusAnswers to
+ * 0 as each request's answers begin.
+ */
+void note_monitor_status(SCAN_SESSION *session, unsigned long value)
+{
+    int milOn = (value & 0x80000000UL) ? TRUE : FALSE;
+    int count = (int)((value >> 24) & 0x7F);
+
+    if (session->statusAnswers++ && session->reportedCodeCount >= 0)
+    {
+        session->mil_is_on = session->mil_is_on || milOn;
+        session->reportedCodeCount += count;
+    }
+    else
+    {
+        session->mil_is_on = milOn;
+        session->reportedCodeCount = count;
+    }
+}
+
+// data is one decoded Mode 01 response: 41, the pid, then the value bytes
+void process_and_display_data(SCAN_SESSION *session, const unsigned char *data, int length)
 {
     // if the buffer holds a response
-    if (0 == strncmp(buf, "41", RESPONSE_SIZE))
+    if (length > RESPONSE_SIZE && 0x41 == data[0])
     {
         int index=0;
-        buf += RESPONSE_SIZE;
-        while ((0 == stopWork) && sensors[index].pid[0])
+        int pidNumber = data[1];
+        const char *published = NULL;   // the label of the value last published
+        char pid[PID_SIZE+1];
+#ifdef WIN_VS6
+        sprintf(pid, "%02X", data[1]);
+#else // WIN_VS6
+        StringCchPrintf(pid, sizeof(pid), "%02X", data[1]);
+#endif // WIN_VS6
+        data += RESPONSE_SIZE;
+        length -= RESPONSE_SIZE;
+        while (sensors[index].pid[0])
         {
             // if there is a formula
             // and it matches the pid, then we have a winner
             if (sensors[index].formula &&
-                (0 == strncmp(buf, sensors[index].pid, PID_SIZE)))
+                (0 == strncmp(pid, sensors[index].pid, PID_SIZE)))
             {
-                char *valuePtr = buf + PID_SIZE;
-                if ((int)strlen(valuePtr) >= sensors[index].bytes)
+                // bytes past the length of the pid are padding
+                if (length >= sensors[index].bytes)
                 {
-                    char outbuf[OUTPUT_BUFFER_SIZE];
-                    int data = (int) strtoul(valuePtr, NULL, DATA_RADIX);
+                    char line[OUTPUT_BUFFER_SIZE];
+                    OUTPUT_BUFFER out;
+                    char *outbuf;
+                    int value = 0;
+                    int k;
 
-                    // for the purpose of the simulator, set the global
-                    // pointer to the input buffer value to pick up where they left off
-                    if (simBuffer)
+                    for (k = 0; k < sensors[index].bytes; ++k)
                     {
-                        globalSimBuffer = valuePtr;
+                        value = (value << 8) | data[k];
                     }
 
-                    // process the data into buffer.
-                    // all routines null terminate the buffer
-                    sensors[index].formula(data, outbuf, sizeof(outbuf));
-
-                    // for clarity the next time through, reset to NULL
-                    if (simBuffer)
+                    // process the data into the display line, after the label
+                    outbuf_init(&out, line, sizeof(line));
+                    outbuf_printf(&out, "%s ", sensors[index].label);
+                    outbuf = append_sensor_value(&out, &sensors[index], value);
+                    if (NULL == outbuf)
+                    {
+                        break;
+                    }
+                    if (sensors[index].bIsListBox)
+                    {
+                        // remember the MIL status, the codes themselves are
+                        // read once per scan by acquire_trouble_codes
+                        note_monitor_status(session, (unsigned long)value);
+                    }
+                    StringCchCopy(session->screen_buf[index], SCREEN_BUF_SIZE, outbuf);
+                    ++session->samples;
+                    if (live_publish_enabled() &&
+                        (NULL == published || strcmp(published, sensors[index].label)))
                     {
-                        globalSimBuffer = NULL;
+                        // once per value, the GUI rows that repeat one are left out
+                        live_publish(session->adapter, index, pidNumber, sensors[index].label, value, outbuf);
+                        published = sensors[index].label;
                     }
 #ifdef WIN_GUI
                     if (sensors[index].bIsProgressBar)
@@ -296,7 +427,19 @@ void process_and_display_data(char *buf, char *simBuffer)
                         }
                     }
 #else   /* WIN_GUI */
-                    printf("%s %s\n", sensors[index].label, outbuf);
+                    if (session->callbacks)
+                    {
+                        // the value alone, the client lays it out
+                        if (session->callbacks->value)
+                        {
+                            session->callbacks->value(session->callbacks->context, pidNumber, sensors[index].label, outbuf);
+                        }
+                    }
+                    else if (session->report)
+                    {
+                        outbuf_append(&out, "\n");
+                        outbuf_append(session->report, line);
+                    }
 #endif  /* WIN_GUI */
                 }
             }
@@ -308,7 +451,7 @@ void process_and_display_data(char *buf, char *simBuffer)
 
 // the data value of the trouble code read
 // buf and bufSize are for the output buffer
-void process_trouble_codes(int data, char *buf, unsigned long bufSize)
+void mil_status_formula(int data, char *buf, unsigned long bufSize)
 {
     // the first byte is the trouble code count and the high bit is the MIL status light indicator
     // the remaining 3 bytes are tests available and tests incomplete
@@ -328,77 +471,14 @@ void process_trouble_codes(int data, char *buf, unsigned long bufSize)
     // Oxygen Sensor          C5                   D5
     // Oxygen Sensor Heater   C6                   D6
     // EGR System             C7                   D7
-    int codeCount;
-    int lightOn = 0;
-    int k;
-    int response;
-    char *globalPtr = globalSimBuffer;
-    DWORD numBytes = 0;
+    int codeCount = (data >> 24) & 0x7F;
+    int lightOn = (data & 0x80000000) ? 1 : 0;
 
-    ready_trouble_codes();
-
-    if (data & 0x80000000)
-    {
-        lightOn = 1;
-        codeCount &= 0x7FFFFFFF;
-    }
-
-    codeCount = (data >> 24) & 0x7F;
 #ifdef WIN_VS6
     sprintf(buf, "%d : MIL=%s\n", codeCount, lightOn ? "On" : "Off");
 #else // WIN_VS6
     StringCchPrintf(buf, bufSize, "%d : MIL=%s\n", codeCount, lightOn ? "On" : "Off");
 #endif // WIN_VS6
-
-    for (k=0; k<codeCount && (0 == stopWork);)
-    {
-        if (NULL == globalSimBuffer)
-        {
-            char inbuf[128];
-            char cmdbuf[16];
-#ifdef WIN_VS6
-            sprintf(cmdbuf, "%02X", MODE_STORED_DIAG_TROUBLE_CODES);
-#else // WIN_VS6
-            StringCchPrintf(cmdbuf, sizeof(cmdbuf), "%02X", MODE_STORED_DIAG_TROUBLE_CODES);
-#endif // WIN_VS6
-            response = sendAndWaitForResponse(inbuf, sizeof(inbuf), cmdbuf, &numBytes, CMD_TO_RESPONSE_SLEEP_MS);
-            if (DATA == response)
-            {
-                k += handle_read_codes(inbuf, FALSE);
-            }
-            else
-            {
-                break;
-            }
-        }
-        else
-        {
-            // find the next response string in the file
-            globalPtr = strstr(globalPtr, "43");
-            k += handle_read_codes(globalPtr, FALSE);
-            ++globalPtr;    // go to next byte so that we don't spin on the same line
-        }
-    }
-
-    printTroubleCodes(buf, bufSize);
-}
-
-void getStoredDiagnosticCodes()
-{
-    DWORD numBytes = 0;
-    int response;
-    char inbuf[1024];
-    char cmdbuf[16];
-#ifdef WIN_VS6
-    sprintf(cmdbuf, "%02X", MODE_STORED_DIAG_TROUBLE_CODES);
-#else // WIN_VS6
-    StringCchPrintf(cmdbuf, sizeof(cmdbuf), "%02X", MODE_STORED_DIAG_TROUBLE_CODES);
-#endif // WIN_VS6
-    response = sendAndWaitForResponse(inbuf, sizeof(inbuf), cmdbuf, &numBytes, CMD_TO_RESPONSE_SLEEP_MS);
-    if (DATA == response)
-    {
-        handle_read_codes(inbuf, FALSE);
-    }
 }
 
 void engine_rpm_formula(int data, char *buf, unsigned long bufSize)
@@ -66,8 +66,17 @@
 #define IDC_MODELYEARVALUE              0
 #endif  /* WIN_GUI*/
 
+struct _SCAN_SESSION;
+
 void obd_requirements_formula(int data, char *buf, unsigned long bufSize);
-void process_and_display_data(char *buf, char *simBuffer);
-int codeIsDisplayed(unsigned long index);
+void process_and_display_data(struct _SCAN_SESSION *session, const unsigned char *data, int length);
+int codeIsDisplayed(struct _SCAN_SESSION *session, unsigned long index);
+void note_monitor_status(struct _SCAN_SESSION *session, unsigned long value);
+int sensor_bytes(int pid);
+int sensor_count(void);
+const char *sensor_label(int index);
+const char *sensor_pid(int index);
+int sensor_data_bytes(int index);
+void sensor_format(int index, int raw, char *buf, unsigned long bufSize);
 
 #endif
@@ -7,43 +7,64 @@
 #ifdef WIN_VS6
 #include <windows.h>
 #endif // WIN_VS6
+#ifndef _WIN32
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#endif // _WIN32
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include "globals.h"
 #include "serial.h"
 #include "topwork.h"
+#include "text_kernels.h"
+#include "platform.h"
+#include "capture.h"
+#include "comm_log.h"
+#include "scan_stats.h"
+#include "scan_trace.h"
 
-extern COMPORT comport;
-HANDLE CommHandle;
-int serial_time_out;
 
-int open_comport()
+// the port's name as the OS knows it, in buf unless it was opened by name
+const char *comport_name(const COMPORT *port, char *buf, unsigned long bufSize)
 {
-   DCB dcb;
-   char temp_str[16];
-   COMMTIMEOUTS timeouts;
-
-   if (comport.status == READY)    // if the comport is open,
+   if (port->device)
    {
-      close_comport();    // close it
+      return port->device;
    }
-
+#ifdef _WIN32
 #ifdef WIN_VS6
-   sprintf(temp_str, "COM%i", comport.number);
+   sprintf(buf, "COM%i", port->number);
 #else // WIN_VS6
-   StringCchPrintf(temp_str, sizeof(temp_str), "COM%i", comport.number);
+   StringCchPrintf(buf, bufSize, "COM%i", port->number);
 #endif // WIN_VS6
-   CommHandle = CreateFile(temp_str, GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, 0, 0);
-   if (CommHandle == INVALID_HANDLE_VALUE)
+#else // _WIN32
+   // COM1 is the first serial port
+   StringCchPrintf(buf, bufSize, "/dev/ttyS%i", port->number - 1);
+#endif // _WIN32
+   return buf;
+}
+
+#ifdef _WIN32
+
+static int serial_open(COMPORT *port)
+{
+   DCB dcb;
+   char temp_str[16];
+   const char *name = comport_name(port, temp_str, sizeof(temp_str));
+   COMMTIMEOUTS timeouts;
+
+   port->handle = CreateFile(name, GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING, 0, 0);
+   if (port->handle == INVALID_HANDLE_VALUE)
    {
-      printf("Unable to open %s\n", temp_str);
-      comport.status = NOT_OPEN; //port was not open
       return -1; // return error
    }
 
-   GetCommState(CommHandle, &dcb);
-   dcb.BaudRate = comport.baud_rate;
+   GetCommState(port->handle, &dcb);
+   dcb.BaudRate = port->baud_rate;
    dcb.ByteSize = 8;
    dcb.StopBits = ONESTOPBIT;
    dcb.fParity = FALSE;
@@ -57,37 +78,224 @@ int open_comport()
    dcb.fDsrSensitivity = FALSE;
    dcb.fErrorChar = FALSE;
    dcb.fAbortOnError = FALSE;
-   SetCommState(CommHandle, &dcb);
+   SetCommState(port->handle, &dcb);
 
    timeouts.ReadIntervalTimeout = MAXWORD;
    timeouts.ReadTotalTimeoutMultiplier = 0;
    timeouts.ReadTotalTimeoutConstant = 0;
+   // a write that has not gone out by then never will
    timeouts.WriteTotalTimeoutMultiplier = 0;
-   timeouts.WriteTotalTimeoutConstant = 0;
-   SetCommTimeouts(CommHandle, &timeouts);
+   timeouts.WriteTotalTimeoutConstant = ECU_TIMEOUT;
+   SetCommTimeouts(port->handle, &timeouts);
+
+   return 0; // everything is okay
+}
+
+
+static void serial_close(COMPORT *port)
+{
+   PurgeComm(port->handle, PURGE_TXCLEAR|PURGE_RXCLEAR);
+   CloseHandle(port->handle);
+}
+
+
+static void serial_write(COMPORT *port, const char *data, unsigned long length)
+{
+   DWORD bytes_written;
+
+   PurgeComm(port->handle, PURGE_TXCLEAR|PURGE_RXCLEAR);
+   WriteFile(port->handle, data, (DWORD) length, &bytes_written, 0);
+}
+
+
+static unsigned long serial_read(COMPORT *port, char *buf, unsigned long size)
+{
+   DWORD errors;
+   DWORD numBytes = 0;
+   COMSTAT stat;
+
+   ClearCommError(port->handle, &errors, &stat);
+   if (stat.cbInQue > 0)
+   {
+      ReadFile(port->handle, buf, (stat.cbInQue < size) ? stat.cbInQue : (DWORD) size, &numBytes, 0);
+   }
+   return numBytes;
+}
+
+#else // _WIN32
+
+static speed_t baud_to_speed(int baud_rate)
+{
+   switch (baud_rate)
+   {
+      case 38400:
+         return B38400;
+      case 115200:
+         return B115200;
+      default:
+         return B9600;
+   }
+}
+
+
+static int serial_open(COMPORT *port)
+{
+   struct termios tio;
+   char temp_str[24];
+   const char *name = comport_name(port, temp_str, sizeof(temp_str));
+
+   port->fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+   if (port->fd < 0)
+   {
+      return -1; // return error
+   }
+
+   // raw 8N1, reads return what has come in without waiting
+   if (0 == tcgetattr(port->fd, &tio))
+   {
+      tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF);
+      tio.c_oflag &= ~OPOST;
+      tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+      tio.c_cflag &= ~(CSIZE | PARENB | CSTOPB | CRTSCTS);
+      tio.c_cflag |= CS8 | CREAD | CLOCAL;
+      tio.c_cc[VMIN] = 0;
+      tio.c_cc[VTIME] = 0;
+      cfsetispeed(&tio, baud_to_speed(port->baud_rate));
+      cfsetospeed(&tio, baud_to_speed(port->baud_rate));
+      tcsetattr(port->fd, TCSANOW, &tio);
+   }
+
+   return 0; // everything is okay
+}
+
+
+static void serial_close(COMPORT *port)
+{
+   tcflush(port->fd, TCIOFLUSH);
+   close(port->fd);
+   port->fd = -1;
+}
+
+
+static void serial_write(COMPORT *port, const char *data, unsigned long length)
+{
+   ssize_t written;
+
+   tcflush(port->fd, TCIOFLUSH);
+   while (length > 0)
+   {
+      written = write(port->fd, data, length);
+      if (written < 0)
+      {
+         if (EINTR == errno)
+         {
+            continue;
+         }
+         if (EAGAIN != errno)
+         {
+            break;
+         }
+         // the output queue is full, wait for room unless cancelled or it never comes
+         if (cancel_wait_fd(port->cancel, port->fd, POLLOUT, ECU_TIMEOUT) <= 0)
+         {
+            break;
+         }
+         continue;
+      }
+      data += written;
+      length -= (unsigned long) written;
+   }
+}
 
-   serial_time_out = FALSE;
-   comport.status = READY;
+
+static unsigned long serial_read(COMPORT *port, char *buf, unsigned long size)
+{
+   ssize_t got;
+
+   do
+   {
+      got = read(port->fd, buf, size);
+   } while (got < 0 && EINTR == errno);
+   return (got > 0) ? (unsigned long) got : 0;
+}
+
+#endif // _WIN32
+
+
+static void serial_wait(COMPORT *port, unsigned long ms)
+{
+   (void) cancel_wait(port->cancel, ms);
+}
+
+
+static TIME_US serial_now(COMPORT *port)
+{
+   (void) port;
+   return time_now_us();
+}
+
+
+static const TRANSPORT_OPS serialOps =
+{
+   serial_open,
+   serial_close,
+   serial_write,
+   serial_read,
+   serial_wait,
+   serial_now
+};
+
+
+static const TRANSPORT_OPS *port_ops(const COMPORT *port)
+{
+   return port->ops ? port->ops : &serialOps;
+}
+
+
+// the transport's clock in us, virtual for the replay adapter
+TIME_US comport_time(COMPORT *port)
+{
+   return port_ops(port)->now(port);
+}
+
+
+int open_comport(COMPORT *port)
+{
+   if (port->status == READY)    // if the comport is open,
+   {
+      close_comport(port);    // close it
+   }
+
+   if (port_ops(port)->open(port) < 0)
+   {
+      port->status = NOT_OPEN; //port was not open
+      return -1; // return error
+   }
+
+   port->time_out = FALSE;
+   port->status = READY;
 
    return 0; // everything is okay
 }
 
 
-void close_comport()
+void close_comport(COMPORT *port)
 {
-   if (comport.status == READY)    // if the comport is open, close it
+   if (port->status == READY)    // if the comport is open, close it
    {
-      PurgeComm(CommHandle, PURGE_TXCLEAR|PURGE_RXCLEAR);
-      CloseHandle(CommHandle);
+      port_ops(port)->close(port);
    }
-   comport.status = NOT_OPEN;
+   port->status = NOT_OPEN;
 }
 
 
-void send_command(const char *command)
+void send_command(COMPORT *port, const char *command)
 {
    char tx_buf[32];
-   DWORD bytes_written;
+   const TRANSPORT_OPS *ops = port_ops(port);
+#ifdef LOG_COMMS
+   TIME_US sent;
+#endif
 
 #ifdef WIN_VS6
    sprintf(tx_buf, "%s\r", command);  // Append CR to the command
@@ -96,28 +304,21 @@ void send_command(const char *command)
 #endif // WIN_VS6
 
 #ifdef LOG_COMMS
-   write_comm_log("TX", tx_buf);
+   sent = ops->now(port);
+#endif
+   ops->write(port, tx_buf, (unsigned long) strlen(tx_buf));
+#ifdef LOG_COMMS
+   // logged after the write so the log does not delay the command
+   comm_log_record(CAPTURE_TX, port->number, tx_buf, (unsigned long)strlen(tx_buf), sent);
 #endif
-
-   PurgeComm(CommHandle, PURGE_TXCLEAR|PURGE_RXCLEAR);
-   WriteFile(CommHandle, tx_buf, (DWORD) strlen(tx_buf), &bytes_written, 0);
 }
 
 
-int read_comport(char *response, DWORD *numBytes)
+int read_comport(COMPORT *port, char *response, unsigned long bufSize, DWORD *numBytes)
 {
-//   char *prompt_pos = NULL;
-
-   DWORD errors;
-   COMSTAT stat;
-
-   *numBytes = 0;
    response[0] = '\0';
-   ClearCommError(CommHandle, &errors, &stat);
-   if (stat.cbInQue > 0)
-   {
-      ReadFile(CommHandle, response, stat.cbInQue, numBytes, 0);
-   }
+   // leave room for the terminator
+   *numBytes = (DWORD) port_ops(port)->read(port, response, bufSize - 1);
    response[*numBytes] = '\0';
 
    if (*numBytes == 0)  // if the string is empty,
@@ -127,7 +328,13 @@ int read_comport(char *response, DWORD *numBytes)
    else                         //otherwise,
    {
 #ifdef LOG_COMMS
-      write_comm_log("RX", response);
+      // the port is polled, so this is when the bytes were seen, not when the first arrived
+      TIME_US received = port_ops(port)->now(port);
+      comm_log_record(CAPTURE_RX, port->number, response, *numBytes, received);
+      if (memchr(response, '>', *numBytes))
+      {
+         comm_log_record(CAPTURE_PROMPT, port->number, NULL, 0, received);
+      }
 #endif
       return DATA;
    }
@@ -135,25 +342,13 @@ int read_comport(char *response, DWORD *numBytes)
 
 long compress_response(char *msg, long bufSize)
 {
-   long cIndex=0;
-   long mIndex=0;
+   long cIndex;
+   const char *end = (const char *)memchr(msg, '\0', bufSize);
    // go until end of input string
-   while (mIndex < bufSize &&
-          msg[mIndex])
-   {
-      // if an intervening space, get rid of them
-      if (' ' == msg[mIndex])
-      {
-         // if the character is a space, then skip it
-         ++mIndex;
-      }
-      else
-      {
-         // if the character is not a space, copy it and
-         // advance both indices
-         msg[cIndex++] = msg[mIndex++];
-      }
-   }
+   long mIndex = end ? (long)(end - msg) : bufSize;
+
+   // get rid of the intervening spaces
+   cIndex = (long)strip_spaces(msg, (unsigned long)mIndex);
    // re-guarantee the null termination
    msg[cIndex++] = '\0';
    return cIndex;
@@ -248,15 +443,71 @@ const char *get_protocol_string(int interface_type, int protocol_id)
 }
 
 
-int sendAndWaitForResponse(char *buf, unsigned long bufSize, char *cmdbuf, DWORD *numBytes, long sleepTimeMs)
+int sendAndWaitForResponse(COMPORT *port, char *buf, unsigned long bufSize, char *cmdbuf, DWORD *numBytes, long sleepTimeMs)
 {
    int response;
-
-   send_command(cmdbuf);
-   Sleep(sleepTimeMs);
+   TIME_US sent = port_ops(port)->now(port);
+   TIME_US deadline = sent + (TIME_US)sleepTimeMs * 1000;
+   TIME_US seen;
+   TIME_US firstByte = 0;
+   TIME_US prompt = 0;
+   DWORD used = 0;
+   DWORD got;
+
+   if (cancel_requested(port->cancel))
+   {
+      // not sent, and not counted as a request the vehicle left unanswered
+      buf[0] = '\0';
+      *numBytes = 0;
+      return EMPTY;
+   }
+   TRACE_BEGIN();
+   TRACE_BEGIN();
+   send_command(port, cmdbuf);
+   TRACE_END("serial", "write", cmdbuf);
    // This also gives us the array of supported commands
    memset(buf, 0, bufSize);
-   response = read_comport(buf, numBytes);
+   TRACE_BEGIN();
+   // read as the answer comes in, until the prompt ends it or sleepTimeMs runs out
+   for (;;)
+   {
+      seen = port_ops(port)->now(port);
+      if (used + 1 < bufSize && DATA == read_comport(port, buf + used, bufSize - used, &got))
+      {
+         if (0 == used)
+         {
+            firstByte = seen;
+         }
+         if (memchr(buf + used, '>', got))
+         {
+            prompt = seen;
+         }
+         used += got;
+      }
+      if (prompt || seen >= deadline || used + 1 >= bufSize || cancel_requested(port->cancel))
+      {
+         break;
+      }
+      port_ops(port)->wait(port, RESPONSE_POLL_MS);
+   }
+   TRACE_END("serial", "read", NULL);
+   *numBytes = used;
+   response = used ? DATA : EMPTY;
+   port->usage.baudRate = port->baud_rate;
+   // an answer the prompt never ended waited out the whole of sleepTimeMs
+   link_usage_request(&port->usage, cmdbuf, buf, used, sent, seen, prompt ? 0 : seen - sent);
+   if (scan_stats_enabled())
+   {
+      scan_stats_request(cmdbuf, sent, firstByte, prompt, (unsigned long)strlen(cmdbuf) + 1, used,
+                         (used && strstr(buf, "NO DATA")) ? TRUE : FALSE);
+   }
    *numBytes = compress_response(buf, *numBytes);
+   ++port->requests;
+   if (EMPTY == response)
+   {
+      ++port->timeouts;
+   }
+   link_usage_live(&port->usage);
+   TRACE_END("serial", "request", cmdbuf);
    return response;
 }
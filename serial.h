@@ -1,6 +1,9 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 
+#include "platform.h"
+#include "link_usage.h"
+
    #define COM1   0
    #define COM2   1
    #define COM3   2
@@ -14,6 +17,7 @@
 
 #define CMD_TO_RESPONSE_SLEEP_MS   100
 #define CMD_TO_RESPONSE_VIN_SLEEP_MS   256
+#define RESPONSE_POLL_MS   1    // between the reads of an answer coming in
 #define DATA_RADIX  16
 #define FIELD_DELIMITER     '\t'
 #define RECORD_DELIMITER    0x0D
@@ -58,36 +62,61 @@
 #define AT_TIMEOUT            130
 #define ECU_TIMEOUT           5000
 
+typedef enum
+{
+    ST_READY
+} ST_STATUS_TYPES;
+
+struct COMPORT;
+
+// what the port talks through, the COM port unless something else is attached
+typedef struct _TRANSPORT_OPS {
+   int (*open)(struct COMPORT *port);     // 0 when open, -1 on error
+   void (*close)(struct COMPORT *port);
+   void (*write)(struct COMPORT *port, const char *data, unsigned long length);   // drops unread input first
+   unsigned long (*read)(struct COMPORT *port, char *buf, unsigned long size);    // what has come in, never waits
+   void (*wait)(struct COMPORT *port, unsigned long ms);  // returns early once port->cancel is
+   TIME_US (*now)(struct COMPORT *port);  // the transport's clock, for the comm log
+} TRANSPORT_OPS;
+
+typedef struct COMPORT {
+   int number;
+   int baud_rate;
+   ST_STATUS_TYPES status;    // READY, NOT_OPEN, USER_IGNORED
+#ifdef _WIN32
+   HANDLE handle;             // handle of the open port, one per scan session
+#else // _WIN32
+   int fd;                    // the open tty, one per scan session
+#endif // _WIN32
+   const char *device;        // the port by name, NULL for COM<number> or /dev/ttyS<number - 1>
+   int time_out;
+   const TRANSPORT_OPS *ops;  // NULL for the COM port
+   void *context;             // for ops
+   unsigned long requests;    // sent by sendAndWaitForResponse
+   unsigned long timeouts;    // of those, answered with nothing
+   LINK_USAGE usage;          // where the time of those went
+   CANCEL_TOKEN *cancel;      // cuts the waits short, NULL for never
+} COMPORT;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-extern HANDLE CommHandle;
-
 // function prototypes
 long compress_response(char *msg, long bufSize);
-int open_comport();
-void close_comport();
-void send_command(const char *command);
-int read_comport(char *response, DWORD *numBytes);
+const char *comport_name(const COMPORT *port, char *buf, unsigned long bufSize);
+int open_comport(COMPORT *port);
+TIME_US comport_time(COMPORT *port);
+void close_comport(COMPORT *port);
+void send_command(COMPORT *port, const char *command);
+int read_comport(COMPORT *port, char *response, unsigned long bufSize, DWORD *numBytes);
 void start_serial_timer(int delay);
 int process_response(const char *cmd_sent, char *msg_received);
 const char *get_protocol_string(int interface_type, int protocol_id);
 int display_error_message(int error, int retry);
-int sendAndWaitForResponse(char *buf, unsigned long bufSize, char *cmdbuf, DWORD *numBytes, long sleepTimeMs);
+int sendAndWaitForResponse(COMPORT *port, char *buf, unsigned long bufSize, char *cmdbuf, DWORD *numBytes, long sleepTimeMs);
 #ifdef __cplusplus
    }
 #endif
 
-typedef enum
-{
-    ST_READY
-} ST_STATUS_TYPES;
-
-typedef struct COMPORT {
-   int number;
-   int baud_rate;
-   ST_STATUS_TYPES status;    // READY, NOT_OPEN, USER_IGNORED
-} COMPORT;
-
 #endif
@@ -0,0 +1,145 @@
+#ifdef WINDDK
+#include <windows.h>
+#include <strsafe.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "globals.h"
+#include "elm_response.h"
+#include "session.h"
+
+void initializeSession(SCAN_SESSION *session)
+{
+    memset(session, 0, sizeof(*session));
+    session->comport.status = NOT_OPEN;
+    cancel_init(&session->cancel);
+    session->comport.cancel = &session->cancel;
+    session->reportedCodeCount = -1;
+    initializeFoundList(session);
+}
+
+void destroySession(SCAN_SESSION *session)
+{
+    destroyFoundList(session);
+    sim_index_free(&session->simIndex);
+    session->simBuffer = NULL;
+    cancel_destroy(&session->cancel);
+    session->comport.cancel = NULL;
+}
+
+// ready for another scan on the same port; the port, its token and the outputs stay
+void resetSession(SCAN_SESSION *session)
+{
+    void (*live)(void *context, const LINK_USAGE *usage) = session->comport.usage.live;
+
+    destroyFoundList(session);
+    sim_index_free(&session->simIndex);
+    session->simBuffer = NULL;
+    session->simBufSize = 0;
+    session->mil_is_on = FALSE;
+    session->reportedCodeCount = -1;
+    session->statusAnswers = 0;
+    session->headerDigits = 0;
+    session->headersFound = FALSE;
+    memset(&session->dtcs, 0, sizeof(session->dtcs));
+    session->samples = 0;
+    memset(session->screen_buf, 0, sizeof(session->screen_buf));
+    session->comport.requests = 0;
+    session->comport.timeouts = 0;
+    memset(&session->comport.usage, 0, sizeof(session->comport.usage));
+    session->comport.usage.live = live;
+    session->comport.usage.liveContext = session;
+}
+
+// a line of the scan's output, to the client, else the session's report if it has one
+void session_message(SCAN_SESSION *session, const char *text)
+{
+    if (session->callbacks)
+    {
+        if (session->callbacks->message)
+        {
+            session->callbacks->message(session->callbacks->context, text);
+        }
+    }
+    else if (session->report)
+    {
+        outbuf_append(session->report, text);
+    }
+}
+
+// the usage as a live "Link: ..." line, where the messages go but to the client's link callback
+void session_link_line(SCAN_SESSION *session, const LINK_USAGE *usage)
+{
+    char line[LINK_LINE_SIZE];
+
+    link_usage_format(usage, line, sizeof(line));
+    if (session->callbacks)
+    {
+        if (session->callbacks->link)
+        {
+            session->callbacks->link(session->callbacks->context, line);
+        }
+    }
+    else if (session->report)
+    {
+        outbuf_append(session->report, line);
+    }
+}
+
+static void live_link(void *context, const LINK_USAGE *usage)
+{
+    session_link_line((SCAN_SESSION *)context, usage);
+}
+
+// the link usage once a second while scanning, on or off
+void session_live_link(SCAN_SESSION *session, int live)
+{
+    session->comport.usage.live = live ? live_link : NULL;
+    session->comport.usage.liveContext = session;
+}
+
+void session_vehicle(SCAN_SESSION *session, const char *vin, const char *modelYear)
+{
+    char line[96];
+
+    if (session->callbacks)
+    {
+        if (session->callbacks->vehicle)
+        {
+            session->callbacks->vehicle(session->callbacks->context, vin, modelYear);
+        }
+        return;
+    }
+#ifdef WIN_VS6
+    sprintf(line, "Vehicle VIN: %s  Model year: %s\n", vin, modelYear);
+#else // WIN_VS6
+    StringCchPrintf(line, sizeof(line), "Vehicle VIN: %s  Model year: %s\n", vin, modelYear);
+#endif // WIN_VS6
+    session_message(session, line);
+}
+
+/*
+ * Headers are whatever the interface was left with, so the first answer
+ * that shows them decides how every later one is read.  Later answers
+ * are never looked at again: call it before parsing, from the thread
+ * that sends.
+ */
+void session_find_headers(SCAN_SESSION *session, const char *buf, unsigned long size)
+{
+    int digits;
+
+    if (session->headersFound)
+    {
+        return;
+    }
+    digits = elm_header_digits(buf, size);
+    if (digits >= 0)
+    {
+        session->headerDigits = digits;
+        session->headersFound = TRUE;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "serial.h"
+#include "trouble_code_reader.h"
+#include "sim_index.h"
+#include "output_buffer.h"
+#include "libscantool.h"
+
+#define MAX_SENSORS       96    // rows in the sensors[] table, sensors.c
+#define SCREEN_BUF_SIZE   64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Everything written while scanning one vehicle.  The code and sensor
+ * tables are read-only, so any number of sessions may run side by side.
+ */
+typedef struct _SCAN_SESSION
+{
+    COMPORT comport;
+    CANCEL_TOKEN cancel;        // stops the scan between requests and inside their waits
+    int mil_is_on;              // MIL is ON or OFF
+    int reportedCodeCount;      // stored codes reported by Mode 01 PID 01, -1 if not read
+    int statusAnswers;          // PID 01 answers to the request being read, set to 0 before each
+    int headerDigits;           // hex digits of the header ID when headers are on (ATH1), 0 when off
+    int headersFound;           // TRUE once an answer showed whether headers are on
+    const char *simBuffer;      // NULL when handling live data, not NUL terminated
+    unsigned long simBufSize;
+    SIM_INDEX simIndex;         // responses in simBuffer by mode and pid
+    FOUND_TROUBLE_CODE *foundCodes;
+    int numFoundCodes;
+    int maxFoundCodes;
+    DTC_RESULT dtcs;
+    unsigned long samples;      // sensor values decoded
+    int adapter;                // from 0, the range of the published values it writes
+    OUTPUT_BUFFER *report;      // where the sensor lines and messages go, NULL to drop them
+    const SCANTOOL_CALLBACKS *callbacks;    // a library client's, ahead of report; NULL for none
+    char screen_buf[MAX_SENSORS][SCREEN_BUF_SIZE];  // last value shown per sensor
+} SCAN_SESSION;
+
+void initializeSession(SCAN_SESSION *session);
+void destroySession(SCAN_SESSION *session);
+void resetSession(SCAN_SESSION *session);
+void session_message(SCAN_SESSION *session, const char *text);
+void session_live_link(SCAN_SESSION *session, int live);
+void session_link_line(SCAN_SESSION *session, const LINK_USAGE *usage);
+void session_vehicle(SCAN_SESSION *session, const char *vin, const char *modelYear);
+void session_find_headers(SCAN_SESSION *session, const char *buf, unsigned long size);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* SESSION_H */
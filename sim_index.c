@@ -0,0 +1,194 @@
+#ifdef WINDDK
+#include <windows.h>
+#include <strsafe.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <string.h>
+#include <stdlib.h>
+#include "globals.h"
+#include "sim_index.h"
+
+#define SIM_ENTRY_GROWTH    1024
+#define SIM_DATA_GROWTH     (16 * 1024)
+
+// the key of a response, -1 if it is not a response to a service request
+static long sim_key(int mode, int pid)
+{
+    if (mode < 0x40 || mode > 0x7F)
+    {
+        return -1;
+    }
+    return (long)(mode - 0x40) * 257 + pid + 1;
+}
+
+// the responses that do not echo a pid back
+static int response_has_pid(int mode)
+{
+    switch (mode)
+    {
+    case 0x43:
+    case 0x44:
+    case 0x47:
+    case 0x4A:
+        return FALSE;
+    default:
+        return TRUE;
+    }
+}
+
+static int add_entry(SIM_INDEX *index, const ELM_MESSAGE *msg, unsigned long exchange)
+{
+    SIM_ENTRY *entry;
+    long key;
+    int pid = SIM_NO_PID;
+
+    if (response_has_pid(msg->data[0]))
+    {
+        if (msg->length < 2)
+        {
+            return TRUE;
+        }
+        pid = msg->data[1];
+    }
+    key = sim_key(msg->data[0], pid);
+    if (key < 0 || 0x41 == msg->data[0])
+    {
+        return TRUE;    // echoed commands, and Mode 01 data which is replayed straight from the buffer
+    }
+
+    if (index->numEntries >= index->maxEntries)
+    {
+        long newMax = index->maxEntries ? index->maxEntries * 2 : SIM_ENTRY_GROWTH;
+        SIM_ENTRY *newEntries = (SIM_ENTRY *)realloc(index->entries, newMax * sizeof(SIM_ENTRY));
+        if (NULL == newEntries)
+        {
+            return FALSE;
+        }
+        index->entries = newEntries;
+        index->maxEntries = newMax;
+    }
+    if (index->dataLen + msg->length > index->dataSize)
+    {
+        unsigned long newSize = index->dataSize ? index->dataSize : SIM_DATA_GROWTH;
+        unsigned char *newData;
+        while (newSize < index->dataLen + msg->length)
+        {
+            newSize *= 2;
+        }
+        newData = (unsigned char *)realloc(index->data, newSize);
+        if (NULL == newData)
+        {
+            return FALSE;
+        }
+        index->data = newData;
+        index->dataSize = newSize;
+    }
+
+    entry = &index->entries[index->numEntries];
+    entry->dataOffset = index->dataLen;
+    entry->length = (unsigned short)msg->length;
+    entry->multiFrame = (unsigned char)(msg->multiFrame ? TRUE : FALSE);
+    entry->headerLength = 0;
+    if (msg->header && msg->headerLength <= ELM_MAX_HEADER)
+    {
+        memcpy(entry->header, msg->header, msg->headerLength);
+        entry->headerLength = (unsigned char)msg->headerLength;
+    }
+    entry->next = -1;
+    entry->exchange = exchange;
+    memcpy(index->data + index->dataLen, msg->data, msg->length);
+    index->dataLen += msg->length;
+
+    // chain it behind the previous occurrence
+    if (index->last[key] >= 0)
+    {
+        index->entries[index->last[key]].next = index->numEntries;
+    }
+    else
+    {
+        index->first[key] = index->numEntries;
+    }
+    index->last[key] = index->numEntries++;
+    return TRUE;
+}
+
+// returns FALSE if the index could not be allocated
+int sim_index_build(SIM_INDEX *index, const char *buf, unsigned long size, int headerDigits)
+{
+    ELM_MESSAGE_READER reader;
+    ELM_MESSAGE msg;
+    long k;
+
+    memset(index, 0, sizeof(*index));
+    index->first = (long *)malloc(SIM_KEYS * sizeof(long));
+    index->last = (long *)malloc(SIM_KEYS * sizeof(long));
+    if (NULL == index->first || NULL == index->last)
+    {
+        sim_index_free(index);
+        return FALSE;
+    }
+    for (k = 0; k < SIM_KEYS; ++k)
+    {
+        index->first[k] = -1;
+        index->last[k] = -1;
+    }
+
+    elm_reader_init(&reader, buf, size, headerDigits);
+    while (elm_next_message(&reader, &msg))
+    {
+        if (msg.length > 0 && !add_entry(index, &msg, reader.prompts))
+        {
+            sim_index_free(index);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+void sim_index_free(SIM_INDEX *index)
+{
+    free(index->entries);
+    free(index->data);
+    free(index->first);
+    free(index->last);
+    memset(index, 0, sizeof(*index));
+}
+
+// the first occurrence of a response, -1 if the input holds none
+long sim_index_first(const SIM_INDEX *index, int mode, int pid)
+{
+    long key = sim_key(mode, pid);
+
+    if (key < 0 || NULL == index->first)
+    {
+        return -1;
+    }
+    return index->first[key];
+}
+
+long sim_index_next(const SIM_INDEX *index, long entry)
+{
+    return index->entries[entry].next;
+}
+
+void sim_index_message(const SIM_INDEX *index, long entry, ELM_MESSAGE *msg)
+{
+    const SIM_ENTRY *e = &index->entries[entry];
+
+    memcpy(msg->data, index->data + e->dataOffset, e->length);
+    msg->length = e->length;
+    msg->expected = e->length;
+    msg->nextFrame = 0;
+    msg->multiFrame = e->multiFrame;
+    memcpy(msg->headerText, e->header, e->headerLength);
+    msg->header = e->headerLength ? msg->headerText : NULL;
+    msg->headerLength = e->headerLength;
+}
+
+// the request an entry answers, counted in prompts; 0 for all of an input without them
+unsigned long sim_index_exchange(const SIM_INDEX *index, long entry)
+{
+    return index->entries[entry].exchange;
+}
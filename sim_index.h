@@ -0,0 +1,55 @@
+#ifndef SIM_INDEX_H
+#define SIM_INDEX_H
+
+#include "elm_response.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_NO_PID      -1      // pid of responses that carry none: Mode 03, 04, 07, 0A
+#define SIM_KEYS        (64 * 257)  // response modes 40-7F, each with no pid or pid 00-FF
+
+// one response in the simulation input, decoded
+typedef struct _SIM_ENTRY
+{
+    unsigned long dataOffset;   // bytes in the index data arena
+    unsigned short length;
+    unsigned char headerLength;
+    unsigned char multiFrame;
+    char header[ELM_MAX_HEADER];
+    long next;                  // next occurrence of the same mode and pid, -1 if none
+    unsigned long exchange;     // prompts before it: entries of one request share it
+} SIM_ENTRY;
+
+/*
+ * The responses of a simulation input, built in one pass.  Entries are
+ * kept in capture order and chained per mode/pid, so all occurrences of
+ * a response can be replayed without searching the buffer again.  Mode 01
+ * data, the bulk of a capture, is left out: it is replayed in order
+ * straight from the buffer, which keeps the index small next to it.
+ */
+typedef struct _SIM_INDEX
+{
+    SIM_ENTRY *entries;
+    long numEntries;
+    long maxEntries;
+    unsigned char *data;
+    unsigned long dataLen;
+    unsigned long dataSize;
+    long *first;                // per key, the first occurrence
+    long *last;
+} SIM_INDEX;
+
+int sim_index_build(SIM_INDEX *index, const char *buf, unsigned long size, int headerDigits);
+void sim_index_free(SIM_INDEX *index);
+long sim_index_first(const SIM_INDEX *index, int mode, int pid);
+long sim_index_next(const SIM_INDEX *index, long entry);
+void sim_index_message(const SIM_INDEX *index, long entry, ELM_MESSAGE *msg);
+unsigned long sim_index_exchange(const SIM_INDEX *index, long entry);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* SIM_INDEX_H */
@@ -0,0 +1,73 @@
+#ifdef WINDDK
+#include <windows.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <stdlib.h>
+#include <string.h>
+#include "globals.h"
+#include "platform.h"
+#include "spsc_ring.h"
+
+// count is rounded up to a power of two; returns FALSE if out of memory
+int spsc_init(SPSC_RING *ring, unsigned long count, unsigned long slotSize)
+{
+    unsigned long slots = 1;
+
+    while (slots < count)
+    {
+        slots <<= 1;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->slots = (char *)malloc(slots * slotSize);
+    if (NULL == ring->slots)
+    {
+        return FALSE;
+    }
+    ring->count = slots;
+    ring->slotSize = slotSize;
+    return TRUE;
+}
+
+void spsc_free(SPSC_RING *ring)
+{
+    free(ring->slots);
+    memset(ring, 0, sizeof(*ring));
+}
+
+// producer: the next slot to fill, NULL while the ring is full
+void *spsc_claim(SPSC_RING *ring)
+{
+    unsigned long head = ring->head;
+
+    if (head - atomic_load_acquire(&ring->tail) >= ring->count)
+    {
+        return NULL;
+    }
+    return ring->slots + (head & (ring->count - 1)) * ring->slotSize;
+}
+
+// producer: the claimed slot is filled, the consumer may have it
+void spsc_publish(SPSC_RING *ring)
+{
+    atomic_store_release(&ring->head, ring->head + 1);
+}
+
+// consumer: the oldest published slot, NULL while the ring is empty
+void *spsc_peek(SPSC_RING *ring)
+{
+    unsigned long tail = ring->tail;
+
+    if (atomic_load_acquire(&ring->head) == tail)
+    {
+        return NULL;
+    }
+    return ring->slots + (tail & (ring->count - 1)) * ring->slotSize;
+}
+
+// consumer: done with the slot from spsc_peek, the producer may fill it again
+void spsc_release(SPSC_RING *ring)
+{
+    atomic_store_release(&ring->tail, ring->tail + 1);
+}
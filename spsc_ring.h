@@ -0,0 +1,42 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include "platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A ring of fixed size slots between exactly one producer thread and one
+ * consumer thread, without a lock.  The producer fills the slot
+ * spsc_claim gives it in place and hands it over with spsc_publish; the
+ * consumer reads the slot spsc_peek gives it and frees it with
+ * spsc_release.  Neither ever waits on the other: a full ring gives the
+ * producer NULL, an empty one gives the consumer NULL, and what to do
+ * then is the caller's business.
+ *
+ * head and tail count every slot ever published and released, so
+ * head - tail is what the ring holds even after the counters wrap.
+ */
+typedef struct _SPSC_RING
+{
+    char *slots;
+    unsigned long slotSize;
+    unsigned long count;            // slots, a power of two
+    volatile unsigned long head;    // written by the producer only
+    volatile unsigned long tail;    // written by the consumer only
+} SPSC_RING;
+
+int spsc_init(SPSC_RING *ring, unsigned long count, unsigned long slotSize);
+void spsc_free(SPSC_RING *ring);
+void *spsc_claim(SPSC_RING *ring);
+void spsc_publish(SPSC_RING *ring);
+void *spsc_peek(SPSC_RING *ring);
+void spsc_release(SPSC_RING *ring);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* SPSC_RING_H */
@@ -0,0 +1,426 @@
+/*
+ * The capture writer and reader: what one writes the other must read
+ * back, whole, cut short or damaged.
+ *
+ *   capture_test
+ *
+ * Records drawn from a fixed seed, of every type, with times from the
+ * same microsecond to hours apart and lengths past a block, are written
+ * to memory and read back field by field; seeking to a time must find
+ * every record after it.  A capture cut at any length must read as the
+ * records of its complete blocks, and one with bytes spoiled, or with
+ * an index offset that wraps, must read to an end without leaving the
+ * buffer.  Exits 1 on the first difference, after printing it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../globals.h"
+#include "../platform.h"
+#include "../capture.h"
+
+#define RECORDS         3000
+#define MAX_DATA        (CAPTURE_BLOCK_SIZE + 512)
+#define SEEKS           200
+#define DAMAGED_COPIES  300
+
+typedef struct _EXPECTED
+{
+    int type;
+    unsigned long port;
+    TIME_US time;
+    unsigned long offset;       // of its data in the data arena
+    unsigned long length;
+} EXPECTED;
+
+typedef struct _MEMORY_SINK
+{
+    unsigned char *buf;
+    unsigned long len;
+    unsigned long size;
+    int failed;
+} MEMORY_SINK;
+
+static EXPECTED expected[RECORDS];
+static unsigned char *arena;
+static unsigned long seed = 4242;
+
+static unsigned long next_random(void)
+{
+    seed = seed * 1103515245UL + 12345UL;
+    return (seed >> 16) & 0x7FFF;
+}
+
+static void memory_sink(void *context, const unsigned char *data, unsigned long length)
+{
+    MEMORY_SINK *sink = (MEMORY_SINK *)context;
+
+    if (sink->len + length > sink->size)
+    {
+        unsigned long newSize = sink->size ? sink->size : 64 * 1024;
+        unsigned char *newBuf;
+        while (newSize < sink->len + length)
+        {
+            newSize *= 2;
+        }
+        newBuf = (unsigned char *)realloc(sink->buf, newSize);
+        if (NULL == newBuf)
+        {
+            sink->failed = TRUE;
+            return;
+        }
+        sink->buf = newBuf;
+        sink->size = newSize;
+    }
+    memcpy(sink->buf + sink->len, data, length);
+    sink->len += length;
+}
+
+// the records, each with its data in the arena
+static int make_records(void)
+{
+    TIME_US time = 0;
+    unsigned long offset = 0;
+    unsigned long arenaSize = 0;
+    unsigned long k, n;
+
+    for (k = 0; k < RECORDS; ++k)
+    {
+        switch (next_random() % 8)
+        {
+        case 0:
+            break;                                  // the same microsecond
+        case 1:
+            time += (TIME_US)next_random() << 20;   // up to hours later
+            break;
+        default:
+            time += next_random();
+            break;
+        }
+        expected[k].type = CAPTURE_TX + (int)(next_random() % 4);
+        expected[k].port = (0 == next_random() % 16) ? 0xFFFFFFFFUL : next_random() % 8;
+        expected[k].time = time;
+        expected[k].offset = offset;
+        switch (next_random() % 64)
+        {
+        case 0:
+            expected[k].length = MAX_DATA - next_random() % 1024;   // a block of its own
+            break;
+        case 1:
+            expected[k].length = 0;
+            break;
+        default:
+            expected[k].length = 1 + next_random() % 200;
+            break;
+        }
+        if (offset + expected[k].length > arenaSize)
+        {
+            unsigned char *newArena;
+            arenaSize = 2 * arenaSize + MAX_DATA;
+            newArena = (unsigned char *)realloc(arena, arenaSize);
+            if (NULL == newArena)
+            {
+                return FALSE;
+            }
+            arena = newArena;
+        }
+        for (n = 0; n < expected[k].length; ++n)
+        {
+            arena[offset + n] = (unsigned char)next_random();
+        }
+        offset += expected[k].length;
+    }
+    return TRUE;
+}
+
+static int write_capture(MEMORY_SINK *sink)
+{
+    CAPTURE_WRITER writer;
+    unsigned long k;
+
+    memset(sink, 0, sizeof(*sink));
+    if (!capture_writer_init(&writer, memory_sink, sink, 1234567890123456ULL, 0))
+    {
+        return FALSE;
+    }
+    for (k = 0; k < RECORDS; ++k)
+    {
+        if (!capture_write(&writer, expected[k].type, expected[k].port, expected[k].time,
+                           arena + expected[k].offset, expected[k].length))
+        {
+            return FALSE;
+        }
+        // blocks closed early too, as the comm log does on each flush
+        if (0 == next_random() % 500)
+        {
+            capture_flush_block(&writer);
+        }
+    }
+    capture_writer_finish(&writer);
+    return !sink->failed;
+}
+
+static int same_record(const CAPTURE_RECORD *rec, unsigned long k)
+{
+    return rec->type == expected[k].type && rec->port == expected[k].port &&
+           rec->time == expected[k].time && rec->length == expected[k].length &&
+           0 == memcmp(rec->data, arena + expected[k].offset, rec->length);
+}
+
+static int check_round_trip(const MEMORY_SINK *sink)
+{
+    CAPTURE_READER reader;
+    CAPTURE_RECORD rec;
+    unsigned long k = 0;
+
+    if (!capture_is_capture((const char *)sink->buf, sink->len) ||
+        !capture_reader_init(&reader, (const char *)sink->buf, sink->len) ||
+        NULL == reader.index || 1234567890123456ULL != reader.wallClock)
+    {
+        printf("round trip: the capture or its index is not recognized\n");
+        return FALSE;
+    }
+    while (capture_next(&reader, &rec))
+    {
+        if (k >= RECORDS || !same_record(&rec, k))
+        {
+            printf("round trip: record %lu read back wrong\n", k);
+            return FALSE;
+        }
+        ++k;
+    }
+    if (RECORDS != k)
+    {
+        printf("round trip: %lu records read back of %d\n", k, RECORDS);
+        return FALSE;
+    }
+    printf("round trip: %d records in %lu bytes, %lu blocks\n", RECORDS, sink->len, reader.numBlocks);
+    return TRUE;
+}
+
+// after a seek to a time, reading on must give every record later than it,
+// and no more of the earlier ones than share a block with the first of them
+static int check_seek(const MEMORY_SINK *sink)
+{
+    CAPTURE_READER reader;
+    CAPTURE_RECORD rec;
+    TIME_US time;
+    unsigned long later, found, earlier, k;
+    unsigned long blockRecords = 0;
+    const unsigned char *entry;
+    int n;
+
+    capture_reader_init(&reader, (const char *)sink->buf, sink->len);
+    for (k = 0; k < reader.numBlocks; ++k)
+    {
+        entry = reader.index + k * CAPTURE_INDEX_ENTRY_SIZE + 16;
+        if (entry[0] + ((unsigned long)entry[1] << 8) > blockRecords)
+        {
+            blockRecords = entry[0] + ((unsigned long)entry[1] << 8);
+        }
+    }
+    for (n = 0; n < SEEKS; ++n)
+    {
+        time = expected[next_random() % RECORDS].time + (TIME_US)(next_random() % 3) - 1;
+        later = 0;
+        for (k = 0; k < RECORDS; ++k)
+        {
+            later += (expected[k].time > time) ? 1 : 0;
+        }
+        if (!capture_seek(&reader, time))
+        {
+            printf("seek: refused with an index\n");
+            return FALSE;
+        }
+        found = 0;
+        earlier = 0;
+        while (capture_next(&reader, &rec))
+        {
+            if (rec.time > time)
+            {
+                ++found;
+            }
+            else
+            {
+                ++earlier;
+            }
+        }
+        if (found != later || earlier > blockRecords)
+        {
+            printf("seek: to %llu gives %lu later records and %lu earlier, there are %lu later\n",
+                   (unsigned long long)time, found, earlier, later);
+            return FALSE;
+        }
+    }
+    printf("seek: %d times found\n", SEEKS);
+    return TRUE;
+}
+
+// cut short, the index is gone and the records of the complete blocks remain
+static int check_truncated(const MEMORY_SINK *sink)
+{
+    CAPTURE_READER reader;
+    CAPTURE_RECORD rec;
+    unsigned char *copy;
+    unsigned long size = sink->len;
+    unsigned long previous = RECORDS;
+    unsigned long k;
+    int cuts = 0;
+
+    while (size > CAPTURE_HEADER_SIZE)
+    {
+        k = 1 + next_random() % 1000;
+        size = (size - CAPTURE_HEADER_SIZE > k) ? size - k : CAPTURE_HEADER_SIZE;
+        // a copy of just that much, so that reading past the cut is caught by a checker
+        copy = (unsigned char *)malloc(size);
+        if (NULL == copy)
+        {
+            return FALSE;
+        }
+        memcpy(copy, sink->buf, size);
+        if (!capture_reader_init(&reader, (const char *)copy, size) || capture_seek(&reader, 0))
+        {
+            printf("truncated: %lu bytes not recognized, or seek by an index\n", size);
+            free(copy);
+            return FALSE;
+        }
+        k = 0;
+        while (capture_next(&reader, &rec) && k <= RECORDS)
+        {
+            if (k >= RECORDS || !same_record(&rec, k))
+            {
+                printf("truncated: record %lu of %lu bytes read back wrong\n", k, size);
+                free(copy);
+                return FALSE;
+            }
+            ++k;
+        }
+        free(copy);
+        // shorter captures never hold more
+        if (k > previous)
+        {
+            printf("truncated: %lu bytes give %lu records, more bytes gave %lu\n", size, k, previous);
+            return FALSE;
+        }
+        previous = k;
+        ++cuts;
+    }
+    if (capture_is_capture((const char *)sink->buf, CAPTURE_HEADER_SIZE - 1))
+    {
+        printf("truncated: a part of the header taken for a capture\n");
+        return FALSE;
+    }
+    printf("truncated: %d lengths read\n", cuts);
+    return TRUE;
+}
+
+static void put_u64(unsigned char *p, PLATFORM_U64 value)
+{
+    int k;
+
+    for (k = 0; k < 8; ++k)
+    {
+        p[k] = (unsigned char)(value >> (8 * k));
+    }
+}
+
+// reads to an end without leaving the buffer, under a memory checker at least
+static unsigned long read_all(const unsigned char *buf, unsigned long size)
+{
+    CAPTURE_READER reader;
+    CAPTURE_RECORD rec;
+    unsigned long records = 0;
+    volatile unsigned char sum = 0;
+
+    if (!capture_reader_init(&reader, (const char *)buf, size))
+    {
+        return 0;
+    }
+    capture_seek(&reader, (TIME_US)next_random() << 10);
+    while (capture_next(&reader, &rec) && records <= RECORDS)
+    {
+        if (rec.length)
+        {
+            sum ^= rec.data[0] ^ rec.data[rec.length - 1];
+        }
+        ++records;
+    }
+    return records;
+}
+
+static int check_damaged(const MEMORY_SINK *sink)
+{
+    static const PLATFORM_U64 offsets[] =
+    {
+        0, 8, CAPTURE_HEADER_SIZE - 1, 0xFFFFFFFFULL, 0xFFFFFFFFFFFFFFF8ULL, 0x8000000000000000ULL, 0xFFFFFFFFFFFFFFFFULL
+    };
+    unsigned char *copy = (unsigned char *)malloc(sink->len);
+    unsigned long k, n, spoiled;
+    int copies;
+
+    if (NULL == copy)
+    {
+        return FALSE;
+    }
+    for (copies = 0; copies < DAMAGED_COPIES; ++copies)
+    {
+        memcpy(copy, sink->buf, sink->len);
+        spoiled = 1 + next_random() % 16;
+        for (n = 0; n < spoiled; ++n)
+        {
+            k = ((next_random() << 15) | next_random()) % sink->len;
+            copy[k] = (unsigned char)next_random();
+        }
+        if (read_all(copy, sink->len) > RECORDS)
+        {
+            printf("damaged: more records read than written\n");
+            free(copy);
+            return FALSE;
+        }
+    }
+    // an index offset that wraps, or points into the header or past the end
+    for (n = 0; n < sizeof(offsets) / sizeof(offsets[0]); ++n)
+    {
+        CAPTURE_READER reader;
+
+        memcpy(copy, sink->buf, sink->len);
+        put_u64(copy + sink->len - CAPTURE_TRAILER_SIZE, offsets[n]);
+        if (!capture_reader_init(&reader, (const char *)copy, sink->len) || NULL != reader.index)
+        {
+            printf("damaged: index offset %llu taken\n", (unsigned long long)offsets[n]);
+            free(copy);
+            return FALSE;
+        }
+        if (RECORDS != read_all(copy, sink->len))
+        {
+            printf("damaged: without the index at %llu the records do not all read\n", (unsigned long long)offsets[n]);
+            free(copy);
+            return FALSE;
+        }
+    }
+    free(copy);
+    printf("damaged: %d spoiled copies and %lu bad index offsets read\n",
+           DAMAGED_COPIES, (unsigned long)(sizeof(offsets) / sizeof(offsets[0])));
+    return TRUE;
+}
+
+int main(void)
+{
+    MEMORY_SINK sink;
+    int right;
+
+    if (!make_records())
+    {
+        printf("out of memory\n");
+        return 1;
+    }
+    if (!write_capture(&sink))
+    {
+        printf("the capture could not be written\n");
+        return 1;
+    }
+    right = check_round_trip(&sink) && check_seek(&sink) && check_truncated(&sink) && check_damaged(&sink);
+    free(sink.buf);
+    free(arena);
+    return right ? 0 : 1;
+}
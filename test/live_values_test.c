@@ -0,0 +1,207 @@
+/*
+ * The published values and their readers: a reader must never keep a
+ * value or a sample torn by the scan writing it, must account for every
+ * sample it was too slow for, and must give up on a value left mid-write.
+ *
+ *   live_values_test
+ *
+ * A publisher thread writes values whose text, pid and adapter all
+ * follow from raw, while this thread reads them back through the
+ * segment mapped read-only, as live_tail does.  It publishes under a
+ * name of its own, so it can run beside a scan that publishes.  Exits 1
+ * on the first difference, after printing it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../globals.h"
+#include "../platform.h"
+#include "../live_values.h"
+
+#define TEST_NAME       "scantool_live_test"
+#define PUBLISHES       200000L
+#define SLOTS_USED      4
+#define MAX_WAIT_US     1000000     // for a value left mid-write, ten times what the reader allows
+
+static volatile unsigned long published;
+
+// what the publisher writes for raw, the reader checks against it
+static void publish_one(long raw)
+{
+    char label[LIVE_LABEL_SIZE];
+    char text[LIVE_TEXT_SIZE];
+
+    sprintf(label, "label %02lX", (unsigned long)raw & 0xFF);
+    sprintf(text, "%ld", raw);
+    live_publish((int)((raw / SLOTS_USED) % LIVE_ADAPTERS), (int)(raw % SLOTS_USED),
+                 (int)(raw & 0xFF), label, raw, text);
+}
+
+static void publisher(void *arg)
+{
+    long raw;
+
+    (void)arg;
+    for (raw = 0; raw < PUBLISHES; ++raw)
+    {
+        publish_one(raw);
+        atomic_store_release(&published, (unsigned long)raw + 1);
+    }
+}
+
+static int value_consistent(const LIVE_VALUE *value, int slot)
+{
+    char label[LIVE_LABEL_SIZE];
+
+    sprintf(label, "label %02lX", (unsigned long)value->raw & 0xFF);
+    return value->raw >= 0 && value->raw < PUBLISHES &&
+           value->raw % SLOTS_USED == slot % LIVE_SLOTS &&
+           (value->raw / SLOTS_USED) % LIVE_ADAPTERS == value->adapter &&
+           slot / LIVE_SLOTS == value->adapter &&
+           (value->raw & 0xFF) == value->pid &&
+           atol(value->text) == value->raw &&
+           0 == strcmp(value->label, label);
+}
+
+static int sample_consistent(const LIVE_SAMPLE *sample, unsigned long cursor)
+{
+    return (unsigned long)sample->raw + 1 == cursor &&
+           sample->slot == (int)(sample->adapter * LIVE_SLOTS + sample->raw % SLOTS_USED) &&
+           (sample->raw & 0xFF) == sample->pid &&
+           atol(sample->text) == sample->raw;
+}
+
+// read values and follow samples while the publisher writes them
+static int check_concurrent(const LIVE_SEGMENT *segment)
+{
+    PLATFORM_THREAD thread;
+    LIVE_VALUE value;
+    LIVE_SAMPLE sample;
+    unsigned long cursor = 0;
+    unsigned long missed = 0;
+    unsigned long samples = 0;
+    unsigned long reads = 0;
+    unsigned long round = 0;
+    int slot;
+    int done = FALSE;
+
+    if (!thread_start(&thread, publisher, NULL))
+    {
+        printf("no thread\n");
+        return FALSE;
+    }
+    while (!done)
+    {
+        // the last round starts after the last publish, so nothing is left unread
+        done = (PUBLISHES == (long)atomic_load_acquire(&published));
+        slot = (int)((round / SLOTS_USED) % LIVE_ADAPTERS) * LIVE_SLOTS + (int)(round % SLOTS_USED);
+        ++round;
+        if (live_read_value(segment, slot, &value))
+        {
+            if (!value_consistent(&value, slot))
+            {
+                printf("concurrent: slot %d read torn: raw %ld pid %02X adapter %d text %s label %s\n",
+                       slot, value.raw, value.pid, value.adapter, value.text, value.label);
+                thread_join(&thread);
+                return FALSE;
+            }
+            ++reads;
+        }
+        while (live_next_sample(segment, &cursor, &sample, &missed))
+        {
+            if (!sample_consistent(&sample, cursor))
+            {
+                printf("concurrent: sample %lu read torn: raw %ld slot %d text %s\n",
+                       cursor - 1, sample.raw, sample.slot, sample.text);
+                thread_join(&thread);
+                return FALSE;
+            }
+            ++samples;
+        }
+    }
+    thread_join(&thread);
+    if (PUBLISHES != (long)cursor || PUBLISHES != (long)(samples + missed))
+    {
+        printf("concurrent: %lu samples read and %lu missed of %ld\n", samples, missed, PUBLISHES);
+        return FALSE;
+    }
+    // the latest of each slot, once the publisher is done
+    for (slot = 0; slot < LIVE_VALUES; ++slot)
+    {
+        if (live_read_value(segment, slot, &value) &&
+            (!value_consistent(&value, slot) ||
+             value.raw + SLOTS_USED * LIVE_ADAPTERS < PUBLISHES))
+        {
+            printf("concurrent: slot %d does not hold its last value, raw %ld\n", slot, value.raw);
+            return FALSE;
+        }
+    }
+    printf("concurrent: %lu values and %lu samples read whole, %lu samples missed\n", reads, samples, missed);
+    return TRUE;
+}
+
+// a slot never written, one written, and one its writer died in
+static int check_stuck(void)
+{
+    LIVE_SEGMENT *segment = (LIVE_SEGMENT *)calloc(1, sizeof(LIVE_SEGMENT));
+    LIVE_VALUE value;
+    TIME_US start;
+    TIME_US waited;
+    int right;
+
+    if (NULL == segment)
+    {
+        printf("out of memory\n");
+        return FALSE;
+    }
+    segment->values[1].seq = 2;
+    segment->values[1].raw = 42;
+    segment->values[2].seq = 5;
+    right = !live_read_value(segment, 0, &value) &&
+            live_read_value(segment, 1, &value) && 42 == value.raw &&
+            !live_read_value(segment, -1, &value) && !live_read_value(segment, LIVE_VALUES, &value);
+    start = time_now_us();
+    right = right && !live_read_value(segment, 2, &value);
+    waited = time_now_us() - start;
+    free(segment);
+    if (!right || waited > MAX_WAIT_US)
+    {
+        printf("stuck: wrong, or %lu us to give up on a value mid-write\n", (unsigned long)waited);
+        return FALSE;
+    }
+    printf("stuck: gave up on a value mid-write after %lu us\n", (unsigned long)waited);
+    return TRUE;
+}
+
+int main(void)
+{
+    LIVE_MAP map;
+    const LIVE_SEGMENT *segment;
+    int right;
+
+    if (!check_stuck())
+    {
+        return 1;
+    }
+    if (!live_publish_open(TEST_NAME))
+    {
+        printf("cannot publish as %s\n", TEST_NAME);
+        return 1;
+    }
+    segment = live_attach(&map, TEST_NAME);
+    if (NULL == segment)
+    {
+        printf("cannot read %s\n", TEST_NAME);
+        live_publish_close();
+        return 1;
+    }
+    right = check_concurrent(segment);
+    live_publish_close();
+    if (right && !atomic_load_acquire((volatile unsigned long *)&segment->closed))
+    {
+        printf("closed: not set for the reader\n");
+        right = FALSE;
+    }
+    live_detach(&map);
+    return right ? 0 : 1;
+}
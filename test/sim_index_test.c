@@ -0,0 +1,253 @@
+/*
+ * The simulation index against the message reader it is built from.
+ *
+ *   sim_index_test [simfile ...]
+ *
+ * For a built-in log with headers off, one with headers on, and each
+ * file named, every response the reader decodes must be in the index
+ * under its mode and pid, in order, with its data, header and the
+ * request it answers; Mode 01 data and nothing else must be left out.
+ * The built-in logs check a few lookups by hand as well.  Exits 1 on
+ * the first difference, after printing it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../globals.h"
+#include "../elm_response.h"
+#include "../sim_index.h"
+#include "../mapped_file.h"
+
+#define MAX_MODES       64
+#define MAX_PIDS        257
+
+// two scans, headers off, the VIN in CAN frames and the codes from two ECUs
+static const char scansSim[] =
+    "0902\r014\r0:490201314433\r1:4856313354303953\r2:37313830353735\r\r>"
+    "0100\r41 00 BE 3F A8 13\r\r>"
+    "010C\r41 0C 1A F8\r\r>"
+    "03\r43 01 01 33\r43 01 02 01\r\r>"
+    "07\r47 00\r\r>"
+    "0A\r4A 01 02 01\r\r>"
+    "0902\r014\r0:490201314433\r1:4856313354303953\r2:37313830353735\r\r>"
+    "010C\rNO DATA\r\r>"
+    "03\r43 00\r\r>";
+
+// one scan, headers on, two ECUs
+static const char headersSim[] =
+    "0902\r7E8 10 14 49 02 01 31 44 33 \r7E8 21 48 56 31 33 54 30 39 \r7E8 22 53 37 31 38 30 35 37 \r\r>"
+    "0100\r7E8 06 41 00 BE 3F A8 13 \r7E9 06 41 00 98 18 80 11 \r\r>"
+    "03\r7E8 04 43 01 01 33 \r7E9 04 43 01 02 01 \r\r>"
+    "07\r7E8 02 47 00 \r\r>";
+
+// the ith occurrence of a mode and pid, -1 if there are fewer
+static long nth_entry(const SIM_INDEX *index, int mode, int pid, int nth)
+{
+    long entry = sim_index_first(index, mode, pid);
+
+    while (entry >= 0 && nth-- > 0)
+    {
+        entry = sim_index_next(index, entry);
+    }
+    return entry;
+}
+
+static int same_message(const ELM_MESSAGE *a, const ELM_MESSAGE *b)
+{
+    if (a->length != b->length || 0 != memcmp(a->data, b->data, a->length) ||
+        (a->multiFrame ? 1 : 0) != (b->multiFrame ? 1 : 0) ||
+        (NULL == a->header) != (NULL == b->header))
+    {
+        return FALSE;
+    }
+    return NULL == a->header ||
+           (a->headerLength == b->headerLength && 0 == memcmp(a->header, b->header, a->headerLength));
+}
+
+static void print_message(const char *what, const ELM_MESSAGE *msg)
+{
+    int k;
+
+    printf("  %s:", what);
+    if (msg->header)
+    {
+        printf(" [%.*s]", msg->headerLength, msg->header);
+    }
+    for (k = 0; k < msg->length; ++k)
+    {
+        printf(" %02X", msg->data[k]);
+    }
+    printf("\n");
+}
+
+// walk the reader and the chains of the index side by side
+static int check_against_reader(const char *name, const char *buf, unsigned long size)
+{
+    static int seen[MAX_MODES][MAX_PIDS];
+    ELM_MESSAGE_READER reader;
+    ELM_MESSAGE msg;
+    ELM_MESSAGE indexed;
+    SIM_INDEX index;
+    int headerDigits = elm_header_digits(buf, size);
+    long entries = 0;
+    long entry;
+    int mode, pid;
+
+    if (!sim_index_build(&index, buf, size, headerDigits))
+    {
+        printf("%s: out of memory\n", name);
+        return FALSE;
+    }
+    memset(seen, 0, sizeof(seen));
+    elm_reader_init(&reader, buf, size, headerDigits);
+    while (elm_next_message(&reader, &msg))
+    {
+        if (msg.length < 1 || msg.data[0] < 0x40 || msg.data[0] > 0x7F)
+        {
+            continue;
+        }
+        mode = msg.data[0];
+        pid = SIM_NO_PID;
+        if (0x43 != mode && 0x44 != mode && 0x47 != mode && 0x4A != mode)
+        {
+            if (msg.length < 2)
+            {
+                continue;
+            }
+            pid = msg.data[1];
+        }
+        entry = nth_entry(&index, mode, pid, seen[mode - 0x40][pid + 1]++);
+        if (0x41 == mode)
+        {
+            if (entry >= 0)
+            {
+                printf("%s: Mode 01 data is in the index\n", name);
+                sim_index_free(&index);
+                return FALSE;
+            }
+            continue;
+        }
+        if (entry < 0)
+        {
+            printf("%s: response %d of mode %02X pid %d is missing\n", name, seen[mode - 0x40][pid + 1], mode, pid);
+            sim_index_free(&index);
+            return FALSE;
+        }
+        sim_index_message(&index, entry, &indexed);
+        if (!same_message(&msg, &indexed) || sim_index_exchange(&index, entry) != reader.prompts)
+        {
+            printf("%s: entry %ld of mode %02X pid %d, request %lu, the reader has request %lu\n",
+                   name, entry, mode, pid, sim_index_exchange(&index, entry), reader.prompts);
+            print_message("reader", &msg);
+            print_message("index", &indexed);
+            sim_index_free(&index);
+            return FALSE;
+        }
+        ++entries;
+    }
+    if (entries != index.numEntries)
+    {
+        printf("%s: %ld entries, the reader has %ld responses for them\n", name, index.numEntries, entries);
+        sim_index_free(&index);
+        return FALSE;
+    }
+    sim_index_free(&index);
+    printf("%s: %ld responses indexed\n", name, entries);
+    return TRUE;
+}
+
+static int check_lookups(void)
+{
+    SIM_INDEX index;
+    ELM_MESSAGE msg;
+    long entry;
+    int right;
+
+    if (!sim_index_build(&index, scansSim, sizeof(scansSim) - 1, 0))
+    {
+        return FALSE;
+    }
+    // the VIN twice, reassembled, the second a request of the second scan
+    entry = sim_index_first(&index, 0x49, 0x02);
+    if (entry >= 0)
+    {
+        sim_index_message(&index, entry, &msg);
+    }
+    right = (entry >= 0 && 20 == msg.length && msg.multiFrame &&
+             0 == memcmp(msg.data + 3, "1D3HV13T09S718057", 17) &&
+             0 == sim_index_exchange(&index, entry));
+    entry = right ? sim_index_next(&index, entry) : -1;
+    right = right && entry >= 0 && 6 == sim_index_exchange(&index, entry) && sim_index_next(&index, entry) < 0;
+    // the stored codes of both ECUs answer one request, the empty answer of the next scan another
+    entry = sim_index_first(&index, 0x43, SIM_NO_PID);
+    right = right && entry >= 0 && 3 == sim_index_exchange(&index, entry);
+    entry = right ? sim_index_next(&index, entry) : -1;
+    right = right && entry >= 0 && 3 == sim_index_exchange(&index, entry);
+    entry = right ? sim_index_next(&index, entry) : -1;
+    right = right && entry >= 0 && 8 == sim_index_exchange(&index, entry) && sim_index_next(&index, entry) < 0;
+    // Mode 01 is replayed from the buffer, 0A has no pid, and nothing answers Mode 02
+    right = right && sim_index_first(&index, 0x41, 0x00) < 0 && sim_index_first(&index, 0x41, 0x0C) < 0;
+    right = right && sim_index_first(&index, 0x4A, SIM_NO_PID) >= 0 && sim_index_first(&index, 0x4A, 0x01) < 0;
+    right = right && sim_index_first(&index, 0x42, 0x00) < 0 && sim_index_first(&index, 0x01, 0x00) < 0;
+    sim_index_free(&index);
+    if (!right)
+    {
+        printf("built-in lookups: wrong\n");
+        return FALSE;
+    }
+
+    // each ECU's header kept with its codes
+    if (!sim_index_build(&index, headersSim, sizeof(headersSim) - 1, 3))
+    {
+        return FALSE;
+    }
+    entry = sim_index_first(&index, 0x43, SIM_NO_PID);
+    if (entry >= 0)
+    {
+        sim_index_message(&index, entry, &msg);
+    }
+    right = (entry >= 0 && msg.header && 3 == msg.headerLength && 0 == memcmp(msg.header, "7E8", 3));
+    entry = right ? sim_index_next(&index, entry) : -1;
+    if (entry >= 0)
+    {
+        sim_index_message(&index, entry, &msg);
+    }
+    right = right && entry >= 0 && msg.header && 0 == memcmp(msg.header, "7E9", 3) &&
+            4 == msg.length && 0x02 == msg.data[2];
+    sim_index_free(&index);
+    if (!right)
+    {
+        printf("built-in lookups with headers: wrong\n");
+        return FALSE;
+    }
+    printf("built-in lookups: right\n");
+    return TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+    MAPPED_FILE file;
+    int k;
+
+    if (!check_against_reader("headers off", scansSim, sizeof(scansSim) - 1) ||
+        !check_against_reader("headers on", headersSim, sizeof(headersSim) - 1) ||
+        !check_lookups())
+    {
+        return 1;
+    }
+    for (k = 1; k < argc; ++k)
+    {
+        if (!map_file(&file, argv[k]))
+        {
+            printf("%s: cannot be read\n", argv[k]);
+            return 1;
+        }
+        if (!check_against_reader(argv[k], file.data, file.size))
+        {
+            unmap_file(&file);
+            return 1;
+        }
+        unmap_file(&file);
+    }
+    return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * The single producer, single consumer ring, on one thread and on two.
+ *
+ *   spsc_ring_test
+ *
+ * On one thread the ring must round its size up to a power of two, hold
+ * exactly that many slots, and give them back in order.  Then a producer
+ * thread sends numbered slots through a small ring to a consumer thread,
+ * starting with the counters just short of wrapping: every slot must
+ * arrive once, in order, with the bytes the producer wrote.  Exits 1 on
+ * the first difference, after printing it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../globals.h"
+#include "../platform.h"
+#include "../spsc_ring.h"
+
+#define RING_SLOTS      100     // rounded up to 128
+#define SLOT_SIZE       40
+#define ITEMS           500000UL
+#define SPINS_PER_NAP   64      // then give up the time slice, a single processor must let the other thread run
+#define WRAP_MARGIN     1000UL  // slots before the counters wrap
+
+typedef struct _THREAD_RESULT
+{
+    SPSC_RING *ring;
+    unsigned long done;
+    unsigned long waits;
+} THREAD_RESULT;
+
+// set by the consumer on a wrong slot, so the producer does not wait for ever
+static volatile unsigned long stopped;
+
+// the bytes of slot n, all of them, so a torn slot shows
+static void fill_slot(unsigned char *slot, unsigned long n)
+{
+    int k;
+
+    memcpy(slot, &n, sizeof(n));
+    for (k = sizeof(n); k < SLOT_SIZE; ++k)
+    {
+        slot[k] = (unsigned char)(n * 31 + k);
+    }
+}
+
+static int slot_is(const unsigned char *slot, unsigned long n)
+{
+    unsigned char want[SLOT_SIZE];
+
+    fill_slot(want, n);
+    return 0 == memcmp(slot, want, SLOT_SIZE);
+}
+
+static void nap(unsigned long *waits)
+{
+    if (0 == ++*waits % SPINS_PER_NAP)
+    {
+        sleep_ms(0);
+    }
+}
+
+static void producer(void *arg)
+{
+    THREAD_RESULT *result = (THREAD_RESULT *)arg;
+    unsigned char *slot;
+
+    while (result->done < ITEMS && !atomic_load_acquire(&stopped))
+    {
+        slot = (unsigned char *)spsc_claim(result->ring);
+        if (NULL == slot)
+        {
+            nap(&result->waits);
+            continue;
+        }
+        fill_slot(slot, result->done++);
+        spsc_publish(result->ring);
+    }
+}
+
+static void consumer(void *arg)
+{
+    THREAD_RESULT *result = (THREAD_RESULT *)arg;
+    const unsigned char *slot;
+
+    while (result->done < ITEMS)
+    {
+        slot = (const unsigned char *)spsc_peek(result->ring);
+        if (NULL == slot)
+        {
+            nap(&result->waits);
+            continue;
+        }
+        if (!slot_is(slot, result->done))
+        {
+            printf("two threads: slot %lu arrived wrong\n", result->done);
+            atomic_store_release(&stopped, TRUE);
+            return;
+        }
+        ++result->done;
+        spsc_release(result->ring);
+    }
+}
+
+static int check_one_thread(void)
+{
+    SPSC_RING ring;
+    unsigned long k;
+    void *slot;
+
+    if (!spsc_init(&ring, RING_SLOTS, SLOT_SIZE))
+    {
+        printf("out of memory\n");
+        return FALSE;
+    }
+    if (128 != ring.count || NULL != spsc_peek(&ring))
+    {
+        printf("one thread: a new ring of %lu slots is not empty\n", ring.count);
+        spsc_free(&ring);
+        return FALSE;
+    }
+    for (k = 0; k < ring.count; ++k)
+    {
+        slot = spsc_claim(&ring);
+        if (NULL == slot)
+        {
+            printf("one thread: full after %lu slots\n", k);
+            spsc_free(&ring);
+            return FALSE;
+        }
+        fill_slot((unsigned char *)slot, k);
+        spsc_publish(&ring);
+    }
+    if (NULL != spsc_claim(&ring))
+    {
+        printf("one thread: more than %lu slots taken\n", ring.count);
+        spsc_free(&ring);
+        return FALSE;
+    }
+    for (k = 0; k < ring.count; ++k)
+    {
+        slot = spsc_peek(&ring);
+        if (NULL == slot || !slot_is((const unsigned char *)slot, k))
+        {
+            printf("one thread: slot %lu read back wrong\n", k);
+            spsc_free(&ring);
+            return FALSE;
+        }
+        spsc_release(&ring);
+    }
+    if (NULL != spsc_peek(&ring) || NULL == spsc_claim(&ring))
+    {
+        printf("one thread: not empty once all is read\n");
+        spsc_free(&ring);
+        return FALSE;
+    }
+    spsc_free(&ring);
+    printf("one thread: %d slots held and read back in order\n", 128);
+    return TRUE;
+}
+
+static int check_two_threads(void)
+{
+    SPSC_RING ring;
+    PLATFORM_THREAD producerThread;
+    PLATFORM_THREAD consumerThread;
+    THREAD_RESULT produced;
+    THREAD_RESULT consumed;
+
+    if (!spsc_init(&ring, RING_SLOTS, SLOT_SIZE))
+    {
+        printf("out of memory\n");
+        return FALSE;
+    }
+    ring.head = ring.tail = 0UL - WRAP_MARGIN;
+    memset(&produced, 0, sizeof(produced));
+    memset(&consumed, 0, sizeof(consumed));
+    produced.ring = &ring;
+    consumed.ring = &ring;
+    if (!thread_start(&consumerThread, consumer, &consumed))
+    {
+        printf("no thread\n");
+        spsc_free(&ring);
+        return FALSE;
+    }
+    if (!thread_start(&producerThread, producer, &produced))
+    {
+        printf("no thread\n");
+        // the consumer waits for ever without it
+        exit(1);
+    }
+    thread_join(&producerThread);
+    thread_join(&consumerThread);
+    spsc_free(&ring);
+    if (ITEMS != consumed.done)
+    {
+        return FALSE;
+    }
+    printf("two threads: %lu slots passed in order, %lu full and %lu empty polls\n",
+           ITEMS, produced.waits, consumed.waits);
+    return TRUE;
+}
+
+int main(void)
+{
+    return (check_one_thread() && check_two_threads()) ? 0 : 1;
+}
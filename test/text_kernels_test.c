@@ -0,0 +1,202 @@
+/*
+ * The SIMD text kernels against the scalar ones, on every length up to
+ * a few blocks past the widest vector and every alignment within one.
+ *
+ *   text_kernels_test
+ *
+ * Text is drawn from a fixed seed: responses with spaces from none to
+ * all of them, and hex with a bad character anywhere or none.  Each
+ * kernel set the CPU runs must give the scalar results byte for byte
+ * and leave the bytes past its output alone.  Exits 1 on the first
+ * difference, after printing it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../globals.h"
+#include "../text_kernels.h"
+
+#define MAX_LENGTH      300     // some blocks of 32 and a tail
+#define ALIGNMENTS      64
+#define GUARD           32
+#define GUARD_BYTE      0xA5
+#define SPACE_DENSITIES 5
+
+static const char hexDigits[] = "0123456789ABCDEFabcdef";
+static const char notHex[] = "GgZz:/@`\r> \x7F\x80\xFF";
+
+static unsigned long seed = 12345;
+
+static unsigned long next_random(void)
+{
+    seed = seed * 1103515245UL + 12345UL;
+    return (seed >> 16) & 0x7FFF;
+}
+
+// length characters of a response, a space one in 2^density - 1 of them, all for density 0
+static void make_response(char *text, unsigned long length, int density)
+{
+    unsigned long k;
+
+    for (k = 0; k < length; ++k)
+    {
+        if (0 == density || 0 == next_random() % ((1UL << density) - 1))
+        {
+            text[k] = ' ';
+        }
+        else
+        {
+            text[k] = hexDigits[next_random() % (sizeof(hexDigits) - 1)];
+        }
+    }
+}
+
+static int guard_intact(const unsigned char *guard)
+{
+    int k;
+
+    for (k = 0; k < GUARD; ++k)
+    {
+        if (GUARD_BYTE != guard[k])
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static int check_strip(int level, unsigned long length, int align, int density)
+{
+    static char input[MAX_LENGTH];
+    static char expected[MAX_LENGTH];
+    static char space[ALIGNMENTS + MAX_LENGTH + GUARD];
+    char *buf = space + align;
+    unsigned long want, got;
+
+    make_response(input, length, density);
+    memcpy(expected, input, length);
+    text_kernels_select(TEXT_KERNEL_SCALAR);
+    want = strip_spaces(expected, length);
+
+    memset(space, GUARD_BYTE, sizeof(space));
+    memcpy(buf, input, length);
+    text_kernels_select(level);
+    got = strip_spaces(buf, length);
+    if (got != want || 0 != memcmp(buf, expected, want) ||
+        !guard_intact((unsigned char *)buf + length))
+    {
+        printf("strip_spaces %s: length %lu alignment %d gives %lu bytes, scalar %lu\n",
+               text_kernels_name(level), length, align, got, want);
+        printf("  in:  %.*s\n  out: %.*s\n  ref: %.*s\n",
+               (int)length, input, (int)got, buf, (int)want, expected);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// bad is the character to spoil, length for none
+static int check_hex(int level, unsigned long length, int align, unsigned long bad)
+{
+    static char input[ALIGNMENTS + MAX_LENGTH];
+    static unsigned char expected[MAX_LENGTH / 2];
+    static unsigned char out[MAX_LENGTH / 2 + GUARD];
+    char *text = input + align;
+    unsigned long k;
+    int want, got;
+
+    for (k = 0; k < length; ++k)
+    {
+        text[k] = hexDigits[next_random() % (sizeof(hexDigits) - 1)];
+    }
+    if (bad < length)
+    {
+        text[bad] = notHex[next_random() % (sizeof(notHex) - 1)];
+    }
+    text_kernels_select(TEXT_KERNEL_SCALAR);
+    want = hex_to_bytes(text, length, expected);
+
+    memset(out, GUARD_BYTE, sizeof(out));
+    text_kernels_select(level);
+    got = hex_to_bytes(text, length, out);
+    // what a failed decode leaves in out is not defined
+    if (got != want || (want && 0 != memcmp(out, expected, length / 2)) ||
+        !guard_intact(out + length / 2))
+    {
+        printf("hex_to_bytes %s: length %lu alignment %d bad at %lu gives %d, scalar %d\n",
+               text_kernels_name(level), length, align, bad, got, want);
+        printf("  in: %.*s\n", (int)length, text);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int check_level(int level)
+{
+    unsigned long length, bad;
+    int align, density;
+
+    for (length = 0; length <= MAX_LENGTH; ++length)
+    {
+        for (align = 0; align < ALIGNMENTS; ++align)
+        {
+            for (density = 0; density < SPACE_DENSITIES; ++density)
+            {
+                if (!check_strip(level, length, align, density))
+                {
+                    return FALSE;
+                }
+            }
+            if (!check_hex(level, length, align, length))
+            {
+                return FALSE;
+            }
+            // odd lengths are refused before any kernel runs; for the rest
+            // a bad character at every position of the short ones, one somewhere in the long
+            if (length & 1)
+            {
+                continue;
+            }
+            if (length <= 2 * ALIGNMENTS)
+            {
+                for (bad = 0; bad < length; ++bad)
+                {
+                    if (!check_hex(level, length, align, bad))
+                    {
+                        return FALSE;
+                    }
+                }
+            }
+            else if (!check_hex(level, length, align, next_random() % length))
+            {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+int main(void)
+{
+    int level;
+    int checked = 0;
+
+    for (level = TEXT_KERNEL_SSE2; level <= TEXT_KERNEL_AVX2; ++level)
+    {
+        if (text_kernels_select(level) != level)
+        {
+            printf("%s: not supported here, skipped\n", text_kernels_name(level));
+            continue;
+        }
+        if (!check_level(level))
+        {
+            return 1;
+        }
+        printf("%s: same as scalar\n", text_kernels_name(level));
+        ++checked;
+    }
+    if (0 == checked)
+    {
+        printf("scalar only, nothing to compare\n");
+    }
+    return 0;
+}
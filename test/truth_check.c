@@ -0,0 +1,399 @@
+/*
+ * A capgen output scanned through libscantool, against the truth file
+ * capgen wrote with it.
+ *
+ *   truth_check [-n] input truth
+ *
+ * The values the scan hands to its value callback must be the values
+ * of the truth, each as often: the PID and the text the formula makes
+ * of it.  Each trouble code must be reported with the kinds the truth
+ * has it as and by as many ECUs, no code the truth lacks may be, and
+ * the VIN must be the truth's.  Works on the text format and on a
+ * capture (-c) alike.  Exits 1 on the first difference, after printing
+ * it.
+ *
+ * -n leaves the ECU counts out, for the protocols before CAN with
+ * headers off: an answer of several frames then reads as several ECUs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../globals.h"
+#include "../mapped_file.h"
+#include "../libscantool.h"
+
+#define MAX_LINE        1024
+#define MAX_TRUTH_CODES 1024
+#define MAX_CODE_ECUS   32
+
+typedef struct _STRING_LIST
+{
+    char **items;
+    unsigned long count;
+    unsigned long size;
+} STRING_LIST;
+
+typedef struct _CODE_SEEN
+{
+    char code[8];
+    int kinds;
+    int ecus;                   // the scan's count, or how many IDs below for the truth
+    char ids[MAX_CODE_ECUS][16];
+} CODE_SEEN;
+
+typedef struct _RESULTS
+{
+    STRING_LIST values;
+    CODE_SEEN codes[MAX_TRUTH_CODES];
+    int numCodes;
+    char vin[32];
+    int failed;                 // out of memory, or more codes than fit
+} RESULTS;
+
+static int add_string(STRING_LIST *list, const char *text)
+{
+    char *copy = (char *)malloc(strlen(text) + 1);
+
+    if (NULL == copy)
+    {
+        return FALSE;
+    }
+    if (list->count >= list->size)
+    {
+        unsigned long newSize = list->size ? 2 * list->size : 1024;
+        char **newItems = (char **)realloc(list->items, newSize * sizeof(char *));
+        if (NULL == newItems)
+        {
+            free(copy);
+            return FALSE;
+        }
+        list->items = newItems;
+        list->size = newSize;
+    }
+    strcpy(copy, text);
+    list->items[list->count++] = copy;
+    return TRUE;
+}
+
+static void free_strings(STRING_LIST *list)
+{
+    unsigned long k;
+
+    for (k = 0; k < list->count; ++k)
+    {
+        free(list->items[k]);
+    }
+    free(list->items);
+    memset(list, 0, sizeof(*list));
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static CODE_SEEN *find_code(RESULTS *results, const char *code)
+{
+    int k;
+
+    for (k = 0; k < results->numCodes; ++k)
+    {
+        if (0 == strcmp(results->codes[k].code, code))
+        {
+            return &results->codes[k];
+        }
+    }
+    if (results->numCodes >= MAX_TRUTH_CODES || strlen(code) >= sizeof(results->codes[0].code))
+    {
+        results->failed = TRUE;
+        return NULL;
+    }
+    memset(&results->codes[results->numCodes], 0, sizeof(CODE_SEEN));
+    strcpy(results->codes[results->numCodes].code, code);
+    return &results->codes[results->numCodes++];
+}
+
+// "pid\ttext", the text as capgen writes it to the truth: one line, no tabs
+static int add_value(RESULTS *results, int pid, const char *value)
+{
+    char line[MAX_LINE];
+    char *end;
+
+    sprintf(line, "%02X\t", pid);
+    strncat(line, value, sizeof(line) - strlen(line) - 1);
+    for (end = line + strlen(line); end > line + 3 && ('\n' == end[-1] || '\r' == end[-1]); --end)
+    {
+        end[-1] = '\0';
+    }
+    for (end = line + 3; *end; ++end)
+    {
+        if ('\n' == *end || '\r' == *end || '\t' == *end)
+        {
+            *end = ' ';
+        }
+    }
+    return add_string(&results->values, line);
+}
+
+static void on_vehicle(void *context, const char *vin, const char *modelYear)
+{
+    RESULTS *results = (RESULTS *)context;
+
+    (void)modelYear;
+    strncpy(results->vin, vin, sizeof(results->vin) - 1);
+}
+
+static void on_value(void *context, int pid, const char *label, const char *value)
+{
+    RESULTS *results = (RESULTS *)context;
+
+    (void)label;
+    if (!add_value(results, pid, value))
+    {
+        results->failed = TRUE;
+    }
+}
+
+static void on_trouble_code(void *context, const char *code, const char *description, int kinds, int ecus)
+{
+    RESULTS *results = (RESULTS *)context;
+    CODE_SEEN *seen = find_code(results, code);
+
+    (void)description;
+    if (seen)
+    {
+        seen->kinds |= kinds;
+        seen->ecus = ecus;
+    }
+}
+
+static void on_message(void *context, const char *text)
+{
+    (void)context;
+    printf("scan: %s\n", text);
+}
+
+static int scan_input(const char *fname, RESULTS *results)
+{
+    MAPPED_FILE file;
+    SCANTOOL_TRANSPORT transport;
+    SCANTOOL_CALLBACKS callbacks;
+    SCANTOOL *tool;
+    int status;
+
+    if (!map_file(&file, fname))
+    {
+        printf("%s: cannot be read\n", fname);
+        return FALSE;
+    }
+    memset(&transport, 0, sizeof(transport));
+    transport.kind = SCANTOOL_LOG;
+    transport.data = file.data;
+    transport.size = file.size;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.vehicle = on_vehicle;
+    callbacks.value = on_value;
+    callbacks.trouble_code = on_trouble_code;
+    callbacks.message = on_message;
+    callbacks.context = results;
+    tool = scantool_open(&transport, &callbacks);
+    if (NULL == tool)
+    {
+        printf("%s: cannot be scanned\n", fname);
+        unmap_file(&file);
+        return FALSE;
+    }
+    status = scantool_scan(tool, 0, NULL);
+    scantool_close(tool);
+    unmap_file(&file);
+    if (SCANTOOL_OK != status || results->failed)
+    {
+        printf("%s: the scan failed\n", fname);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// the codes of one ECU's answer, each with the ECU's ID
+static int add_truth_codes(RESULTS *truth, const char *id, int kind, char *codes)
+{
+    CODE_SEEN *seen;
+    char *code;
+    int k;
+
+    for (code = strtok(codes, " "); code; code = strtok(NULL, " "))
+    {
+        seen = find_code(truth, code);
+        if (NULL == seen)
+        {
+            return FALSE;
+        }
+        seen->kinds |= kind;
+        for (k = 0; k < seen->ecus && strcmp(seen->ids[k], id); ++k)
+        {
+        }
+        if (k == seen->ecus)
+        {
+            if (seen->ecus >= MAX_CODE_ECUS || strlen(id) >= sizeof(seen->ids[0]))
+            {
+                return FALSE;
+            }
+            strcpy(seen->ids[seen->ecus++], id);
+        }
+    }
+    return TRUE;
+}
+
+static int read_truth(const char *fname, RESULTS *truth)
+{
+    FILE *in = fopen(fname, "r");
+    char line[MAX_LINE];
+    char *field[6];
+    char *p;
+    int n;
+    int right = TRUE;
+
+    if (NULL == in)
+    {
+        printf("%s: cannot be read\n", fname);
+        return FALSE;
+    }
+    while (right && fgets(line, sizeof(line), in))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        for (n = 0, p = line; n < 6 && p; ++n)
+        {
+            field[n] = p;
+            p = strchr(p, '\t');
+            if (p)
+            {
+                *p++ = '\0';
+            }
+        }
+        if (n < 5)
+        {
+            continue;
+        }
+        if (0 == strncmp(field[3], "pid", 3) && 6 == n)
+        {
+            right = add_value(truth, (int)strtol(field[3] + 3, NULL, 16), field[5]);
+        }
+        else if (0 == strcmp(field[3], "stored"))
+        {
+            right = add_truth_codes(truth, field[2], SCANTOOL_CODE_STORED, field[4]);
+        }
+        else if (0 == strcmp(field[3], "pending"))
+        {
+            right = add_truth_codes(truth, field[2], SCANTOOL_CODE_PENDING, field[4]);
+        }
+        else if (0 == strcmp(field[3], "permanent"))
+        {
+            right = add_truth_codes(truth, field[2], SCANTOOL_CODE_PERMANENT, field[4]);
+        }
+        else if (0 == strcmp(field[3], "vin"))
+        {
+            strncpy(truth->vin, field[4], sizeof(truth->vin) - 1);
+        }
+    }
+    fclose(in);
+    if (!right)
+    {
+        printf("%s: too many codes or out of memory\n", fname);
+    }
+    return right;
+}
+
+static int compare_values(const RESULTS *scanned, const RESULTS *truth)
+{
+    unsigned long s = 0;
+    unsigned long t = 0;
+    int order;
+
+    qsort(scanned->values.items, scanned->values.count, sizeof(char *), compare_strings);
+    qsort(truth->values.items, truth->values.count, sizeof(char *), compare_strings);
+    while (s < scanned->values.count || t < truth->values.count)
+    {
+        if (s == scanned->values.count)
+        {
+            order = 1;
+        }
+        else if (t == truth->values.count)
+        {
+            order = -1;
+        }
+        else
+        {
+            order = strcmp(scanned->values.items[s], truth->values.items[t]);
+        }
+        if (order < 0)
+        {
+            printf("values: the scan has one the truth lacks: %s\n", scanned->values.items[s]);
+            return FALSE;
+        }
+        if (order > 0)
+        {
+            printf("values: the scan lacks one of the truth: %s\n", truth->values.items[t]);
+            return FALSE;
+        }
+        ++s;
+        ++t;
+    }
+    printf("values: %lu the same\n", s);
+    return TRUE;
+}
+
+static int compare_codes(RESULTS *scanned, RESULTS *truth, int countEcus)
+{
+    const CODE_SEEN *seen;
+    int k;
+
+    for (k = 0; k < truth->numCodes; ++k)
+    {
+        seen = find_code(scanned, truth->codes[k].code);
+        if (NULL == seen || seen->kinds != truth->codes[k].kinds ||
+            (countEcus && seen->ecus != truth->codes[k].ecus))
+        {
+            printf("codes: %s is kinds %X from %d ECUs, the scan has kinds %X from %d\n",
+                   truth->codes[k].code, truth->codes[k].kinds, truth->codes[k].ecus,
+                   seen ? seen->kinds : 0, seen ? seen->ecus : 0);
+            return FALSE;
+        }
+    }
+    if (scanned->numCodes != truth->numCodes)
+    {
+        printf("codes: the scan has %d, the truth %d\n", scanned->numCodes, truth->numCodes);
+        return FALSE;
+    }
+    printf("codes: %d the same\n", truth->numCodes);
+    return TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+    static RESULTS scanned;
+    static RESULTS truth;
+    int countEcus = TRUE;
+    int right;
+
+    if (argc > 1 && 0 == strcmp(argv[1], "-n"))
+    {
+        countEcus = FALSE;
+        ++argv;
+        --argc;
+    }
+    if (3 != argc)
+    {
+        printf("Usage: truth_check [-n] input truth\n");
+        return 2;
+    }
+    right = read_truth(argv[2], &truth) && scan_input(argv[1], &scanned) &&
+            compare_values(&scanned, &truth) && compare_codes(&scanned, &truth, countEcus);
+    if (right && strcmp(scanned.vin, truth.vin))
+    {
+        printf("vin: the scan has %s, the truth %s\n", scanned.vin, truth.vin);
+        right = FALSE;
+    }
+    free_strings(&scanned.values);
+    free_strings(&truth.values);
+    return right ? 0 : 1;
+}
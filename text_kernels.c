@@ -0,0 +1,412 @@
+#ifdef WINDDK
+#include <windows.h>
+#endif // WINDDK
+#ifdef WIN_VS6
+#include <windows.h>
+#endif // WIN_VS6
+#include <string.h>
+#include "globals.h"
+#include "platform.h"
+#include "text_kernels.h"
+
+// VS6 has no SSE2 intrinsics, so it only gets the scalar kernels
+#if defined(_MSC_VER) && !defined(WIN_VS6) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#include <emmintrin.h>
+#define HAVE_SSE2_KERNELS
+#define TARGET_SSE2
+#if _MSC_VER >= 1800
+#include <immintrin.h>
+#define HAVE_AVX2_KERNELS
+#define TARGET_AVX2
+#endif // _MSC_VER
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define HAVE_SSE2_KERNELS
+#define HAVE_AVX2_KERNELS
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// the set in use plus one, 0 until the first call picks it; scans on
+// several threads can make that first call at the same time
+static volatile unsigned long kernelSet = 0;
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static unsigned long strip_spaces_scalar(char *buf, unsigned long length)
+{
+    unsigned long in;
+    unsigned long out = 0;
+
+    for (in = 0; in < length; ++in)
+    {
+        if (' ' != buf[in])
+        {
+            buf[out++] = buf[in];
+        }
+    }
+    return out;
+}
+
+static int hex_to_bytes_scalar(const char *text, unsigned long length, unsigned char *out)
+{
+    unsigned long k;
+    int hi, lo;
+
+    for (k = 0; k + 1 < length; k += 2)
+    {
+        hi = hex_value(text[k]);
+        lo = hex_value(text[k + 1]);
+        if (hi < 0 || lo < 0)
+        {
+            return FALSE;
+        }
+        *out++ = (unsigned char)((hi << 4) | lo);
+    }
+    return TRUE;
+}
+
+#ifdef HAVE_SSE2_KERNELS
+
+/*
+ * SSE2 has no byte shuffle, so blocks without a space are moved whole
+ * and the rest go byte by byte.  That pays off on text with long runs
+ * between spaces, which compressed captures and headers-off CAN are.
+ */
+TARGET_SSE2 static unsigned long strip_spaces_sse2(char *buf, unsigned long length)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    unsigned long in = 0;
+    unsigned long out = 0;
+
+    while (in + 16 <= length)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(buf + in));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, space));
+        if (0 == mask)
+        {
+            _mm_storeu_si128((__m128i *)(buf + out), block);
+            out += 16;
+        }
+        else
+        {
+            int k;
+            for (k = 0; k < 16; ++k)
+            {
+                if (0 == (mask & (1 << k)))
+                {
+                    buf[out++] = buf[in + k];
+                }
+            }
+        }
+        in += 16;
+    }
+    while (in < length)
+    {
+        if (' ' != buf[in])
+        {
+            buf[out++] = buf[in];
+        }
+        ++in;
+    }
+    return out;
+}
+
+// value of 16 ASCII hex digits as 16 nibbles, FALSE if any is not a digit
+TARGET_SSE2 static int nibbles_sse2(__m128i text, __m128i *value)
+{
+    __m128i lower = _mm_or_si128(text, _mm_set1_epi8(0x20));
+    __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(text, _mm_set1_epi8('0' - 1)),
+                                    _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), text));
+    __m128i isAlpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                    _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+
+    if (0xFFFF != _mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)))
+    {
+        return FALSE;
+    }
+    *value = _mm_or_si128(_mm_and_si128(isDigit, _mm_sub_epi8(text, _mm_set1_epi8('0'))),
+                          _mm_and_si128(isAlpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+    return TRUE;
+}
+
+TARGET_SSE2 static int hex_to_bytes_sse2(const char *text, unsigned long length, unsigned char *out)
+{
+    unsigned long k = 0;
+
+    for (; k + 16 <= length; k += 16)
+    {
+        __m128i value;
+        __m128i pairs;
+        if (!nibbles_sse2(_mm_loadu_si128((const __m128i *)(text + k)), &value))
+        {
+            return FALSE;
+        }
+        // each 16 bit lane holds (high digit, low digit), little endian
+        pairs = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(value, _mm_set1_epi16(0x00FF)), 4),
+                             _mm_srli_epi16(value, 8));
+        _mm_storel_epi64((__m128i *)out, _mm_packus_epi16(pairs, pairs));
+        out += 8;
+    }
+    return hex_to_bytes_scalar(text + k, length - k, out);
+}
+
+#endif // HAVE_SSE2_KERNELS
+
+#ifdef HAVE_AVX2_KERNELS
+
+// shuffle control per 8 bit space mask: the indices of the bytes to keep
+static unsigned char keepShuffle[256][8];
+static unsigned char keepCount[256];
+static volatile unsigned long keepTables = 0;  // 1 while being built, 2 once built
+
+static void build_keep_tables(void)
+{
+    int mask, bit, n;
+
+    if (!atomic_compare_swap(&keepTables, 0, 1))
+    {
+        // another thread got here first
+        while (2 != atomic_load_acquire(&keepTables))
+        {
+            sleep_ms(1);
+        }
+        return;
+    }
+    for (mask = 0; mask < 256; ++mask)
+    {
+        n = 0;
+        for (bit = 0; bit < 8; ++bit)
+        {
+            if (0 == (mask & (1 << bit)))
+            {
+                keepShuffle[mask][n++] = (unsigned char)bit;
+            }
+        }
+        keepCount[mask] = (unsigned char)n;
+        while (n < 8)
+        {
+            keepShuffle[mask][n++] = 0x80;  // zero fill
+        }
+    }
+    atomic_store_release(&keepTables, 2);
+}
+
+/*
+ * Compacts each 8 byte half with a table driven shuffle.  Stores are
+ * 8 bytes wide but never pass the end of the block being read, so the
+ * kernel works in place.
+ */
+TARGET_AVX2 static unsigned long strip_spaces_avx2(char *buf, unsigned long length)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    unsigned long in = 0;
+    unsigned long out = 0;
+
+    while (in + 32 <= length)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(buf + in));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, space));
+        if (0 == mask)
+        {
+            _mm256_storeu_si256((__m256i *)(buf + out), block);
+            out += 32;
+        }
+        else
+        {
+            __m128i half[2];
+            int k;
+            half[0] = _mm256_castsi256_si128(block);
+            half[1] = _mm256_extracti128_si256(block, 1);
+            for (k = 0; k < 4; ++k)
+            {
+                unsigned int m = (mask >> (k * 8)) & 0xFF;
+                __m128i bytes = (k & 1) ? _mm_srli_si128(half[k >> 1], 8) : half[k >> 1];
+                __m128i shuffle = _mm_loadl_epi64((const __m128i *)keepShuffle[m]);
+                _mm_storel_epi64((__m128i *)(buf + out), _mm_shuffle_epi8(bytes, shuffle));
+                out += keepCount[m];
+            }
+        }
+        in += 32;
+    }
+    while (in < length)
+    {
+        if (' ' != buf[in])
+        {
+            buf[out++] = buf[in];
+        }
+        ++in;
+    }
+    return out;
+}
+
+TARGET_AVX2 static int hex_to_bytes_avx2(const char *text, unsigned long length, unsigned char *out)
+{
+    unsigned long k = 0;
+
+    for (; k + 32 <= length; k += 32)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i *)(text + k));
+        __m256i lower = _mm256_or_si256(chars, _mm256_set1_epi8(0x20));
+        __m256i isDigit = _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8('0' - 1)),
+                                           _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chars));
+        __m256i isAlpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                           _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+        __m256i value, pairs, packed;
+
+        if (-1 != _mm256_movemask_epi8(_mm256_or_si256(isDigit, isAlpha)))
+        {
+            return FALSE;
+        }
+        value = _mm256_or_si256(_mm256_and_si256(isDigit, _mm256_sub_epi8(chars, _mm256_set1_epi8('0'))),
+                                _mm256_and_si256(isAlpha, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+        pairs = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(value, _mm256_set1_epi16(0x00FF)), 4),
+                                _mm256_srli_epi16(value, 8));
+        // packing works per 128 bit lane, gather the two low quarters
+        packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(pairs, pairs), 0xD8);
+        _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(packed));
+        out += 16;
+    }
+    return hex_to_bytes_scalar(text + k, length - k, out);
+}
+
+#endif // HAVE_AVX2_KERNELS
+
+// the best kernel set this CPU and OS can run
+static int detect_level(void)
+{
+    int level = TEXT_KERNEL_SCALAR;
+#if defined(_MSC_VER) && defined(HAVE_SSE2_KERNELS)
+    int info[4];
+
+    __cpuid(info, 1);
+    if (info[3] & (1 << 26))
+    {
+        level = TEXT_KERNEL_SSE2;
+    }
+#ifdef HAVE_AVX2_KERNELS
+    // AVX2 also needs the OS to save the ymm registers
+    if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+        6 == (_xgetbv(0) & 6))
+    {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5))
+        {
+            level = TEXT_KERNEL_AVX2;
+        }
+    }
+#endif // HAVE_AVX2_KERNELS
+#elif defined(HAVE_SSE2_KERNELS)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+    {
+        level = TEXT_KERNEL_SSE2;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        level = TEXT_KERNEL_AVX2;
+    }
+#endif
+    return level;
+}
+
+// use the best kernel set up to level, returns the set in use
+int text_kernels_select(int level)
+{
+    int best = detect_level();
+
+    if (level > best)
+    {
+        level = best;
+    }
+#ifdef HAVE_AVX2_KERNELS
+    if (level >= TEXT_KERNEL_AVX2)
+    {
+        build_keep_tables();
+    }
+#endif // HAVE_AVX2_KERNELS
+    atomic_store_release(&kernelSet, (unsigned long)level + 1);
+    return level;
+}
+
+int text_kernels_level(void)
+{
+    unsigned long set = atomic_load_acquire(&kernelSet);
+
+    if (0 == set)
+    {
+        return text_kernels_select(TEXT_KERNEL_AVX2);
+    }
+    return (int)(set - 1);
+}
+
+const char *text_kernels_name(int level)
+{
+    switch (level)
+    {
+    case TEXT_KERNEL_AVX2:
+        return "avx2";
+    case TEXT_KERNEL_SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+// remove the spaces from length bytes of buf in place, returns the new length
+unsigned long strip_spaces(char *buf, unsigned long length)
+{
+    switch (text_kernels_level())
+    {
+#ifdef HAVE_AVX2_KERNELS
+    case TEXT_KERNEL_AVX2:
+        return strip_spaces_avx2(buf, length);
+#endif // HAVE_AVX2_KERNELS
+#ifdef HAVE_SSE2_KERNELS
+    case TEXT_KERNEL_SSE2:
+        return strip_spaces_sse2(buf, length);
+#endif // HAVE_SSE2_KERNELS
+    default:
+        return strip_spaces_scalar(buf, length);
+    }
+}
+
+// decode length (even) ASCII hex digits into length / 2 bytes
+// returns FALSE if any character is not a hex digit
+int hex_to_bytes(const char *text, unsigned long length, unsigned char *out)
+{
+    if (length & 1)
+    {
+        return FALSE;
+    }
+    switch (text_kernels_level())
+    {
+#ifdef HAVE_AVX2_KERNELS
+    case TEXT_KERNEL_AVX2:
+        return hex_to_bytes_avx2(text, length, out);
+#endif // HAVE_AVX2_KERNELS
+#ifdef HAVE_SSE2_KERNELS
+    case TEXT_KERNEL_SSE2:
+        return hex_to_bytes_sse2(text, length, out);
+#endif // HAVE_SSE2_KERNELS
+    default:
+        return hex_to_bytes_scalar(text, length, out);
+    }
+}
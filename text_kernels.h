@@ -0,0 +1,30 @@
+#ifndef TEXT_KERNELS_H
+#define TEXT_KERNELS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// instruction sets the kernels can run on, in order of preference
+#define TEXT_KERNEL_SCALAR  0
+#define TEXT_KERNEL_SSE2    1
+#define TEXT_KERNEL_AVX2    2
+
+/*
+ * Bulk text kernels for interface responses.  The best set the CPU
+ * supports is picked on first use, from whichever thread gets there
+ * first; text_kernels_select can hold them to a lower set, which the
+ * benchmark uses to compare against scalar.
+ */
+unsigned long strip_spaces(char *buf, unsigned long length);
+int hex_to_bytes(const char *text, unsigned long length, unsigned char *out);
+
+int text_kernels_select(int level);
+int text_kernels_level(void);
+const char *text_kernels_name(int level);
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif  /* TEXT_KERNELS_H */
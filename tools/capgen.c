@@ -0,0 +1,1007 @@
+/*
+ * Synthetic interface traffic for parser and decoder benchmarks: scans of
+ * virtual vehicles as an ELM327 would print them, in the -i text format
+ * or as a binary capture, with the values behind every response written
+ * alongside so a decoder can be checked as well as timed.
+ *
+ *   capgen [-s seed] [-m megabytes | -n scans] [-p protocol] [-H] [-S]
+ *          [-e ecus] [-P pids] [-M pids per request] [-d codes]
+ *          [-c] [-t truth file] output
+ *
+ *   -p 1-9    protocol as ATSP: 1-2 J1850, 3-5 ISO 9141 and KWP, 6-9 CAN
+ *   -H        headers on (ATH1), -S spaces off (ATS0)
+ *   -P        PIDs each ECU supports, all sensors[] decodes by default
+ *   -M        CAN only, up to six PIDs in one Mode 01 request
+ *   -d        codes of each kind per ECU, at most
+ *   -c        a binary capture with the timing the bus would give, not text
+ *
+ * A scan is what the scan tool asks for: the VIN, the supported PIDs, each
+ * of them, then Modes 03, 07 and 0A, with one request in sixteen for a PID
+ * nobody supports.  Values drift from scan to scan.  Everything is drawn
+ * from the seed, so the same options always give the same bytes.
+ *
+ * The truth file has a line per decoded value, tab separated:
+ *   request number, command, ECU header ID, what, value
+ * where what is pidXX with the raw value in decimal as a sensor formula
+ * gets it, stored/pending/permanent with the codes, vin, or nodata.
+ * A pidXX line has a sixth field, the text the formula makes of the
+ * value, and there is one for each row of the sensors table that decodes
+ * the PID, as the report has a line for each.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../globals.h"
+#include "../platform.h"
+#include "../capture.h"
+#include "../sensors.h"
+#include "../trouble_code_reader.h"
+
+#define MAX_ECUS            8
+#define MAX_CODES           32
+#define MAX_MESSAGE         128     // bytes of one answer
+#define MAX_ANSWERS         (MAX_ECUS * 8)
+#define MAX_TEXT            8192    // one request and its response as printed
+#define OUT_BUFFER_SIZE     (4 * 1024 * 1024)
+#define NO_DATA_ONE_IN      16
+#define HOST_BAUD           38400
+#define ECU_LATENCY_US      15000
+#define ADAPTIVE_WAIT_US    20000
+
+typedef struct _GEN_ECU
+{
+    unsigned long id;                   // CAN ID, 29 bit ID, or legacy source address
+    int hasPid[256];
+    int pidBytes[256];
+    unsigned char pidValue[256][4];
+    unsigned int codes[NUM_DTC_KINDS][MAX_CODES];
+    int numCodes[NUM_DTC_KINDS];
+} GEN_ECU;
+
+typedef struct _GEN_ANSWER
+{
+    const GEN_ECU *ecu;
+    unsigned char data[MAX_MESSAGE];
+    int length;
+} GEN_ANSWER;
+
+typedef struct _GENERATOR
+{
+    unsigned long rng;
+    int protocol;
+    int headers;
+    int spaces;
+    int pidsPerRequest;
+    GEN_ECU ecus[MAX_ECUS];
+    int numEcus;
+    char vin[18];
+    int supported[256];                 // by any ECU
+    FILE *out;
+    FILE *truth;
+    int binary;
+    CAPTURE_WRITER writer;
+    TIME_US now;
+    PLATFORM_U64 written;
+    unsigned long requests;
+    char text[MAX_TEXT];
+    int textLen;
+    TIME_US lineTime[MAX_ANSWERS * 20]; // when each line of the text is ready, for the capture
+    int lineEnd[MAX_ANSWERS * 20];
+    int numLines;
+} GENERATOR;
+
+static const char hexDigits[] = "0123456789ABCDEF";
+static const unsigned long bitRates[10] = { 0, 41600, 10400, 10400, 10400, 10400, 500000, 500000, 250000, 250000 };
+static const char *kindNames[NUM_DTC_KINDS] = { "stored", "pending", "permanent" };
+static const unsigned char kindModes[NUM_DTC_KINDS] = { 0x03, 0x07, 0x0A };
+
+static unsigned long next_random(GENERATOR *gen)
+{
+    unsigned long x = gen->rng;
+    x ^= (x << 13) & 0xFFFFFFFFUL;
+    x ^= x >> 17;
+    x ^= (x << 5) & 0xFFFFFFFFUL;
+    gen->rng = x;
+    return x;
+}
+
+static int is_can(int protocol)
+{
+    return protocol >= 6;
+}
+
+static void code_text(unsigned int code, char *text)
+{
+    text[0] = "PCBU"[code >> 14];
+    text[1] = (char)('0' + ((code >> 12) & 0x03));
+    text[2] = hexDigits[(code >> 8) & 0x0F];
+    text[3] = hexDigits[(code >> 4) & 0x0F];
+    text[4] = hexDigits[code & 0x0F];
+    text[5] = '\0';
+}
+
+static unsigned int code_value(const char *code)
+{
+    static const char letters[] = "PCBU";
+    const char *letter = strchr(letters, code[0]);
+
+    if (NULL == letter)
+    {
+        return 0;
+    }
+    return ((unsigned int)(letter - letters) << 14) |
+           ((unsigned int)(code[1] - '0') << 12) |
+           (unsigned int)strtoul(code + 2, NULL, 16);
+}
+
+/* text of the response, as the interface prints it */
+
+static void put_char(GENERATOR *gen, char c)
+{
+    if (gen->textLen < MAX_TEXT - 1)
+    {
+        gen->text[gen->textLen++] = c;
+    }
+}
+
+static void put_hex(GENERATOR *gen, unsigned long value, int digits)
+{
+    while (digits-- > 0)
+    {
+        put_char(gen, hexDigits[(value >> (4 * digits)) & 0x0F]);
+    }
+}
+
+static void put_byte(GENERATOR *gen, unsigned char value)
+{
+    put_hex(gen, value, 2);
+    if (gen->spaces)
+    {
+        put_char(gen, ' ');
+    }
+}
+
+static void put_bytes(GENERATOR *gen, const unsigned char *data, int count)
+{
+    int k;
+    for (k = 0; k < count; ++k)
+    {
+        put_byte(gen, data[k]);
+    }
+}
+
+// end a line that is ready at the given time
+static void end_line(GENERATOR *gen, TIME_US when)
+{
+    put_char(gen, '\r');
+    if (gen->numLines < (int)(sizeof(gen->lineEnd) / sizeof(gen->lineEnd[0])))
+    {
+        gen->lineTime[gen->numLines] = when;
+        gen->lineEnd[gen->numLines] = gen->textLen;
+        ++gen->numLines;
+    }
+}
+
+// the CAN ID of a header line, 11 or 29 bit
+static void put_can_header(GENERATOR *gen, const GEN_ECU *ecu)
+{
+    if (gen->protocol & 1)
+    {
+        put_byte(gen, (unsigned char)(ecu->id >> 24));
+        put_byte(gen, (unsigned char)(ecu->id >> 16));
+        put_byte(gen, (unsigned char)(ecu->id >> 8));
+        put_byte(gen, (unsigned char)ecu->id);
+    }
+    else
+    {
+        put_hex(gen, ecu->id, 3);
+        if (gen->spaces)
+        {
+            put_char(gen, ' ');
+        }
+    }
+}
+
+// time for a frame with this many data bytes on the bus
+static unsigned long frame_us(int protocol, int dataBytes)
+{
+    unsigned long bits;
+
+    if (is_can(protocol))
+    {
+        bits = (protocol & 1) ? 155 : 130;
+    }
+    else if (protocol <= 2)
+    {
+        bits = (3 + dataBytes + 1) * 8 + 24;
+    }
+    else
+    {
+        bits = (3 + dataBytes + 1) * 10;
+    }
+    return bits * 1000000UL / bitRates[protocol];
+}
+
+static unsigned char j1850_crc(const unsigned char *data, int count)
+{
+    unsigned char crc = 0xFF;
+    int k;
+    int bit;
+
+    for (k = 0; k < count; ++k)
+    {
+        crc ^= data[k];
+        for (bit = 0; bit < 8; ++bit)
+        {
+            crc = (unsigned char)((crc & 0x80) ? (crc << 1) ^ 0x1D : crc << 1);
+        }
+    }
+    return (unsigned char)~crc;
+}
+
+// one legacy frame: priority, target, source, the data and the checksum with headers on
+static void put_legacy_frame(GENERATOR *gen, const GEN_ECU *ecu, const unsigned char *data, int count, TIME_US when)
+{
+    if (gen->headers)
+    {
+        unsigned char frame[16];
+        int len = 0;
+        int k;
+        unsigned int sum = 0;
+
+        if (1 == gen->protocol)
+        {
+            frame[len++] = 0x41;
+        }
+        else if (gen->protocol >= 4)
+        {
+            frame[len++] = (unsigned char)(0x80 | count);
+        }
+        else
+        {
+            frame[len++] = 0x48;
+        }
+        frame[len++] = (gen->protocol >= 4) ? 0xF1 : 0x6B;
+        frame[len++] = (unsigned char)ecu->id;
+        memcpy(frame + len, data, count);
+        len += count;
+        for (k = 0; k < len; ++k)
+        {
+            sum += frame[k];
+        }
+        frame[len] = (gen->protocol <= 2) ? j1850_crc(frame, len) : (unsigned char)sum;
+        put_bytes(gen, frame, len + 1);
+    }
+    else
+    {
+        put_bytes(gen, data, count);
+    }
+    end_line(gen, when);
+}
+
+// the ready time of each answer's lines moves on by their time on the bus
+static TIME_US put_answer(GENERATOR *gen, const GEN_ANSWER *answer, TIME_US when)
+{
+    int pos;
+    int frame;
+
+    if (!is_can(gen->protocol))
+    {
+        when += frame_us(gen->protocol, answer->length);
+        put_legacy_frame(gen, answer->ecu, answer->data, answer->length, when);
+        return when;
+    }
+    if (answer->length <= 7)
+    {
+        when += frame_us(gen->protocol, 8);
+        if (gen->headers)
+        {
+            put_can_header(gen, answer->ecu);
+            put_byte(gen, (unsigned char)answer->length);
+        }
+        put_bytes(gen, answer->data, answer->length);
+        end_line(gen, when);
+        return when;
+    }
+    if (!gen->headers)
+    {
+        put_hex(gen, answer->length, 3);
+        end_line(gen, when);
+    }
+    // the first frame, the tester's flow control, then consecutive frames
+    for (pos = 0, frame = 0; pos < answer->length; ++frame)
+    {
+        int count = (0 == frame) ? 6 : 7;
+        if (count > answer->length - pos)
+        {
+            count = answer->length - pos;
+        }
+        when += frame_us(gen->protocol, 8) * (1 == frame ? 2 : 1);
+        if (gen->headers)
+        {
+            put_can_header(gen, answer->ecu);
+            if (0 == frame)
+            {
+                put_byte(gen, (unsigned char)(0x10 | (answer->length >> 8)));
+                put_byte(gen, (unsigned char)answer->length);
+            }
+            else
+            {
+                put_byte(gen, (unsigned char)(0x20 | (frame & 0x0F)));
+            }
+        }
+        else
+        {
+            put_char(gen, hexDigits[frame & 0x0F]);
+            put_char(gen, ':');
+            if (gen->spaces)
+            {
+                put_char(gen, ' ');
+            }
+        }
+        put_bytes(gen, answer->data + pos, count);
+        end_line(gen, when);
+        pos += count;
+    }
+    return when;
+}
+
+/* the answers and their truth */
+
+static int add_answer(GEN_ANSWER *answers, int numAnswers, const GEN_ECU *ecu, const unsigned char *data, int length)
+{
+    if (numAnswers >= MAX_ANSWERS || length > MAX_MESSAGE)
+    {
+        return numAnswers;
+    }
+    answers[numAnswers].ecu = ecu;
+    memcpy(answers[numAnswers].data, data, length);
+    answers[numAnswers].length = length;
+    return numAnswers + 1;
+}
+
+static void truth(GENERATOR *gen, const char *cmd, const GEN_ECU *ecu, const char *what, const char *value)
+{
+    if (gen->truth)
+    {
+        fprintf(gen->truth, "%lu\t%s\t%lX\t%s\t%s\n", gen->requests, cmd, ecu ? ecu->id : 0UL, what, value);
+    }
+}
+
+// the PID's value through every row of the sensors table that decodes it
+static void pid_truth(GENERATOR *gen, const char *cmd, const GEN_ECU *ecu, int pid, const unsigned char *value, int valueLen)
+{
+    char hexPid[4];
+    char what[8];
+    char text[96];
+    char shown[64];
+    unsigned long raw;
+    char *end;
+    int index;
+    int b;
+
+    if (NULL == gen->truth)
+    {
+        return;
+    }
+    sprintf(hexPid, "%02X", pid);
+    sprintf(what, "pid%s", hexPid);
+    for (index = 0; index < sensor_count(); ++index)
+    {
+        // as the decoder does, from the first bytes of the value
+        if (strcmp(hexPid, sensor_pid(index)) || sensor_data_bytes(index) > valueLen)
+        {
+            continue;
+        }
+        raw = 0;
+        for (b = 0; b < sensor_data_bytes(index); ++b)
+        {
+            raw = (raw << 8) | value[b];
+        }
+        sensor_format(index, (int)raw, shown, sizeof(shown));
+        // a line of the truth each: the MIL status ends in a line break
+        for (end = shown + strlen(shown); end > shown && ('\n' == end[-1] || '\r' == end[-1]); --end)
+        {
+            end[-1] = '\0';
+        }
+        for (end = shown; *end; ++end)
+        {
+            if ('\n' == *end || '\r' == *end || '\t' == *end)
+            {
+                *end = ' ';
+            }
+        }
+        sprintf(text, "%lu\t%s", raw, shown);
+        truth(gen, cmd, ecu, what, text);
+    }
+}
+
+static int pid_supported(const GEN_ECU *ecu, int pid)
+{
+    int next;
+
+    if (0 == pid || (0 != (pid % 0x20)))
+    {
+        return 0 == pid || ecu->hasPid[pid];
+    }
+    for (next = pid + 1; next < 256; ++next)
+    {
+        if (ecu->hasPid[next])
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static int pid_value(GENERATOR *gen, GEN_ECU *ecu, int pid, unsigned char *out)
+{
+    int k;
+
+    if (0 == (pid % 0x20))
+    {
+        if (!pid_supported(ecu, pid))
+        {
+            return 0;
+        }
+        memset(out, 0, 4);
+        for (k = 1; k <= 0x20 && pid + k < 256; ++k)
+        {
+            if (pid_supported(ecu, pid + k))
+            {
+                out[(k - 1) / 8] |= (unsigned char)(0x80 >> ((k - 1) % 8));
+            }
+        }
+        return 4;
+    }
+    if (0x01 == pid)
+    {
+        out[0] = (unsigned char)((ecu->numCodes[DTC_STORED] ? 0x80 : 0) | ecu->numCodes[DTC_STORED]);
+        out[1] = 0x07;
+        out[2] = 0x65;
+        out[3] = 0x04;
+        return 4;
+    }
+    if (!ecu->hasPid[pid])
+    {
+        return 0;
+    }
+    memcpy(out, ecu->pidValue[pid], ecu->pidBytes[pid]);
+    return ecu->pidBytes[pid];
+}
+
+static int mode01_answers(GENERATOR *gen, const char *cmd, const unsigned char *pids, int numPids, GEN_ANSWER *answers)
+{
+    int numAnswers = 0;
+    int e;
+    int k;
+
+    for (e = 0; e < gen->numEcus; ++e)
+    {
+        GEN_ECU *ecu = &gen->ecus[e];
+        unsigned char msg[MAX_MESSAGE];
+        int len = 0;
+
+        msg[len++] = 0x41;
+        for (k = 0; k < numPids; ++k)
+        {
+            unsigned char value[4];
+            int valueLen = pid_value(gen, ecu, pids[k], value);
+
+            if (0 == valueLen)
+            {
+                continue;
+            }
+            msg[len++] = pids[k];
+            memcpy(msg + len, value, valueLen);
+            len += valueLen;
+            pid_truth(gen, cmd, ecu, pids[k], value, valueLen);
+        }
+        if (len > 1)
+        {
+            numAnswers = add_answer(answers, numAnswers, ecu, msg, len);
+        }
+    }
+    return numAnswers;
+}
+
+static int code_answers(GENERATOR *gen, const char *cmd, int kind, GEN_ANSWER *answers)
+{
+    int numAnswers = 0;
+    int e;
+    int k;
+
+    for (e = 0; e < gen->numEcus; ++e)
+    {
+        const GEN_ECU *ecu = &gen->ecus[e];
+        int count = ecu->numCodes[kind];
+        unsigned char msg[MAX_MESSAGE];
+        char list[MAX_CODES * 6 + 1];
+        int len = 0;
+
+        list[0] = '\0';
+        for (k = 0; k < count; ++k)
+        {
+            code_text(ecu->codes[kind][k], list + strlen(list));
+            if (k + 1 < count)
+            {
+                strcat(list, " ");
+            }
+        }
+        truth(gen, cmd, ecu, kindNames[kind], list);
+
+        if (is_can(gen->protocol))
+        {
+            msg[len++] = (unsigned char)(0x40 | kindModes[kind]);
+            msg[len++] = (unsigned char)count;
+            for (k = 0; k < count; ++k)
+            {
+                msg[len++] = (unsigned char)(ecu->codes[kind][k] >> 8);
+                msg[len++] = (unsigned char)ecu->codes[kind][k];
+            }
+            numAnswers = add_answer(answers, numAnswers, ecu, msg, len);
+            continue;
+        }
+        // three codes a frame, padded with zeros
+        k = 0;
+        do
+        {
+            int slot;
+            len = 0;
+            msg[len++] = (unsigned char)(0x40 | kindModes[kind]);
+            for (slot = 0; slot < 3; ++slot, ++k)
+            {
+                unsigned int code = (k < count) ? ecu->codes[kind][k] : 0;
+                msg[len++] = (unsigned char)(code >> 8);
+                msg[len++] = (unsigned char)code;
+            }
+            numAnswers = add_answer(answers, numAnswers, ecu, msg, len);
+        } while (k < count);
+    }
+    return numAnswers;
+}
+
+static int vin_answers(GENERATOR *gen, const char *cmd, GEN_ANSWER *answers)
+{
+    const GEN_ECU *ecu = &gen->ecus[0];
+    unsigned char msg[MAX_MESSAGE];
+    int numAnswers = 0;
+    int k;
+
+    truth(gen, cmd, ecu, "vin", gen->vin);
+    if (is_can(gen->protocol))
+    {
+        msg[0] = 0x49;
+        msg[1] = 0x02;
+        msg[2] = 0x01;
+        memcpy(msg + 3, gen->vin, 17);
+        return add_answer(answers, numAnswers, ecu, msg, 20);
+    }
+    // five frames of four characters, the first led by three NULs
+    {
+        char padded[20];
+        memset(padded, 0, 3);
+        memcpy(padded + 3, gen->vin, 17);
+        for (k = 0; k < 5; ++k)
+        {
+            msg[0] = 0x49;
+            msg[1] = 0x02;
+            msg[2] = (unsigned char)(k + 1);
+            memcpy(msg + 3, padded + 4 * k, 4);
+            numAnswers = add_answer(answers, numAnswers, ecu, msg, 7);
+        }
+    }
+    return numAnswers;
+}
+
+/* output */
+
+static void capture_sink(void *context, const unsigned char *data, unsigned long length)
+{
+    fwrite(data, 1, length, (FILE *)context);
+}
+
+// the request, its echo and answers, and the prompt, in the chosen format
+static void emit(GENERATOR *gen, const char *cmd, const GEN_ANSWER *answers, int numAnswers)
+{
+    TIME_US sent = gen->now;
+    TIME_US when;
+    int cmdLen = (int)strlen(cmd);
+    int k;
+    int line;
+    int start;
+
+    // the command at the host baud rate, then on the bus
+    gen->textLen = 0;
+    gen->numLines = 0;
+    when = sent + (TIME_US)(cmdLen + 1) * 10 * 1000000 / HOST_BAUD;
+    for (k = 0; k < cmdLen; ++k)
+    {
+        put_char(gen, cmd[k]);
+    }
+    end_line(gen, when);
+    when += frame_us(gen->protocol, (cmdLen / 2)) + ECU_LATENCY_US;
+
+    if (0 == numAnswers)
+    {
+        when += ADAPTIVE_WAIT_US * 4;
+        for (k = 0; "NO DATA"[k]; ++k)
+        {
+            put_char(gen, "NO DATA"[k]);
+        }
+        end_line(gen, when);
+        truth(gen, cmd, NULL, "nodata", "");
+    }
+    else if (gen->headers && is_can(gen->protocol))
+    {
+        // with headers on, the ECUs' frames come as the bus carries them
+        for (k = 0; k < numAnswers; ++k)
+        {
+            TIME_US done = put_answer(gen, &answers[k], when + k * frame_us(gen->protocol, 8));
+            if (k + 1 == numAnswers)
+            {
+                when = done;
+            }
+        }
+    }
+    else
+    {
+        for (k = 0; k < numAnswers; ++k)
+        {
+            when = put_answer(gen, &answers[k], when);
+        }
+    }
+    when += ADAPTIVE_WAIT_US;
+    put_char(gen, '\r');
+    put_char(gen, '>');
+
+    if (!gen->binary)
+    {
+        fwrite(gen->text, 1, gen->textLen, gen->out);
+        gen->written += gen->textLen;
+    }
+    else
+    {
+        // as the port saw it: the command out, each line in as it came, the prompt
+        capture_write(&gen->writer, CAPTURE_TX, 0, sent, cmd, cmdLen);
+        for (line = 0, start = 0; line < gen->numLines; ++line)
+        {
+            capture_write(&gen->writer, CAPTURE_RX, 0, gen->lineTime[line], gen->text + start, gen->lineEnd[line] - start);
+            start = gen->lineEnd[line];
+        }
+        capture_write(&gen->writer, CAPTURE_RX, 0, when, gen->text + start, gen->textLen - start);
+        capture_write(&gen->writer, CAPTURE_PROMPT, 0, when, NULL, 0);
+        gen->written = gen->writer.offset;
+    }
+    gen->now = when + 1000;
+    ++gen->requests;
+}
+
+static void request_mode01(GENERATOR *gen, const unsigned char *pids, int numPids)
+{
+    GEN_ANSWER answers[MAX_ANSWERS];
+    char cmd[16];
+    int k;
+
+    sprintf(cmd, "01");
+    for (k = 0; k < numPids; ++k)
+    {
+        sprintf(cmd + 2 + 2 * k, "%02X", pids[k]);
+    }
+    emit(gen, cmd, answers, mode01_answers(gen, cmd, pids, numPids, answers));
+}
+
+static void scan(GENERATOR *gen)
+{
+    GEN_ANSWER answers[MAX_ANSWERS];
+    unsigned char pids[6];
+    int numPids = 0;
+    int pid;
+    int kind;
+    int e;
+
+    emit(gen, "0902", answers, vin_answers(gen, "0902", answers));
+    for (pid = 0; pid < 256; pid += 0x20)
+    {
+        int any = FALSE;
+        for (e = 0; e < gen->numEcus; ++e)
+        {
+            any |= pid_supported(&gen->ecus[e], pid);
+        }
+        if (any)
+        {
+            pids[0] = (unsigned char)pid;
+            request_mode01(gen, pids, 1);
+        }
+    }
+    for (pid = 1; pid < 256; ++pid)
+    {
+        if (0 == (pid % 0x20))
+        {
+            continue;
+        }
+        if (!gen->supported[pid] && 0 != next_random(gen) % NO_DATA_ONE_IN)
+        {
+            continue;
+        }
+        pids[numPids++] = (unsigned char)pid;
+        if (numPids >= gen->pidsPerRequest)
+        {
+            request_mode01(gen, pids, numPids);
+            numPids = 0;
+        }
+    }
+    if (numPids)
+    {
+        request_mode01(gen, pids, numPids);
+    }
+    for (kind = DTC_STORED; kind < NUM_DTC_KINDS; ++kind)
+    {
+        char cmd[4];
+        sprintf(cmd, "%02X", kindModes[kind]);
+        emit(gen, cmd, answers, code_answers(gen, cmd, kind, answers));
+    }
+
+    // the engine warms up, the car moves, and so on
+    for (e = 0; e < gen->numEcus; ++e)
+    {
+        GEN_ECU *ecu = &gen->ecus[e];
+        for (pid = 2; pid < 256; ++pid)
+        {
+            if (ecu->hasPid[pid])
+            {
+                int last = ecu->pidBytes[pid] - 1;
+                ecu->pidValue[pid][last] = (unsigned char)(ecu->pidValue[pid][last] + (int)(next_random(gen) % 5) - 2);
+            }
+        }
+    }
+}
+
+/* setup */
+
+// "0C,0D,05" or the count of PIDs to pick, 0 for all
+static void init_generator(GENERATOR *gen, unsigned long seed, int numEcus, const char *pidList, int maxCodes)
+{
+    int numTroubleCodes = 0;
+    int chosen[256];
+    int e;
+    int pid;
+    int kind;
+    int k;
+
+    gen->rng = (seed * 2654435761UL + 1) & 0xFFFFFFFFUL;
+    if (0 == gen->rng)
+    {
+        gen->rng = 1;
+    }
+    while (master_trouble_list[numTroubleCodes].code)
+    {
+        ++numTroubleCodes;
+    }
+
+    // the PIDs the vehicle has, from what sensors[] can decode
+    memset(chosen, 0, sizeof(chosen));
+    if (pidList && strchr(pidList, ','))
+    {
+        const char *p = pidList;
+        while (*p)
+        {
+            pid = (int)strtoul(p, NULL, 16) & 0xFF;
+            if (sensor_bytes(pid) > 0)
+            {
+                chosen[pid] = TRUE;
+            }
+            p = strchr(p, ',');
+            p = p ? p + 1 : "";
+        }
+    }
+    else
+    {
+        int count = pidList ? atoi(pidList) : 0;
+        int available = 0;
+        for (pid = 2; pid < 256; ++pid)
+        {
+            if (0 != (pid % 0x20) && sensor_bytes(pid) > 0)
+            {
+                chosen[pid] = TRUE;
+                ++available;
+            }
+        }
+        // drop PIDs at random down to the count asked for
+        while (count > 0 && available > count)
+        {
+            pid = 2 + (int)(next_random(gen) % 254);
+            if (chosen[pid])
+            {
+                chosen[pid] = FALSE;
+                --available;
+            }
+        }
+    }
+
+    snprintf(gen->vin, sizeof(gen->vin), "1GENCAP009%07lu", next_random(gen) % 10000000UL);
+    gen->numEcus = numEcus;
+    for (e = 0; e < numEcus; ++e)
+    {
+        GEN_ECU *ecu = &gen->ecus[e];
+
+        if (is_can(gen->protocol))
+        {
+            ecu->id = (gen->protocol & 1) ? 0x18DAF110UL + e : 0x7E8UL + e;
+        }
+        else
+        {
+            ecu->id = 0x10 + e;
+        }
+        ecu->hasPid[0x01] = TRUE;
+        for (pid = 2; pid < 256; ++pid)
+        {
+            if (chosen[pid] && (0 == e || 0 == next_random(gen) % 4))
+            {
+                ecu->hasPid[pid] = TRUE;
+                ecu->pidBytes[pid] = sensor_bytes(pid) > 4 ? 4 : sensor_bytes(pid);
+                for (k = 0; k < ecu->pidBytes[pid]; ++k)
+                {
+                    ecu->pidValue[pid][k] = (unsigned char)next_random(gen);
+                }
+                gen->supported[pid] = TRUE;
+            }
+        }
+        for (kind = DTC_STORED; kind < NUM_DTC_KINDS && numTroubleCodes > 0; ++kind)
+        {
+            int count = (DTC_PERMANENT == kind) ? (ecu->numCodes[DTC_STORED] ? 1 : 0)
+                                                : (int)(next_random(gen) % (maxCodes + 1));
+            for (k = 0; k < count && k < MAX_CODES; ++k)
+            {
+                ecu->codes[kind][k] = (DTC_PERMANENT == kind)
+                    ? ecu->codes[DTC_STORED][0]
+                    : code_value(master_trouble_list[next_random(gen) % numTroubleCodes].code);
+            }
+            ecu->numCodes[kind] = k;
+        }
+    }
+    gen->supported[0x01] = TRUE;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: capgen [-s seed] [-m megabytes | -n scans] [-p protocol] [-H] [-S] [-e ecus]\n"
+                    "              [-P pids] [-M pids per request] [-d codes] [-c] [-t truth file] output\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static GENERATOR gen;
+    unsigned long seed = 1;
+    unsigned long megabytes = 0;
+    unsigned long scans = 0;
+    unsigned long done = 0;
+    int numEcus = 2;
+    int maxCodes = 3;
+    const char *pidList = NULL;
+    const char *truthName = NULL;
+    int k;
+
+    gen.protocol = 6;
+    gen.spaces = TRUE;
+    gen.pidsPerRequest = 1;
+    for (k = 1; k < argc - 1; ++k)
+    {
+        if (0 == strcmp(argv[k], "-H"))
+        {
+            gen.headers = TRUE;
+        }
+        else if (0 == strcmp(argv[k], "-S"))
+        {
+            gen.spaces = FALSE;
+        }
+        else if (0 == strcmp(argv[k], "-c"))
+        {
+            gen.binary = TRUE;
+        }
+        else if (k + 2 >= argc)
+        {
+            usage();
+            return 1;
+        }
+        else if (0 == strcmp(argv[k], "-s"))
+        {
+            seed = strtoul(argv[++k], NULL, 10);
+        }
+        else if (0 == strcmp(argv[k], "-m"))
+        {
+            megabytes = strtoul(argv[++k], NULL, 10);
+        }
+        else if (0 == strcmp(argv[k], "-n"))
+        {
+            scans = strtoul(argv[++k], NULL, 10);
+        }
+        else if (0 == strcmp(argv[k], "-p"))
+        {
+            gen.protocol = atoi(argv[++k]);
+        }
+        else if (0 == strcmp(argv[k], "-e"))
+        {
+            numEcus = atoi(argv[++k]);
+        }
+        else if (0 == strcmp(argv[k], "-P"))
+        {
+            pidList = argv[++k];
+        }
+        else if (0 == strcmp(argv[k], "-M"))
+        {
+            gen.pidsPerRequest = atoi(argv[++k]);
+        }
+        else if (0 == strcmp(argv[k], "-d"))
+        {
+            maxCodes = atoi(argv[++k]);
+        }
+        else if (0 == strcmp(argv[k], "-t"))
+        {
+            truthName = argv[++k];
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (k != argc - 1 || gen.protocol < 1 || gen.protocol > 9 || numEcus < 1 || numEcus > MAX_ECUS ||
+        maxCodes < 0 || maxCodes > MAX_CODES || gen.pidsPerRequest < 1 || gen.pidsPerRequest > 6)
+    {
+        usage();
+        return 1;
+    }
+    if (!is_can(gen.protocol))
+    {
+        gen.pidsPerRequest = 1;     // only CAN takes several PIDs a request
+    }
+    if (0 == megabytes && 0 == scans)
+    {
+        scans = 1;
+    }
+
+    gen.out = fopen(argv[k], "wb");
+    if (NULL == gen.out)
+    {
+        fprintf(stderr, "Error: unable to create %s\n", argv[k]);
+        return 1;
+    }
+    setvbuf(gen.out, NULL, _IOFBF, OUT_BUFFER_SIZE);
+    if (truthName)
+    {
+        gen.truth = fopen(truthName, "w");
+        if (NULL == gen.truth)
+        {
+            fprintf(stderr, "Error: unable to create %s\n", truthName);
+            return 1;
+        }
+        setvbuf(gen.truth, NULL, _IOFBF, OUT_BUFFER_SIZE);
+    }
+    if (gen.binary && !capture_writer_init(&gen.writer, capture_sink, gen.out, 0, 0))
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+    init_generator(&gen, seed, numEcus, pidList, maxCodes);
+
+    while ((0 == scans || done < scans) &&
+           (0 == megabytes || gen.written < (PLATFORM_U64)megabytes * 1024 * 1024))
+    {
+        scan(&gen);
+        ++done;
+    }
+
+    if (gen.binary)
+    {
+        capture_writer_finish(&gen.writer);
+    }
+    fclose(gen.out);
+    if (gen.truth)
+    {
+        fclose(gen.truth);
+    }
+    fprintf(stderr, "%lu scans, %lu requests, %lu MB, %lu s of traffic\n", done, gen.requests,
+            (unsigned long)(gen.written / (1024 * 1024)), (unsigned long)(gen.now / 1000000));
+    return 0;
+}
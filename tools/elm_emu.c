@@ -0,0 +1,1099 @@
+/*
+ * An ELM327 on a pseudo-terminal, answering for virtual ECUs, so the live
+ * serial path can be run and timed on any POSIX box without a car.
+ *
+ *   elm_emu [-f ecus.txt] [-p protocol] [-l latency ms] [-b baud]
+ *
+ * The slave side of the pty is printed on start; point the scan tool at
+ * it with  ScanTool -c /dev/pts/N.  The AT commands a scan tool uses are
+ * understood: Z, WS, D, E, S, H, L, SP, TP, ST, AT, DP, DPN, I, RV, @1.
+ * Mode 01 requests may ask for up to six PIDs at once on CAN, and a
+ * single trailing digit (0100 1) is the count of responses to wait for.
+ *
+ * Timing: each ECU answers after its latency plus the time its frames
+ * take on the bus at the protocol's bit rate.  After the last answer the
+ * emulator waits as the chip does, the ATST time or, with adaptive timing
+ * on, the longest gap between answers seen so far and a margin, a
+ * quarter of it at AT1 and an eighth at AT2.  Output is paced at the baud
+ * rate of the RS232 side, 0 for no pacing.  A character arriving while a
+ * request is answered stops it, as on the chip.
+ *
+ * The ECU file holds one directive per line, '#' starts a comment:
+ *
+ *   protocol 6               1-9, as ATSP
+ *   ecu 7E8 latency 20       a new ECU: its CAN ID or legacy address, ms
+ *   pid 0C 1A F8             a Mode 01 PID and its data bytes
+ *   vin 1D3HV13T09S718057
+ *   stored P0133 P0134       Mode 03, 07 and 0A codes
+ *   pending P0100
+ *   permanent P0133
+ *   mil on
+ */
+#define _XOPEN_SOURCE 600       // posix_openpt and the rest of the pty calls
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include "../globals.h"
+
+#define MAX_ECUS            8
+#define MAX_CODES           32
+#define MAX_LINE            256
+#define MAX_MESSAGE         64      // data bytes in one answer
+#define MAX_ANSWERS         (MAX_ECUS * 6)
+#define ELM_VERSION         "ELM327 v1.5"
+#define DEFAULT_PROTOCOL    6
+#define DEFAULT_LATENCY_MS  15
+#define DEFAULT_BAUD        38400
+#define DEFAULT_TIMEOUT     0x32    // ATST units of 4 ms
+#define MIN_ADAPTIVE_US     8000
+
+typedef enum
+{
+    CODES_STORED,
+    CODES_PENDING,
+    CODES_PERMANENT,
+    NUM_CODE_KINDS
+} CODE_KIND;
+
+typedef struct _VIRTUAL_ECU
+{
+    unsigned long id;               // CAN ID, or the source address of a legacy frame
+    unsigned long latencyUs;
+    int hasPid[256];
+    unsigned char pidData[256][4];
+    int pidLength[256];
+    unsigned int codes[NUM_CODE_KINDS][MAX_CODES];
+    int numCodes[NUM_CODE_KINDS];
+    char vin[18];
+    int mil;
+} VIRTUAL_ECU;
+
+typedef struct _ANSWER
+{
+    const VIRTUAL_ECU *ecu;
+    unsigned char data[MAX_MESSAGE];
+    int length;
+    unsigned long atUs;             // after the request, when it is printed
+} ANSWER;
+
+typedef struct _ELM_STATE
+{
+    int echo;
+    int spaces;
+    int headers;
+    int linefeeds;
+    int protocol;                   // 1-9
+    int autoProtocol;               // SEARCHING... before the first answer
+    int timeout;                    // ATST units
+    int adaptive;                   // ATAT, 0 off
+    unsigned long slowestUs;        // longest wait for an answer so far, for adaptive timing
+    unsigned long baud;
+} ELM_STATE;
+
+static VIRTUAL_ECU ecus[MAX_ECUS];
+static int numEcus = 0;
+static int configProtocol = DEFAULT_PROTOCOL;
+static int masterFd = -1;
+static volatile int done = FALSE;
+static unsigned long requests = 0;
+static unsigned long stopped = 0;
+
+static const unsigned long bitRates[10] = { 0, 41600, 10400, 10400, 10400, 10400, 500000, 500000, 250000, 250000 };
+static const char *protocolNames[10] =
+{
+    "AUTO",
+    "SAE J1850 PWM",
+    "SAE J1850 VPW",
+    "ISO 9141-2",
+    "ISO 14230-4 (KWP 5BAUD)",
+    "ISO 14230-4 (KWP FAST)",
+    "ISO 15765-4 (CAN 11/500)",
+    "ISO 15765-4 (CAN 29/500)",
+    "ISO 15765-4 (CAN 11/250)",
+    "ISO 15765-4 (CAN 29/250)"
+};
+
+static int is_can(int protocol)
+{
+    return protocol >= 6;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    done = TRUE;
+}
+
+static unsigned long now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+// wait until the deadline, FALSE if the host sent something first
+static int wait_until(unsigned long deadline)
+{
+    struct pollfd pfd;
+    unsigned long now;
+
+    pfd.fd = masterFd;
+    pfd.events = POLLIN;
+    while ((now = now_us()) < deadline)
+    {
+        int ms = (int)((deadline - now + 999) / 1000);
+        pfd.revents = 0;
+        if (poll(&pfd, 1, ms) > 0 && (pfd.revents & POLLIN))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// write at the RS232 rate, FALSE if the host interrupted
+static int send_text(const ELM_STATE *elm, const char *text)
+{
+    unsigned long length = (unsigned long)strlen(text);
+    unsigned long start = now_us();
+    unsigned long paced = length;
+
+    while (length > 0)
+    {
+        ssize_t written = write(masterFd, text, length);
+        if (written < 0)
+        {
+            if (EINTR == errno || EAGAIN == errno)
+            {
+                continue;
+            }
+            return FALSE;
+        }
+        text += written;
+        length -= (unsigned long)written;
+    }
+    if (elm->baud)
+    {
+        // 10 bits a character: start, 8 data, stop
+        return wait_until(start + paced * 10 * 1000000UL / elm->baud);
+    }
+    return TRUE;
+}
+
+static void send_line(const ELM_STATE *elm, const char *text)
+{
+    char line[MAX_LINE + 4];
+
+    snprintf(line, sizeof(line), "%s%s", text, elm->linefeeds ? "\r\n" : "\r");
+    send_text(elm, line);
+}
+
+static void send_prompt(const ELM_STATE *elm)
+{
+    send_text(elm, elm->linefeeds ? "\r\n>" : "\r>");
+}
+
+// time a frame with this many data bytes is on the bus
+static unsigned long frame_us(int protocol, int dataBytes)
+{
+    unsigned long bits;
+
+    if (is_can(protocol))
+    {
+        // arbitration, control, 8 data bytes (padded), CRC and stuffing
+        bits = (protocol & 1) ? 155 : 130;
+    }
+    else if (protocol <= 2)
+    {
+        // J1850: 3 header bytes, data, CRC, start and end of frame
+        bits = (3 + dataBytes + 1) * 8 + 24;
+    }
+    else
+    {
+        // ISO 9141 and KWP: 10 bits a byte, header and checksum
+        bits = (3 + dataBytes + 1) * 10;
+    }
+    return bits * 1000000UL / bitRates[protocol];
+}
+
+// time an answer of this many bytes is on the bus, flow control included
+static unsigned long answer_us(int protocol, int length)
+{
+    int frames;
+
+    if (is_can(protocol))
+    {
+        if (length <= 7)
+        {
+            return frame_us(protocol, length);
+        }
+        frames = 1 + (length - 6 + 6) / 7;
+        // first frame, the tester's flow control, consecutive frames at STmin 0
+        return (frames + 1) * frame_us(protocol, 8);
+    }
+    frames = (length + 6) / 7;
+    return frames * frame_us(protocol, 7);
+}
+
+static void append_hex(const ELM_STATE *elm, char *line, size_t size, unsigned long value, int digits)
+{
+    size_t len = strlen(line);
+    snprintf(line + len, size - len, "%0*lX%s", digits, value, elm->spaces ? " " : "");
+}
+
+static void append_bytes(const ELM_STATE *elm, char *line, size_t size, const unsigned char *data, int count)
+{
+    int k;
+    for (k = 0; k < count; ++k)
+    {
+        append_hex(elm, line, size, data[k], 2);
+    }
+}
+
+static void append_can_header(const ELM_STATE *elm, char *line, size_t size, unsigned long id)
+{
+    if (elm->protocol & 1)
+    {
+        // 29 bit: priority, 0xDA, tester 0xF1, ECU
+        append_hex(elm, line, size, 0x18, 2);
+        append_hex(elm, line, size, 0xDA, 2);
+        append_hex(elm, line, size, 0xF1, 2);
+        append_hex(elm, line, size, (id - 0x7E8 + 0x10) & 0xFF, 2);
+    }
+    else
+    {
+        append_hex(elm, line, size, id, 3);
+    }
+}
+
+// print one ECU's answer the way the chip formats it for the protocol
+static int print_answer(const ELM_STATE *elm, const ANSWER *answer)
+{
+    char line[MAX_LINE];
+    int pos = 0;
+    int frame = 0;
+
+    if (is_can(elm->protocol))
+    {
+        if (answer->length <= 7)
+        {
+            line[0] = '\0';
+            if (elm->headers)
+            {
+                append_can_header(elm, line, sizeof(line), answer->ecu->id);
+                append_hex(elm, line, sizeof(line), answer->length, 2);
+            }
+            append_bytes(elm, line, sizeof(line), answer->data, answer->length);
+            send_line(elm, line);
+            return TRUE;
+        }
+        if (!elm->headers)
+        {
+            // the total length, then frames numbered 0-F
+            line[0] = '\0';
+            snprintf(line, sizeof(line), "%03X", answer->length);
+            send_line(elm, line);
+        }
+        while (pos < answer->length)
+        {
+            int count = (0 == frame) ? 6 : 7;
+            if (count > answer->length - pos)
+            {
+                count = answer->length - pos;
+            }
+            line[0] = '\0';
+            if (elm->headers)
+            {
+                append_can_header(elm, line, sizeof(line), answer->ecu->id);
+                if (0 == frame)
+                {
+                    append_hex(elm, line, sizeof(line), 0x10 | (answer->length >> 8), 2);
+                    append_hex(elm, line, sizeof(line), answer->length & 0xFF, 2);
+                }
+                else
+                {
+                    append_hex(elm, line, sizeof(line), 0x20 | (frame & 0x0F), 2);
+                }
+            }
+            else
+            {
+                snprintf(line, sizeof(line), "%X:%s", frame & 0x0F, elm->spaces ? " " : "");
+            }
+            append_bytes(elm, line, sizeof(line), answer->data + pos, count);
+            send_line(elm, line);
+            pos += count;
+            ++frame;
+        }
+        return TRUE;
+    }
+
+    // legacy: a frame of up to 7 bytes, priority, target, source and checksum with headers
+    line[0] = '\0';
+    if (elm->headers)
+    {
+        unsigned int sum = 0x48 + 0x6B + (unsigned int)answer->ecu->id;
+        int k;
+        for (k = 0; k < answer->length; ++k)
+        {
+            sum += answer->data[k];
+        }
+        append_hex(elm, line, sizeof(line), 0x48, 2);
+        append_hex(elm, line, sizeof(line), 0x6B, 2);
+        append_hex(elm, line, sizeof(line), answer->ecu->id & 0xFF, 2);
+        append_bytes(elm, line, sizeof(line), answer->data, answer->length);
+        append_hex(elm, line, sizeof(line), sum & 0xFF, 2);
+    }
+    else
+    {
+        append_bytes(elm, line, sizeof(line), answer->data, answer->length);
+    }
+    send_line(elm, line);
+    return TRUE;
+}
+
+static int add_answer(ANSWER *answers, int numAnswers, const VIRTUAL_ECU *ecu, const unsigned char *data, int length)
+{
+    if (numAnswers >= MAX_ANSWERS || length > MAX_MESSAGE)
+    {
+        return numAnswers;
+    }
+    answers[numAnswers].ecu = ecu;
+    memcpy(answers[numAnswers].data, data, length);
+    answers[numAnswers].length = length;
+    answers[numAnswers].atUs = 0;
+    return numAnswers + 1;
+}
+
+// the Mode 01 support bitmap of the bank starting at pid, 0 if the ECU does not answer it
+static int supported_pids(const VIRTUAL_ECU *ecu, int pid, unsigned char *bits)
+{
+    int k;
+    int any = FALSE;
+
+    if (pid > 0 && !ecu->hasPid[pid])
+    {
+        return FALSE;
+    }
+    memset(bits, 0, 4);
+    for (k = 1; k <= 0x20 && pid + k < 256; ++k)
+    {
+        int next;
+        if (ecu->hasPid[pid + k])
+        {
+            bits[(k - 1) / 8] |= 0x80 >> ((k - 1) % 8);
+            any = TRUE;
+        }
+        // the next bank's support pid is set if anything lies beyond it
+        for (next = pid + 0x21; 0x20 == k && next < 256; ++next)
+        {
+            if (ecu->hasPid[next])
+            {
+                bits[3] |= 0x01;
+                break;
+            }
+        }
+    }
+    return any;
+}
+
+static int pid_value(const VIRTUAL_ECU *ecu, int pid, unsigned char *out)
+{
+    if (0 == (pid % 0x20))
+    {
+        return supported_pids(ecu, pid, out) ? 4 : 0;
+    }
+    if (0x01 == pid && !ecu->pidLength[0x01])
+    {
+        // monitor status: MIL and the stored code count, continuous monitors complete
+        out[0] = (unsigned char)((ecu->mil ? 0x80 : 0) | (ecu->numCodes[CODES_STORED] & 0x7F));
+        out[1] = 0x07;
+        out[2] = 0x65;
+        out[3] = 0x04;
+        return 4;
+    }
+    if (!ecu->hasPid[pid])
+    {
+        return 0;
+    }
+    memcpy(out, ecu->pidData[pid], ecu->pidLength[pid]);
+    return ecu->pidLength[pid];
+}
+
+// every ECU's answer to the request, none if no ECU supports it
+static int build_answers(const ELM_STATE *elm, const unsigned char *req, int reqLength, ANSWER *answers)
+{
+    int numAnswers = 0;
+    int e;
+    unsigned char msg[MAX_MESSAGE];
+    int len;
+    int k;
+
+    for (e = 0; e < numEcus; ++e)
+    {
+        const VIRTUAL_ECU *ecu = &ecus[e];
+        int mode = req[0];
+
+        len = 0;
+        if (0x01 == mode && reqLength >= 2)
+        {
+            // up to six PIDs at once on CAN, one answer per PID otherwise
+            msg[len++] = 0x41;
+            for (k = 1; k < reqLength && k <= 6; ++k)
+            {
+                unsigned char value[4];
+                int valueLen = pid_value(ecu, req[k], value);
+                if (0 == valueLen)
+                {
+                    continue;
+                }
+                if (!is_can(elm->protocol) && len > 1)
+                {
+                    numAnswers = add_answer(answers, numAnswers, ecu, msg, len);
+                    len = 1;
+                }
+                msg[len++] = req[k];
+                memcpy(msg + len, value, valueLen);
+                len += valueLen;
+            }
+            if (len > 1)
+            {
+                numAnswers = add_answer(answers, numAnswers, ecu, msg, len);
+            }
+        }
+        else if (0x03 == mode || 0x07 == mode || 0x0A == mode)
+        {
+            CODE_KIND kind = (0x03 == mode) ? CODES_STORED : (0x07 == mode) ? CODES_PENDING : CODES_PERMANENT;
+            int count = ecu->numCodes[kind];
+
+            if (is_can(elm->protocol))
+            {
+                msg[len++] = (unsigned char)(0x40 | mode);
+                msg[len++] = (unsigned char)count;
+                for (k = 0; k < count && len + 2 <= MAX_MESSAGE; ++k)
+                {
+                    msg[len++] = (unsigned char)(ecu->codes[kind][k] >> 8);
+                    msg[len++] = (unsigned char)ecu->codes[kind][k];
+                }
+                numAnswers = add_answer(answers, numAnswers, ecu, msg, len);
+            }
+            else
+            {
+                // three codes a frame, padded with zeros
+                k = 0;
+                do
+                {
+                    int slot;
+                    len = 0;
+                    msg[len++] = (unsigned char)(0x40 | mode);
+                    for (slot = 0; slot < 3; ++slot, ++k)
+                    {
+                        unsigned int code = (k < count) ? ecu->codes[kind][k] : 0;
+                        msg[len++] = (unsigned char)(code >> 8);
+                        msg[len++] = (unsigned char)code;
+                    }
+                    numAnswers = add_answer(answers, numAnswers, ecu, msg, len);
+                } while (k < count);
+            }
+        }
+        else if (0x09 == mode && reqLength >= 2 && ecu->vin[0])
+        {
+            if (0x00 == req[1])
+            {
+                unsigned char bits[4] = { 0x40, 0x00, 0x00, 0x00 };     // PID 02, the VIN
+                msg[len++] = 0x49;
+                msg[len++] = 0x00;
+                memcpy(msg + len, bits, 4);
+                len += 4;
+                numAnswers = add_answer(answers, numAnswers, ecu, msg, len);
+            }
+            else if (0x02 == req[1] && is_can(elm->protocol))
+            {
+                msg[len++] = 0x49;
+                msg[len++] = 0x02;
+                msg[len++] = 0x01;
+                memcpy(msg + len, ecu->vin, 17);
+                len += 17;
+                numAnswers = add_answer(answers, numAnswers, ecu, msg, len);
+            }
+            else if (0x02 == req[1])
+            {
+                // five frames of four characters, the first led by three NULs
+                char padded[20];
+                memset(padded, 0, 3);
+                memcpy(padded + 3, ecu->vin, 17);
+                for (k = 0; k < 5; ++k)
+                {
+                    msg[0] = 0x49;
+                    msg[1] = 0x02;
+                    msg[2] = (unsigned char)(k + 1);
+                    memcpy(msg + 3, padded + 4 * k, 4);
+                    numAnswers = add_answer(answers, numAnswers, ecu, msg, 7);
+                }
+            }
+        }
+    }
+    return numAnswers;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static void reset_elm(ELM_STATE *elm, unsigned long baud)
+{
+    memset(elm, 0, sizeof(*elm));
+    elm->echo = TRUE;
+    elm->spaces = TRUE;
+    elm->protocol = configProtocol;
+    elm->timeout = DEFAULT_TIMEOUT;
+    elm->adaptive = 1;
+    elm->baud = baud;
+}
+
+// an AT command, without the AT
+static void handle_at(ELM_STATE *elm, const char *cmd)
+{
+    if (0 == strcmp(cmd, "Z") || 0 == strcmp(cmd, "WS"))
+    {
+        reset_elm(elm, elm->baud);
+        send_text(elm, "\r\r");
+        send_line(elm, ELM_VERSION);
+    }
+    else if (0 == strcmp(cmd, "D"))
+    {
+        unsigned long baud = elm->baud;
+        int echo = elm->echo;
+        reset_elm(elm, baud);
+        elm->echo = echo;
+        send_line(elm, "OK");
+    }
+    else if (0 == strcmp(cmd, "I"))
+    {
+        send_line(elm, ELM_VERSION);
+    }
+    else if (0 == strcmp(cmd, "@1"))
+    {
+        send_line(elm, "OBDII to RS232 Interpreter");
+    }
+    else if (0 == strcmp(cmd, "RV"))
+    {
+        send_line(elm, "12.6V");
+    }
+    else if (0 == strcmp(cmd, "DP"))
+    {
+        char line[64];
+        snprintf(line, sizeof(line), "%s%s", elm->autoProtocol ? "AUTO, " : "", protocolNames[elm->protocol]);
+        send_line(elm, line);
+    }
+    else if (0 == strcmp(cmd, "DPN"))
+    {
+        char line[8];
+        snprintf(line, sizeof(line), "%s%d", elm->autoProtocol ? "A" : "", elm->protocol);
+        send_line(elm, line);
+    }
+    else if (('E' == cmd[0] || 'S' == cmd[0] || 'H' == cmd[0] || 'L' == cmd[0]) &&
+             ('0' == cmd[1] || '1' == cmd[1]) && 0 == cmd[2])
+    {
+        int on = ('1' == cmd[1]);
+        switch (cmd[0])
+        {
+            case 'E': elm->echo = on; break;
+            case 'S': elm->spaces = on; break;
+            case 'H': elm->headers = on; break;
+            default: elm->linefeeds = on; break;
+        }
+        send_line(elm, "OK");
+    }
+    else if (('S' == cmd[0] || 'T' == cmd[0]) && 'P' == cmd[1])
+    {
+        // SP, SPA, TP, TPA: 0 or A is automatic, the configured vehicle protocol is found
+        const char *p = cmd + 2;
+        int automatic = FALSE;
+        if ('A' == *p)
+        {
+            automatic = TRUE;
+            ++p;
+        }
+        if (1 != strlen(p) || hex_value(*p) < 0 || hex_value(*p) > 9)
+        {
+            send_line(elm, "?");
+            return;
+        }
+        elm->autoProtocol = automatic || ('0' == *p);
+        elm->protocol = ('0' == *p) ? configProtocol : hex_value(*p);
+        send_line(elm, "OK");
+    }
+    else if ('S' == cmd[0] && 'T' == cmd[1] && hex_value(cmd[2]) >= 0 && hex_value(cmd[3]) >= 0 && 0 == cmd[4])
+    {
+        elm->timeout = hex_value(cmd[2]) * 16 + hex_value(cmd[3]);
+        if (0 == elm->timeout)
+        {
+            elm->timeout = DEFAULT_TIMEOUT;
+        }
+        send_line(elm, "OK");
+    }
+    else if ('A' == cmd[0] && 'T' == cmd[1] && cmd[2] >= '0' && cmd[2] <= '2' && 0 == cmd[3])
+    {
+        elm->adaptive = cmd[2] - '0';
+        send_line(elm, "OK");
+    }
+    else if (cmd[0])
+    {
+        // the rest of the set is accepted and has no effect here
+        send_line(elm, isalpha((unsigned char)cmd[0]) ? "OK" : "?");
+    }
+    else
+    {
+        send_line(elm, "?");
+    }
+}
+
+static int compare_answers(const void *a, const void *b)
+{
+    unsigned long ta = ((const ANSWER *)a)->atUs;
+    unsigned long tb = ((const ANSWER *)b)->atUs;
+    return (ta < tb) ? -1 : (ta > tb) ? 1 : 0;
+}
+
+// an OBD request in hex, returns FALSE if the host stopped it
+static int handle_request(ELM_STATE *elm, const char *cmd, unsigned long received)
+{
+    unsigned char req[8];
+    int reqLength = 0;
+    int digits = (int)strlen(cmd);
+    int wanted = 0;
+    ANSWER answers[MAX_ANSWERS];
+    int numAnswers;
+    int k;
+    unsigned long requestUs;
+    unsigned long wait;
+
+    if (digits & 1)
+    {
+        // a trailing digit is the count of responses to wait for
+        wanted = hex_value(cmd[digits - 1]);
+        --digits;
+    }
+    if (0 == digits || digits / 2 > (int)sizeof(req))
+    {
+        send_line(elm, "?");
+        return TRUE;
+    }
+    for (k = 0; k < digits; k += 2)
+    {
+        int hi = hex_value(cmd[k]);
+        int lo = hex_value(cmd[k + 1]);
+        if (hi < 0 || lo < 0)
+        {
+            send_line(elm, "?");
+            return TRUE;
+        }
+        req[reqLength++] = (unsigned char)(hi * 16 + lo);
+    }
+    ++requests;
+
+    if (elm->autoProtocol)
+    {
+        send_line(elm, "SEARCHING...");
+        elm->autoProtocol = FALSE;
+    }
+
+    // when each answer is ready: the request on the bus, the ECU, the answer on the bus
+    requestUs = frame_us(elm->protocol, reqLength);
+    numAnswers = build_answers(elm, req, reqLength, answers);
+    for (k = 0; k < numAnswers; ++k)
+    {
+        answers[k].atUs = requestUs + answers[k].ecu->latencyUs + answer_us(elm->protocol, answers[k].length);
+        if (k > 0 && answers[k].ecu == answers[k - 1].ecu)
+        {
+            // the same ECU's next frame follows its last one
+            answers[k].atUs = answers[k - 1].atUs + answer_us(elm->protocol, answers[k].length);
+        }
+    }
+    qsort(answers, numAnswers, sizeof(ANSWER), compare_answers);
+
+    for (k = 0; k < numAnswers; ++k)
+    {
+        unsigned long gap = answers[k].atUs - (k ? answers[k - 1].atUs : requestUs);
+
+        if (!wait_until(received + answers[k].atUs))
+        {
+            return FALSE;
+        }
+        print_answer(elm, &answers[k]);
+        if (gap > elm->slowestUs)
+        {
+            elm->slowestUs = gap;
+        }
+        if (wanted && k + 1 >= wanted)
+        {
+            return TRUE;
+        }
+    }
+
+    // no more answers are coming, but the chip cannot know that until it times out
+    wait = (unsigned long)elm->timeout * 4000;
+    if (elm->adaptive && elm->slowestUs > 0)
+    {
+        unsigned long adaptive = elm->slowestUs + elm->slowestUs / (2 == elm->adaptive ? 8 : 4);
+        if (adaptive < MIN_ADAPTIVE_US)
+        {
+            adaptive = MIN_ADAPTIVE_US;
+        }
+        if (adaptive < wait)
+        {
+            wait = adaptive;
+        }
+    }
+    if (!wait_until(received + (numAnswers ? answers[numAnswers - 1].atUs : requestUs) + wait))
+    {
+        return FALSE;
+    }
+    if (0 == numAnswers)
+    {
+        send_line(elm, "NO DATA");
+    }
+    return TRUE;
+}
+
+static unsigned int parse_code(const char *text)
+{
+    static const char letters[] = "PCBU";
+    const char *letter = strchr(letters, toupper((unsigned char)text[0]));
+    if (NULL == letter || strlen(text) != 5)
+    {
+        return 0;
+    }
+    return ((unsigned int)(letter - letters) << 14) |
+           ((unsigned int)(text[1] - '0') << 12) |
+           (unsigned int)strtoul(text + 2, NULL, 16);
+}
+
+static VIRTUAL_ECU *add_ecu(unsigned long id, unsigned long latencyMs)
+{
+    VIRTUAL_ECU *ecu;
+    if (numEcus >= MAX_ECUS)
+    {
+        return NULL;
+    }
+    ecu = &ecus[numEcus++];
+    memset(ecu, 0, sizeof(*ecu));
+    ecu->id = id;
+    ecu->latencyUs = latencyMs * 1000;
+    ecu->hasPid[0x01] = TRUE;
+    return ecu;
+}
+
+static void set_pid(VIRTUAL_ECU *ecu, int pid, const unsigned char *data, int length)
+{
+    ecu->hasPid[pid] = TRUE;
+    memcpy(ecu->pidData[pid], data, length);
+    ecu->pidLength[pid] = length;
+}
+
+static void add_codes(VIRTUAL_ECU *ecu, CODE_KIND kind, char *list)
+{
+    char *tok;
+    for (tok = strtok(list, " \t\r\n"); tok && ecu->numCodes[kind] < MAX_CODES; tok = strtok(NULL, " \t\r\n"))
+    {
+        ecu->codes[kind][ecu->numCodes[kind]++] = parse_code(tok);
+    }
+}
+
+// an engine ECU and a transmission, answering what the scan tool asks
+static void default_ecus(unsigned long latencyMs)
+{
+    static const unsigned char rpm[] = { 0x1A, 0xF8 };
+    static const unsigned char speed[] = { 0x3C };
+    static const unsigned char coolant[] = { 0x5A };
+    static const unsigned char load[] = { 0x40 };
+    static const unsigned char maf[] = { 0x01, 0x90 };
+    static const unsigned char fuelTrim[] = { 0x80 };
+    static const unsigned char intake[] = { 0x41 };
+    char codes[64];
+    VIRTUAL_ECU *ecu = add_ecu(0x7E8, latencyMs);
+
+    set_pid(ecu, 0x04, load, 1);
+    set_pid(ecu, 0x05, coolant, 1);
+    set_pid(ecu, 0x06, fuelTrim, 1);
+    set_pid(ecu, 0x07, fuelTrim, 1);
+    set_pid(ecu, 0x0C, rpm, 2);
+    set_pid(ecu, 0x0D, speed, 1);
+    set_pid(ecu, 0x0F, intake, 1);
+    set_pid(ecu, 0x10, maf, 2);
+    StringCchCopy(ecu->vin, sizeof(ecu->vin), "1D3HV13T09S718057");
+    StringCchCopy(codes, sizeof(codes), "P0133 P0134");
+    add_codes(ecu, CODES_STORED, codes);
+    StringCchCopy(codes, sizeof(codes), "P0100");
+    add_codes(ecu, CODES_PENDING, codes);
+    StringCchCopy(codes, sizeof(codes), "P0133");
+    add_codes(ecu, CODES_PERMANENT, codes);
+    ecu->mil = TRUE;
+
+    ecu = add_ecu(0x7E9, latencyMs + latencyMs / 2);
+    set_pid(ecu, 0x0D, speed, 1);
+    StringCchCopy(codes, sizeof(codes), "P0700");
+    add_codes(ecu, CODES_PENDING, codes);
+}
+
+// returns FALSE if the file cannot be read
+static int load_ecus(const char *fname, unsigned long latencyMs)
+{
+    FILE *fp = fopen(fname, "r");
+    char line[MAX_LINE];
+    VIRTUAL_ECU *ecu = NULL;
+    int lineNumber = 0;
+
+    if (NULL == fp)
+    {
+        return FALSE;
+    }
+    while (fgets(line, sizeof(line), fp))
+    {
+        char *hash = strchr(line, '#');
+        char *word;
+        char *rest;
+
+        ++lineNumber;
+        if (hash)
+        {
+            *hash = '\0';
+        }
+        word = strtok(line, " \t\r\n");
+        if (NULL == word)
+        {
+            continue;
+        }
+        rest = word + strlen(word) + 1;
+        if (0 == strcmp(word, "protocol"))
+        {
+            configProtocol = atoi(strtok(NULL, " \t\r\n") ? rest : "6");
+            if (configProtocol < 1 || configProtocol > 9)
+            {
+                configProtocol = DEFAULT_PROTOCOL;
+            }
+        }
+        else if (0 == strcmp(word, "ecu"))
+        {
+            char *id = strtok(NULL, " \t\r\n");
+            char *key = strtok(NULL, " \t\r\n");
+            char *value = strtok(NULL, " \t\r\n");
+            ecu = add_ecu(id ? strtoul(id, NULL, 16) : 0x7E8,
+                          (key && value && 0 == strcmp(key, "latency")) ? strtoul(value, NULL, 10) : latencyMs);
+        }
+        else if (NULL == ecu)
+        {
+            fprintf(stderr, "%s:%d: %s before the first ecu\n", fname, lineNumber, word);
+        }
+        else if (0 == strcmp(word, "pid"))
+        {
+            unsigned char data[4];
+            int length = 0;
+            char *tok = strtok(NULL, " \t\r\n");
+            int pid = tok ? (int)strtoul(tok, NULL, 16) & 0xFF : 0;
+            while (length < 4 && NULL != (tok = strtok(NULL, " \t\r\n")))
+            {
+                data[length++] = (unsigned char)strtoul(tok, NULL, 16);
+            }
+            if (pid > 0 && length > 0)
+            {
+                set_pid(ecu, pid, data, length);
+            }
+        }
+        else if (0 == strcmp(word, "vin"))
+        {
+            char *vin = strtok(NULL, " \t\r\n");
+            if (vin && 17 == strlen(vin))
+            {
+                StringCchCopy(ecu->vin, sizeof(ecu->vin), vin);
+            }
+        }
+        else if (0 == strcmp(word, "stored"))
+        {
+            add_codes(ecu, CODES_STORED, rest);
+        }
+        else if (0 == strcmp(word, "pending"))
+        {
+            add_codes(ecu, CODES_PENDING, rest);
+        }
+        else if (0 == strcmp(word, "permanent"))
+        {
+            add_codes(ecu, CODES_PERMANENT, rest);
+        }
+        else if (0 == strcmp(word, "mil"))
+        {
+            char *value = strtok(NULL, " \t\r\n");
+            ecu->mil = (value && 0 == strcmp(value, "on")) ? TRUE : FALSE;
+        }
+        else
+        {
+            fprintf(stderr, "%s:%d: unknown directive %s\n", fname, lineNumber, word);
+        }
+    }
+    fclose(fp);
+    return TRUE;
+}
+
+static int open_pty(void)
+{
+    struct termios tio;
+
+    masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (masterFd < 0 || 0 != grantpt(masterFd) || 0 != unlockpt(masterFd))
+    {
+        return FALSE;
+    }
+    // the master side passes bytes through untouched
+    if (0 == tcgetattr(masterFd, &tio))
+    {
+        tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+        tio.c_oflag &= ~OPOST;
+        tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+        tcsetattr(masterFd, TCSANOW, &tio);
+    }
+    return TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *ecuFile = NULL;
+    unsigned long latencyMs = DEFAULT_LATENCY_MS;
+    unsigned long baud = DEFAULT_BAUD;
+    ELM_STATE elm;
+    char cmd[MAX_LINE];
+    int cmdLength = 0;
+    int slaveFd;
+    int k;
+
+    for (k = 1; k < argc; ++k)
+    {
+        if (0 == strcmp(argv[k], "-f") && k + 1 < argc)
+        {
+            ecuFile = argv[++k];
+        }
+        else if (0 == strcmp(argv[k], "-p") && k + 1 < argc)
+        {
+            configProtocol = atoi(argv[++k]);
+        }
+        else if (0 == strcmp(argv[k], "-l") && k + 1 < argc)
+        {
+            latencyMs = strtoul(argv[++k], NULL, 10);
+        }
+        else if (0 == strcmp(argv[k], "-b") && k + 1 < argc)
+        {
+            baud = strtoul(argv[++k], NULL, 10);
+        }
+        else
+        {
+            fprintf(stderr, "usage: elm_emu [-f ecus.txt] [-p protocol] [-l latency ms] [-b baud]\n");
+            return 1;
+        }
+    }
+    if (ecuFile && !load_ecus(ecuFile, latencyMs))
+    {
+        fprintf(stderr, "Error: unable to read %s\n", ecuFile);
+        return 1;
+    }
+    if (0 == numEcus)
+    {
+        default_ecus(latencyMs);
+    }
+    if (configProtocol < 1 || configProtocol > 9)
+    {
+        configProtocol = DEFAULT_PROTOCOL;
+    }
+    if (!open_pty())
+    {
+        fprintf(stderr, "Error: unable to open a pseudo-terminal\n");
+        return 1;
+    }
+    // held open so the pty survives the scan tool closing its side
+    slaveFd = open(ptsname(masterFd), O_RDWR | O_NOCTTY);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    reset_elm(&elm, baud);
+    printf("%s on %s, %d ECUs, %s\n", ELM_VERSION, ptsname(masterFd), numEcus, protocolNames[configProtocol]);
+    fflush(stdout);
+
+    while (!done)
+    {
+        char c;
+        ssize_t got = read(masterFd, &c, 1);
+
+        if (got <= 0)
+        {
+            if (got < 0 && EINTR != errno && EAGAIN != errno)
+            {
+                break;
+            }
+            continue;
+        }
+        if ('\r' != c)
+        {
+            // spaces, line feeds and control characters are ignored, as on the chip
+            if (isgraph((unsigned char)c) && cmdLength < (int)sizeof(cmd) - 1)
+            {
+                cmd[cmdLength++] = (char)toupper((unsigned char)c);
+            }
+            continue;
+        }
+        cmd[cmdLength] = '\0';
+        if (elm.echo)
+        {
+            send_text(&elm, cmd);
+            send_text(&elm, "\r");
+        }
+        if (0 == strncmp(cmd, "AT", 2))
+        {
+            handle_at(&elm, cmd + 2);
+            send_prompt(&elm);
+        }
+        else if (cmdLength > 0)
+        {
+            if (handle_request(&elm, cmd, now_us()))
+            {
+                send_prompt(&elm);
+            }
+            else
+            {
+                // the character that stopped it is lost
+                char lost;
+                (void)read(masterFd, &lost, 1);
+                ++stopped;
+                send_line(&elm, "STOPPED");
+                send_prompt(&elm);
+            }
+        }
+        else
+        {
+            send_prompt(&elm);
+        }
+        cmdLength = 0;
+    }
+
+    printf("%lu requests, %lu stopped\n", requests, stopped);
+    if (slaveFd >= 0)
+    {
+        close(slaveFd);
+    }
+    close(masterFd);
+    return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * Read the values a scan publishes with --publish, as a dashboard or a
+ * logger would: follow the samples as they come, or print the latest
+ * value of every sensor once.  It maps the segment read-only, so the
+ * scan never knows it is there.
+ *
+ *   live_tail [-n name] [-t]
+ *
+ * Without -t it waits for a scan to publish, prints each sample with its
+ * time in ms since the first, and stops when the scan closes the segment.
+ * Every line names the adapter, from 1 as the daemon numbers them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../globals.h"
+#include "../platform.h"
+#include "../live_values.h"
+
+#define POLL_MS     10
+
+static void print_table(const LIVE_SEGMENT *segment)
+{
+    LIVE_VALUE value;
+    int slot;
+
+    for (slot = 0; slot < LIVE_VALUES; ++slot)
+    {
+        if (live_read_value(segment, slot, &value))
+        {
+            printf("%2d %02X %-36s %-24s %lu samples\n", value.adapter + 1, value.pid, value.label, value.text, value.samples);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    LIVE_MAP map;
+    const LIVE_SEGMENT *segment;
+    LIVE_SAMPLE sample;
+    LIVE_VALUE value;
+    const char *name = NULL;
+    int table = FALSE;
+    unsigned long cursor;
+    unsigned long missed = 0;
+    unsigned long samples = 0;
+    unsigned long closed;
+    TIME_US first = 0;
+    int k;
+
+    for (k = 1; k < argc; ++k)
+    {
+        if (0 == strcmp(argv[k], "-n") && k + 1 < argc)
+        {
+            name = argv[++k];
+        }
+        else if (0 == strcmp(argv[k], "-t"))
+        {
+            table = TRUE;
+        }
+        else
+        {
+            fprintf(stderr, "usage: live_tail [-n name] [-t]\n");
+            return 1;
+        }
+    }
+
+    while (NULL == (segment = live_attach(&map, name)))
+    {
+        if (table)
+        {
+            fprintf(stderr, "Nothing is published as %s\n", name ? name : LIVE_NAME);
+            return 1;
+        }
+        sleep_ms(100);
+    }
+    if (table)
+    {
+        print_table(segment);
+        live_detach(&map);
+        return 0;
+    }
+
+    // from the oldest sample still in the ring
+    cursor = atomic_load_acquire((volatile unsigned long *)&segment->published);
+    cursor = (cursor > LIVE_RING_SIZE) ? cursor - LIVE_RING_SIZE : 0;
+    do
+    {
+        // read before the samples: once closed, the ring has all there will be
+        closed = atomic_load_acquire((volatile unsigned long *)&segment->closed);
+        while (live_next_sample(segment, &cursor, &sample, &missed))
+        {
+            if (0 == samples++)
+            {
+                first = sample.time;
+            }
+            (void)live_read_value(segment, sample.slot, &value);
+            printf("%8lu %2d %02X %-36s %s\n", (unsigned long)((sample.time - first) / 1000),
+                   sample.adapter + 1, sample.pid, value.label, sample.text);
+        }
+        fflush(stdout);
+        if (!closed)
+        {
+            sleep_ms(POLL_MS);
+        }
+    } while (!closed);
+    printf("%lu samples, %lu missed\n", samples, missed);
+    live_detach(&map);
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Convert a text communications log, "[TX]...[/TX]" and "[RX]...[/RX]"
+ * spans, to a binary capture the simulation path replays directly.  The
+ * text log holds no times, so every record is at time 0 and the capture
+ * is flagged CAPTURE_FLAG_NO_TIMING.  Other spans become mark records.
+ *
+ *   log2cap comm_log.txt comm_log.cap
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../globals.h"
+#include "../mapped_file.h"
+#include "../capture.h"
+
+#define MAX_TAG     32
+
+static void file_sink(void *context, const unsigned char *data, unsigned long length)
+{
+    fwrite(data, 1, length, (FILE *)context);
+}
+
+// the offset of text in buf from pos on, or size if it is not there
+static unsigned long find_text(const char *buf, unsigned long size, unsigned long pos, const char *text, unsigned long length)
+{
+    while (pos + length <= size)
+    {
+        const char *hit = (const char *)memchr(buf + pos, text[0], size - pos - length + 1);
+        if (NULL == hit)
+        {
+            break;
+        }
+        pos = (unsigned long)(hit - buf);
+        if (0 == memcmp(hit, text, length))
+        {
+            return pos;
+        }
+        ++pos;
+    }
+    return size;
+}
+
+int main(int argc, char *argv[])
+{
+    MAPPED_FILE log;
+    FILE *out;
+    CAPTURE_WRITER writer;
+    char tag[MAX_TAG];
+    char closing[MAX_TAG + 3];
+    unsigned long pos = 0;
+    unsigned long tagLen;
+    unsigned long start;
+    unsigned long end;
+    unsigned long records = 0;
+
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: log2cap <text log> <capture>\n");
+        return 1;
+    }
+    memset(&log, 0, sizeof(log));
+    if (!map_file(&log, argv[1]))
+    {
+        fprintf(stderr, "Error: unable to open %s\n", argv[1]);
+        return 1;
+    }
+    out = fopen(argv[2], "wb");
+    if (NULL == out)
+    {
+        fprintf(stderr, "Error: unable to create %s\n", argv[2]);
+        unmap_file(&log);
+        return 1;
+    }
+    if (!capture_writer_init(&writer, file_sink, out, 0, CAPTURE_FLAG_NO_TIMING))
+    {
+        fprintf(stderr, "Error: not enough memory\n");
+        fclose(out);
+        unmap_file(&log);
+        return 1;
+    }
+
+    while ((pos = find_text(log.data, log.size, pos, "[", 1)) < log.size)
+    {
+        // an opening tag is a short name without a slash
+        for (tagLen = 0; pos + 1 + tagLen < log.size && tagLen < MAX_TAG - 1; ++tagLen)
+        {
+            char c = log.data[pos + 1 + tagLen];
+            if (']' == c || '[' == c || '/' == c || '\r' == c || '\n' == c)
+            {
+                break;
+            }
+        }
+        if (0 == tagLen ||
+            pos + 1 + tagLen >= log.size ||
+            ']' != log.data[pos + 1 + tagLen])
+        {
+            ++pos;
+            continue;
+        }
+        memcpy(tag, log.data + pos + 1, tagLen);
+        tag[tagLen] = '\0';
+        closing[0] = '[';
+        closing[1] = '/';
+        memcpy(closing + 2, tag, tagLen);
+        closing[tagLen + 2] = ']';
+
+        // a response spans lines, and the last one may have been cut off
+        start = pos + tagLen + 2;
+        end = find_text(log.data, log.size, start, closing, tagLen + 3);
+        if (0 == strcmp(tag, "TX"))
+        {
+            capture_write(&writer, CAPTURE_TX, 0, 0, log.data + start, end - start);
+        }
+        else if (0 == strcmp(tag, "RX"))
+        {
+            capture_write(&writer, CAPTURE_RX, 0, 0, log.data + start, end - start);
+        }
+        else
+        {
+            // "marker:data", as the log writes notes into a capture
+            char *note = (char *)malloc(tagLen + 1 + (end - start));
+            if (note)
+            {
+                memcpy(note, tag, tagLen);
+                note[tagLen] = ':';
+                memcpy(note + tagLen + 1, log.data + start, end - start);
+                capture_write(&writer, CAPTURE_MARK, 0, 0, note, tagLen + 1 + (end - start));
+                free(note);
+            }
+        }
+        ++records;
+        pos = (end < log.size) ? end + tagLen + 3 : end;
+    }
+
+    capture_writer_finish(&writer);
+    fclose(out);
+    unmap_file(&log);
+    printf("%lu records\n", records);
+    return 0;
+}
@@ -0,0 +1,1102 @@
+/*
+ * Virtual ECUs on SocketCAN interfaces, for load testing native CAN
+ * collectors without vehicles.
+ *
+ *   vcan_ecu [-e ecus] [-l latency ms] [-j jitter ms] [-d codes] [-s seed]
+ *            [-x] [-n vehicles] interface...
+ *
+ * Each interface is one vehicle with several ECUs.  With -n the first
+ * interface name is a prefix: -n 32 vcan serves vcan0 to vcan31.  All
+ * vehicles are served from one thread, the pending transmissions of every
+ * ECU kept in a heap ordered by when they are due.
+ *
+ * Requests are ISO 15765-4: functional to 0x7DF (0x18DB33F1 with -x) or
+ * physical to 0x7E0 + n (0x18DA1nF1), answered from 0x7E8 + n
+ * (0x18DAF11n).  ISO-TP is complete both ways: first frames wait for the
+ * tester's flow control, block size and STmin are honoured, a tester that
+ * never sends it is timed out after N_Bs.  Segmented requests get a flow
+ * control frame and are answered once complete.
+ *
+ * Served: OBD Modes 01 (up to six PIDs), 03, 04, 07, 09 and 0A, UDS
+ * 0x10, 0x11, 0x14, 0x19 0x02, 0x22 and 0x3E.  Other services are
+ * refused with a negative response when addressed physically and ignored
+ * when functional, as ISO 14229 asks.
+ *
+ * The PIDs are those sensors[] can decode, all of them on the engine ECU
+ * and a random quarter on each other ECU, with values that drift between
+ * reads.  Codes are drawn from master_trouble_list.  Everything random is
+ * drawn from the seed, so the same options give the same vehicles.
+ */
+#define _GNU_SOURCE             // ppoll
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include "../globals.h"
+#include "../platform.h"
+#include "../sensors.h"
+#include "../trouble_code_reader.h"
+
+#define MAX_VEHICLES        256
+#define MAX_ECUS            8
+#define MAX_CODES           16
+#define ISOTP_MAX           4095
+#define N_BS_US             1000000UL       // longest wait for the tester's flow control
+#define RETRY_US            1000UL          // after the interface queue was full
+#define PADDING             0xAA
+
+#define FUNCTIONAL_ID       0x7DF
+#define REQUEST_ID          0x7E0
+#define RESPONSE_ID         0x7E8
+#define FUNCTIONAL_ID_29    0x18DB33F1UL
+#define PHYSICAL_ID_29      0x18DA00F1UL    // ECU address in bits 8-15
+#define RESPONSE_ID_29      0x18DAF100UL    // ECU address in bits 0-7
+#define ECU_ADDRESS_29      0x10
+
+#define NRC_NOT_SUPPORTED   0x11
+#define NRC_SUB_FUNCTION    0x12
+#define NRC_BAD_LENGTH      0x13
+#define NRC_OUT_OF_RANGE    0x31
+
+typedef enum
+{
+    CODES_STORED,
+    CODES_PENDING,
+    CODES_PERMANENT,
+    NUM_CODE_KINDS
+} CODE_KIND;
+
+typedef enum
+{
+    TX_IDLE,
+    TX_PENDING,         // the ECU is working on the answer
+    TX_WAIT_FC,         // first frame sent, waiting for flow control
+    TX_CF               // sending consecutive frames
+} TX_STATE;
+
+typedef struct _ISOTP_TX
+{
+    TX_STATE state;
+    unsigned char data[ISOTP_MAX];
+    int length;
+    int pos;
+    int seq;
+    int blockLeft;                  // consecutive frames until the next flow control, 0 for no limit
+    unsigned long stminUs;
+    TIME_US due;
+} ISOTP_TX;
+
+typedef struct _ISOTP_RX
+{
+    int active;
+    unsigned char data[ISOTP_MAX];
+    int length;
+    int pos;
+    int seq;
+} ISOTP_RX;
+
+struct _VEHICLE;
+
+typedef struct _VIRTUAL_ECU
+{
+    struct _VEHICLE *vehicle;
+    int index;
+    canid_t txId;
+    int hasPid[256];
+    unsigned char pidValue[256][4];
+    int pidBytes[256];
+    unsigned int codes[NUM_CODE_KINDS][MAX_CODES];
+    int numCodes[NUM_CODE_KINDS];
+    ISOTP_TX tx;
+    ISOTP_RX rx;
+    int heapIndex;                  // -1 if nothing is due
+} VIRTUAL_ECU;
+
+typedef struct _VEHICLE
+{
+    char name[IFNAMSIZ];
+    int fd;
+    int extended;                   // 29 bit IDs
+    unsigned long rng;
+    char vin[18];
+    VIRTUAL_ECU ecus[MAX_ECUS];
+    int numEcus;
+    unsigned long requests;
+    unsigned long responses;
+    unsigned long frames;
+    unsigned long fcTimeouts;
+    unsigned long retries;
+} VEHICLE;
+
+static VEHICLE *vehicles;
+static int numVehicles = 0;
+static VIRTUAL_ECU *heap[MAX_VEHICLES * MAX_ECUS];
+static int heapCount = 0;
+static unsigned long latencyUs = 10000;
+static unsigned long jitterUs = 2000;
+static volatile int done = FALSE;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    done = TRUE;
+}
+
+// xorshift, one stream per vehicle so vehicles do not depend on each other
+static unsigned long next_random(VEHICLE *vehicle)
+{
+    unsigned long x = vehicle->rng;
+    x ^= (x << 13) & 0xFFFFFFFFUL;
+    x ^= x >> 17;
+    x ^= (x << 5) & 0xFFFFFFFFUL;
+    vehicle->rng = x;
+    return x;
+}
+
+/* the heap of ECUs by the time their next frame is due */
+
+static void heap_swap(int a, int b)
+{
+    VIRTUAL_ECU *t = heap[a];
+    heap[a] = heap[b];
+    heap[b] = t;
+    heap[a]->heapIndex = a;
+    heap[b]->heapIndex = b;
+}
+
+static void heap_fix(int k)
+{
+    while (k > 0 && heap[(k - 1) / 2]->tx.due > heap[k]->tx.due)
+    {
+        heap_swap(k, (k - 1) / 2);
+        k = (k - 1) / 2;
+    }
+    for (;;)
+    {
+        int least = k;
+        int child = 2 * k + 1;
+        if (child < heapCount && heap[child]->tx.due < heap[least]->tx.due)
+        {
+            least = child;
+        }
+        if (child + 1 < heapCount && heap[child + 1]->tx.due < heap[least]->tx.due)
+        {
+            least = child + 1;
+        }
+        if (least == k)
+        {
+            break;
+        }
+        heap_swap(k, least);
+        k = least;
+    }
+}
+
+// the ECU's tx.due changed, or it has something due for the first time
+static void heap_update(VIRTUAL_ECU *ecu)
+{
+    if (ecu->heapIndex < 0)
+    {
+        ecu->heapIndex = heapCount;
+        heap[heapCount++] = ecu;
+    }
+    heap_fix(ecu->heapIndex);
+}
+
+static void heap_remove(VIRTUAL_ECU *ecu)
+{
+    int k = ecu->heapIndex;
+
+    if (k < 0)
+    {
+        return;
+    }
+    ecu->heapIndex = -1;
+    if (k != --heapCount)
+    {
+        heap[k] = heap[heapCount];
+        heap[k]->heapIndex = k;
+        heap_fix(k);
+    }
+}
+
+/* CAN and ISO-TP */
+
+// FALSE if the interface queue is full and it should be sent again later
+static int send_frame(VEHICLE *vehicle, canid_t id, const unsigned char *data, int length)
+{
+    struct can_frame frame;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = id;
+    frame.can_dlc = 8;
+    memset(frame.data, PADDING, 8);
+    memcpy(frame.data, data, length);
+    if (write(vehicle->fd, &frame, sizeof(frame)) != (ssize_t)sizeof(frame))
+    {
+        ++vehicle->retries;
+        return FALSE;
+    }
+    ++vehicle->frames;
+    return TRUE;
+}
+
+static unsigned long stmin_us(unsigned char stmin)
+{
+    if (stmin <= 0x7F)
+    {
+        return stmin * 1000UL;
+    }
+    if (stmin >= 0xF1 && stmin <= 0xF9)
+    {
+        return (stmin - 0xF0) * 100UL;
+    }
+    return 0x7F * 1000UL;       // reserved values mean the longest
+}
+
+// start answering after the ECU's latency and jitter
+static void schedule_response(VIRTUAL_ECU *ecu, const unsigned char *data, int length, TIME_US now)
+{
+    unsigned long delay = latencyUs;
+
+    if (jitterUs)
+    {
+        delay += next_random(ecu->vehicle) % (2 * jitterUs + 1);
+        delay = (delay > jitterUs) ? delay - jitterUs : 0;
+    }
+    memcpy(ecu->tx.data, data, length);
+    ecu->tx.length = length;
+    ecu->tx.pos = 0;
+    ecu->tx.seq = 1;
+    ecu->tx.state = TX_PENDING;
+    ecu->tx.due = now + delay;
+    ++ecu->vehicle->responses;
+    heap_update(ecu);
+}
+
+// the next frame of the ECU's answer is due
+static void run_tx(VIRTUAL_ECU *ecu, TIME_US now)
+{
+    ISOTP_TX *tx = &ecu->tx;
+    unsigned char frame[8];
+    int count;
+
+    switch (tx->state)
+    {
+        case TX_PENDING:
+            if (tx->length <= 7)
+            {
+                frame[0] = (unsigned char)tx->length;
+                memcpy(frame + 1, tx->data, tx->length);
+                if (!send_frame(ecu->vehicle, ecu->txId, frame, tx->length + 1))
+                {
+                    tx->due = now + RETRY_US;
+                    break;
+                }
+                tx->state = TX_IDLE;
+                break;
+            }
+            frame[0] = (unsigned char)(0x10 | (tx->length >> 8));
+            frame[1] = (unsigned char)tx->length;
+            memcpy(frame + 2, tx->data, 6);
+            if (!send_frame(ecu->vehicle, ecu->txId, frame, 8))
+            {
+                tx->due = now + RETRY_US;
+                break;
+            }
+            tx->pos = 6;
+            tx->state = TX_WAIT_FC;
+            tx->due = now + N_BS_US;
+            break;
+
+        case TX_WAIT_FC:
+            ++ecu->vehicle->fcTimeouts;
+            tx->state = TX_IDLE;
+            break;
+
+        case TX_CF:
+            count = tx->length - tx->pos;
+            if (count > 7)
+            {
+                count = 7;
+            }
+            frame[0] = (unsigned char)(0x20 | (tx->seq & 0x0F));
+            memcpy(frame + 1, tx->data + tx->pos, count);
+            if (!send_frame(ecu->vehicle, ecu->txId, frame, count + 1))
+            {
+                tx->due = now + RETRY_US;
+                break;
+            }
+            tx->pos += count;
+            ++tx->seq;
+            if (tx->pos >= tx->length)
+            {
+                tx->state = TX_IDLE;
+            }
+            else if (tx->blockLeft && 0 == --tx->blockLeft)
+            {
+                tx->state = TX_WAIT_FC;
+                tx->due = now + N_BS_US;
+            }
+            else
+            {
+                tx->due = now + tx->stminUs;
+            }
+            break;
+
+        default:
+            tx->state = TX_IDLE;
+            break;
+    }
+
+    if (TX_IDLE == tx->state)
+    {
+        heap_remove(ecu);
+    }
+    else
+    {
+        heap_update(ecu);
+    }
+}
+
+static void flow_control(VIRTUAL_ECU *ecu, const unsigned char *data, TIME_US now)
+{
+    ISOTP_TX *tx = &ecu->tx;
+
+    if (TX_WAIT_FC != tx->state)
+    {
+        return;
+    }
+    switch (data[0] & 0x0F)
+    {
+        case 0:     // continue to send
+            tx->blockLeft = data[1];
+            tx->stminUs = stmin_us(data[2]);
+            tx->state = TX_CF;
+            tx->due = now;
+            heap_update(ecu);
+            break;
+        case 1:     // wait
+            tx->due = now + N_BS_US;
+            heap_update(ecu);
+            break;
+        default:    // overflow, abort
+            tx->state = TX_IDLE;
+            heap_remove(ecu);
+            break;
+    }
+}
+
+/* the ECU's data */
+
+static unsigned int code_value(const char *code)
+{
+    static const char letters[] = "PCBU";
+    const char *letter = strchr(letters, code[0]);
+
+    if (NULL == letter)
+    {
+        return 0;
+    }
+    return ((unsigned int)(letter - letters) << 14) |
+           ((unsigned int)(code[1] - '0') << 12) |
+           (unsigned int)strtoul(code + 2, NULL, 16);
+}
+
+static int pid_supported(const VIRTUAL_ECU *ecu, int pid)
+{
+    int next;
+
+    if (0 == pid)
+    {
+        return TRUE;
+    }
+    if (0 != (pid % 0x20))
+    {
+        return ecu->hasPid[pid];
+    }
+    // a support PID is there if anything beyond it is
+    for (next = pid + 1; next < 256; ++next)
+    {
+        if (ecu->hasPid[next])
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// the value of the Mode 01 PID, 0 bytes if not supported
+static int pid_value(VIRTUAL_ECU *ecu, int pid, unsigned char *out)
+{
+    int k;
+
+    if (0 == (pid % 0x20))
+    {
+        if (!pid_supported(ecu, pid))
+        {
+            return 0;
+        }
+        memset(out, 0, 4);
+        for (k = 1; k <= 0x20 && pid + k < 256; ++k)
+        {
+            if (pid_supported(ecu, pid + k))
+            {
+                out[(k - 1) / 8] |= (unsigned char)(0x80 >> ((k - 1) % 8));
+            }
+        }
+        return 4;
+    }
+    if (0x01 == pid)
+    {
+        // MIL and the stored code count, continuous monitors complete
+        out[0] = (unsigned char)((ecu->numCodes[CODES_STORED] ? 0x80 : 0) | ecu->numCodes[CODES_STORED]);
+        out[1] = 0x07;
+        out[2] = 0x65;
+        out[3] = 0x04;
+        return 4;
+    }
+    if (!ecu->hasPid[pid])
+    {
+        return 0;
+    }
+    // drift the low byte a little between reads
+    k = ecu->pidBytes[pid] - 1;
+    ecu->pidValue[pid][k] = (unsigned char)(ecu->pidValue[pid][k] + (int)(next_random(ecu->vehicle) % 5) - 2);
+    memcpy(out, ecu->pidValue[pid], ecu->pidBytes[pid]);
+    return ecu->pidBytes[pid];
+}
+
+static int negative_response(unsigned char *resp, unsigned char service, unsigned char nrc)
+{
+    resp[0] = 0x7F;
+    resp[1] = service;
+    resp[2] = nrc;
+    return 3;
+}
+
+static int read_codes(const VIRTUAL_ECU *ecu, unsigned char mode, unsigned char *resp)
+{
+    CODE_KIND kind = (0x03 == mode) ? CODES_STORED : (0x07 == mode) ? CODES_PENDING : CODES_PERMANENT;
+    int len = 0;
+    int k;
+
+    resp[len++] = (unsigned char)(0x40 | mode);
+    resp[len++] = (unsigned char)ecu->numCodes[kind];
+    for (k = 0; k < ecu->numCodes[kind]; ++k)
+    {
+        resp[len++] = (unsigned char)(ecu->codes[kind][k] >> 8);
+        resp[len++] = (unsigned char)ecu->codes[kind][k];
+    }
+    return len;
+}
+
+// UDS 0x19 0x02, codes by status mask: confirmed for stored, pending
+static int report_dtcs(const VIRTUAL_ECU *ecu, unsigned char mask, unsigned char *resp)
+{
+    static const unsigned char status[NUM_CODE_KINDS] = { 0x08, 0x04, 0x08 };
+    int len = 0;
+    int kind;
+    int k;
+
+    resp[len++] = 0x59;
+    resp[len++] = 0x02;
+    resp[len++] = 0x0C;     // pending and confirmed are reported
+    for (kind = CODES_STORED; kind <= CODES_PENDING; ++kind)
+    {
+        for (k = 0; k < ecu->numCodes[kind] && (status[kind] & mask); ++k)
+        {
+            resp[len++] = (unsigned char)(ecu->codes[kind][k] >> 8);
+            resp[len++] = (unsigned char)ecu->codes[kind][k];
+            resp[len++] = 0x00;
+            resp[len++] = status[kind];
+        }
+    }
+    return len;
+}
+
+// the answer to a complete request, 0 bytes for none
+static int build_response(VIRTUAL_ECU *ecu, const unsigned char *req, int length, int functional, unsigned char *resp)
+{
+    VEHICLE *vehicle = ecu->vehicle;
+    int len = 0;
+    int k;
+
+    switch (req[0])
+    {
+        case 0x01:
+            resp[len++] = 0x41;
+            for (k = 1; k < length && k <= 6; ++k)
+            {
+                unsigned char value[4];
+                int valueLen = pid_value(ecu, req[k], value);
+                if (valueLen)
+                {
+                    resp[len++] = req[k];
+                    memcpy(resp + len, value, valueLen);
+                    len += valueLen;
+                }
+            }
+            return (len > 1) ? len : 0;
+
+        case 0x03:
+        case 0x07:
+        case 0x0A:
+            return read_codes(ecu, req[0], resp);
+
+        case 0x04:
+            memset(ecu->numCodes, 0, sizeof(ecu->numCodes));
+            resp[len++] = 0x44;
+            return len;
+
+        case 0x09:
+            if (length < 2)
+            {
+                return 0;
+            }
+            resp[len++] = 0x49;
+            resp[len++] = req[1];
+            if (0x00 == req[1])
+            {
+                // 02 the VIN on the engine ECU, 0A the ECU name on all
+                resp[len++] = (0 == ecu->index) ? 0x40 : 0x00;
+                resp[len++] = 0x40;
+                resp[len++] = 0x00;
+                resp[len++] = 0x00;
+                return len;
+            }
+            if (0x02 == req[1] && 0 == ecu->index)
+            {
+                resp[len++] = 0x01;
+                memcpy(resp + len, vehicle->vin, 17);
+                return len + 17;
+            }
+            if (0x0A == req[1])
+            {
+                char name[21];
+                memset(name, 0, sizeof(name));
+                snprintf(name, sizeof(name), "ECU%d-VirtualECU", ecu->index);
+                resp[len++] = 0x01;
+                memcpy(resp + len, name, 20);
+                return len + 20;
+            }
+            return 0;
+
+        case 0x10:
+        case 0x11:
+        case 0x3E:
+            if (length < 2)
+            {
+                return negative_response(resp, req[0], NRC_BAD_LENGTH);
+            }
+            if (req[1] & 0x80)
+            {
+                return 0;       // suppress the positive response
+            }
+            resp[len++] = (unsigned char)(req[0] + 0x40);
+            resp[len++] = req[1];
+            if (0x10 == req[0])
+            {
+                // P2 50 ms, P2* 5000 ms
+                resp[len++] = 0x00;
+                resp[len++] = 0x32;
+                resp[len++] = 0x01;
+                resp[len++] = 0xF4;
+            }
+            return len;
+
+        case 0x14:
+            memset(ecu->numCodes, 0, sizeof(ecu->numCodes));
+            resp[len++] = 0x54;
+            return len;
+
+        case 0x19:
+            if (length < 3 || 0x02 != req[1])
+            {
+                return functional ? 0 : negative_response(resp, req[0], (length < 2) ? NRC_BAD_LENGTH : NRC_SUB_FUNCTION);
+            }
+            return report_dtcs(ecu, req[2], resp);
+
+        case 0x22:
+            if (length < 3 || 0 == (length & 1))
+            {
+                return negative_response(resp, req[0], NRC_BAD_LENGTH);
+            }
+            resp[len++] = 0x62;
+            for (k = 1; k + 1 < length; k += 2)
+            {
+                unsigned int did = (req[k] << 8) | req[k + 1];
+                char text[24];
+
+                if (0xF190 == did && 0 == ecu->index)
+                {
+                    StringCchCopy(text, sizeof(text), vehicle->vin);
+                }
+                else if (0xF18C == did)
+                {
+                    snprintf(text, sizeof(text), "SN%s%02d", vehicle->name, ecu->index);
+                }
+                else
+                {
+                    continue;
+                }
+                resp[len++] = req[k];
+                resp[len++] = req[k + 1];
+                memcpy(resp + len, text, strlen(text));
+                len += (int)strlen(text);
+            }
+            if (len > 1)
+            {
+                return len;
+            }
+            return functional ? 0 : negative_response(resp, req[0], NRC_OUT_OF_RANGE);
+
+        default:
+            return functional ? 0 : negative_response(resp, req[0], NRC_NOT_SUPPORTED);
+    }
+}
+
+static void handle_request(VIRTUAL_ECU *ecu, const unsigned char *req, int length, int functional, TIME_US now)
+{
+    unsigned char resp[ISOTP_MAX];
+    int len;
+
+    ++ecu->vehicle->requests;
+    len = build_response(ecu, req, length, functional, resp);
+    if (len > 0)
+    {
+        // a new request ends the answer in progress, as on a real ECU
+        schedule_response(ecu, resp, len, now);
+    }
+    else if (TX_IDLE != ecu->tx.state)
+    {
+        ecu->tx.state = TX_IDLE;
+        heap_remove(ecu);
+    }
+}
+
+// a frame from the tester addressed to this ECU, or to all of them
+static void receive_frame(VIRTUAL_ECU *ecu, const unsigned char *data, int dlc, int functional, TIME_US now)
+{
+    ISOTP_RX *rx = &ecu->rx;
+    int count;
+
+    switch (data[0] >> 4)
+    {
+        case 0:     // single frame
+            count = data[0] & 0x0F;
+            if (count > 0 && count < dlc)
+            {
+                rx->active = FALSE;
+                handle_request(ecu, data + 1, count, functional, now);
+            }
+            break;
+
+        case 1:     // first frame, physical requests only
+            rx->length = ((data[0] & 0x0F) << 8) | data[1];
+            if (functional || rx->length <= 7 || dlc < 8)
+            {
+                break;
+            }
+            memcpy(rx->data, data + 2, 6);
+            rx->pos = 6;
+            rx->seq = 1;
+            rx->active = TRUE;
+            {
+                static const unsigned char cts[3] = { 0x30, 0x00, 0x00 };
+                send_frame(ecu->vehicle, ecu->txId, cts, 3);
+            }
+            break;
+
+        case 2:     // consecutive frame
+            if (!rx->active || (data[0] & 0x0F) != (rx->seq & 0x0F))
+            {
+                rx->active = FALSE;
+                break;
+            }
+            count = rx->length - rx->pos;
+            if (count > 7)
+            {
+                count = 7;
+            }
+            if (count > dlc - 1)
+            {
+                rx->active = FALSE;
+                break;
+            }
+            memcpy(rx->data + rx->pos, data + 1, count);
+            rx->pos += count;
+            ++rx->seq;
+            if (rx->pos >= rx->length)
+            {
+                rx->active = FALSE;
+                handle_request(ecu, rx->data, rx->length, FALSE, now);
+            }
+            break;
+
+        case 3:     // flow control for our answer
+            if (dlc >= 3)
+            {
+                flow_control(ecu, data, now);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void handle_frame(VEHICLE *vehicle, const struct can_frame *frame, TIME_US now)
+{
+    canid_t id = frame->can_id;
+    int target = -1;
+    int k;
+
+    if (frame->can_dlc < 1)
+    {
+        return;
+    }
+    if (vehicle->extended && (id & CAN_EFF_FLAG))
+    {
+        id &= CAN_EFF_MASK;
+        if (FUNCTIONAL_ID_29 == id)
+        {
+            target = MAX_ECUS;
+        }
+        else if ((id & 0x1FFF00FFUL) == PHYSICAL_ID_29)
+        {
+            target = (int)((id >> 8) & 0xFF) - ECU_ADDRESS_29;
+        }
+    }
+    else if (!vehicle->extended && !(id & CAN_EFF_FLAG))
+    {
+        if (FUNCTIONAL_ID == id)
+        {
+            target = MAX_ECUS;
+        }
+        else if (id >= REQUEST_ID && id < REQUEST_ID + MAX_ECUS)
+        {
+            target = (int)(id - REQUEST_ID);
+        }
+    }
+
+    if (MAX_ECUS == target)
+    {
+        // functional requests are single frames, flow control is physical
+        if (0 == (frame->data[0] >> 4))
+        {
+            for (k = 0; k < vehicle->numEcus; ++k)
+            {
+                receive_frame(&vehicle->ecus[k], frame->data, frame->can_dlc, TRUE, now);
+            }
+        }
+    }
+    else if (target >= 0 && target < vehicle->numEcus)
+    {
+        receive_frame(&vehicle->ecus[target], frame->data, frame->can_dlc, FALSE, now);
+    }
+}
+
+/* setup */
+
+static void init_vehicle(VEHICLE *vehicle, const char *name, int numEcus, int extended, int maxCodes, unsigned long seed, int number)
+{
+    int numTroubleCodes = 0;
+    int e;
+    int pid;
+    int kind;
+    int k;
+
+    while (master_trouble_list[numTroubleCodes].code)
+    {
+        ++numTroubleCodes;
+    }
+    memset(vehicle, 0, sizeof(*vehicle));
+    StringCchCopy(vehicle->name, sizeof(vehicle->name), name);
+    vehicle->fd = -1;
+    vehicle->extended = extended;
+    vehicle->rng = (seed * 2654435761UL + (unsigned long)number * 40503UL + 1) & 0xFFFFFFFFUL;
+    if (0 == vehicle->rng)
+    {
+        vehicle->rng = 1;
+    }
+    snprintf(vehicle->vin, sizeof(vehicle->vin), "1VCANECU9%08lu", (next_random(vehicle) % 100000000UL));
+    vehicle->numEcus = numEcus;
+
+    for (e = 0; e < numEcus; ++e)
+    {
+        VIRTUAL_ECU *ecu = &vehicle->ecus[e];
+
+        ecu->vehicle = vehicle;
+        ecu->index = e;
+        ecu->heapIndex = -1;
+        ecu->txId = extended ? (canid_t)(RESPONSE_ID_29 | (ECU_ADDRESS_29 + e) | CAN_EFF_FLAG) : (canid_t)(RESPONSE_ID + e);
+        ecu->hasPid[0x01] = TRUE;
+        for (pid = 0x02; pid < 256; ++pid)
+        {
+            int bytes = sensor_bytes(pid);
+            if (0 == (pid % 0x20) || bytes <= 0)
+            {
+                continue;
+            }
+            if (0 == e || 0 == next_random(vehicle) % 4)
+            {
+                ecu->hasPid[pid] = TRUE;
+                ecu->pidBytes[pid] = (bytes > 4) ? 4 : bytes;
+                for (k = 0; k < ecu->pidBytes[pid]; ++k)
+                {
+                    ecu->pidValue[pid][k] = (unsigned char)next_random(vehicle);
+                }
+            }
+        }
+        for (kind = CODES_STORED; kind < NUM_CODE_KINDS && numTroubleCodes > 0; ++kind)
+        {
+            // permanent codes are stored codes the ECU keeps
+            int count = (CODES_PERMANENT == kind) ? (ecu->numCodes[CODES_STORED] ? 1 : 0)
+                                                  : (int)(next_random(vehicle) % (maxCodes + 1));
+            for (k = 0; k < count && k < MAX_CODES; ++k)
+            {
+                ecu->codes[kind][k] = (CODES_PERMANENT == kind)
+                    ? ecu->codes[CODES_STORED][0]
+                    : code_value(master_trouble_list[next_random(vehicle) % numTroubleCodes].code);
+            }
+            ecu->numCodes[kind] = k;
+        }
+    }
+}
+
+// FALSE if the interface cannot be opened
+static int open_vehicle(VEHICLE *vehicle)
+{
+    struct ifreq ifr;
+    struct sockaddr_can addr;
+    struct can_filter filters[2];
+
+    vehicle->fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (vehicle->fd < 0)
+    {
+        return FALSE;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    StringCchCopy(ifr.ifr_name, sizeof(ifr.ifr_name), vehicle->name);
+    if (ioctl(vehicle->fd, SIOCGIFINDEX, &ifr) < 0)
+    {
+        close(vehicle->fd);
+        vehicle->fd = -1;
+        return FALSE;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+
+    // only requests to our ECUs wake us up
+    if (vehicle->extended)
+    {
+        filters[0].can_id = FUNCTIONAL_ID_29 | CAN_EFF_FLAG;
+        filters[0].can_mask = CAN_EFF_MASK | CAN_EFF_FLAG;
+        filters[1].can_id = PHYSICAL_ID_29 | CAN_EFF_FLAG;
+        filters[1].can_mask = 0x1FFF00FFUL | CAN_EFF_FLAG;
+    }
+    else
+    {
+        filters[0].can_id = FUNCTIONAL_ID;
+        filters[0].can_mask = CAN_SFF_MASK | CAN_EFF_FLAG;
+        filters[1].can_id = REQUEST_ID;
+        filters[1].can_mask = (CAN_SFF_MASK & ~(MAX_ECUS - 1)) | CAN_EFF_FLAG;
+    }
+    setsockopt(vehicle->fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters, sizeof(filters));
+    if (bind(vehicle->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(vehicle->fd);
+        vehicle->fd = -1;
+        return FALSE;
+    }
+    fcntl(vehicle->fd, F_SETFL, fcntl(vehicle->fd, F_GETFL) | O_NONBLOCK);
+    return TRUE;
+}
+
+// until a signal: frames in, answers out when they are due
+static void serve(void)
+{
+    struct pollfd *pfds = (struct pollfd *)calloc(numVehicles, sizeof(struct pollfd));
+    int k;
+
+    if (NULL == pfds)
+    {
+        return;
+    }
+    for (k = 0; k < numVehicles; ++k)
+    {
+        pfds[k].fd = vehicles[k].fd;
+        pfds[k].events = POLLIN;
+    }
+    while (!done)
+    {
+        TIME_US now = time_now_us();
+        struct timespec timeout;
+        struct timespec *wait = NULL;
+
+        while (heapCount > 0 && heap[0]->tx.due <= now)
+        {
+            run_tx(heap[0], now);
+        }
+        if (heapCount > 0)
+        {
+            TIME_US left = heap[0]->tx.due - now;
+            timeout.tv_sec = (time_t)(left / 1000000);
+            timeout.tv_nsec = (long)(left % 1000000) * 1000;
+            wait = &timeout;
+        }
+        if (ppoll(pfds, numVehicles, wait, NULL) <= 0)
+        {
+            continue;
+        }
+        now = time_now_us();
+        for (k = 0; k < numVehicles; ++k)
+        {
+            struct can_frame frame;
+
+            if (!(pfds[k].revents & POLLIN))
+            {
+                continue;
+            }
+            while (read(vehicles[k].fd, &frame, sizeof(frame)) == (ssize_t)sizeof(frame))
+            {
+                handle_frame(&vehicles[k], &frame, now);
+            }
+        }
+    }
+    free(pfds);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: vcan_ecu [-e ecus] [-l latency ms] [-j jitter ms] [-d codes] [-s seed] [-x] [-n vehicles] interface...\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int numEcus = 3;
+    int maxCodes = 3;
+    int extended = FALSE;
+    int count = 0;
+    unsigned long seed = 1;
+    unsigned long requests = 0;
+    unsigned long responses = 0;
+    unsigned long frames = 0;
+    unsigned long fcTimeouts = 0;
+    unsigned long retries = 0;
+    TIME_US start;
+    int k;
+
+    for (k = 1; k < argc && '-' == argv[k][0]; ++k)
+    {
+        if (0 == strcmp(argv[k], "-x"))
+        {
+            extended = TRUE;
+        }
+        else if (k + 1 >= argc)
+        {
+            usage();
+            return 1;
+        }
+        else if (0 == strcmp(argv[k], "-e"))
+        {
+            numEcus = atoi(argv[++k]);
+        }
+        else if (0 == strcmp(argv[k], "-l"))
+        {
+            latencyUs = strtoul(argv[++k], NULL, 10) * 1000;
+        }
+        else if (0 == strcmp(argv[k], "-j"))
+        {
+            jitterUs = strtoul(argv[++k], NULL, 10) * 1000;
+        }
+        else if (0 == strcmp(argv[k], "-d"))
+        {
+            maxCodes = atoi(argv[++k]);
+        }
+        else if (0 == strcmp(argv[k], "-s"))
+        {
+            seed = strtoul(argv[++k], NULL, 10);
+        }
+        else if (0 == strcmp(argv[k], "-n"))
+        {
+            count = atoi(argv[++k]);
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (k >= argc || numEcus < 1 || numEcus > MAX_ECUS || maxCodes < 0 || maxCodes > MAX_CODES ||
+        count < 0 || count > MAX_VEHICLES || argc - k > MAX_VEHICLES)
+    {
+        usage();
+        return 1;
+    }
+
+    vehicles = (VEHICLE *)calloc(count ? count : argc - k, sizeof(VEHICLE));
+    if (NULL == vehicles)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+    if (count)
+    {
+        for (numVehicles = 0; numVehicles < count; ++numVehicles)
+        {
+            char name[IFNAMSIZ];
+            snprintf(name, sizeof(name), "%s%d", argv[k], numVehicles);
+            init_vehicle(&vehicles[numVehicles], name, numEcus, extended, maxCodes, seed, numVehicles);
+        }
+    }
+    else
+    {
+        for (; k < argc; ++k, ++numVehicles)
+        {
+            init_vehicle(&vehicles[numVehicles], argv[k], numEcus, extended, maxCodes, seed, numVehicles);
+        }
+    }
+    for (k = 0; k < numVehicles; ++k)
+    {
+        if (!open_vehicle(&vehicles[k]))
+        {
+            fprintf(stderr, "Error: unable to open %s: %s\n", vehicles[k].name, strerror(errno));
+            return 1;
+        }
+        printf("%s: VIN %s, %d ECUs\n", vehicles[k].name, vehicles[k].vin, numEcus);
+    }
+    fflush(stdout);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    start = time_now_us();
+    serve();
+
+    for (k = 0; k < numVehicles; ++k)
+    {
+        requests += vehicles[k].requests;
+        responses += vehicles[k].responses;
+        frames += vehicles[k].frames;
+        fcTimeouts += vehicles[k].fcTimeouts;
+        retries += vehicles[k].retries;
+        close(vehicles[k].fd);
+    }
+    printf("%d vehicles, %lu s: %lu requests, %lu responses, %lu frames, %lu flow control timeouts, %lu retries\n",
+           numVehicles, (unsigned long)((time_now_us() - start) / 1000000),
+           requests, responses, frames, fcTimeouts, retries);
+    free(vehicles);
+    return 0;
+}
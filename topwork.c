@@ -33,61 +33,137 @@
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
+#ifndef _WIN32
+#include <poll.h>
+#endif // _WIN32
 #include "globals.h"
 #include "serial.h"
 #include "sensors.h"
 #include "trouble_code_reader.h"
+#include "elm_response.h"
+#include "scan_stats.h"
+#include "scan_trace.h"
+#include "spsc_ring.h"
+#include "session.h"
+#include "mapped_file.h"
+#include "capture.h"
 #include "topwork.h"
 
-COMPORT comport;
 #ifdef WIN_GUI
 HWND ghMainWnd = NULL;
 #endif // WIN_GUI
-int stopWork = 0;
 
-#ifdef LOG_COMMS
-char comm_log_file_name[20];
-void write_comm_log(const char *marker, const char *data)
-{
-    FILE *logfile = NULL;
+#define VIN_LENGTH  17
+#define PID_MONITOR_STATUS  0x01    // the MIL and stored code count, each ECU answers for itself
 
-    if (0 == fopen_s(&logfile, comm_log_file_name, "a"))
+// append VIN characters, skipping the NUL padding some protocols lead with
+static void append_vin(char *pVin, unsigned long vinSize, unsigned long *vinLen, const unsigned char *bytes, int count)
+{
+    int k;
+    for (k = 0; k < count && *vinLen + 1 < vinSize; ++k)
     {
-        fprintf(logfile, "[%s]%s[/%s]\n", marker, data, marker);
-        fclose(logfile);
+        if (bytes[k])
+        {
+            pVin[(*vinLen)++] = (char)bytes[k];
+        }
     }
 }
-#endif
 
-static char BCDToByte(char hi, char lo)
+// the model year coded in the 10th VIN character
+static long vin_model_year(const char *pVin)
 {
-    if (isdigit(hi))
-    {
-        hi -= '0';
-    }
-    else
+    long modelYear;
+
+    // assume the year is 1980-2009
+    switch (pVin[9])
     {
-        hi = hi - 'A' + 10;
+    case 'A':
+    case 'B':
+    case 'C':
+    case 'D':
+    case 'E':
+    case 'F':
+    case 'G':
+    case 'H':
+        modelYear = 1980 + pVin[9] - 'A';
+        break;
+    case 'J':
+    case 'K':
+    case 'L':
+    case 'M':
+    case 'N':
+        modelYear = 1988 + pVin[9] - 'J';
+        break;
+    case 'P':
+        modelYear = 1996;
+        break;
+    case 'R':
+    case 'S':
+    case 'T':
+        modelYear = 1994 + pVin[9] - 'R';
+        break;
+    case 'V':
+    case 'W':
+    case 'X':
+    case 'Y':
+        modelYear = 1997 + pVin[9] - 'V';
+        break;
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+        modelYear = 2001 + pVin[9] - '1';
+        break;
+    default:
+        modelYear = 1980;
+        break;
     }
-    if (isdigit(lo))
+
+    if (isalpha(pVin[6]))
     {
-        lo -= '0';
+        // make the adjustment to the new year range.
+        modelYear += 2010 - 1980;
     }
-    else
+
+    return modelYear;
+}
+
+// the VIN from a live answer to 0902, pVin is cleared first
+static void parse_vin(SCAN_SESSION *session, const char *buf, unsigned long size, char *pVin, unsigned long vinSize)
+{
+    unsigned long vinLen = 0;
+    ELM_MESSAGE_READER reader;
+    ELM_MESSAGE msg;
+
+    memset(pVin, 0, vinSize);
+    TRACE_BEGIN();
+    elm_reader_init(&reader, buf, size, session->headerDigits);
+    while (vinLen < VIN_LENGTH &&
+           elm_next_message(&reader, &msg))
     {
-        lo = lo - 'A' + 10;
+        // find the leading signature for the VIN return, skip the item count
+        if (msg.length > 3 &&
+            0x49 == msg.data[0] &&
+            0x02 == msg.data[1])
+        {
+            scan_stats_answer(MODE_REQUEST_VIN, 0x02, msg.header, msg.headerLength);
+            append_vin(pVin, vinSize, &vinLen, msg.data + 3, msg.length - 3);
+        }
     }
-    return (hi << 4) + lo;
+    TRACE_END("parse", "parse", "0902");
 }
 
-static long getVinInfo(char *simBuffer, unsigned long simBufSize, char *pVin, unsigned long vinSize, char *pYear, unsigned long yearSize)
+static long getVinInfo(SCAN_SESSION *session, const char *simBuffer, unsigned long simBufSize, char *pVin, unsigned long vinSize, char *pYear, unsigned long yearSize)
 {
     int response;
     char cmdbuf[8];
     char inbuf[128];
-    char *ptr;
-    char *next;
-    char *vptr;
+    const char *ptr;
     DWORD numBytes = 0;
     long modelYear = 0;
 
@@ -96,7 +172,11 @@ static long getVinInfo(char *simBuffer, unsigned long simBufSize, char *pVin, un
         memset(inbuf, 0, sizeof(inbuf));
         // first and foremost, ask for the VIN information
         StringCchCopy(cmdbuf, sizeof(cmdbuf), "0902");
-        response = sendAndWaitForResponse(inbuf, sizeof(inbuf), cmdbuf, &numBytes, CMD_TO_RESPONSE_VIN_SLEEP_MS);
+        response = sendAndWaitForResponse(&session->comport, inbuf, sizeof(inbuf), cmdbuf, &numBytes, CMD_TO_RESPONSE_VIN_SLEEP_MS);
+        if (DATA == response)
+        {
+            session_find_headers(session, inbuf, numBytes);
+        }
         ptr = inbuf;
     }
     else
@@ -106,131 +186,42 @@ static long getVinInfo(char *simBuffer, unsigned long simBufSize, char *pVin, un
         numBytes = (long)simBufSize;
     }
     // this gets a little tricky
-    // the format for this command returns a length in units
+    // on CAN the format for this command returns a length in units
     // then multiple lines with a line index prefix followed by a colon
     // 014
     // 0: 49 02 01 31 44 33
     // 1: 48 56 31 33 54 30 39
     // 2: 53 37 31 38 30 35 37
+    // the other protocols send 4 characters per line, numbered by the third byte
+    // 49 02 01 00 00 00 31
+    // 49 02 02 44 33 48 56
     if (pVin)
     {
         memset(pVin, 0, vinSize);
-        if (DATA == response &&
-            numBytes)
+        if (simBuffer)
         {
-            // find the leading signature for the VIN return
-            next = strstr(ptr, "0:490201");
-            if (next)
+            unsigned long vinLen = 0;
+            ELM_MESSAGE msg;
+            long entry;
+
+            for (entry = sim_index_first(&session->simIndex, 0x49, 0x02);
+                 entry >= 0 && vinLen < VIN_LENGTH;
+                 entry = sim_index_next(&session->simIndex, entry))
             {
-                numBytes -= (long)(next - ptr);
-                ptr = next;
-                numBytes -= 8;
-                ptr += 8;
-                vptr = pVin;
-                while (numBytes &&
-                       *ptr &&
-                       RECORD_DELIMITER != *ptr &&
-                       LINE_DELIMITER != *ptr)
-                {
-                    *vptr = BCDToByte(ptr[0], ptr[1]);
-                    ptr += 2;
-                    numBytes -= 2;
-                    ++vptr;
-                }
-                next = strstr(ptr, "1:");
-                if (next)
+                sim_index_message(&session->simIndex, entry, &msg);
+                if (msg.length > 3)
                 {
-                    numBytes -= (long)(next - ptr);
-                    ptr = next;
-                    ptr += 2;
-                    numBytes -= 2;
-                    while (numBytes &&
-                           *ptr &&
-                           RECORD_DELIMITER != *ptr &&
-                           LINE_DELIMITER != *ptr)
-                    {
-                        *vptr = BCDToByte(ptr[0], ptr[1]);
-                        ptr += 2;
-                        numBytes -= 2;
-                        ++vptr;
-                    }
-                    next = strstr(ptr, "2:");
-                    if (next)
-                    {
-                        numBytes -= (long)(next - ptr);
-                        ptr = next;
-                        numBytes -= 2;
-                        ptr += 2;
-                        while (numBytes &&
-                               *ptr &&
-                               RECORD_DELIMITER != *ptr &&
-                               LINE_DELIMITER != *ptr)
-                        {
-                            *vptr = BCDToByte(ptr[0], ptr[1]);
-                            ptr += 2;
-                            numBytes -= 2;
-                            ++vptr;
-                        }
-                    }
+                    append_vin(pVin, vinSize, &vinLen, msg.data + 3, msg.length - 3);
                 }
-            }   // end IF the VIN id string is found
+            }
         }
-
-        // assume the year is 1980-2009
-        switch (pVin[9])
+        else if (DATA == response &&
+                 numBytes)
         {
-        case 'A':
-        case 'B':
-        case 'C':
-        case 'D':
-        case 'E':
-        case 'F':
-        case 'G':
-        case 'H':
-            modelYear = 1980 + pVin[9] - 'A';
-            break;
-        case 'J':
-        case 'K':
-        case 'L':
-        case 'M':
-        case 'N':
-            modelYear = 1988 + pVin[9] - 'J';
-            break;
-        case 'P':
-            modelYear = 1996;
-            break;
-        case 'R':
-        case 'S':
-        case 'T':
-            modelYear = 1994 + pVin[9] - 'R';
-            break;
-        case 'V':
-        case 'W':
-        case 'X':
-        case 'Y':
-            modelYear = 1997 + pVin[9] - 'V';
-            break;
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-            modelYear = 2001 + pVin[9] - '1';
-            break;
-        default:
-            modelYear = 1980;
-            break;
+            parse_vin(session, ptr, numBytes, pVin, vinSize);
         }
 
-        if (isalpha(pVin[6]))
-        {
-            // make the adjustment to the new year range.
-            modelYear += 2010 - 1980;
-        }
+        modelYear = vin_model_year(pVin);
     }
 
     if (pYear)
@@ -245,53 +236,445 @@ static long getVinInfo(char *simBuffer, unsigned long simBufSize, char *pVin, un
     return numBytes;
 }
 
-void workInit(char *simBuffer, unsigned long simBufSize, int comPortNumber, char *pVin, unsigned long vinSize, char *pYear, unsigned long yearSize)
+// the answer to AT DPN: "A6" while searching automatically, "6" when set, after the echo if it is on.
+// With headers on, the protocol says how long they are
+static void parse_protocol(SCAN_SESSION *session, const char *inbuf)
+{
+    const char *ptr = strstr(inbuf, "ATDPN");
+    int digits;
+
+    ptr = ptr ? ptr + 5 : inbuf;
+    while (RECORD_DELIMITER == *ptr || LINE_DELIMITER == *ptr)
+    {
+        ++ptr;
+    }
+    if ('A' == *ptr)
+    {
+        ++ptr;
+    }
+    if (*ptr >= '1' && *ptr <= '9')
+    {
+        session->comport.usage.protocol = *ptr - '0';
+        digits = elm_protocol_header_digits(session->comport.usage.protocol);
+        if (session->headerDigits && digits)
+        {
+            session->headerDigits = digits;
+        }
+    }
+}
+
+// the protocol the interface settled on, for the bus estimates of the link usage
+static void read_protocol(SCAN_SESSION *session)
+{
+    char cmdbuf[8];
+    char inbuf[64];
+    DWORD numBytes = 0;
+
+    StringCchCopy(cmdbuf, sizeof(cmdbuf), "ATDPN");
+    if (DATA == sendAndWaitForResponse(&session->comport, inbuf, sizeof(inbuf), cmdbuf, &numBytes, CMD_TO_RESPONSE_SLEEP_MS))
+    {
+        parse_protocol(session, inbuf);
+    }
+}
+
+void workInit(SCAN_SESSION *session, const char *simBuffer, unsigned long simBufSize, int comPortNumber, char *pVin, unsigned long vinSize, char *pYear, unsigned long yearSize)
 {
-    initializeUnknownList();
+    session->simBuffer = simBuffer;
     if (simBuffer)
     {
-        comport.status = READY;
-        simBufSize = compress_response(simBuffer, (long)simBufSize);
+        session->comport.status = READY;
+        session->simBufSize = simBufSize;
+        // one pass over the input, every lookup after this goes through the index
+        TRACE_BEGIN();
+        session_find_headers(session, simBuffer, simBufSize);
+        if (!sim_index_build(&session->simIndex, simBuffer, simBufSize, session->headerDigits))
+        {
+            session_message(session, "Error: not enough memory to index the simulation input\n");
+            session->comport.status = NOT_OPEN;
+        }
+        TRACE_END("parse", "sim index", NULL);
     }
-    else
+    else if (READY != session->comport.status)
     {
-#ifdef LOG_COMMS
-        char temp_buf[256];
-        StringCchCopy(comm_log_file_name, sizeof(comm_log_file_name), "comm_log.txt");
-        remove(comm_log_file_name);
-        write_comm_log("START_TIME", temp_buf);
-#endif
-        comport.status = NOT_OPEN;
-        comport.number = comPortNumber;
-        comport.baud_rate = 9600;
+        char line[80];
+        char name[24];
+
+        session->comport.number = comPortNumber;
+        if (0 == session->comport.baud_rate)
+        {
+            session->comport.baud_rate = 9600;
+        }
 
         /* try opening comport (comport.status will be set) */
-        open_comport();
+        if (open_comport(&session->comport) < 0)
+        {
+#ifdef WIN_VS6
+            sprintf(line, "Unable to open %s\n", comport_name(&session->comport, name, sizeof(name)));
+#else // WIN_VS6
+            StringCchPrintf(line, sizeof(line), "Unable to open %s\n", comport_name(&session->comport, name, sizeof(name)));
+#endif // WIN_VS6
+            session_message(session, line);
+        }
+    }
+
+    if (READY == session->comport.status)
+    {
+        TRACE_BEGIN();
+        simBufSize = getVinInfo(session, simBuffer, simBufSize, pVin, vinSize, pYear, yearSize);
+        TRACE_END("scan", "vin", NULL);
+        if (NULL == simBuffer)
+        {
+            // asked after the first request, once the protocol is found
+            read_protocol(session);
+        }
+    }
+}
+
+// find the first Mode 01 response for pid
+// returns the number of bytes in msg, 0 if no ECU answered
+static int find_current_data(SCAN_SESSION *session, const char *buf, unsigned long size, int pid, ELM_MESSAGE *msg)
+{
+    ELM_MESSAGE_READER reader;
+
+    elm_reader_init(&reader, buf, size, session->headerDigits);
+    while (elm_next_message(&reader, msg))
+    {
+        if (msg->length > 2 &&
+            (0x40 | MODE_CURRENT_DATA) == msg->data[0] &&
+            pid == msg->data[1])
+        {
+            scan_stats_answer(MODE_CURRENT_DATA, pid, msg->header, msg->headerLength);
+            return msg->length;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Show the first ECU's answer to a Mode 01 request.  Only that one is
+ * shown, but every ECU's answer to PID 01 adds its MIL and code count.
+ */
+static void display_current_data(SCAN_SESSION *session, const ELM_MESSAGE *first, const char *buf, unsigned long size)
+{
+    ELM_MESSAGE_READER reader;
+    ELM_MESSAGE msg;
+    int answers = 0;
+
+    if (PID_MONITOR_STATUS != first->data[1])
+    {
+        process_and_display_data(session, first->data, first->length);
+        return;
+    }
+    session->statusAnswers = 0;
+    process_and_display_data(session, first->data, first->length);
+    elm_reader_init(&reader, buf, size, session->headerDigits);
+    while (elm_next_message(&reader, &msg))
+    {
+        if (msg.length > 2 &&
+            (0x40 | MODE_CURRENT_DATA) == msg.data[0] &&
+            PID_MONITOR_STATUS == msg.data[1])
+        {
+            // the first is in already
+            if (answers++ && msg.length >= 6)
+            {
+                note_monitor_status(session, ((unsigned long)msg.data[2] << 24) | ((unsigned long)msg.data[3] << 16) |
+                                             ((unsigned long)msg.data[4] << 8) | msg.data[5]);
+            }
+        }
+    }
+}
+
+// the supported pid bitmap of a bank, or'd over every ECU that answered
+static int read_supported_pids(SCAN_SESSION *session, const char *buf, unsigned long size, int pid, unsigned long *codes)
+{
+    ELM_MESSAGE_READER reader;
+    ELM_MESSAGE msg;
+    int found = FALSE;
+
+    *codes = 0;
+    elm_reader_init(&reader, buf, size, session->headerDigits);
+    while (elm_next_message(&reader, &msg))
+    {
+        if (msg.length >= 6 &&
+            (0x40 | MODE_CURRENT_DATA) == msg.data[0] &&
+            pid == msg.data[1])
+        {
+            *codes |= ((unsigned long)msg.data[2] << 24) | ((unsigned long)msg.data[3] << 16) |
+                      ((unsigned long)msg.data[4] << 8) | msg.data[5];
+            found = TRUE;
+            scan_stats_answer(MODE_CURRENT_DATA, pid, msg.header, msg.headerLength);
+        }
+    }
+    return found;
+}
+
+#define DECODE_RING_SLOTS   (MAX_BANKS_OF_20 * 0x20)   // every PID of a sweep, on its way to the decoder
+#define DECODE_LINK_LINE    -1      // pid of a record that carries the link usage instead of a response
+
+// a PID's response as read, for the decoder
+typedef struct _PID_RESPONSE
+{
+    int pid;                    // DECODE_LINK_LINE for a live link usage line
+    int response;               // of sendAndWaitForResponse
+    DWORD numBytes;
+    char cmdbuf[16];
+    char inbuf[128];
+    LINK_USAGE usage;           // of a DECODE_LINK_LINE
+} PID_RESPONSE;
+
+/*
+ * The live sweep is a pipeline: the scanning thread only sends and
+ * receives, and hands each response to a decode thread through an SPSC
+ * ring, so the next request goes out while the last answer is parsed,
+ * formatted and printed.  A full ring drops the response rather than
+ * hold up the bus.  If the thread cannot be started the responses are
+ * decoded on the scanning thread, as they always were.
+ *
+ * The decoder is then the only thread that gives the session output:
+ * a live link usage line due during a request goes through the ring
+ * behind that request's response.
+ */
+typedef struct _DECODE_STAGE
+{
+    SCAN_SESSION *session;
+    SPSC_RING ring;
+    PLATFORM_EVENT ready;       // to the decoder: a response is in, or the sweep is over
+    PLATFORM_THREAD thread;
+    volatile unsigned long done;
+    int running;
+    unsigned long dropped;      // responses the ring had no room for
+    void (*live)(void *context, const LINK_USAGE *usage);   // the session's link hook, back after the sweep
+    void *liveContext;
+    LINK_USAGE linkUsage;       // a line due, until the ring has room for it
+    int linkDue;
+} DECODE_STAGE;
+
+// parse, decode and show the answer to the request for one PID
+static void decode_pid_response(SCAN_SESSION *session, int pid, int response, const char *buf, unsigned long size, const char *cmdbuf)
+{
+    ELM_MESSAGE msg;
+    char line[80];
+    int found;
+
+    TRACE_BEGIN();
+    found = (DATA == response &&
+             find_current_data(session, buf, size, pid, &msg));
+    TRACE_END("parse", "parse", cmdbuf);
+    if (found && codeIsDisplayed(session, pid))
+    {
+        TRACE_BEGIN();
+        display_current_data(session, &msg, buf, size);
+        TRACE_END("decode", "decode", cmdbuf);
+        return;
+    }
+    if (!found && cancel_requested(&session->cancel))
+    {
+        // never asked, the scan was stopped first
+        return;
+    }
+#ifdef WIN_VS6
+    sprintf(line, found ? "PID %02X reported and not handled\n" :
+                          "Hmmm. PID %02X reported as supported, but no response to query\n", pid);
+#else // WIN_VS6
+    StringCchPrintf(line, sizeof(line), found ? "PID %02X reported and not handled\n" :
+                                                "Hmmm. PID %02X reported as supported, but no response to query\n", pid);
+#endif // WIN_VS6
+    session_message(session, line);
+}
+
+static void decode_thread(void *arg)
+{
+    DECODE_STAGE *stage = (DECODE_STAGE *)arg;
+    PID_RESPONSE *rsp;
+    unsigned long done;
+
+    TRACE_THREAD_NAME("decode");
+    for (;;)
+    {
+        // read before the ring: once done is set, everything was published
+        done = atomic_load_acquire(&stage->done);
+        rsp = (PID_RESPONSE *)spsc_peek(&stage->ring);
+        if (rsp && DECODE_LINK_LINE == rsp->pid)
+        {
+            session_link_line(stage->session, &rsp->usage);
+            spsc_release(&stage->ring);
+        }
+        else if (rsp)
+        {
+            decode_pid_response(stage->session, rsp->pid, rsp->response, rsp->inbuf, rsp->numBytes, rsp->cmdbuf);
+            spsc_release(&stage->ring);
+        }
+        else if (done)
+        {
+            break;
+        }
+        else
+        {
+            (void)event_wait(&stage->ready, WAIT_FOREVER);
+        }
+    }
+}
+
+// on the scanning thread, inside a request: the line waits for the ring
+static void stage_link(void *context, const LINK_USAGE *usage)
+{
+    DECODE_STAGE *stage = (DECODE_STAGE *)context;
+
+    stage->linkUsage = *usage;
+    stage->linkDue = TRUE;
+}
+
+static void decode_stage_start(DECODE_STAGE *stage, SCAN_SESSION *session)
+{
+    memset(stage, 0, sizeof(*stage));
+    stage->session = session;
+    if (spsc_init(&stage->ring, DECODE_RING_SLOTS, sizeof(PID_RESPONSE)))
+    {
+        if (event_init(&stage->ready))
+        {
+            if (thread_start(&stage->thread, decode_thread, stage))
+            {
+                stage->running = TRUE;
+                stage->live = session->comport.usage.live;
+                stage->liveContext = session->comport.usage.liveContext;
+                if (stage->live)
+                {
+                    session->comport.usage.live = stage_link;
+                    session->comport.usage.liveContext = stage;
+                }
+                return;
+            }
+            event_destroy(&stage->ready);
+        }
+        spsc_free(&stage->ring);
+    }
+}
+
+// where the next response goes: a ring slot, or spare if there is none
+static PID_RESPONSE *decode_stage_slot(DECODE_STAGE *stage, PID_RESPONSE *spare)
+{
+    PID_RESPONSE *rsp = stage->running ? (PID_RESPONSE *)spsc_claim(&stage->ring) : NULL;
+    return rsp ? rsp : spare;
+}
+
+// the link usage line due, behind the responses in the ring; it waits if the ring is full
+static void decode_stage_link(DECODE_STAGE *stage)
+{
+    PID_RESPONSE *rsp = stage->linkDue ? (PID_RESPONSE *)spsc_claim(&stage->ring) : NULL;
+
+    if (rsp)
+    {
+        rsp->pid = DECODE_LINK_LINE;
+        rsp->usage = stage->linkUsage;
+        spsc_publish(&stage->ring);
+        event_signal(&stage->ready);
+        stage->linkDue = FALSE;
+    }
+}
+
+static void decode_stage_put(DECODE_STAGE *stage, PID_RESPONSE *rsp, PID_RESPONSE *spare)
+{
+    if (rsp != spare)
+    {
+        spsc_publish(&stage->ring);
+        event_signal(&stage->ready);
+    }
+    else if (stage->running)
+    {
+        ++stage->dropped;
+    }
+    else
+    {
+        decode_pid_response(stage->session, rsp->pid, rsp->response, rsp->inbuf, rsp->numBytes, rsp->cmdbuf);
+    }
+    decode_stage_link(stage);
+}
+
+// waits for the decoder to finish what the ring holds
+static void decode_stage_stop(DECODE_STAGE *stage)
+{
+    if (stage->running)
+    {
+        atomic_store_release(&stage->done, TRUE);
+        event_signal(&stage->ready);
+        thread_join(&stage->thread);
+        event_destroy(&stage->ready);
+        spsc_free(&stage->ring);
+        stage->running = FALSE;
+        stage->session->comport.usage.live = stage->live;
+        stage->session->comport.usage.liveContext = stage->liveContext;
+        if (stage->linkDue)
+        {
+            session_link_line(stage->session, &stage->linkUsage);
+        }
+        if (stage->dropped)
+        {
+            char line[96];
+#ifdef WIN_VS6
+            sprintf(line, "%lu responses not decoded, the decoder fell behind\n", stage->dropped);
+#else // WIN_VS6
+            StringCchPrintf(line, sizeof(line), "%lu responses not decoded, the decoder fell behind\n", stage->dropped);
+#endif // WIN_VS6
+            session_message(stage->session, line);
+        }
     }
+}
+
+// one Mode 01 request on an open port, its values to the session's output
+// returns FALSE if no ECU answered with a value this tool decodes
+int read_current_data(SCAN_SESSION *session, int pid)
+{
+    char cmdbuf[16];
+    char inbuf[128];
+    DWORD numBytes = 0;
+    ELM_MESSAGE msg;
 
-    if (READY == comport.status)
+    if (NULL != session->simBuffer || READY != session->comport.status)
+    {
+        return FALSE;
+    }
+#ifdef WIN_VS6
+    sprintf(cmdbuf, "%02X%02X", MODE_CURRENT_DATA, pid);
+#else // WIN_VS6
+    StringCchPrintf(cmdbuf, sizeof(cmdbuf), "%02X%02X", MODE_CURRENT_DATA, pid);
+#endif // WIN_VS6
+    if (DATA != sendAndWaitForResponse(&session->comport, inbuf, sizeof(inbuf), cmdbuf, &numBytes, CMD_TO_RESPONSE_SLEEP_MS))
     {
-        simBufSize = getVinInfo(simBuffer, simBufSize, pVin, vinSize, pYear, yearSize);
+        return FALSE;
     }
-    destroyUnknownList();
+    session_find_headers(session, inbuf, numBytes);
+    if (!find_current_data(session, inbuf, numBytes, pid, &msg) ||
+        !codeIsDisplayed(session, pid))
+    {
+        return FALSE;
+    }
+    TRACE_BEGIN();
+    display_current_data(session, &msg, inbuf, numBytes);
+    TRACE_END("decode", "decode", cmdbuf);
+    return TRUE;
 }
 
-void process_all_codes(char *simBuffer)
+void process_all_codes(SCAN_SESSION *session)
 {
+    const char *simBuffer = session->simBuffer;
     int bank = 0;
     int response;
     char cmdbuf[16];
     char inbuf[128];
-    char *ptr;
-    unsigned long enabledCodes[3];
+    ELM_MESSAGE msg;
     unsigned long index;
     DWORD numBytes = 0;
+    int found;
+    DECODE_STAGE stage;
+    PID_RESPONSE spare;
 
+    TRACE_BEGIN();
     // the input buffer pointer being NULL means we are handling live data
     if (NULL == simBuffer)
     {
-        if (READY == comport.status)
+        if (READY == session->comport.status)
         {
+            decode_stage_start(&stage, session);
             do
             {
                 index = (bank * 0x20) + 1;    // set the index to the starting pid for that bank
@@ -301,47 +684,33 @@ void process_all_codes(char *simBuffer)
                 StringCchPrintf(cmdbuf, sizeof(cmdbuf), "%02X%X0", MODE_CURRENT_DATA, bank * 2);
 #endif // WIN_VS6
                 // generate current mode commands
-                response = sendAndWaitForResponse(inbuf, sizeof(inbuf), cmdbuf, &numBytes, CMD_TO_RESPONSE_SLEEP_MS);
+                response = sendAndWaitForResponse(&session->comport, inbuf, sizeof(inbuf), cmdbuf, &numBytes, CMD_TO_RESPONSE_SLEEP_MS);
                 if (DATA == response)
                 {
-                    cmdbuf[0] = '4';  // replace command with response byte and find
-                    ptr = strstr(inbuf, cmdbuf);
-                    if (ptr)
+                    unsigned long codes;
+                    TRACE_BEGIN();
+                    // before the decode thread reads any answer with them
+                    session_find_headers(session, inbuf, numBytes);
+                    found = read_supported_pids(session, inbuf, numBytes, bank * 0x20, &codes);
+                    TRACE_END("parse", "parse", cmdbuf);
+                    if (found)
                     {
-                        unsigned long codes;
-                        ptr += 4;   // skip the 4yxx response
-                        codes = enabledCodes[bank] = strtoul(ptr, NULL, DATA_RADIX);
                         // continue until there are no more codes to process
-                        while (codes && (0 == stopWork))
+                        while (codes && !cancel_requested(&session->cancel))
                         {
                             // check uppermost bits for what is enabled
                             if (codes & 0x80000000)
                             {
+                                PID_RESPONSE *rsp = decode_stage_slot(&stage, &spare);
+                                rsp->pid = (int)index;
                                 // query each of the interfaces supported
 #ifdef WIN_VS6
-                                sprintf(cmdbuf, "%02X%02X", MODE_CURRENT_DATA, (int)index);
+                                sprintf(rsp->cmdbuf, "%02X%02X", MODE_CURRENT_DATA, (int)index);
 #else // WIN_VS6
-                                StringCchPrintf(cmdbuf, sizeof(cmdbuf), "%02X%02X", MODE_CURRENT_DATA, (int)index);
+                                StringCchPrintf(rsp->cmdbuf, sizeof(rsp->cmdbuf), "%02X%02X", MODE_CURRENT_DATA, (int)index);
 #endif // WIN_VS6
-                                response = sendAndWaitForResponse(inbuf, sizeof(inbuf), cmdbuf, &numBytes, CMD_TO_RESPONSE_SLEEP_MS);
-                                cmdbuf[0] = '4';  // replace command with response byte and find
-                                ptr = strstr(inbuf, cmdbuf);
-                                if (ptr)
-                                {
-                                    // check to see if we are handling this code
-                                    if (codeIsDisplayed(index))
-                                    {
-                                        process_and_display_data(ptr, simBuffer);
-                                    }
-                                    else
-                                    {
-                                        printf("PID %02X reported and not handled\n", (int)index);
-                                    }
-                                }
-                                else
-                                {
-                                    printf("Hmmm. PID %02X reported as supported, but no response to query\n", (int)index);
-                                }
+                                rsp->response = sendAndWaitForResponse(&session->comport, rsp->inbuf, sizeof(rsp->inbuf), rsp->cmdbuf, &rsp->numBytes, CMD_TO_RESPONSE_SLEEP_MS);
+                                decode_stage_put(&stage, rsp, &spare);
                             }
                             ++index;        // account for numeric index
                             codes <<= 1;    // shift next bit up
@@ -354,31 +723,440 @@ void process_all_codes(char *simBuffer)
                     break;
                 }
                 ++bank;
-            } while ((0 == stopWork) && (bank < MAX_BANKS_OF_20));
+            } while (!cancel_requested(&session->cancel) && (bank < MAX_BANKS_OF_20));
+            decode_stage_stop(&stage);
         }
     }
     else
     {
         // simulated data is being used.
-        // that means we scan for return values and then pump them into the display routines
-        int codeIndex;
-        for (codeIndex = 1; codeIndex < 0x7F; ++codeIndex)
+        // that means we replay every response, in capture order, into the display routines.
+        // one sequential pass straight off the input keeps only the pages being read resident
+        ELM_MESSAGE_READER reader;
+        unsigned long prompts = 0;
+
+        session->statusAnswers = 0;
+        elm_reader_init(&reader, simBuffer, session->simBufSize, session->headerDigits);
+        while (!cancel_requested(&session->cancel) && elm_next_message(&reader, &msg))
         {
+            if (reader.prompts != prompts)
+            {
+                // a new request, its PID 01 answers add up on their own
+                session->statusAnswers = 0;
+                prompts = reader.prompts;
+            }
             /* do not process the indices reports */
-            if (codeIndex != 0x20 && codeIndex != 0x40)
+            if ((0x40 | MODE_CURRENT_DATA) == msg.data[0] &&
+                msg.length > 2 &&
+                0 != (msg.data[1] % 0x20))
+            {
+                TRACE_BEGIN();
+                process_and_display_data(session, msg.data, msg.length);
+                TRACE_END("decode", "decode", NULL);
+            }
+        }
+    }
+    TRACE_END("scan", "sweep", NULL);
+}
+
+#define STREAM_CHUNK_SIZE   (64 * 1024)
+
+// fills buf with up to size bytes of interface text, returns 0 at the end
+typedef long (*REPLAY_SOURCE)(void *context, char *buf, unsigned long size);
+
+/*
+ * Replay interface text as a source hands it over.  Input is read a
+ * chunk at a time and cut after the last complete line; the partial line
+ * waits for the next read, so memory stays at one chunk however long the
+ * input runs.  Responses are handed on as they come.
+ */
+static const DTC_RESULT *replay_source(SCAN_SESSION *session, REPLAY_SOURCE source, void *context)
+{
+    char *chunk;
+    unsigned long held = 0;     // bytes read but not yet handed to the reader
+    unsigned long used;
+    long got;
+    TIME_US arrived;
+    int atEnd = FALSE;
+    ELM_MESSAGE_READER reader;
+    ELM_MESSAGE msg;
+    char vin[VIN_LENGTH + 1];
+    unsigned long vinLen = 0;
+    int nextEcu[NUM_DTC_KINDS];
+    unsigned long prompts = 0;
+    int stored = 0;
+    int kind;
+
+    ready_trouble_codes(session);
+    chunk = (char *)malloc(STREAM_CHUNK_SIZE);
+    if (NULL == chunk)
+    {
+        session_message(session, "Error: not enough memory to read the input stream\n");
+        return &session->dtcs;
+    }
+    memset(vin, 0, sizeof(vin));
+    memset(nextEcu, 0, sizeof(nextEcu));
+    session->statusAnswers = 0;
+    elm_reader_init(&reader, chunk, 0, session->headerDigits);
+
+    while (!atEnd && !cancel_requested(&session->cancel))
+    {
+        TIME_US asked = time_now_us();
+        got = source(context, chunk + held, STREAM_CHUNK_SIZE - held);
+        arrived = time_now_us();
+        if (got <= 0)
+        {
+            atEnd = TRUE;
+        }
+        else
+        {
+            held += got;
+        }
+        // cut after the last complete line, a line longer than a chunk is taken as is
+        used = held;
+        if (!atEnd)
+        {
+            while (used > 0 &&
+                   RECORD_DELIMITER != chunk[used - 1] &&
+                   LINE_DELIMITER != chunk[used - 1] &&
+                   '>' != chunk[used - 1])
+            {
+                --used;
+            }
+            if (0 == used && STREAM_CHUNK_SIZE == held)
+            {
+                used = held;
+            }
+        }
+
+        link_usage_stream(&session->comport.usage, chunk, used, arrived, arrived - asked);
+        link_usage_live(&session->comport.usage);
+        if (!session->headersFound)
+        {
+            session_find_headers(session, chunk, used);
+            reader.tok.headerDigits = session->headerDigits;
+        }
+        elm_reader_feed(&reader, chunk, used, !atEnd);
+        while (!cancel_requested(&session->cancel) && elm_next_message(&reader, &msg))
+        {
+            if (reader.prompts != prompts)
+            {
+                // a new request, ECUs without headers are numbered from its first answer
+                memset(nextEcu, 0, sizeof(nextEcu));
+                session->statusAnswers = 0;
+                prompts = reader.prompts;
+            }
+            if ((0x40 | MODE_CURRENT_DATA) == msg.data[0])
             {
+                /* do not process the indices reports */
+                if (msg.length > 2 && 0 != (msg.data[1] % 0x20))
+                {
+                    process_and_display_data(session, msg.data, msg.length);
+                }
+            }
+            else if ((0x40 | MODE_REQUEST_VIN) == msg.data[0])
+            {
+                if (msg.length > 3 && 0x02 == msg.data[1] && vinLen < VIN_LENGTH)
+                {
+                    append_vin(vin, sizeof(vin), &vinLen, msg.data + 3, msg.length - 3);
+                    if (VIN_LENGTH == vinLen)
+                    {
+                        char modelYear[8];
 #ifdef WIN_VS6
-                sprintf(cmdbuf, "41%02X", codeIndex);
+                        sprintf(modelYear, "%ld", vin_model_year(vin));
 #else // WIN_VS6
-                StringCchPrintf(cmdbuf, sizeof(cmdbuf), "41%02X", codeIndex);
+                        StringCchPrintf(modelYear, sizeof(modelYear), "%ld", vin_model_year(vin));
 #endif // WIN_VS6
-                ptr = strstr(simBuffer, cmdbuf);
-                if (ptr)
+                        session_vehicle(session, vin, modelYear);
+                    }
+                }
+            }
+            else
+            {
+                for (kind = 0; kind < NUM_DTC_KINDS; ++kind)
                 {
-                    process_and_display_data(ptr, simBuffer);
+                    if (dtc_response_bytes[kind] == msg.data[0])
+                    {
+                        int found = handle_trouble_code_message(session, &msg, (DTC_KIND)kind, &nextEcu[kind]);
+                        if (DTC_STORED == kind)
+                        {
+                            stored += found;
+                        }
+                    }
                 }
             }
         }
+
+        memmove(chunk, chunk + used, held - used);
+        held -= used;
+    }
+    free(chunk);
+
+    // the stored code count may have come at any point of the stream
+    session->dtcs.reportedCount = session->reportedCodeCount;
+    session->dtcs.mismatch = (session->dtcs.reportedCount >= 0 &&
+                              stored != session->dtcs.reportedCount) ? TRUE : FALSE;
+    return &session->dtcs;
+}
+
+typedef struct _STREAM_SOURCE
+{
+    int fd;
+    CANCEL_TOKEN *cancel;
+} STREAM_SOURCE;
+
+static long read_stream(void *context, char *buf, unsigned long size)
+{
+    STREAM_SOURCE *source = (STREAM_SOURCE *)context;
+
+#ifndef _WIN32
+    // a quiet pipe must not outlast a cancel, which ends the stream
+    if (cancel_wait_fd(source->cancel, source->fd, POLLIN, WAIT_FOREVER) < 0)
+    {
+        return 0;
+    }
+#endif // _WIN32
+    return stream_read(source->fd, buf, size);
+}
+
+// replay the log as it arrives on fd: stdin, a pipe or a FIFO
+const DTC_RESULT *replay_stream(SCAN_SESSION *session, int fd)
+{
+    STREAM_SOURCE source;
+
+    source.fd = fd;
+    source.cancel = &session->cancel;
+    return replay_source(session, read_stream, &source);
+}
+
+typedef struct _CAPTURE_SOURCE
+{
+    CAPTURE_READER reader;
+    CAPTURE_RECORD rec;
+    unsigned long used;         // bytes of rec already handed over
+} CAPTURE_SOURCE;
+
+// the received bytes of a capture, in order, the same text a log holds
+static long read_capture(void *context, char *buf, unsigned long size)
+{
+    CAPTURE_SOURCE *src = (CAPTURE_SOURCE *)context;
+    unsigned long count = 0;
+    unsigned long take;
+
+    while (count < size)
+    {
+        if (src->used == src->rec.length)
+        {
+            if (!capture_next(&src->reader, &src->rec))
+            {
+                break;
+            }
+            src->used = (CAPTURE_RX == src->rec.type) ? 0 : src->rec.length;
+            continue;
+        }
+        take = src->rec.length - src->used;
+        if (take > size - count)
+        {
+            take = size - count;
+        }
+        memcpy(buf + count, src->rec.data + src->used, take);
+        src->used += take;
+        count += take;
+    }
+    return (long)count;
+}
+
+// replay a binary capture held in memory, see capture.h
+const DTC_RESULT *replay_capture(SCAN_SESSION *session, const char *buf, unsigned long size)
+{
+    CAPTURE_SOURCE src;
+
+    memset(&src, 0, sizeof(src));
+    if (!capture_reader_init(&src.reader, buf, size))
+    {
+        session_message(session, "Error: the capture is damaged or from a newer version\n");
+        ready_trouble_codes(session);
+        return &session->dtcs;
+    }
+    return replay_source(session, read_capture, &src);
+}
+
+// ready for the first request; the session's port is for the caller to drive
+void scan_machine_init(SCAN_SESSION *session, SCAN_MACHINE *machine)
+{
+    memset(machine, 0, sizeof(*machine));
+    machine->step = SCAN_STEP_VIN;
+    session->comport.status = READY;
+}
+
+// the command of the current step, NULL once the scan is done.  The interface ends
+// every answer with its prompt, timeoutMs is for one that never does
+const char *scan_machine_command(SCAN_MACHINE *machine, unsigned long *timeoutMs)
+{
+    *timeoutMs = ECU_TIMEOUT;
+    switch (machine->step)
+    {
+    case SCAN_STEP_VIN:
+        StringCchCopy(machine->command, sizeof(machine->command), "0902");
+        break;
+    case SCAN_STEP_PROTOCOL:
+        StringCchCopy(machine->command, sizeof(machine->command), "ATDPN");
+        *timeoutMs = ATZ_TIMEOUT;
+        break;
+    case SCAN_STEP_BANK:
+#ifdef WIN_VS6
+        sprintf(machine->command, "%02X%X0", MODE_CURRENT_DATA, machine->bank * 2);
+#else // WIN_VS6
+        StringCchPrintf(machine->command, sizeof(machine->command), "%02X%X0", MODE_CURRENT_DATA, machine->bank * 2);
+#endif // WIN_VS6
+        break;
+    case SCAN_STEP_PID:
+#ifdef WIN_VS6
+        sprintf(machine->command, "%02X%02X", MODE_CURRENT_DATA, machine->pid);
+#else // WIN_VS6
+        StringCchPrintf(machine->command, sizeof(machine->command), "%02X%02X", MODE_CURRENT_DATA, machine->pid);
+#endif // WIN_VS6
+        break;
+    case SCAN_STEP_CODES:
+#ifdef WIN_VS6
+        sprintf(machine->command, "%02X", dtc_response_bytes[machine->kind] & ~0x40);
+#else // WIN_VS6
+        StringCchPrintf(machine->command, sizeof(machine->command), "%02X", dtc_response_bytes[machine->kind] & ~0x40);
+#endif // WIN_VS6
+        break;
+    default:
+        return NULL;
+    }
+    return machine->command;
+}
+
+static void start_codes(SCAN_SESSION *session, SCAN_MACHINE *machine)
+{
+    ready_trouble_codes(session);
+    machine->step = SCAN_STEP_CODES;
+    machine->kind = DTC_STORED;
+    machine->stored = 0;
+}
+
+// on to the next supported PID of the bank, the next bank, or the codes after the last one
+static void next_pid(SCAN_SESSION *session, SCAN_MACHINE *machine)
+{
+    while (machine->codes && 0 == (machine->codes & 0x80000000))
+    {
+        ++machine->pid;
+        machine->codes <<= 1;
+    }
+    if (cancel_requested(&session->cancel))
+    {
+        start_codes(session, machine);
+    }
+    else if (machine->codes)
+    {
+        machine->step = SCAN_STEP_PID;
+    }
+    else if (++machine->bank < MAX_BANKS_OF_20)
+    {
+        machine->step = SCAN_STEP_BANK;
+    }
+    else
+    {
+        start_codes(session, machine);
+    }
+}
+
+// as acquire_trouble_codes: Modes 03, 07 and 0A once each
+static void codes_answer(SCAN_SESSION *session, SCAN_MACHINE *machine, int response, const char *buf, unsigned long size)
+{
+    int newCodes = (DATA == response) ? handle_read_codes(session, buf, size, (DTC_KIND)machine->kind) : -1;
+
+    if (DTC_STORED == machine->kind && newCodes > 0)
+    {
+        machine->stored = newCodes;
+    }
+    if (!cancel_requested(&session->cancel) && machine->kind + 1 < NUM_DTC_KINDS)
+    {
+        ++machine->kind;
+        return;
+    }
+    session->dtcs.mismatch = (session->dtcs.reportedCount >= 0 &&
+                              machine->stored != session->dtcs.reportedCount) ? TRUE : FALSE;
+    machine->step = SCAN_STEP_DONE;
+}
+
+// buf holds the answer to the current command as read, NUL terminated
+void scan_machine_answer(SCAN_SESSION *session, SCAN_MACHINE *machine, int response, const char *buf, unsigned long size)
+{
+    unsigned long codes;
+
+    ++session->comport.requests;
+    if (EMPTY == response)
+    {
+        ++session->comport.timeouts;
+    }
+    if (DATA == response && SCAN_STEP_PROTOCOL != machine->step)
+    {
+        session_find_headers(session, buf, size);
+    }
+    switch (machine->step)
+    {
+    case SCAN_STEP_VIN:
+        if (DATA == response)
+        {
+            parse_vin(session, buf, size, machine->vin, sizeof(machine->vin));
+        }
+#ifdef WIN_VS6
+        sprintf(machine->modelYear, "%ld", vin_model_year(machine->vin));
+#else // WIN_VS6
+        StringCchPrintf(machine->modelYear, sizeof(machine->modelYear), "%ld", vin_model_year(machine->vin));
+#endif // WIN_VS6
+        machine->step = SCAN_STEP_PROTOCOL;
+        break;
+    case SCAN_STEP_PROTOCOL:
+        if (DATA == response)
+        {
+            parse_protocol(session, buf);
+        }
+        machine->step = SCAN_STEP_BANK;
+        machine->bank = 0;
+        break;
+    case SCAN_STEP_BANK:
+        if (DATA != response)
+        {
+            start_codes(session, machine);
+            break;
+        }
+        machine->pid = (machine->bank * 0x20) + 1;
+        machine->codes = read_supported_pids(session, buf, size, machine->bank * 0x20, &codes) ? codes : 0;
+        next_pid(session, machine);
+        break;
+    case SCAN_STEP_PID:
+        decode_pid_response(session, machine->pid, response, buf, size, machine->command);
+        ++machine->pid;
+        machine->codes <<= 1;
+        next_pid(session, machine);
+        break;
+    case SCAN_STEP_CODES:
+        codes_answer(session, machine, response, buf, size);
+        break;
+    default:
+        break;
     }
 }
 
+// the trouble code report that ends a scan, FALSE if it was truncated
+int write_scan_report(SCAN_SESSION *session, const DTC_RESULT *dtcs, OUTPUT_BUFFER *out)
+{
+    int ecu;
+
+    for (ecu = 0; ecu < dtcs->numEcus; ++ecu)
+    {
+        outbuf_printf(out, "ECU %d: %d stored, %d pending, %d permanent\n", ecu + 1,
+                      dtcs->ecus[ecu].count[DTC_STORED], dtcs->ecus[ecu].count[DTC_PENDING], dtcs->ecus[ecu].count[DTC_PERMANENT]);
+    }
+    if (dtcs->mismatch)
+    {
+        outbuf_printf(out, "Vehicle reported %d stored codes, but returned a different number\n", dtcs->reportedCount);
+    }
+    outbuf_printf(out, "Trouble codes (MIL=%s):\n", session->mil_is_on ? "On" : "Off");
+    return printTroubleCodes(session, out);
+}
@@ -11,21 +11,60 @@ typedef enum _OBD_MODES
     MODE_CURRENT_DATA=1,
     MODE_FREEZE_FRAME_DATA=2,
     MODE_STORED_DIAG_TROUBLE_CODES=3,
-    MODE_REQUEST_VIN=9
+    MODE_PENDING_DIAG_TROUBLE_CODES=7,
+    MODE_REQUEST_VIN=9,
+    MODE_PERMANENT_DIAG_TROUBLE_CODES=0x0A
 } OBD_MODES;
 
-#ifdef LOG_COMMS
-void write_comm_log(const char *marker, const char *data);
-#endif
+// the steps of a live scan, in the order workInit, process_all_codes and acquire_trouble_codes take them
+typedef enum _SCAN_STEP
+{
+    SCAN_STEP_VIN,              // init: the first request, it settles the protocol
+    SCAN_STEP_PROTOCOL,         // init: AT DPN
+    SCAN_STEP_BANK,             // discovery: the supported PIDs of a bank
+    SCAN_STEP_PID,              // sweep: each supported PID of the bank
+    SCAN_STEP_CODES,            // stored, pending and permanent trouble codes
+    SCAN_STEP_DONE
+} SCAN_STEP;
+
+/*
+ * A live scan one request at a time, for callers that cannot block on
+ * the port: scan_machine_command gives the next command and how long its
+ * answer may take, scan_machine_answer takes the answer, or EMPTY if
+ * none came, and moves on.  The requests and what is made of the
+ * answers are those of workInit, process_all_codes and
+ * acquire_trouble_codes.
+ */
+typedef struct _SCAN_MACHINE
+{
+    SCAN_STEP step;
+    int bank;
+    int pid;
+    unsigned long codes;        // supported PIDs of the bank from pid on, top bit first
+    int kind;                   // DTC_KIND being read
+    int stored;                 // stored codes read
+    char command[16];
+    char vin[64];
+    char modelYear[8];
+} SCAN_MACHINE;
 
 #ifdef WIN_GUI
 extern HWND ghMainWnd;
 #endif //WIN_GUI
-extern int stopWork;
 
-void getStoredDiagnosticCodes();
-void process_all_codes(char *simBuffer);
-void workInit(char *, unsigned long, int, char *, unsigned long , char *, unsigned long);
+struct _SCAN_SESSION;
+struct _DTC_RESULT;
+struct _OUTPUT_BUFFER;
+
+void process_all_codes(struct _SCAN_SESSION *session);
+int read_current_data(struct _SCAN_SESSION *session, int pid);
+const struct _DTC_RESULT *replay_stream(struct _SCAN_SESSION *session, int fd);
+const struct _DTC_RESULT *replay_capture(struct _SCAN_SESSION *session, const char *buf, unsigned long size);
+void workInit(struct _SCAN_SESSION *, const char *, unsigned long, int, char *, unsigned long , char *, unsigned long);
+void scan_machine_init(struct _SCAN_SESSION *session, SCAN_MACHINE *machine);
+const char *scan_machine_command(SCAN_MACHINE *machine, unsigned long *timeoutMs);
+void scan_machine_answer(struct _SCAN_SESSION *session, SCAN_MACHINE *machine, int response, const char *buf, unsigned long size);
+int write_scan_report(struct _SCAN_SESSION *session, const struct _DTC_RESULT *dtcs, struct _OUTPUT_BUFFER *out);
 #ifdef __cplusplus
    }
 #endif
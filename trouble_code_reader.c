@@ -1,13 +1,16 @@
 #include "globals.h"
 #include "serial.h"
 #include "trouble_code_reader.h"
+#include "output_buffer.h"
+#include "elm_response.h"
+#include "session.h"
 #include "topwork.h"
+#include "scan_stats.h"
+#include "scan_trace.h"
 #ifdef WIN_GUI
 #include "resource.h"
 #endif  /* WIN_GUI */
 
-#define MAX(x,y)     (((x) > (y)) ? (x) : (y))
-
 typedef enum
 {
     MSG_USER,
@@ -27,342 +30,350 @@ typedef enum
 #define READ_PENDING   3
 #define CLEAR_CODES    4
 
-#define NUM_OF_RETRIES   3
-
-static int mil_is_on; // MIL is ON or OFF
-
-#define CODE_LEN    5   /* Pxxxx or Uxxxx */
-#define MAX_UNKNOWN_SIZE  10
+#define FOUND_LIST_GROWTH  16
 
-TROUBLE_CODE unknownTCList[MAX_UNKNOWN_SIZE];
-
-static void add_trouble_code(char *, int);
-static void clear_trouble_codes(void);
+static void clear_trouble_codes(SCAN_SESSION *);
 
 // function definitions:
-static void trouble_codes_simulator(int show);
 
-extern COMPORT comport;
+void initializeFoundList(SCAN_SESSION *session)
+{
+    session->foundCodes = NULL;
+    session->numFoundCodes = 0;
+    session->maxFoundCodes = 0;
+}
 
-void initializeUnknownList(void)
+void destroyFoundList(SCAN_SESSION *session)
 {
-    memset(unknownTCList, 0, sizeof(unknownTCList));
+    if (session->foundCodes)
+    {
+        free(session->foundCodes);
+    }
+    initializeFoundList(session);
 }
 
-void destroyUnknownList(void)
+void ready_trouble_codes(SCAN_SESSION *session)
 {
+    clear_trouble_codes(session);
+    memset(&session->dtcs, 0, sizeof(session->dtcs));
+    session->dtcs.reportedCount = session->reportedCodeCount;
+}
+
+// remember a code against the ECU that reported it
+// returns TRUE if the ECU had not already reported it as this kind
+static int add_ecu_trouble_code(SCAN_SESSION *session, int ecu, DTC_KIND kind, const char *code)
+{
+    ECU_TROUBLE_CODES *ecuCodes;
     int k;
-    for (k = 0; k < MAX_UNKNOWN_SIZE; ++k)
+
+    if (ecu >= MAX_ECUS)
+    {
+        ecu = MAX_ECUS - 1;
+    }
+    if (ecu >= session->dtcs.numEcus)
+    {
+        session->dtcs.numEcus = ecu + 1;
+    }
+    ecuCodes = &session->dtcs.ecus[ecu];
+    for (k = 0; k < ecuCodes->count[kind]; ++k)
     {
-        if (unknownTCList[k].code)
+        if (0 == strcmp(code, ecuCodes->codes[kind][k]))
         {
-            free(unknownTCList[k].code);
-            unknownTCList[k].code = NULL;
-            unknownTCList[k].foundCount = 0;
+            return FALSE;
         }
     }
+    if (ecuCodes->count[kind] >= MAX_DTCS_PER_ECU)
+    {
+        return FALSE;
+    }
+    memcpy(ecuCodes->codes[kind][ecuCodes->count[kind]++], code, CODE_LEN + 1);
+    return TRUE;
 }
 
-void ready_trouble_codes(void)
-{
-    clear_trouble_codes();
-    mil_is_on = FALSE;
-}
-
-int parse_dtcs(const char *response, int pending)
+// returns the number of codes new to this ECU and kind
+int parse_dtcs(SCAN_SESSION *session, const unsigned char *response, int length, DTC_KIND kind, int ecu)
 {
-    char code_letter[] = "PCBU";
+    static const char code_letter[] = "PCBU";
     int dtc_count = 0;
-    unsigned long k;
+    int k;
     char temp_trouble_code[CODE_LEN + 1];
-    unsigned long respLen = (unsigned long)strlen(response);
-    ULONG respConvert;
 
-    for (k = 0; k < respLen; k += 4)    // read codes
+    for (k = 0; k + 1 < length; k += 2)    // read codes
     {
-        memset(temp_trouble_code, 0, sizeof(temp_trouble_code));
-        temp_trouble_code[0] = ' '; // make first position a blank space
-                                    // begin to copy from response to temp_trouble_code.code beginning with position #1
-        memcpy(temp_trouble_code + 1, response + k, CODE_LEN - 1);
-
-        if (strcmp(temp_trouble_code, " 0000") == 0) // if there's no trouble code,
+        if (0 == response[k] && 0 == response[k + 1]) // if there's no trouble code,
         {
             break;      // break out of the for() loop
         }
 
-        // begin with position #1 (skip blank space), convert to hex, extract first two bits
-        // use the result as an index into the code_letter array to get the corresponding code letter
-        respConvert = strtol(temp_trouble_code + 1, NULL, 16);
-        temp_trouble_code[0] = code_letter[respConvert >> 14];
-        temp_trouble_code[1] = (char)((respConvert >> 12) & 0x03);
-        temp_trouble_code[1] += 0x30; // convert to ASCII
-        add_trouble_code(temp_trouble_code, pending);
-        dtc_count++;
+        // the first two bits index the code letter, the next two are the first digit
+#ifdef WIN_VS6
+        sprintf(temp_trouble_code, "%c%d%X%02X",
+#else // WIN_VS6
+        StringCchPrintf(temp_trouble_code, sizeof(temp_trouble_code), "%c%d%X%02X",
+#endif // WIN_VS6
+                        code_letter[response[k] >> 6], (response[k] >> 4) & 0x03, response[k] & 0x0F, response[k + 1]);
+        if (add_ecu_trouble_code(session, ecu, kind, temp_trouble_code))
+        {
+            add_trouble_code(session, temp_trouble_code, kind, ecu);
+            dtc_count++;
+        }
     }
 
     return dtc_count;
 }
 
-static int find_valid_response(char *buf, char *response, const char *filter, char **stop)
+// with headers on, the ECU is known by its header ID
+static int find_ecu(SCAN_SESSION *session, const ELM_MESSAGE *msg, int *nextEcu)
 {
-    char *in_ptr = response;
-    char *out_ptr = buf;
-
-    buf[0] = 0;
-
-    while (*in_ptr)
+    int k;
+    if (NULL == msg->header)
     {
-        // check if the current pointer matches the filter
-        if (strncmp(in_ptr, filter, strlen(filter)) == 0)
-        {
-            // copy the matching filter and everything after until a delimiter is found
-            while (*in_ptr &&
-                   *in_ptr != SPECIAL_DELIMITER &&
-                   *in_ptr != LINE_DELIMITER &&
-                   *in_ptr != RECORD_DELIMITER) // copy valid response into buf
-            {
-                *out_ptr = *in_ptr;
-                in_ptr++;
-                out_ptr++;
-            }
-            *out_ptr = 0;  // terminate string
-            while (*in_ptr == SPECIAL_DELIMITER ||
-                   *in_ptr == LINE_DELIMITER ||
-                   *in_ptr == RECORD_DELIMITER)
-            {
-                in_ptr++;
-            }
-            break;
-        }
-        else
+        // without headers, ECUs are told apart by the order they answer in
+        return (*nextEcu)++;
+    }
+    for (k = 0; k < session->dtcs.numEcus; ++k)
+    {
+        if ((int)strlen(session->dtcs.ecus[k].id) == msg->headerLength &&
+            0 == strncmp(session->dtcs.ecus[k].id, msg->header, msg->headerLength))
         {
-            // skip to the next delimiter
-            while (*in_ptr &&
-                   *in_ptr != SPECIAL_DELIMITER &&
-                   *in_ptr != LINE_DELIMITER &&
-                   *in_ptr != RECORD_DELIMITER)
-            {
-                in_ptr++;
-            }
-            if (*in_ptr == SPECIAL_DELIMITER ||
-                *in_ptr == LINE_DELIMITER ||
-                *in_ptr == RECORD_DELIMITER)  // skip the delimiter
-            {
-                in_ptr++;
-            }
+            return k;
         }
     }
-    if (stop)
+    if (k < MAX_ECUS && msg->headerLength < (int)sizeof(session->dtcs.ecus[k].id))
     {
-        *stop = in_ptr;
+        memcpy(session->dtcs.ecus[k].id, msg->header, msg->headerLength);
+        session->dtcs.ecus[k].id[msg->headerLength] = '\0';
+        session->dtcs.numEcus = k + 1;
     }
-
-    return (strlen(buf) > 0) ? TRUE : FALSE;
+    return k;
 }
 
 /* NOTE:
- *  ELM327 multi-message CAN responses are parsed using the following assumptions:
+ *  ELM327 multi-message CAN responses are reassembled by elm_next_message using the following assumptions:
  *   - max 8 ECUs (per ISO15765-4 standard)
  *   - max 51 DTCs per ECU - there is no way to tell which ECU a response belongs to when the message counter wraps (0-F)
  *   - ECUs respond sequentially (i.e. 2nd msg from the 1st ECU to respond will come before 2nd msg from the 2nd ECU to respond)
  *     This has been observed imperically (in fact most of the time 2nd ECU lags several messages behind the 1st ECU),
  *     this should be true for most cases due to arbitration, unless 1st ECU takes a very long time to prepare next message,
- *     which should not happen. There is no other choice at the moment, unless we turn on headers, but that would mean rewriting
- *     whole communication paradigm.
+ *     which should not happen. With headers on (session->headerDigits), frames are matched by header ID instead.
  */
-int handle_read_codes(char *vehicle_response, int pending)
+const unsigned char dtc_response_bytes[NUM_DTC_KINDS] = { 0x43, 0x47, 0x4A };
+
+// returns the number of new codes in one ECU's response
+int handle_trouble_code_message(SCAN_SESSION *session, const ELM_MESSAGE *msg, DTC_KIND kind, int *nextEcu)
 {
-    int dtc_count = 0;
-    char *start = vehicle_response;
-    char filter[3];
-    char msg[48];
-    int can_resp_cnt = 0;
-    int can_msg_cnt = 0;
-    int can_resp_len[8];
-    char *can_resp_buf[8];  // 8 CAN ECUs max
-    int buf_len;
-    int max_len;
-    int trim;
-    int i;
-
-    // First, look for non-CAN and single-message CAN responses
-    StringCchCopy(filter, sizeof(filter), (pending) ? "47" : "43");
-    while (find_valid_response(msg, start, filter, &start))
+    int skip;
+
+    if (msg->length == 2)  // skip '4X 00' CAN responses
     {
-        if (strlen(msg) == 4)  // skip '4X 00' CAN responses
-        {
-            continue;
-        }
-        // if even number of bytes (CAN), skip first 2 bytes, otherwise, skip 1 byte
-        i = (((strlen(msg) / 2) & 0x01) == 0) ? 4 : 2;
-        dtc_count += parse_dtcs(msg + i, pending);
+        (void)find_ecu(session, msg, nextEcu);
+        return 0;
     }
-#if 0
-    // Look for CAN multi-message responses
-    start = vehicle_response;
-    while (find_valid_response(msg, start, "", &start))  // step through all responses
+    // CAN responses carry a code count after the mode byte: even number of bytes
+    // for a single frame, always for a reassembled one
+    skip = (msg->multiFrame || 0 == (msg->length & 0x01)) ? 2 : 1;
+    return parse_dtcs(session, msg->data + skip, msg->length - skip, kind, find_ecu(session, msg, nextEcu));
+}
+
+int handle_read_codes(SCAN_SESSION *session, const char *vehicle_response, unsigned long length, DTC_KIND kind)
+{
+    int dtc_count = 0;
+    int nextEcu = 0;
+    ELM_MESSAGE_READER reader;
+    ELM_MESSAGE msg;
+
+    elm_reader_init(&reader, vehicle_response, length, session->headerDigits);
+    while (elm_next_message(&reader, &msg))
     {
-        if (strlen(msg) == 3)  // we're looking for 3-byte response length messages
+        if (msg.length >= 1 && dtc_response_bytes[kind] == msg.data[0])
         {
-            can_resp_len[can_resp_cnt] = strtol(msg, NULL, 16);  // get total length for the response
-            can_resp_buf[can_resp_cnt] = calloc((can_resp_len[can_resp_cnt]-2)*2 + 1, sizeof(char));
-            i = (int) ceil((float)(can_resp_len[can_resp_cnt] + 1) / 7);  // calculate number of messages necessary to transmit specified number of bytes
-            can_msg_cnt = MAX(can_msg_cnt, i);  // calculate max number of messages for any response
-            can_resp_cnt++;
+            scan_stats_answer(msg.data[0] & ~0x40, STATS_NO_PID, msg.header, msg.headerLength);
+            dtc_count += handle_trouble_code_message(session, &msg, kind, &nextEcu);
         }
     }
-#endif
 
-    for (i = 0; i < can_msg_cnt; i++)
+    return dtc_count; // return the actual number of codes read
+}
+
+// the same, over every occurrence of the response in the simulation input
+static int handle_sim_codes(SCAN_SESSION *session, DTC_KIND kind)
+{
+    int dtc_count = 0;
+    int nextEcu = 0;
+    unsigned long exchange = 0;
+    long entry;
+    ELM_MESSAGE msg;
+
+    for (entry = sim_index_first(&session->simIndex, dtc_response_bytes[kind], SIM_NO_PID);
+         entry >= 0;
+         entry = sim_index_next(&session->simIndex, entry))
     {
-        int j = 0;
-        start = vehicle_response;
-#ifdef WIN_VS6
-        sprintf(filter, "%X:", i);
-#else // WIN_VS6
-        StringCchPrintf(filter, sizeof(filter), "%X:", i);
-#endif // WIN_VS6
-        while (find_valid_response(msg, start, filter, &start))
+        if (sim_index_exchange(&session->simIndex, entry) != exchange)
         {
-            for (; j < can_resp_cnt; j++)  // find next response that is not full
-            {
-                buf_len = (int)strlen(can_resp_buf[j]);
-                max_len = (can_resp_len[j] - 2) * 2;
-                if (buf_len < max_len)
-                {
-                    // first response -- skip '0:4XXX', all other -- skip 'X:'
-                    // first response -- 6 bytes total, all other -- 7 bytes
-                    // if this is last message for a response, trim padding
-                    trim = (buf_len + (int)strlen(msg) - 2 >= max_len) ? buf_len + (int)strlen(msg) - 2 - max_len : 0;
-#ifdef WIN_VS6
-                    strcat(can_resp_buf[j], msg + ((i == 0) ? 6 : 2));
-#else // WIN_VS6
-                    StringCchCatN(can_resp_buf[j], max_len, msg + ((i == 0) ? 6 : 2), (i == 0) ? 8 : 14 - trim);
-#endif // WIN_VS6
-                    j++;
-                    break;
-                }
-            }
+            // a log of several scans answers each of them: without headers, the ECUs count from 1 again
+            exchange = sim_index_exchange(&session->simIndex, entry);
+            nextEcu = 0;
         }
+        sim_index_message(&session->simIndex, entry, &msg);
+        dtc_count += handle_trouble_code_message(session, &msg, kind, &nextEcu);
     }
 
-    for (i = 0; i < can_resp_cnt; i++)
-    {
-        dtc_count += parse_dtcs(can_resp_buf[i], pending);
-        free(can_resp_buf[i]);
-    }
-
-    return dtc_count; // return the actual number of codes read
+    return dtc_count;
 }
 
-void add_trouble_code(char *init_code, int pending)
+void add_trouble_code(SCAN_SESSION *session, char *init_code, DTC_KIND kind, int ecu)
 {
     if (init_code)
     {
+        FOUND_TROUBLE_CODE *found;
         int k = 0;
-        while (master_trouble_list[k].code)
+        // already reported during this session?
+        while (k < session->numFoundCodes &&
+               strcmp(init_code, session->foundCodes[k].code))
         {
-            if (0 == strcmp(init_code, master_trouble_list[k].code))
-            {
-                ++master_trouble_list[k].foundCount;
-                if (pending)
-                {
-                    master_trouble_list[k].pending = "[Pending]";
-                }
-                break;
-            }
             ++k;
         }
-        // check if found
-        if (master_trouble_list[k].code == NULL)
+        if (k < session->numFoundCodes)
         {
-            k = 0;
-            while (k < MAX_UNKNOWN_SIZE &&
-                   unknownTCList[k].code &&
-                   strcmp(init_code, unknownTCList[k].code))
-            {
-                ++k;
-            }
-            if (k < MAX_UNKNOWN_SIZE)
+            found = &session->foundCodes[k];
+        }
+        else
+        {
+            if (session->numFoundCodes == session->maxFoundCodes)
             {
-                if (unknownTCList[k].code)
-                {
-                    ++unknownTCList[k].foundCount;
-                }
-                else
+                found = (FOUND_TROUBLE_CODE *)realloc(session->foundCodes, (session->maxFoundCodes + FOUND_LIST_GROWTH) * sizeof(FOUND_TROUBLE_CODE));
+                if (NULL == found)
                 {
-                    unknownTCList[k].code = (char *)malloc(CODE_LEN + 2);
-                    if (unknownTCList[k].code)
-                    {
-                        memcpy(unknownTCList[k].code, init_code, CODE_LEN + 1);
-                        unknownTCList[k].foundCount = 1;
-                        if (pending)
-                        {
-                            unknownTCList[k].pending = "[Pending]";
-                        }
-                    }
-                    else
-                    {
-                        printf("Error: Allocate for unknown trouble code failed\n");
-                    }
+                    session_message(session, "Error: Allocate for trouble code failed\n");
+                    return;
                 }
+                session->foundCodes = found;
+                session->maxFoundCodes += FOUND_LIST_GROWTH;
             }
-            else
+            found = &session->foundCodes[session->numFoundCodes++];
+            memset(found, 0, sizeof(*found));
+            memcpy(found->code, init_code, CODE_LEN);
+            // look up the description, NULL if not found
+            k = 0;
+            while (master_trouble_list[k].code &&
+                   strcmp(init_code, master_trouble_list[k].code))
             {
-                printf("Error: Unknown trouble list exceeded\n");
+                ++k;
             }
+            found->description = master_trouble_list[k].description;
+        }
+        // an ECU that reports the code as more than one kind is counted once
+        if (ecu >= MAX_ECUS)
+        {
+            ecu = MAX_ECUS - 1;
+        }
+        if (0 == (found->ecus & (1u << ecu)))
+        {
+            found->ecus |= 1u << ecu;
+            ++found->foundCount;
         }
+        found->kinds |= 1 << kind;
     }
 }
 
-void clear_trouble_codes(void)
+void clear_trouble_codes(SCAN_SESSION *session)
 {
-    int k = 0;
-    while (master_trouble_list[k].code)
-    {
-        master_trouble_list[k].foundCount = 0;
-        ++k;
-    }
+    session->numFoundCodes = 0;
 }
 
-void printTroubleCodes(char *buf, unsigned long bufSize)
+// send one trouble code request (or look it up in the simulation data)
+// returns the number of codes not seen before, -1 if the vehicle did not answer
+static int request_trouble_codes(SCAN_SESSION *session, int mode, DTC_KIND kind)
 {
-    int numFound = 0;
-    int k = 0;
-    unsigned long nowLen;
-    while (master_trouble_list[k].code)
+    DWORD numBytes = 0;
+    int response;
+    int newCodes;
+    char inbuf[1024];
+    char cmdbuf[16];
+
+    if (session->simBuffer)
     {
-        if (master_trouble_list[k].foundCount)
-        {
-            numFound += master_trouble_list[k].foundCount;
-            nowLen = (unsigned long)strlen(buf);
+        // every response in the file is one answer to the request
+        return handle_sim_codes(session, kind);
+    }
+
 #ifdef WIN_VS6
-            sprintf(buf + nowLen, "%s(%d) %s\n", master_trouble_list[k].code, master_trouble_list[k].foundCount, master_trouble_list[k].description);
+    sprintf(cmdbuf, "%02X", mode);
 #else // WIN_VS6
-            StringCchPrintf(buf + nowLen, bufSize - nowLen, "%s(%d) %s\n", master_trouble_list[k].code, master_trouble_list[k].foundCount, master_trouble_list[k].description);
+    StringCchPrintf(cmdbuf, sizeof(cmdbuf), "%02X", mode);
 #endif // WIN_VS6
-        }
-        ++k;
+    response = sendAndWaitForResponse(&session->comport, inbuf, sizeof(inbuf), cmdbuf, &numBytes, CMD_TO_RESPONSE_SLEEP_MS);
+    if (DATA != response)
+    {
+        return -1;
     }
-    k = 0;
-    while (k < MAX_UNKNOWN_SIZE && unknownTCList[k].code)
+    TRACE_BEGIN();
+    session_find_headers(session, inbuf, numBytes);
+    newCodes = handle_read_codes(session, inbuf, numBytes, kind);
+    TRACE_END("parse", "parse", cmdbuf);
+    return newCodes;
+}
+
+/*
+ * Read stored, pending and permanent codes with one request per mode.
+ * Every ECU answers the same request, so each mode reaches each ECU once.
+ * Asking again does not make an ECU return codes it left out, so a stored
+ * count short of the one from Mode 01 PID 01 is recorded as a mismatch.
+ */
+const DTC_RESULT *acquire_trouble_codes(SCAN_SESSION *session)
+{
+    int stored;
+
+    ready_trouble_codes(session);
+    if (READY != session->comport.status)
     {
-        ++numFound;
-        nowLen = (unsigned long)strlen(buf);
-#ifdef WIN_VS6
-        sprintf(buf + nowLen, "%s Not Found\n", unknownTCList[k].code);
-#else // WIN_VS6
-        StringCchPrintf(buf + nowLen, bufSize - nowLen, "%s Not Found\n", unknownTCList[k].code);
-#endif // WIN_VS6
-        ++k;
+        return &session->dtcs;
     }
-    if (numFound == 0)
+
+    TRACE_BEGIN();
+    stored = request_trouble_codes(session, MODE_STORED_DIAG_TROUBLE_CODES, DTC_STORED);
+    if (stored < 0)
     {
-        nowLen = (unsigned long)strlen(buf);
-#ifdef WIN_VS6
-        sprintf(buf + nowLen, "None\n");
-#else // WIN_VS6
-        StringCchPrintf(buf + nowLen, bufSize - nowLen, "None\n");
-#endif // WIN_VS6
+        stored = 0;
+    }
+    if (!cancel_requested(&session->cancel))
+    {
+        (void)request_trouble_codes(session, MODE_PENDING_DIAG_TROUBLE_CODES, DTC_PENDING);
+    }
+    if (!cancel_requested(&session->cancel))
+    {
+        (void)request_trouble_codes(session, MODE_PERMANENT_DIAG_TROUBLE_CODES, DTC_PERMANENT);
+    }
+
+    session->dtcs.mismatch = (!cancel_requested(&session->cancel) &&
+                              session->dtcs.reportedCount >= 0 &&
+                              stored != session->dtcs.reportedCount) ? TRUE : FALSE;
+    TRACE_END("scan", "trouble codes", NULL);
+    return &session->dtcs;
+}
+
+// returns FALSE if the report did not fit
+int printTroubleCodes(SCAN_SESSION *session, OUTPUT_BUFFER *out)
+{
+    int k;
+    // only the codes reported during this session are visited
+    for (k = 0; k < session->numFoundCodes; ++k)
+    {
+        const FOUND_TROUBLE_CODE *found = &session->foundCodes[k];
+        const char *pending = (found->kinds & (1 << DTC_PENDING)) ? " [Pending]" : "";
+        const char *permanent = (found->kinds & (1 << DTC_PERMANENT)) ? " [Permanent]" : "";
+        if (found->description)
+        {
+            outbuf_printf(out, "%s(%d) %s%s%s\n", found->code, found->foundCount, found->description, pending, permanent);
+        }
+        else
+        {
+            outbuf_printf(out, "%s Not Found%s%s\n", found->code, pending, permanent);
+        }
+    }
+    if (session->numFoundCodes == 0)
+    {
+        outbuf_append(out, "None\n");
     }
+    return !out->overflow;
 }
@@ -1,22 +1,69 @@
 #ifndef TROUBLE_CODE_READER_H
 #define TROUBLE_CODE_READER_H
 
+#define CODE_LEN    5   /* Pxxxx or Uxxxx */
+
+#define MAX_ECUS            8   /* per ISO15765-4 */
+#define MAX_DTCS_PER_ECU   51
+
+typedef enum
+{
+    DTC_STORED,         // Mode 03
+    DTC_PENDING,        // Mode 07
+    DTC_PERMANENT,      // Mode 0A
+    NUM_DTC_KINDS
+} DTC_KIND;
 
 typedef struct _TROUBLE_CODE
 {
-    char *code;
-    char *description;
-    char *pending;
-    int foundCount;
+    const char *code;
+    const char *description;
 } TROUBLE_CODE;
 
-extern TROUBLE_CODE master_trouble_list[];
+// a trouble code reported by the vehicle during one scan session
+typedef struct _FOUND_TROUBLE_CODE
+{
+    char code[CODE_LEN + 1];
+    const char *description;    // NULL if the code is not in master_trouble_list
+    int kinds;                  // bit per DTC_KIND the code was reported as
+    unsigned int ecus;          // bit per ECU that reported it, as numbered in DTC_RESULT
+    int foundCount;             // of the ECUs, whatever the kinds each reported it as
+} FOUND_TROUBLE_CODE;
+
+// the codes one ECU reported, by kind
+typedef struct _ECU_TROUBLE_CODES
+{
+    char id[12];        // header ID, empty when headers are off
+    int count[NUM_DTC_KINDS];
+    char codes[NUM_DTC_KINDS][MAX_DTCS_PER_ECU][CODE_LEN + 1];
+} ECU_TROUBLE_CODES;
+
+// result of one trouble code acquisition
+typedef struct _DTC_RESULT
+{
+    int numEcus;
+    ECU_TROUBLE_CODES ecus[MAX_ECUS];
+    int reportedCount;  // stored code count from Mode 01 PID 01, -1 if unknown
+    int mismatch;       // TRUE if the stored codes read do not match reportedCount
+} DTC_RESULT;
+
+struct _SCAN_SESSION;
+struct _OUTPUT_BUFFER;
+
+struct _ELM_MESSAGE;
+
+extern const TROUBLE_CODE master_trouble_list[];
+extern const unsigned char dtc_response_bytes[NUM_DTC_KINDS];
 
 int display_trouble_codes(void);
-int handle_read_codes(char *, int);
-void ready_trouble_codes(void);
-void printTroubleCodes(char *buf, unsigned long bufSize);
-void initializeUnknownList();
-void destroyUnknownList();
+int handle_read_codes(struct _SCAN_SESSION *session, const char *, unsigned long, DTC_KIND);
+int parse_dtcs(struct _SCAN_SESSION *session, const unsigned char *response, int length, DTC_KIND kind, int ecu);
+void add_trouble_code(struct _SCAN_SESSION *session, char *code, DTC_KIND kind, int ecu);
+int handle_trouble_code_message(struct _SCAN_SESSION *session, const struct _ELM_MESSAGE *msg, DTC_KIND kind, int *nextEcu);
+const DTC_RESULT *acquire_trouble_codes(struct _SCAN_SESSION *session);
+void ready_trouble_codes(struct _SCAN_SESSION *session);
+int printTroubleCodes(struct _SCAN_SESSION *session, struct _OUTPUT_BUFFER *out);
+void initializeFoundList(struct _SCAN_SESSION *session);
+void destroyFoundList(struct _SCAN_SESSION *session);
 
 #endif